@@ -0,0 +1,432 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "analysis_cache.h"
+
+#include <algorithm>
+
+using namespace analysis_cache_format;
+
+namespace {
+
+constexpr juce::uint64 fnv_offset_basis = 14695981039346656037ull;
+constexpr juce::uint64 fnv_prime = 1099511628211ull;
+
+/**
+ * Continue a 64-bit FNV-1a hash with `size` bytes from `data`.
+ */
+juce::uint64 fnv1a(const void* data, size_t size, juce::uint64 hash) {
+    const auto* bytes = static_cast<const juce::uint8*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * fnv_prime;
+    }
+
+    return hash;
+}
+
+template <typename T>
+juce::uint64 fnv1a(const T& value, juce::uint64 hash) {
+    return fnv1a(&value, sizeof(value), hash);
+}
+
+/**
+ * The number of complex bins between two consecutive arrays in a frame.
+ */
+size_t bin_stride(size_t num_bins) {
+    constexpr size_t bins_per_alignment =
+        alignment / sizeof(std::complex<float>);
+
+    return ((num_bins + bins_per_alignment - 1) / bins_per_alignment) *
+           bins_per_alignment;
+}
+
+}  // namespace
+
+/**
+ * Records the transforms for a single STFT. Frames are written as soon as
+ * every channel has been stored. Recording stops at the first window that
+ * doesn't follow the previous one, for instance because the overlap amount was
+ * changed, and the frames recorded up to that point are kept.
+ */
+class AnalysisCache::Recorder : public ForwardTransformCache {
+   public:
+    Recorder(const AnalysisCacheKey& key, const juce::File& file)
+        : file_(file), partial_file_(file.withFileExtension("partial")) {
+        const size_t num_bins =
+            (static_cast<size_t>(1) << key.fft_order) / 2 + 1;
+
+        std::copy(std::begin(magic), std::end(magic), header_.magic);
+        header_.version = version;
+        header_.num_channels =
+            static_cast<juce::uint32>(key.num_cached_channels());
+        header_.key_hash = key.hash();
+        header_.sample_rate = key.sample_rate;
+        header_.fft_order = static_cast<juce::uint32>(key.fft_order);
+        header_.hop_size = static_cast<juce::uint32>(key.hop_size());
+        header_.num_bins = static_cast<juce::uint32>(num_bins);
+        header_.bin_stride = static_cast<juce::uint32>(bin_stride(num_bins));
+        header_.frame_size = static_cast<juce::uint32>(
+            header_.num_channels * header_.bin_stride *
+            sizeof(std::complex<float>));
+        header_.num_frames = 0;
+
+        frame_.resize(header_.num_channels * header_.bin_stride);
+        stored_channels_.resize(header_.num_channels, false);
+
+        partial_file_.deleteFile();
+        stream_ = std::make_unique<juce::FileOutputStream>(partial_file_);
+        if (stream_->openedOk()) {
+            stream_->write(&header_, sizeof(header_));
+        } else {
+            stream_.reset();
+        }
+    }
+
+    inline bool opened_ok() const { return stream_ != nullptr; }
+
+    const std::complex<float>* find(uint64_t /*position*/,
+                                    size_t /*channel*/) override {
+        return nullptr;
+    }
+
+    void store(uint64_t position,
+               size_t channel,
+               const std::complex<float>* bins) override {
+        if (!stream_ || stopped_) {
+            return;
+        }
+
+        if (position != header_.num_frames * header_.hop_size ||
+            channel >= header_.num_channels || stored_channels_[channel]) {
+            stopped_ = true;
+            return;
+        }
+
+        std::copy_n(bins, header_.num_bins,
+                    frame_.data() + (channel * header_.bin_stride));
+        stored_channels_[channel] = true;
+        num_stored_channels_ += 1;
+
+        if (num_stored_channels_ == header_.num_channels) {
+            stream_->write(frame_.data(), header_.frame_size);
+            header_.num_frames += 1;
+            std::fill(stored_channels_.begin(), stored_channels_.end(), false);
+            num_stored_channels_ = 0;
+        }
+    }
+
+    /**
+     * Write the frame count to the header and move the file to its final
+     * location. Caches without any frames are discarded.
+     */
+    void finish() {
+        if (!stream_) {
+            return;
+        }
+
+        stream_->setPosition(0);
+        stream_->write(&header_, sizeof(header_));
+        stream_->flush();
+        const bool succeeded = !stream_->getStatus().failed();
+        stream_.reset();
+
+        if (succeeded && header_.num_frames > 0) {
+            partial_file_.moveFileTo(file_);
+        } else {
+            partial_file_.deleteFile();
+        }
+    }
+
+   private:
+    const juce::File file_;
+    const juce::File partial_file_;
+    std::unique_ptr<juce::FileOutputStream> stream_;
+
+    FileHeader header_{};
+    /**
+     * The frame currently being assembled.
+     */
+    std::vector<std::complex<float>> frame_;
+    std::vector<bool> stored_channels_;
+    size_t num_stored_channels_ = 0;
+    bool stopped_ = false;
+};
+
+/**
+ * Replays a memory mapped cache file.
+ */
+class AnalysisCache::Replayer : public ForwardTransformCache {
+   public:
+    /**
+     * Map `file`. `opened_ok()` is only true if the file was recorded for
+     * `key`.
+     */
+    Replayer(const AnalysisCacheKey& key, const juce::File& file)
+        : mapping_(file, juce::MemoryMappedFile::readOnly) {
+        const auto* data = static_cast<const char*>(mapping_.getData());
+        const size_t size = mapping_.getSize();
+        if (!data || size < sizeof(FileHeader)) {
+            return;
+        }
+
+        const auto* header = reinterpret_cast<const FileHeader*>(data);
+        const size_t num_bins =
+            (static_cast<size_t>(1) << key.fft_order) / 2 + 1;
+        if (!std::equal(std::begin(magic), std::end(magic),
+                        std::begin(header->magic)) ||
+            header->version != version || header->key_hash != key.hash() ||
+            header->num_channels != key.num_cached_channels() ||
+            header->hop_size != key.hop_size() ||
+            header->num_bins != num_bins ||
+            header->bin_stride != bin_stride(num_bins) ||
+            header->frame_size != header->num_channels * header->bin_stride *
+                                      sizeof(std::complex<float>) ||
+            header->num_frames >
+                (size - sizeof(FileHeader)) / header->frame_size) {
+            return;
+        }
+
+        header_ = header;
+        frames_ = reinterpret_cast<const std::complex<float>*>(
+            data + sizeof(FileHeader));
+    }
+
+    inline bool opened_ok() const { return header_ != nullptr; }
+
+    const std::complex<float>* find(uint64_t position,
+                                    size_t channel) override {
+        if (!header_ || position % header_->hop_size != 0 ||
+            channel >= header_->num_channels) {
+            return nullptr;
+        }
+
+        const uint64_t frame = position / header_->hop_size;
+        if (frame >= header_->num_frames) {
+            return nullptr;
+        }
+
+        return frames_ +
+               (frame * (header_->frame_size / sizeof(std::complex<float>))) +
+               (channel * header_->bin_stride);
+    }
+
+    void store(uint64_t /*position*/,
+               size_t /*channel*/,
+               const std::complex<float>* /*bins*/) override {}
+
+   private:
+    juce::MemoryMappedFile mapping_;
+    const FileHeader* header_ = nullptr;
+    const std::complex<float>* frames_ = nullptr;
+};
+
+juce::uint64 AnalysisCacheKey::hash() const {
+    juce::uint64 hash = fnv_offset_basis;
+    hash = fnv1a(input_hash, hash);
+    hash = fnv1a(fft_order, hash);
+    hash = fnv1a(overlap_order, hash);
+    hash = fnv1a(sample_rate, hash);
+    hash = fnv1a(num_channels, hash);
+    hash = fnv1a(sidechain_active, hash);
+    hash = fnv1a(band, hash);
+    hash = fnv1a(decimation_factor, hash);
+    hash = fnv1a(upper_fft_order, hash);
+    hash = fnv1a(input_gain_db, hash);
+
+    return hash;
+}
+
+AnalysisCache::AnalysisCache(const juce::File& directory,
+                             juce::uint64 input_hash)
+    : directory_(directory), input_hash_(input_hash) {
+    directory_.createDirectory();
+}
+
+AnalysisCache::~AnalysisCache() {
+    finish();
+}
+
+std::optional<juce::uint64> AnalysisCache::hash_files(
+    const std::vector<juce::File>& files) {
+    juce::uint64 hash = fnv_offset_basis;
+    std::vector<char> chunk(1 << 20);
+    for (const juce::File& file : files) {
+        juce::FileInputStream stream(file);
+        if (!stream.openedOk()) {
+            return std::nullopt;
+        }
+
+        while (!stream.isExhausted()) {
+            const int num_read =
+                stream.read(chunk.data(), static_cast<int>(chunk.size()));
+            if (num_read <= 0) {
+                break;
+            }
+
+            hash = fnv1a(chunk.data(), static_cast<size_t>(num_read), hash);
+        }
+    }
+
+    return hash;
+}
+
+ForwardTransformCache* AnalysisCache::open(AnalysisCacheKey key) {
+    key.input_hash = input_hash_;
+    const juce::File file = directory_.getChildFile(
+        juce::String::toHexString(static_cast<juce::int64>(key.hash())) +
+        ".stftcache");
+
+    if (file.existsAsFile()) {
+        auto replayer = std::make_unique<Replayer>(key, file);
+        if (replayer->opened_ok()) {
+            num_replayed_ += 1;
+            return replayers_.emplace_back(std::move(replayer)).get();
+        }
+    }
+
+    auto recorder = std::make_unique<Recorder>(key, file);
+    if (!recorder->opened_ok()) {
+        return nullptr;
+    }
+
+    num_recorded_ += 1;
+    return recorders_.emplace_back(std::move(recorder)).get();
+}
+
+void AnalysisCache::finish() {
+    for (auto& recorder : recorders_) {
+        recorder->finish();
+    }
+}
+
+/**
+ * Holds on to the transforms computed for the current block.
+ */
+class SharedAnalysis::Recorder : public ForwardTransformCache {
+   public:
+    explicit Recorder(const AnalysisCacheKey& key)
+        : key(key),
+          num_channels_(key.num_cached_channels()),
+          num_bins_((static_cast<size_t>(1) << key.fft_order) / 2 + 1) {}
+
+    const std::complex<float>* find(uint64_t /*position*/,
+                                    size_t /*channel*/) override {
+        return nullptr;
+    }
+
+    void store(uint64_t position,
+               size_t channel,
+               const std::complex<float>* bins) override {
+        if (channel >= num_channels_) {
+            return;
+        }
+
+        // The sidechain channels are stored before the main channels, so a
+        // new position starts a new frame. The frames' storage is reused
+        // between blocks.
+        if (num_frames_ == 0 || frames_[num_frames_ - 1].position != position) {
+            if (num_frames_ == frames_.size()) {
+                frames_.push_back(
+                    Frame{.bins = std::vector<std::complex<float>>(
+                              num_channels_ * num_bins_)});
+            }
+
+            frames_[num_frames_].position = position;
+            num_frames_ += 1;
+        }
+
+        std::copy_n(bins, num_bins_,
+                    frames_[num_frames_ - 1].bins.data() +
+                        (channel * num_bins_));
+    }
+
+    /**
+     * The transforms for `channel` at `position`, if they were computed during
+     * the current block.
+     */
+    const std::complex<float>* lookup(uint64_t position, size_t channel) const {
+        if (channel >= num_channels_ || num_frames_ == 0 ||
+            position < frames_[0].position) {
+            return nullptr;
+        }
+
+        // The frames within a block are one hop apart
+        const uint64_t frame_idx =
+            (position - frames_[0].position) / key.hop_size();
+        if (frame_idx >= num_frames_ ||
+            frames_[frame_idx].position != position) {
+            return nullptr;
+        }
+
+        return frames_[frame_idx].bins.data() + (channel * num_bins_);
+    }
+
+    inline void clear() { num_frames_ = 0; }
+
+    const AnalysisCacheKey key;
+
+   private:
+    struct Frame {
+        uint64_t position = 0;
+        std::vector<std::complex<float>> bins;
+    };
+
+    const size_t num_channels_;
+    const size_t num_bins_;
+
+    std::vector<Frame> frames_;
+    size_t num_frames_ = 0;
+};
+
+/**
+ * Reuses the transforms computed by a `SharedAnalysis::Recorder`.
+ */
+class SharedAnalysis::Reader : public ForwardTransformCache {
+   public:
+    explicit Reader(const Recorder& recorder) : recorder_(recorder) {}
+
+    const std::complex<float>* find(uint64_t position,
+                                    size_t channel) override {
+        return recorder_.lookup(position, channel);
+    }
+
+    void store(uint64_t /*position*/,
+               size_t /*channel*/,
+               const std::complex<float>* /*bins*/) override {}
+
+   private:
+    const Recorder& recorder_;
+};
+
+SharedAnalysis::SharedAnalysis() = default;
+SharedAnalysis::~SharedAnalysis() = default;
+
+ForwardTransformCache* SharedAnalysis::open(AnalysisCacheKey key) {
+    for (const auto& recorder : recorders_) {
+        if (recorder->key == key) {
+            return readers_.emplace_back(std::make_unique<Reader>(*recorder))
+                .get();
+        }
+    }
+
+    return recorders_.emplace_back(std::make_unique<Recorder>(key)).get();
+}
+
+void SharedAnalysis::next_block() {
+    for (auto& recorder : recorders_) {
+        recorder->clear();
+    }
+}
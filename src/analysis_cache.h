@@ -0,0 +1,248 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <complex>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+#include "dsp/stft.h"
+
+/**
+ * The on-disk format for the forward transforms stored by `AnalysisCache`. A
+ * file starts with a `FileHeader`, followed by `num_frames` frames of
+ * `frame_size` bytes each. Frame `n` contains the window at position
+ * `n * hop_size`, see `ForwardTransformCache`. Every frame contains
+ * `num_channels` arrays of `num_bins` complex bins from DC up to and including
+ * the Nyquist frequency, padded to `bin_stride` bins. The sidechain channels
+ * follow the main channels. Like with `spectral_frame_format`, everything is
+ * aligned to `alignment` bytes and stored in native byte order.
+ */
+namespace analysis_cache_format {
+
+constexpr char magic[8] = {'S', 'C', 'S', 'T', 'F', 'T', 'A', 'C'};
+/**
+ * The STFT always uses a Hann window. Changing the windowing function should
+ * bump this version.
+ */
+constexpr juce::uint32 version = 1;
+
+constexpr size_t alignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 num_channels;
+    /**
+     * `AnalysisCacheKey::hash()` for the key the file was recorded for.
+     */
+    juce::uint64 key_hash;
+    double sample_rate;
+    juce::uint32 fft_order;
+    juce::uint32 hop_size;
+    juce::uint32 num_bins;
+    juce::uint32 bin_stride;
+    juce::uint32 frame_size;
+    juce::uint32 reserved;
+    juce::uint64 num_frames;
+};
+
+static_assert(sizeof(FileHeader) == alignment);
+
+}  // namespace analysis_cache_format
+
+/**
+ * Everything the forward transforms of one of the processor's STFTs depend on.
+ */
+struct AnalysisCacheKey {
+    /**
+     * A hash of the input files, see `AnalysisCache::hash_files()`.
+     */
+    juce::uint64 input_hash = 0;
+    int fft_order = 0;
+    int overlap_order = 0;
+    /**
+     * The sample rate the STFT runs at.
+     */
+    double sample_rate = 0.0;
+    /**
+     * The number of main input channels.
+     */
+    size_t num_channels = 0;
+    bool sidechain_active = false;
+    /**
+     * 0 for the lower band, and 1 for the upper band in multi-resolution
+     * mode. The lower band's input also depends on `decimation_factor` and on
+     * `upper_fft_order`, since the decimator compensates for the upper band's
+     * latency.
+     */
+    size_t band = 0;
+    size_t decimation_factor = 1;
+    int upper_fft_order = 0;
+    /**
+     * The input gain is applied before the forward transform, so the cached
+     * spectra include it.
+     */
+    float input_gain_db = 0.0f;
+
+    /**
+     * The number of channels stored per window, including the sidechain
+     * channels.
+     */
+    inline size_t num_cached_channels() const {
+        return num_channels * (sidechain_active ? 2 : 1);
+    }
+    inline size_t hop_size() const {
+        return (static_cast<size_t>(1) << fft_order) >> overlap_order;
+    }
+
+    /**
+     * A hash of all of the fields, used to name and verify cache files.
+     */
+    juce::uint64 hash() const;
+
+    bool operator==(const AnalysisCacheKey&) const = default;
+};
+
+/**
+ * Hands out forward transform caches for the processor's STFTs. See
+ * `SpectralCompressorProcessor::set_analysis_cache()`.
+ */
+class AnalysisCacheProvider {
+   public:
+    virtual ~AnalysisCacheProvider() = default;
+
+    /**
+     * The cache for an STFT with the given key. The returned object is owned
+     * by the provider. Returns a null pointer if the transforms can't be
+     * cached.
+     */
+    virtual ForwardTransformCache* open(AnalysisCacheKey key) = 0;
+};
+
+/**
+ * A directory of forward transform caches for offline rendering. When the same
+ * input is rendered again with settings that don't affect the forward
+ * transforms, the STFTs can skip them and only run the compressors, the
+ * inverse transforms, and the overlap-add. Every STFT gets its own cache file,
+ * named after its `AnalysisCacheKey`. Existing complete cache files are memory
+ * mapped and replayed, and missing ones are recorded while rendering. Files
+ * are only written to their final name in `finish()`, so interrupted renders
+ * don't leave incomplete caches behind.
+ *
+ * Cache files are read and written on the audio thread, so this should only
+ * be used when processing offline. See
+ * `SpectralCompressorProcessor::set_analysis_cache()`.
+ */
+class AnalysisCache : public AnalysisCacheProvider {
+   public:
+    /**
+     * @param directory The directory to store the cache files in. This is
+     *   created if it doesn't exist yet.
+     * @param input_hash A hash of the rendered input files, see
+     *   `hash_files()`.
+     */
+    AnalysisCache(const juce::File& directory, juce::uint64 input_hash);
+    /**
+     * Calls `finish()`.
+     */
+    ~AnalysisCache() override;
+
+    /**
+     * Hash the contents of `files`, for use as the `input_hash`. Returns an
+     * empty optional if any of the files could not be read.
+     */
+    static std::optional<juce::uint64> hash_files(
+        const std::vector<juce::File>& files);
+
+    /**
+     * Replays the cache file for `key` if it already exists and records it
+     * otherwise. `key.input_hash` is filled in by this function. Returns a
+     * null pointer if the cache file can't be written.
+     */
+    ForwardTransformCache* open(AnalysisCacheKey key) override;
+
+    /**
+     * Write every recorded cache file to its final location. Nothing gets
+     * recorded after this.
+     */
+    void finish();
+
+    /**
+     * The number of caches opened for replaying, and the number of caches
+     * opened for recording.
+     */
+    inline size_t num_replayed() const { return num_replayed_; }
+    inline size_t num_recorded() const { return num_recorded_; }
+
+    class Recorder;
+    class Replayer;
+
+   private:
+    juce::File directory_;
+    juce::uint64 input_hash_;
+
+    std::vector<std::unique_ptr<Recorder>> recorders_;
+    std::vector<std::unique_ptr<Replayer>> replayers_;
+    size_t num_replayed_ = 0;
+    size_t num_recorded_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(AnalysisCache)
+};
+
+/**
+ * Shares the forward transforms between processors that render the same input
+ * in lockstep, like when rendering several variants of the same preset. The
+ * first processor that opens a cache for a key computes the transforms, and the
+ * other processors with the same key reuse them. Every processor should
+ * process a block before `next_block()` is called, and the first processor
+ * should be the one that processes every block first. Processors with
+ * different keys simply compute their own transforms.
+ *
+ * Like `AnalysisCache`, this is only meant for offline processing since it
+ * allocates while rendering.
+ */
+class SharedAnalysis : public AnalysisCacheProvider {
+   public:
+    SharedAnalysis();
+    ~SharedAnalysis() override;
+
+    ForwardTransformCache* open(AnalysisCacheKey key) override;
+
+    /**
+     * Drop the transforms from the current block. Call this after every
+     * processor has processed the block.
+     */
+    void next_block();
+
+    /**
+     * The number of caches that reuse the transforms from another processor.
+     */
+    inline size_t num_shared() const { return readers_.size(); }
+
+    class Recorder;
+    class Reader;
+
+   private:
+    std::vector<std::unique_ptr<Recorder>> recorders_;
+    std::vector<std::unique_ptr<Reader>> readers_;
+
+    JUCE_DECLARE_NON_COPYABLE(SharedAnalysis)
+};
@@ -0,0 +1,318 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "analyzer.h"
+
+#include <optional>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace {
+
+constexpr int refresh_rate_hz = 30;
+
+constexpr double min_frequency = 20.0;
+constexpr double max_frequency = 20000.0;
+
+/**
+ * The range of the input and sidechain spectra in dBFS.
+ */
+constexpr float spectrum_min_db = -96.0f;
+constexpr float spectrum_max_db = 6.0f;
+/**
+ * The gain curve is centered around 0 dB, and it goes this many decibels up
+ * and down.
+ */
+constexpr float gain_range_db = 24.0f;
+
+/**
+ * How fast the displayed values fall back after a peak.
+ */
+constexpr float fall_rate_db_per_second = 36.0f;
+
+const juce::Colour background_colour(0xff15171a);
+const juce::Colour grid_colour(0xff2c3036);
+const juce::Colour input_colour(0xff5fa8d3);
+const juce::Colour sidechain_colour(0xffe0a458);
+const juce::Colour gain_colour(0xffe05a5a);
+
+/**
+ * The x-coordinate for a frequency on a logarithmic scale between
+ * `min_frequency` and `max_frequency`.
+ */
+float frequency_to_x(double frequency, float width) {
+    return static_cast<float>(std::log(frequency / min_frequency) /
+                              std::log(max_frequency / min_frequency)) *
+           width;
+}
+
+}  // namespace
+
+SpectrumAnalyzer::SpectrumAnalyzer(SpectrumFifo& fifo) : fifo_(fifo) {
+    values_db_[input].fill(spectrum_min_db);
+    values_db_[sidechain].fill(spectrum_min_db);
+    values_db_[gain].fill(0.0f);
+    for (auto& points : points_y_) {
+        points.fill(0.0f);
+    }
+    for (auto& path : paths_) {
+        // Every curve has at most a point per band, and the filled curves need
+        // a few extra points to close the shape
+        path.preallocateSpace((SpectrumFrame::num_bands + 4) * 3);
+    }
+
+    setOpaque(true);
+    startTimerHz(refresh_rate_hz);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {}
+
+void SpectrumAnalyzer::paint(juce::Graphics& g) {
+    g.fillAll(background_colour);
+
+    const float width = static_cast<float>(getWidth());
+    const float height = static_cast<float>(getHeight());
+
+    g.setFont(11.0f);
+    for (const double frequency :
+         {50.0, 100.0, 200.0, 500.0, 1000.0, 2000.0, 5000.0, 10000.0}) {
+        const float x = frequency_to_x(frequency, width);
+        g.setColour(grid_colour);
+        g.drawVerticalLine(juce::roundToInt(x), 0.0f, height);
+        g.setColour(grid_colour.brighter(0.6f));
+        g.drawText(frequency >= 1000.0
+                       ? juce::String(frequency / 1000.0) + "k"
+                       : juce::String(frequency),
+                   juce::Rectangle<float>(x + 3.0f, height - 16.0f, 40.0f,
+                                          14.0f),
+                   juce::Justification::centredLeft);
+    }
+    g.setColour(grid_colour);
+    g.drawHorizontalLine(juce::roundToInt(value_to_y(gain, 0.0f)), 0.0f,
+                         width);
+
+    if (has_sidechain_) {
+        g.setColour(sidechain_colour.withAlpha(0.3f));
+        g.fillPath(paths_[sidechain]);
+    }
+    g.setColour(input_colour.withAlpha(0.35f));
+    g.fillPath(paths_[input]);
+    g.setColour(input_colour);
+    g.strokePath(paths_[input], juce::PathStrokeType(1.0f));
+
+    g.setColour(gain_colour);
+    g.strokePath(paths_[gain], juce::PathStrokeType(1.5f));
+
+    g.setFont(12.0f);
+    juce::Rectangle<int> legend_area(8, 6, 100, 14);
+    const auto draw_legend_entry = [&](const juce::String& label,
+                                       juce::Colour colour) {
+        g.setColour(colour);
+        g.drawText(label, legend_area, juce::Justification::centredLeft);
+        legend_area.translate(0, 14);
+    };
+    draw_legend_entry("Input", input_colour);
+    if (has_sidechain_) {
+        draw_legend_entry("Sidechain", sidechain_colour);
+    }
+    draw_legend_entry("Gain", gain_colour);
+}
+
+void SpectrumAnalyzer::resized() {
+    update_band_positions();
+    update_points(true);
+    rebuild_paths();
+}
+
+void SpectrumAnalyzer::timerCallback() {
+    // Frames are produced much faster than we redraw, so we'll display the
+    // peak values of all frames received since the last tick
+    std::array<std::array<float, SpectrumFrame::num_bands>, num_curves>
+        peaks_db;
+    peaks_db[input].fill(spectrum_min_db);
+    peaks_db[sidechain].fill(spectrum_min_db);
+    peaks_db[gain].fill(0.0f);
+
+    bool layout_changed = false;
+    while (fifo_.pop(frame_)) {
+        if (frame_.sample_rate != sample_rate_ ||
+            frame_.fft_window_size != fft_window_size_ ||
+            frame_.has_sidechain != has_sidechain_) {
+            sample_rate_ = frame_.sample_rate;
+            fft_window_size_ = frame_.fft_window_size;
+            has_sidechain_ = frame_.has_sidechain;
+            layout_changed = true;
+        }
+
+        // A full scale sine wave results in a magnitude of a quarter of the
+        // window size with the Hann window
+        const float reference_magnitude = frame_.fft_window_size / 4.0f;
+        for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+            peaks_db[input][band] =
+                std::max(peaks_db[input][band],
+                         juce::Decibels::gainToDecibels(
+                             frame_.input_magnitudes[band] /
+                                 reference_magnitude,
+                             spectrum_min_db));
+            peaks_db[sidechain][band] =
+                std::max(peaks_db[sidechain][band],
+                         juce::Decibels::gainToDecibels(
+                             frame_.sidechain_magnitudes[band] /
+                                 reference_magnitude,
+                             spectrum_min_db));
+
+            const float gain_db = juce::Decibels::gainToDecibels(
+                frame_.gains[band], -gain_range_db);
+            if (std::abs(gain_db) > std::abs(peaks_db[gain][band])) {
+                peaks_db[gain][band] = gain_db;
+            }
+        }
+    }
+
+    if (layout_changed) {
+        update_band_positions();
+    }
+
+    // When nothing is coming in anymore the curves will fall back to their
+    // resting positions, after which we'll stop repainting
+    const float fall_db = fall_rate_db_per_second / refresh_rate_hz;
+    for (const Curve curve : {input, sidechain}) {
+        for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+            values_db_[curve][band] =
+                std::max({peaks_db[curve][band],
+                          values_db_[curve][band] - fall_db, spectrum_min_db});
+        }
+    }
+    for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+        float& value_db = values_db_[gain][band];
+        if (std::abs(peaks_db[gain][band]) >= std::abs(value_db)) {
+            value_db = peaks_db[gain][band];
+        } else {
+            value_db = value_db > 0.0f ? std::max(value_db - fall_db, 0.0f)
+                                       : std::min(value_db + fall_db, 0.0f);
+        }
+    }
+
+    if (update_points(layout_changed)) {
+        rebuild_paths();
+    }
+}
+
+void SpectrumAnalyzer::update_band_positions() {
+    band_active_.fill(false);
+    if (sample_rate_ <= 0.0 || fft_window_size_ == 0) {
+        return;
+    }
+
+    // Every band is drawn at the center of the bins it contains
+    std::array<size_t, SpectrumFrame::num_bands> first_bin{};
+    std::array<size_t, SpectrumFrame::num_bands> last_bin{};
+    const size_t num_bins = std::min(static_cast<size_t>(fft_window_size_ / 2),
+                                     SpectrumFrame::max_bin_idx);
+    for (size_t bin_idx = 1; bin_idx <= num_bins; bin_idx++) {
+        const size_t band = SpectrumFrame::band_for_bin(bin_idx);
+        if (first_bin[band] == 0) {
+            first_bin[band] = bin_idx;
+        }
+        last_bin[band] = bin_idx;
+    }
+
+    const double bin_frequency = sample_rate_ / fft_window_size_;
+    const float width = static_cast<float>(getWidth());
+    for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+        if (first_bin[band] == 0) {
+            continue;
+        }
+
+        const double frequency =
+            ((first_bin[band] + last_bin[band]) / 2.0) * bin_frequency;
+        if (frequency >= min_frequency && frequency <= max_frequency) {
+            band_active_[band] = true;
+            band_x_[band] = frequency_to_x(frequency, width);
+        }
+    }
+}
+
+float SpectrumAnalyzer::value_to_y(Curve curve, float value_db) const {
+    const float height = static_cast<float>(getHeight());
+    if (curve == gain) {
+        return juce::jmap(
+            juce::jlimit(-gain_range_db, gain_range_db, value_db),
+            gain_range_db, -gain_range_db, 0.0f, height);
+    } else {
+        return juce::jmap(
+            juce::jlimit(spectrum_min_db, spectrum_max_db, value_db),
+            spectrum_max_db, spectrum_min_db, 0.0f, height);
+    }
+}
+
+bool SpectrumAnalyzer::update_points(bool force) {
+    bool changed = false;
+    for (const Curve curve : {input, sidechain, gain}) {
+        for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+            if (!band_active_[band]) {
+                continue;
+            }
+
+            const float y = value_to_y(curve, values_db_[curve][band]);
+            if (force || std::abs(y - points_y_[curve][band]) >= 0.5f) {
+                points_y_[curve][band] = y;
+                changed = true;
+            }
+        }
+    }
+
+    return changed;
+}
+
+void SpectrumAnalyzer::rebuild_paths() {
+    const float height = static_cast<float>(getHeight());
+    for (const Curve curve : {input, sidechain, gain}) {
+        juce::Path& path = paths_[curve];
+        path.clear();
+
+        // The spectra are drawn as filled areas, and the gain is drawn as a
+        // line
+        const bool filled = curve != gain;
+        std::optional<float> last_x;
+        for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+            if (!band_active_[band]) {
+                continue;
+            }
+
+            const float x = band_x_[band];
+            const float y = points_y_[curve][band];
+            if (!last_x) {
+                if (filled) {
+                    path.startNewSubPath(x, height);
+                    path.lineTo(x, y);
+                } else {
+                    path.startNewSubPath(x, y);
+                }
+            } else {
+                path.lineTo(x, y);
+            }
+            last_x = x;
+        }
+
+        if (filled && last_x) {
+            path.lineTo(*last_x, height);
+            path.closeSubPath();
+        }
+    }
+
+    repaint();
+}
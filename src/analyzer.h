@@ -0,0 +1,104 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_gui_basics/juce_gui_basics.h>
+
+#include "spectrum_fifo.h"
+
+/**
+ * Draws the input spectrum, the sidechain spectrum, and the per-band gain
+ * reduction using the frames the audio thread pushes into a `SpectrumFifo`.
+ * The FIFO is drained from a timer at a fixed rate. Only the points that moved
+ * by at least half a pixel get updated, and the paths are only rebuilt and
+ * repainted when something actually changed.
+ */
+class SpectrumAnalyzer : public juce::Component, private juce::Timer {
+   public:
+    explicit SpectrumAnalyzer(SpectrumFifo& fifo);
+    ~SpectrumAnalyzer() override;
+
+    void paint(juce::Graphics& g) override;
+    void resized() override;
+
+   private:
+    /**
+     * The number of curves we're drawing: the input spectrum, the sidechain
+     * spectrum, and the gain.
+     */
+    static constexpr size_t num_curves = 3;
+    enum Curve : size_t { input = 0, sidechain = 1, gain = 2 };
+
+    void timerCallback() override;
+
+    /**
+     * Recompute which bands contain bins and where they should be drawn on the
+     * x-axis. Needed when the component, the sample rate, or the FFT window
+     * size changes.
+     */
+    void update_band_positions();
+    /**
+     * The y-coordinate for a value in decibels on one of the curves.
+     */
+    float value_to_y(Curve curve, float value_db) const;
+    /**
+     * Recompute the y-coordinates from `values_db_`. Points that moved by less
+     * than half a pixel are left alone unless `force` is set.
+     *
+     * @return Whether any point has changed.
+     */
+    bool update_points(bool force);
+    /**
+     * Rebuild the paths from `points_y_`, and mark the component for
+     * repainting.
+     */
+    void rebuild_paths();
+
+    SpectrumFifo& fifo_;
+    /**
+     * Scratch space for popping frames, so the timer doesn't need to allocate.
+     */
+    SpectrumFrame frame_;
+
+    double sample_rate_ = 0.0;
+    juce::uint32 fft_window_size_ = 0;
+    bool has_sidechain_ = false;
+
+    /**
+     * The values currently being displayed for every band, in decibels. These
+     * fall back with a fixed rate when the new values are lower.
+     */
+    std::array<std::array<float, SpectrumFrame::num_bands>, num_curves>
+        values_db_;
+    /**
+     * Whether a band contains any bins at the current FFT window size. The
+     * lowest bands are empty for smaller window sizes.
+     */
+    std::array<bool, SpectrumFrame::num_bands> band_active_{};
+    /**
+     * The x-coordinate for every band.
+     */
+    std::array<float, SpectrumFrame::num_bands> band_x_{};
+    /**
+     * The y-coordinates currently used in `paths_`.
+     */
+    std::array<std::array<float, SpectrumFrame::num_bands>, num_curves>
+        points_y_;
+    std::array<juce::Path, num_curves> paths_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpectrumAnalyzer)
+};
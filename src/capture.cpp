@@ -0,0 +1,272 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "capture.h"
+
+#include "dsp/simd.h"
+
+using namespace capture_format;
+
+juce::uint64 capture_format::hash_buffer(
+    const juce::AudioBuffer<float>& buffer) {
+    juce::uint64 hash = 0xcbf29ce484222325;
+    for (int channel = 0; channel < buffer.getNumChannels(); channel++) {
+        const auto* bytes = reinterpret_cast<const juce::uint8*>(
+            buffer.getReadPointer(channel));
+        const size_t num_bytes =
+            static_cast<size_t>(buffer.getNumSamples()) * sizeof(float);
+        for (size_t i = 0; i < num_bytes; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3;
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * Periodically drains the FIFO to the capture file.
+ */
+class SessionCapture::WriterThread : public juce::Thread {
+   public:
+    WriterThread(SessionCapture& capture,
+                 std::unique_ptr<juce::FileOutputStream> stream)
+        : juce::Thread("Capture writer"),
+          capture_(capture),
+          stream_(std::move(stream)) {}
+
+    void run() override {
+        while (!threadShouldExit()) {
+            wait(20);
+            drain();
+        }
+
+        // Anything written before `stop()` was called should still end up in
+        // the file
+        drain();
+        stream_->flush();
+    }
+
+   private:
+    void drain() {
+        juce::AbstractFifo& fifo = capture_.fifo_;
+        const int num_ready = fifo.getNumReady();
+        if (num_ready == 0) {
+            return;
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(num_ready, start1, size1, start2, size2);
+        if (size1 > 0) {
+            stream_->write(capture_.fifo_buffer_.data() + start1,
+                           static_cast<size_t>(size1));
+        }
+        if (size2 > 0) {
+            stream_->write(capture_.fifo_buffer_.data() + start2,
+                           static_cast<size_t>(size2));
+        }
+        fifo.finishedRead(size1 + size2);
+    }
+
+    SessionCapture& capture_;
+    std::unique_ptr<juce::FileOutputStream> stream_;
+};
+
+SessionCapture::SessionCapture(size_t fifo_size)
+    : fifo_size_(fifo_size), fifo_(static_cast<int>(fifo_size)) {}
+
+SessionCapture::~SessionCapture() {
+    stop();
+}
+
+bool SessionCapture::start(const juce::File& file,
+                           const juce::MemoryBlock& state,
+                           size_t num_parameters) {
+    stop();
+
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream->openedOk()) {
+        return false;
+    }
+    stream->setPosition(0);
+    stream->truncate();
+
+    FileHeader header{};
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.version = version;
+    header.num_parameters = static_cast<juce::uint32>(num_parameters);
+    header.state_size = static_cast<juce::uint32>(state.getSize());
+    header.simd_isa = static_cast<juce::uint8>(simd::kernels().isa);
+    for (int order = 0; order <= fft::max_calibrated_order; order++) {
+        header.fft_backends[order] =
+            static_cast<juce::uint8>(fft::selected_backend(order));
+    }
+    stream->write(&header, sizeof(header));
+    stream->write(state.getData(), state.getSize());
+
+    fifo_buffer_.resize(fifo_size_);
+    fifo_.reset();
+    last_parameter_values_.assign(num_parameters,
+                                  std::numeric_limits<float>::quiet_NaN());
+    pending_dropped_ = 0;
+    total_dropped_ = 0;
+
+    writer_thread_ = std::make_unique<WriterThread>(*this, std::move(stream));
+    writer_thread_->startThread();
+    active_.store(true, std::memory_order_release);
+
+    return true;
+}
+
+void SessionCapture::stop() {
+    active_.store(false, std::memory_order_release);
+    if (writer_thread_) {
+        writer_thread_->stopThread(5000);
+        writer_thread_.reset();
+    }
+}
+
+void SessionCapture::free_buffers() {
+    jassert(!is_active());
+
+    // Every plugin instance has one of these, so the FIFO should not stick
+    // around when we're not capturing
+    fifo_buffer_.clear();
+    fifo_buffer_.shrink_to_fit();
+    last_parameter_values_.clear();
+    last_parameter_values_.shrink_to_fit();
+}
+
+void SessionCapture::record_prepare(double sample_rate,
+                                    int max_block_size,
+                                    int num_main_channels) {
+    const PreparePayload payload{.sample_rate = sample_rate,
+                                 .max_block_size = max_block_size,
+                                 .num_main_channels = num_main_channels};
+    if (begin_record(RecordType::prepare, sizeof(payload))) {
+        write_bytes(&payload, sizeof(payload));
+    }
+}
+
+void SessionCapture::record_release() {
+    begin_record(RecordType::release, 0);
+}
+
+void SessionCapture::record_parameters(
+    const juce::Array<juce::AudioProcessorParameter*>& parameters) {
+    const size_t num_parameters = std::min(
+        last_parameter_values_.size(), static_cast<size_t>(parameters.size()));
+    for (size_t i = 0; i < num_parameters; i++) {
+        const float value = parameters[static_cast<int>(i)]->getValue();
+        // NaN never compares equal, so the first cycle records everything. If
+        // the record gets dropped we'll try again on the next cycle.
+        if (value != last_parameter_values_[i]) {
+            const ParameterPayload payload{
+                .index = static_cast<juce::uint32>(i), .value = value};
+            if (begin_record(RecordType::parameter, sizeof(payload))) {
+                write_bytes(&payload, sizeof(payload));
+                last_parameter_values_[i] = value;
+            }
+        }
+    }
+}
+
+void SessionCapture::record_process_data_swap(int fft_order,
+                                              fft::Backend fft_backend,
+                                              int upper_fft_order,
+                                              fft::Backend upper_fft_backend) {
+    const ProcessDataSwapPayload payload{
+        .fft_order = fft_order,
+        .upper_fft_order = upper_fft_order,
+        .fft_backend = static_cast<juce::uint8>(fft_backend),
+        .upper_fft_backend = static_cast<juce::uint8>(upper_fft_backend),
+        .reserved = {}};
+    if (begin_record(RecordType::process_data_swap, sizeof(payload))) {
+        write_bytes(&payload, sizeof(payload));
+    }
+}
+
+void SessionCapture::record_block(const juce::AudioBuffer<float>& buffer,
+                                  bool bypassed) {
+    const BlockPayload payload{
+        .num_samples = static_cast<juce::uint32>(buffer.getNumSamples()),
+        .num_channels = static_cast<juce::uint32>(buffer.getNumChannels()),
+        .bypassed = bypassed,
+        .reserved = {}};
+    const size_t channel_size =
+        static_cast<size_t>(buffer.getNumSamples()) * sizeof(float);
+
+    if (begin_record(RecordType::block,
+                     sizeof(payload) + (channel_size * payload.num_channels))) {
+        write_bytes(&payload, sizeof(payload));
+        for (int channel = 0; channel < buffer.getNumChannels(); channel++) {
+            write_bytes(buffer.getReadPointer(channel), channel_size);
+        }
+    }
+}
+
+void SessionCapture::record_block_output(
+    const juce::AudioBuffer<float>& buffer) {
+    const juce::uint64 hash = hash_buffer(buffer);
+    if (begin_record(RecordType::block_output, sizeof(hash))) {
+        write_bytes(&hash, sizeof(hash));
+    }
+}
+
+bool SessionCapture::begin_record(RecordType type, size_t payload_size) {
+    // If we previously had to drop records, then the replay needs to know
+    // about that. This is written together with the next record so both fit or
+    // neither does.
+    const size_t dropped_record_size =
+        pending_dropped_ > 0 ? sizeof(RecordHeader) + sizeof(pending_dropped_)
+                             : 0;
+    const size_t record_size = sizeof(RecordHeader) + payload_size;
+    if (static_cast<size_t>(fifo_.getFreeSpace()) <
+        dropped_record_size + record_size) {
+        pending_dropped_ += 1;
+        total_dropped_ += 1;
+        return false;
+    }
+
+    if (pending_dropped_ > 0) {
+        const RecordHeader dropped_header{
+            .type = RecordType::dropped,
+            .reserved = {},
+            .payload_size = sizeof(pending_dropped_)};
+        write_bytes(&dropped_header, sizeof(dropped_header));
+        write_bytes(&pending_dropped_, sizeof(pending_dropped_));
+        pending_dropped_ = 0;
+    }
+
+    const RecordHeader header{
+        .type = type,
+        .reserved = {},
+        .payload_size = static_cast<juce::uint32>(payload_size)};
+    write_bytes(&header, sizeof(header));
+
+    return true;
+}
+
+void SessionCapture::write_bytes(const void* data, size_t size) {
+    int start1, size1, start2, size2;
+    fifo_.prepareToWrite(static_cast<int>(size), start1, size1, start2, size2);
+    jassert(static_cast<size_t>(size1 + size2) == size);
+
+    const auto* bytes = static_cast<const char*>(data);
+    std::copy_n(bytes, size1, fifo_buffer_.data() + start1);
+    std::copy_n(bytes + size1, size2, fifo_buffer_.data() + start2);
+    fifo_.finishedWrite(size1 + size2);
+}
@@ -0,0 +1,291 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+#include <juce_audio_processors/juce_audio_processors.h>
+
+#include "dsp/fft.h"
+
+/**
+ * The on-disk format used by `SessionCapture`. A capture file starts with a
+ * `FileHeader` followed by the plugin's serialized state at the time the
+ * capture started, and then a sequence of records. Every record starts with a
+ * `RecordHeader` followed by `payload_size` bytes. Everything is stored in
+ * native byte order.
+ */
+namespace capture_format {
+
+constexpr char magic[8] = {'S', 'C', 'C', 'A', 'P', 'T', 'U', 'R'};
+constexpr juce::uint32 version = 2;
+
+struct FileHeader {
+    char magic[8];
+    juce::uint32 version;
+    /**
+     * The number of plugin parameters. `RecordType::parameter` records index
+     * into `AudioProcessor::getParameters()`.
+     */
+    juce::uint32 num_parameters;
+    /**
+     * The size of the state blob directly following this header.
+     */
+    juce::uint32 state_size;
+    juce::uint32 reserved;
+    /**
+     * The `simd::Isa` whose kernels were used while capturing.
+     */
+    juce::uint8 simd_isa;
+    /**
+     * The `fft::Backend` selected for every FFT order when the capture
+     * started. The backends that were actually used after a `ProcessData`
+     * swap are stored in that swap's record, since finishing the FFT
+     * calibration in the background can change the selection.
+     */
+    juce::uint8 fft_backends[fft::max_calibrated_order + 1];
+    juce::uint8 reserved2[2];
+};
+
+enum class RecordType : juce::uint8 {
+    /**
+     * `prepareToPlay()` was called. Payload: `PreparePayload`.
+     */
+    prepare = 1,
+    /**
+     * `releaseResources()` was called. No payload.
+     */
+    release = 2,
+    /**
+     * A parameter has a different value than at the start of the last block.
+     * Payload: `ParameterPayload`.
+     */
+    parameter = 3,
+    /**
+     * A new `ProcessData` object has been swapped in. Payload:
+     * `ProcessDataSwapPayload`.
+     */
+    process_data_swap = 4,
+    /**
+     * The input for a call to `processBlock()` or `processBlockBypassed()`.
+     * Payload: `BlockPayload` followed by `num_channels * num_samples` floats,
+     * channel by channel. This includes the sidechain channels.
+     */
+    block = 5,
+    /**
+     * A hash of the entire buffer after processing the last block, used to
+     * verify that a replay is bit-exact. Payload: a `uint64`.
+     */
+    block_output = 6,
+    /**
+     * Records were dropped because the writer thread could not keep up.
+     * Payload: the number of dropped records as a `uint32`. A replay is no
+     * longer guaranteed to be bit-exact after this.
+     */
+    dropped = 7,
+};
+
+struct RecordHeader {
+    RecordType type;
+    juce::uint8 reserved[3];
+    juce::uint32 payload_size;
+};
+
+struct PreparePayload {
+    double sample_rate;
+    juce::int32 max_block_size;
+    juce::int32 num_main_channels;
+};
+
+struct ParameterPayload {
+    juce::uint32 index;
+    /**
+     * The parameter's normalized value.
+     */
+    float value;
+};
+
+struct ProcessDataSwapPayload {
+    juce::int32 fft_order;
+    /**
+     * The upper band's FFT order in multi-resolution mode, or -1.
+     */
+    juce::int32 upper_fft_order;
+    /**
+     * The `fft::Backend`s used for the STFTs at those orders.
+     */
+    juce::uint8 fft_backend;
+    juce::uint8 upper_fft_backend;
+    juce::uint8 reserved[2];
+};
+
+struct BlockPayload {
+    juce::uint32 num_samples;
+    juce::uint32 num_channels;
+    juce::uint8 bypassed;
+    juce::uint8 reserved[3];
+};
+
+/**
+ * A 64-bit FNV-1a hash of the buffer's contents, channel by channel.
+ */
+juce::uint64 hash_buffer(const juce::AudioBuffer<float>& buffer);
+
+}  // namespace capture_format
+
+/**
+ * Records everything that goes into the plugin so that a processing session can
+ * be replayed offline with bit-exact results using the `replay` command from
+ * `spectral-compressor-tools`. This records the inputs for every processing
+ * cycle (including the sidechain), the block sizes, sample rate changes,
+ * parameter changes, and `ProcessData` swaps.
+ *
+ * The audio thread only copies records into a preallocated FIFO, and a
+ * background thread writes those records to disk. If the FIFO is full then the
+ * record gets dropped instead, so the overhead on the audio thread is bounded
+ * by a single copy of the processed buffer. `record_prepare()` and
+ * `record_release()` are called from the message thread, but the host
+ * guarantees that those calls are never concurrent with audio processing so
+ * the FIFO still has a single producer at any point in time.
+ */
+class SessionCapture {
+   public:
+    /**
+     * @param fifo_size The size of the FIFO in bytes. The default can hold
+     *   about 40 seconds of four channel audio at 48 kHz, which should give the
+     *   writer thread plenty of slack. The FIFO is only allocated while
+     *   capturing.
+     */
+    SessionCapture(size_t fifo_size = 32 << 20);
+    ~SessionCapture();
+
+    /**
+     * Start capturing to `file`, overwriting it if it already exists. This
+     * allocates and should thus not be called from the audio thread. Capturing
+     * should start just before `prepareToPlay()` so the replay starts from the
+     * same state.
+     *
+     * @param file The file to write the capture to.
+     * @param state The plugin's state obtained from `getStateInformation()`.
+     * @param num_parameters The number of plugin parameters.
+     *
+     * @return Whether the file could be opened for writing.
+     */
+    bool start(const juce::File& file,
+               const juce::MemoryBlock& state,
+               size_t num_parameters);
+
+    /**
+     * Stop capturing and flush everything to disk. Should not be called from
+     * the audio thread. The audio thread may still be in the middle of
+     * recording a block when this is called, so the FIFO is kept around until
+     * `free_buffers()` is called.
+     */
+    void stop();
+
+    /**
+     * Free the FIFO and the parameter cache after the capture has been
+     * stopped. This must only be called when the audio thread can't be
+     * recording anything, i.e. from `prepareToPlay()` or `releaseResources()`.
+     */
+    void free_buffers();
+
+    /**
+     * Whether we're currently capturing. Recording functions should only be
+     * called when this returns true.
+     */
+    inline bool is_active() const {
+        return active_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * The total number of records dropped because the FIFO was full.
+     */
+    inline size_t num_dropped_records() const { return total_dropped_; }
+
+    /**
+     * The memory currently held by the FIFO and the parameter cache in bytes.
+     */
+    inline size_t memory_usage() const {
+        return fifo_buffer_.capacity() +
+               (last_parameter_values_.capacity() * sizeof(float));
+    }
+
+    void record_prepare(double sample_rate,
+                        int max_block_size,
+                        int num_main_channels);
+    void record_release();
+
+    /**
+     * Record every parameter whose value differs from the last recorded value.
+     * Called at the start of every processing cycle.
+     */
+    void record_parameters(
+        const juce::Array<juce::AudioProcessorParameter*>& parameters);
+    /**
+     * @param upper_fft_order The upper band's FFT order in multi-resolution
+     *   mode, or -1. `upper_fft_backend` is ignored in the latter case.
+     */
+    void record_process_data_swap(int fft_order,
+                                  fft::Backend fft_backend,
+                                  int upper_fft_order,
+                                  fft::Backend upper_fft_backend);
+    void record_block(const juce::AudioBuffer<float>& buffer, bool bypassed);
+    void record_block_output(const juce::AudioBuffer<float>& buffer);
+
+   private:
+    class WriterThread;
+
+    /**
+     * Reserve room for a record with a payload of `payload_size` bytes and
+     * write its header. The caller should then write exactly `payload_size`
+     * bytes using `write_bytes()`. If there's not enough room for the entire
+     * record then nothing gets written, the record is counted as dropped, and
+     * this returns false.
+     */
+    bool begin_record(capture_format::RecordType type, size_t payload_size);
+    /**
+     * Copy raw bytes into the FIFO. The caller should have made sure there's
+     * enough room.
+     */
+    void write_bytes(const void* data, size_t size);
+
+    std::atomic_bool active_ = false;
+
+    const size_t fifo_size_;
+    std::vector<char> fifo_buffer_;
+    juce::AbstractFifo fifo_;
+
+    /**
+     * The last recorded normalized value for every parameter. Initialized to
+     * NaN so the first processing cycle records every parameter.
+     */
+    std::vector<float> last_parameter_values_;
+
+    /**
+     * The number of records dropped since the last successfully written
+     * record. When this is nonzero `begin_record()` will write a
+     * `RecordType::dropped` record before the next record.
+     */
+    juce::uint32 pending_dropped_ = 0;
+    std::atomic_size_t total_dropped_ = 0;
+
+    std::unique_ptr<WriterThread> writer_thread_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SessionCapture)
+};
@@ -0,0 +1,196 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "bands.h"
+
+#include <cmath>
+
+namespace {
+
+/**
+ * The position of `frequency` on `grouping`'s scale, in units of bands. Bins
+ * whose positions have the same integer part fall in the same band.
+ */
+double band_position(BinGrouping grouping, double frequency) {
+    switch (grouping) {
+        case BinGrouping::bark:
+            // Traunmueller's approximation of the Bark scale
+            return ((26.81 * frequency) / (1960.0 + frequency)) - 0.53;
+        case BinGrouping::erb:
+            // The ERB-rate scale from Glasberg and Moore
+            return 21.4 * std::log10(1.0 + (0.00437 * frequency));
+        case BinGrouping::third_octave:
+            return std::log2(frequency) * 3.0;
+        case BinGrouping::sixth_octave:
+            return std::log2(frequency) * 6.0;
+        case BinGrouping::twelfth_octave:
+            return std::log2(frequency) * 12.0;
+        case BinGrouping::none:
+            break;
+    }
+
+    jassertfalse;
+    return frequency;
+}
+
+}  // namespace
+
+BandLayout::BandLayout(BinGrouping grouping,
+                       size_t fft_window_size,
+                       double sample_rate)
+    : grouping_(grouping),
+      sample_rate_(sample_rate),
+      bin_frequency_((sample_rate > 0.0 ? sample_rate : 44100.0) /
+                     static_cast<double>(fft_window_size)),
+      num_bins_(fft_window_size / 2) {
+    const double bin_frequency = bin_frequency_;
+
+    if (grouping == BinGrouping::none) {
+        band_frequencies_.resize(num_bins_);
+        for (size_t bin_idx = 0; bin_idx < num_bins_; bin_idx++) {
+            band_frequencies_[bin_idx] = static_cast<float>(bin_frequency) *
+                                         static_cast<float>(bin_idx + 1);
+        }
+
+        return;
+    }
+
+    double previous_position = 0.0;
+    for (size_t bin_idx = 0; bin_idx < num_bins_; bin_idx++) {
+        const double position = std::floor(
+            band_position(grouping, bin_frequency * (bin_idx + 1)));
+        if (bin_idx == 0 || position != previous_position) {
+            band_starts_.push_back(static_cast<juce::uint32>(bin_idx));
+        }
+
+        previous_position = position;
+    }
+    band_starts_.push_back(static_cast<juce::uint32>(num_bins_));
+
+    // The bands' centers are measured in (fractional) bins relative to bin 1,
+    // since that's what we interpolate over
+    const size_t num_bands = band_starts_.size() - 1;
+    std::vector<double> band_centers(num_bands);
+    band_frequencies_.resize(num_bands);
+    for (size_t band_idx = 0; band_idx < num_bands; band_idx++) {
+        band_centers[band_idx] =
+            (band_starts_[band_idx] + band_starts_[band_idx + 1] - 1) / 2.0;
+        band_frequencies_[band_idx] = static_cast<float>(
+            bin_frequency * (band_centers[band_idx] + 1.0));
+    }
+
+    interpolation_bands_.resize(num_bins_);
+    interpolation_weights_.resize(num_bins_);
+    size_t band_idx = 0;
+    for (size_t bin_idx = 0; bin_idx < num_bins_; bin_idx++) {
+        while (band_idx + 1 < num_bands &&
+               band_centers[band_idx + 1] <= static_cast<double>(bin_idx)) {
+            band_idx++;
+        }
+
+        interpolation_bands_[bin_idx] = static_cast<juce::uint32>(band_idx);
+        if (band_idx + 1 < num_bands &&
+            static_cast<double>(bin_idx) > band_centers[band_idx]) {
+            interpolation_weights_[bin_idx] = static_cast<float>(
+                (static_cast<double>(bin_idx) - band_centers[band_idx]) /
+                (band_centers[band_idx + 1] - band_centers[band_idx]));
+        } else {
+            interpolation_weights_[bin_idx] = 0.0f;
+        }
+    }
+}
+
+IndexRange BandLayout::bins_for_frequencies(float low_frequency,
+                                            float high_frequency) const {
+    // Bin `bin_idx` is centered at `(bin_idx + 1) * bin_frequency_`
+    const double first_bin =
+        std::max(std::ceil(low_frequency / bin_frequency_) - 1.0, 0.0);
+    const double end_bin =
+        std::max(std::floor(high_frequency / bin_frequency_), 0.0);
+
+    const size_t end = std::min(static_cast<size_t>(end_bin), num_bins_);
+    const size_t begin = std::min(static_cast<size_t>(first_bin), end);
+
+    return IndexRange{.begin = begin, .end = end};
+}
+
+IndexRange BandLayout::bands_for_bins(IndexRange bins) const {
+    if (is_identity() || bins.size() == 0) {
+        return bins;
+    }
+
+    // A bin's gain is interpolated from its band in `interpolation_bands_`
+    // and the band after that
+    return IndexRange{
+        .begin = interpolation_bands_[bins.begin],
+        .end = std::min(
+            static_cast<size_t>(interpolation_bands_[bins.end - 1]) + 2,
+            num_bands())};
+}
+
+IndexRange BandLayout::bins_for_bands(IndexRange bands) const {
+    if (is_identity() || bands.size() == 0) {
+        return bands;
+    }
+
+    return IndexRange{.begin = band_starts_[bands.begin],
+                      .end = band_starts_[bands.end]};
+}
+
+void BandLayout::reduce(const float* bin_magnitudes,
+                        float* band_magnitudes,
+                        IndexRange bands) const {
+    jassert(!is_identity());
+    jassert(bands.end <= num_bands());
+
+    for (size_t band_idx = bands.begin; band_idx < bands.end; band_idx++) {
+        const size_t start = band_starts_[band_idx];
+        const size_t end = band_starts_[band_idx + 1];
+
+        float power = 0.0f;
+        for (size_t bin_idx = start; bin_idx < end; bin_idx++) {
+            power += bin_magnitudes[bin_idx] * bin_magnitudes[bin_idx];
+        }
+
+        band_magnitudes[band_idx] =
+            std::sqrt(power / static_cast<float>(end - start));
+    }
+}
+
+void BandLayout::expand(const float* band_gains,
+                        float* bin_gains,
+                        IndexRange bins) const {
+    jassert(!is_identity());
+    jassert(bins.end <= num_bins_);
+
+    const size_t last_band_idx = num_bands() - 1;
+    for (size_t bin_idx = bins.begin; bin_idx < bins.end; bin_idx++) {
+        const size_t band_idx = interpolation_bands_[bin_idx];
+        const float weight = interpolation_weights_[bin_idx];
+        const float gain = band_gains[band_idx];
+        const float next_gain =
+            band_gains[std::min(band_idx + 1, last_band_idx)];
+
+        bin_gains[bin_idx] = gain + (weight * (next_gain - gain));
+    }
+}
+
+size_t BandLayout::memory_usage() const {
+    return (band_starts_.capacity() * sizeof(juce::uint32)) +
+           (band_frequencies_.capacity() * sizeof(float)) +
+           (interpolation_bands_.capacity() * sizeof(juce::uint32)) +
+           (interpolation_weights_.capacity() * sizeof(float));
+}
@@ -0,0 +1,185 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+/**
+ * How the FFT bins are grouped into bands for the compressors. With
+ * `BinGrouping::none` every bin gets its own compressor. The other options pool
+ * the bins into perceptually spaced bands with a single compressor per band.
+ * This should match the choices for the bin grouping parameter.
+ */
+enum class BinGrouping {
+    none,
+    bark,
+    erb,
+    third_octave,
+    sixth_octave,
+    twelfth_octave
+};
+
+/**
+ * A half-open range `[begin, end)` of bin or band indices.
+ */
+struct IndexRange {
+    size_t begin = 0;
+    size_t end = 0;
+
+    inline size_t size() const { return end - begin; }
+    inline bool contains(size_t idx) const { return idx >= begin && idx < end; }
+
+    bool operator==(const IndexRange&) const = default;
+};
+
+/**
+ * Maps the FFT bins (excluding the DC bin) to bands for `BinGrouping`. A bin
+ * belongs to a band when its center frequency falls within that band's range
+ * on the chosen frequency scale. At low frequencies the bands can be narrower
+ * than a single bin, so bands that would not contain any bins are skipped and
+ * every band contains at least one bin.
+ *
+ * The compressors run on `reduce()`d band magnitudes, and their gains are
+ * spread back out over the individual bins with `expand()`. That way the
+ * spectrum is still processed at the FFT's full resolution, while the
+ * compressors only need to run once per band.
+ */
+class BandLayout {
+   public:
+    /**
+     * An empty layout. `is_identity()` returns true for this layout.
+     */
+    BandLayout() = default;
+
+    /**
+     * Compute the layout for an FFT with the given window size.
+     *
+     * @param grouping How the bins should be grouped.
+     * @param fft_window_size The FFT window size. The layout covers bins `[1,
+     *   fft_window_size / 2]`.
+     * @param sample_rate The sample rate, used to compute the bins' center
+     *   frequencies. If this is not known yet (i.e. it is zero), then 44.1 kHz
+     *   is assumed.
+     */
+    BandLayout(BinGrouping grouping,
+               size_t fft_window_size,
+               double sample_rate);
+
+    inline BinGrouping grouping() const { return grouping_; }
+    inline double sample_rate() const { return sample_rate_; }
+
+    /**
+     * Whether every bin is its own band. In that case `reduce()` and
+     * `expand()` don't need to be called and the bin magnitudes can be used
+     * directly.
+     */
+    inline bool is_identity() const { return grouping_ == BinGrouping::none; }
+
+    /**
+     * The number of bins covered by this layout, i.e. `fft_window_size / 2`.
+     */
+    inline size_t num_bins() const { return num_bins_; }
+    /**
+     * The number of bands. This equals `num_bins()` for `BinGrouping::none`.
+     */
+    inline size_t num_bands() const { return band_frequencies_.size(); }
+
+    /**
+     * The center frequency of band `band_idx` in Hertz. For
+     * `BinGrouping::none` this is the frequency of bin `band_idx + 1`.
+     */
+    inline float band_frequency(size_t band_idx) const {
+        return band_frequencies_[band_idx];
+    }
+
+    /**
+     * The bins whose center frequencies lie within `[low_frequency,
+     * high_frequency]` Hertz. Indices are relative to bin 1.
+     */
+    IndexRange bins_for_frequencies(float low_frequency,
+                                    float high_frequency) const;
+    /**
+     * The bands needed to compute the gains for `bins` with `expand()`. This
+     * includes the neighbouring bands used for the interpolation.
+     */
+    IndexRange bands_for_bins(IndexRange bins) const;
+    /**
+     * The bins that make up `bands`, and thus the bins whose magnitudes are
+     * needed to `reduce()` them.
+     */
+    IndexRange bins_for_bands(IndexRange bands) const;
+
+    /**
+     * Compute the RMS magnitude of every band in `bands`. Using the mean power
+     * instead of the total power keeps the levels comparable to those of the
+     * individual bins for broadband signals, so the thresholds don't depend on
+     * the band widths.
+     *
+     * @param bin_magnitudes `num_bins()` magnitudes, starting at bin 1. Only
+     *   the bins in `bins_for_bands(bands)` are read.
+     * @param band_magnitudes `num_bands()` output magnitudes. Only the bands
+     *   in `bands` are written to.
+     * @param bands The bands to compute.
+     */
+    void reduce(const float* bin_magnitudes,
+                float* band_magnitudes,
+                IndexRange bands) const;
+
+    /**
+     * Spread the bands' gains out over the bins in `bins`. Gains are linearly
+     * interpolated between the bands' centers so there are no steps at the
+     * band edges. Bins below the first band's center or above the last band's
+     * center get that band's gain.
+     *
+     * @param band_gains `num_bands()` gains. Only the bands in
+     *   `bands_for_bins(bins)` are read.
+     * @param bin_gains `num_bins()` output gains, starting at bin 1. Only the
+     *   bins in `bins` are written to.
+     * @param bins The bins to compute.
+     */
+    void expand(const float* band_gains,
+                float* bin_gains,
+                IndexRange bins) const;
+
+    /**
+     * The memory held by this layout's tables in bytes.
+     */
+    size_t memory_usage() const;
+
+   private:
+    BinGrouping grouping_ = BinGrouping::none;
+    double sample_rate_ = 0.0;
+    double bin_frequency_ = 0.0;
+    size_t num_bins_ = 0;
+
+    /**
+     * The first bin index (relative to bin 1) of every band, followed by
+     * `num_bins()`. Empty for `BinGrouping::none`.
+     */
+    std::vector<juce::uint32> band_starts_;
+    std::vector<float> band_frequencies_;
+
+    /**
+     * For every bin, the band whose center lies at or below the bin, and the
+     * weight of the next band's gain when interpolating. Empty for
+     * `BinGrouping::none`.
+     */
+    std::vector<juce::uint32> interpolation_bands_;
+    std::vector<float> interpolation_weights_;
+};
@@ -14,6 +14,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <limits>
+
 #include <juce_dsp/juce_dsp.h>
 
 /**
@@ -69,8 +71,18 @@ class MultiwayCompressor {
      * Set the compressor's threshold in dB.
      */
     void set_threshold(T threshold_db) {
-        threshold_db_ = threshold_db;
-        update();
+        set_threshold_gain(juce::Decibels::decibelsToGain(
+            threshold_db, static_cast<T>(-200.0)));
+    }
+
+    /**
+     * Set the compressor's threshold as a linear gain. This is what
+     * `set_threshold()` converts to, so callers that already have linear
+     * thresholds can skip the conversion.
+     */
+    void set_threshold_gain(T threshold) {
+        threshold_ = threshold;
+        threshold_inverse_ = static_cast<T>(1.0) / threshold_;
     }
 
     /**
@@ -111,17 +123,62 @@ class MultiwayCompressor {
         jassert(spec.numChannels > 0);
 
         sample_rate_ = spec.sampleRate;
+        prepared_sample_rate_ = spec.sampleRate;
         envelope_filter_.prepare(spec);
 
         update();
         reset();
     }
 
+    /**
+     * Change the sample rate after the compressor has been prepared without
+     * resetting the envelope follower. JUCE's ballistics filter can only change
+     * its sample rate through `prepare()`, so instead the attack and release
+     * times passed to the filter are scaled by the ratio between the new
+     * sample rate and the one it was prepared for. That results in the same
+     * coefficients.
+     */
+    void set_sample_rate(double sample_rate) {
+        jassert(sample_rate > 0);
+
+        sample_rate_ = sample_rate;
+        update();
+    }
+
     /**
      * Reset the internal state variables of the processor.
      */
     void reset() { envelope_filter_.reset(); }
 
+    /**
+     * The envelope follower's current value for `channel`. JUCE's ballistics
+     * filter doesn't expose its state, so this processes a silent sample with
+     * the release time set to infinity. That returns the current value exactly
+     * without changing it.
+     */
+    T envelope(int channel) {
+        envelope_filter_.setReleaseTime(std::numeric_limits<T>::max());
+        const T envelope = envelope_filter_.processSample(channel, 0);
+        envelope_filter_.setReleaseTime(release_time_ * time_scale());
+
+        return envelope;
+    }
+
+    /**
+     * Set the envelope follower's value for `channel` to a value returned by
+     * `envelope()`. This processes that value with instant attack and release
+     * times, which replaces the previous value exactly. The compressor should
+     * have been prepared for the same number of channels and sample rate as
+     * the one the value was taken from.
+     */
+    void set_envelope(int channel, T envelope) {
+        envelope_filter_.setAttackTime(0);
+        envelope_filter_.setReleaseTime(0);
+        envelope_filter_.processSample(channel, envelope);
+        envelope_filter_.setAttackTime(attack_time_ * time_scale());
+        envelope_filter_.setReleaseTime(release_time_ * time_scale());
+    }
+
     /**
      * Process the input and output samples supplied in the processing context.
      */
@@ -149,6 +206,15 @@ class MultiwayCompressor {
         }
     }
 
+    /**
+     * Feed a sample to the envelope follower without computing a gain for it.
+     * This is a lot cheaper than `process_sample()`, and it keeps the envelope
+     * up to date when the gain for a sample isn't needed.
+     */
+    void process_envelope(int channel, T input) {
+        envelope_filter_.processSample(channel, input);
+    }
+
     /**
      * Process a single sample.
      */
@@ -191,18 +257,27 @@ class MultiwayCompressor {
                                                      multiway_deadzone_db_)) /
                       static_cast<T>(2.0)
                 : 0.0;
-        threshold_ = juce::Decibels::decibelsToGain(threshold_db_,
-                                                    static_cast<T>(-200.0));
-        threshold_inverse_ = static_cast<T>(1.0) / threshold_;
         ratio_inverse_ = static_cast<T>(1.0) / ratio_;
 
-        envelope_filter_.setAttackTime(attack_time_);
-        envelope_filter_.setReleaseTime(release_time_);
+        envelope_filter_.setAttackTime(attack_time_ * time_scale());
+        envelope_filter_.setReleaseTime(release_time_ * time_scale());
+    }
+
+    /**
+     * The factor the attack and release times are scaled by to account for
+     * `set_sample_rate()`.
+     */
+    T time_scale() const {
+        return static_cast<T>(sample_rate_ / prepared_sample_rate_);
     }
 
     Mode mode_ = Mode::downwards;
     double sample_rate_ = 44100.0;
-    T threshold_db_ = 0.0;
+    /**
+     * The sample rate `envelope_filter_` was prepared for. This differs from
+     * `sample_rate_` after a call to `set_sample_rate()`.
+     */
+    double prepared_sample_rate_ = 44100.0;
     T multiway_deadzone_db_ = 0.0;
     T ratio_ = 1.0;
     T attack_time_ = 1.0;
@@ -0,0 +1,460 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "decimation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+float dot_product(const float* a, const float* b, size_t num) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < num; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+/**
+ * Write the first `num` samples of every history to `stream`, preceded by the
+ * number of histories and `num`.
+ */
+void write_histories(juce::OutputStream& stream,
+                     const std::vector<std::vector<float>>& histories,
+                     size_t num) {
+    stream.writeInt64(static_cast<juce::int64>(histories.size()));
+    stream.writeInt64(static_cast<juce::int64>(num));
+    for (const auto& history : histories) {
+        stream.write(history.data(), num * sizeof(float));
+    }
+}
+
+/**
+ * Read histories written by `write_histories()`. Both the number of histories
+ * and `num` need to match.
+ */
+bool read_histories(juce::InputStream& stream,
+                    std::vector<std::vector<float>>& histories,
+                    size_t num) {
+    if (stream.readInt64() != static_cast<juce::int64>(histories.size()) ||
+        stream.readInt64() != static_cast<juce::int64>(num)) {
+        return false;
+    }
+
+    const int num_bytes = static_cast<int>(num * sizeof(float));
+    for (auto& history : histories) {
+        if (stream.read(history.data(), num_bytes) != num_bytes) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Delay `num` samples in `data` by `delay_line.size()` samples. Unlike
+ * `RingBuffer::swap_n_with()` this also works for blocks that are larger than
+ * the delay, which happens when the delay only needs to cover the filter's
+ * group delay.
+ */
+void delay(RingBuffer<float>& delay_line, float* data, size_t num) {
+    for (size_t offset = 0; offset < num;) {
+        offset += delay_line.swap_n_with(
+            data + offset, std::min(num - offset, delay_line.size()));
+    }
+}
+
+}  // namespace
+
+std::vector<float> DecimationFilter::design(size_t factor) {
+    jassert(std::has_single_bit(factor));
+
+    const size_t num_taps = (taps_per_phase * factor) + 1;
+    // In cycles per sample at the original sample rate
+    const double cutoff_frequency =
+        (cutoff * 0.5) / static_cast<double>(factor);
+    const double center = static_cast<double>(num_taps - 1) / 2.0;
+
+    // A Blackman windowed sinc
+    std::vector<double> taps(num_taps);
+    double sum = 0.0;
+    for (size_t tap_idx = 0; tap_idx < num_taps; tap_idx++) {
+        const double x = juce::MathConstants<double>::twoPi * cutoff_frequency *
+                         (static_cast<double>(tap_idx) - center);
+        const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+        const double window_phase = juce::MathConstants<double>::twoPi *
+                                    static_cast<double>(tap_idx) /
+                                    static_cast<double>(num_taps - 1);
+        const double window = 0.42 - (0.5 * std::cos(window_phase)) +
+                              (0.08 * std::cos(2.0 * window_phase));
+
+        taps[tap_idx] = sinc * window;
+        sum += taps[tap_idx];
+    }
+
+    std::vector<float> coefficients(num_taps);
+    for (size_t tap_idx = 0; tap_idx < num_taps; tap_idx++) {
+        coefficients[tap_idx] = static_cast<float>(taps[tap_idx] / sum);
+    }
+
+    return coefficients;
+}
+
+Decimator::Decimator(size_t num_channels,
+                     size_t factor,
+                     size_t max_block_size)
+    : factor_(factor),
+      max_block_size_(max_block_size),
+      coefficients_(DecimationFilter::design(factor)),
+      histories_(num_channels,
+                 std::vector<float>(coefficients_.size() - 1 + max_block_size,
+                                    0.0f)),
+      output_(static_cast<int>(num_channels),
+              static_cast<int>((max_block_size / factor) + 1)) {
+    std::reverse(coefficients_.begin(), coefficients_.end());
+    output_.clear();
+}
+
+size_t Decimator::num_output_samples(size_t num_samples) const {
+    // Samples are kept at input indices that are a multiple of the factor
+    const size_t first_sample = (factor_ - phase_) & (factor_ - 1);
+
+    return num_samples > first_sample
+               ? (num_samples - first_sample + factor_ - 1) / factor_
+               : 0;
+}
+
+juce::AudioBuffer<float> Decimator::process(
+    const juce::AudioBuffer<float>& input,
+    size_t num_samples) {
+    jassert(num_samples <= max_block_size_);
+    jassert(static_cast<size_t>(input.getNumChannels()) >= histories_.size());
+
+    const size_t num_taps = coefficients_.size();
+    const size_t first_sample = (factor_ - phase_) & (factor_ - 1);
+    const size_t num_output = num_output_samples(num_samples);
+    for (size_t channel = 0; channel < histories_.size(); channel++) {
+        float* history = histories_[channel].data();
+        std::copy_n(input.getReadPointer(static_cast<int>(channel)),
+                    num_samples, history + num_taps - 1);
+
+        // The filter's window for input sample `n` spans the `num_taps`
+        // samples ending at `n`, and only every `factor_`th sample is computed
+        float* output = output_.getWritePointer(static_cast<int>(channel));
+        for (size_t output_idx = 0; output_idx < num_output; output_idx++) {
+            output[output_idx] = dot_product(
+                coefficients_.data(),
+                history + first_sample + (output_idx * factor_), num_taps);
+        }
+
+        // The last input samples are needed for the next block's windows
+        std::copy(history + num_samples, history + num_samples + num_taps - 1,
+                  history);
+    }
+
+    phase_ = (phase_ + num_samples) & (factor_ - 1);
+
+    return juce::AudioBuffer<float>(output_.getArrayOfWritePointers(),
+                                    output_.getNumChannels(),
+                                    static_cast<int>(num_output));
+}
+
+void Decimator::write_state(juce::OutputStream& stream) const {
+    // Only the samples kept for the next block's windows carry over
+    write_histories(stream, histories_, coefficients_.size() - 1);
+    stream.writeInt64(static_cast<juce::int64>(factor_));
+    stream.writeInt64(static_cast<juce::int64>(phase_));
+}
+
+bool Decimator::read_state(juce::InputStream& stream) {
+    if (!read_histories(stream, histories_, coefficients_.size() - 1) ||
+        stream.readInt64() != static_cast<juce::int64>(factor_)) {
+        return false;
+    }
+    phase_ = static_cast<size_t>(stream.readInt64()) & (factor_ - 1);
+
+    return true;
+}
+
+size_t Decimator::memory_usage() const {
+    size_t usage = coefficients_.capacity() * sizeof(float);
+    for (const auto& history : histories_) {
+        usage += history.capacity() * sizeof(float);
+    }
+    usage += static_cast<size_t>(output_.getNumChannels()) *
+             static_cast<size_t>(output_.getNumSamples()) * sizeof(float);
+
+    return usage;
+}
+
+size_t Decimator::estimate_memory_usage(size_t num_channels,
+                                        size_t factor,
+                                        size_t max_block_size) {
+    const size_t num_taps = (DecimationFilter::taps_per_phase * factor) + 1;
+    const size_t max_decimated = (max_block_size / factor) + 1;
+
+    return (num_taps + (num_channels * ((num_taps - 1 + max_block_size) +
+                                        max_decimated))) *
+           sizeof(float);
+}
+
+Interpolator::Interpolator(size_t num_channels,
+                           size_t factor,
+                           size_t max_block_size)
+    : factor_(factor),
+      max_block_size_(max_block_size),
+      num_phase_taps_(DecimationFilter::taps_per_phase + 1),
+      phase_coefficients_(factor * num_phase_taps_, 0.0f),
+      histories_(num_channels,
+                 std::vector<float>(
+                     num_phase_taps_ + (max_block_size / factor) + 1,
+                     0.0f)) {
+    // Output sample `n` gets the filter's taps `phase + (k * factor)` for the
+    // `k`th most recent input sample, where `phase` is `n`'s distance to the
+    // most recent input sample
+    const std::vector<float> coefficients = DecimationFilter::design(factor);
+    for (size_t phase = 0; phase < factor; phase++) {
+        float* phase_coefficients =
+            phase_coefficients_.data() + (phase * num_phase_taps_);
+        for (size_t tap_idx = 0; tap_idx < num_phase_taps_; tap_idx++) {
+            const size_t coefficient_idx = phase + (tap_idx * factor);
+            if (coefficient_idx < coefficients.size()) {
+                phase_coefficients[num_phase_taps_ - 1 - tap_idx] =
+                    static_cast<float>(factor) * coefficients[coefficient_idx];
+            }
+        }
+    }
+}
+
+size_t Interpolator::num_input_samples(size_t num_samples) const {
+    // A new input sample lines up with every output index that's a multiple
+    // of the factor
+    const size_t first_sample = (factor_ - phase_) & (factor_ - 1);
+
+    return num_samples > first_sample
+               ? (num_samples - first_sample + factor_ - 1) / factor_
+               : 0;
+}
+
+void Interpolator::process(const juce::AudioBuffer<float>& input,
+                           juce::AudioBuffer<float>& output,
+                           size_t num_samples) {
+    jassert(num_samples <= max_block_size_);
+    jassert(static_cast<size_t>(input.getNumChannels()) >= histories_.size());
+
+    const size_t num_input = num_input_samples(num_samples);
+    jassert(num_input <= static_cast<size_t>(input.getNumSamples()));
+    for (size_t channel = 0; channel < histories_.size(); channel++) {
+        float* history = histories_[channel].data();
+        std::copy_n(input.getReadPointer(static_cast<int>(channel)), num_input,
+                    history + num_phase_taps_);
+
+        // `latest` is the index of the most recent input sample in `history`
+        float* channel_output =
+            output.getWritePointer(static_cast<int>(channel));
+        size_t latest = num_phase_taps_ - 1;
+        size_t phase = phase_;
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            if (phase == 0) {
+                latest += 1;
+            }
+
+            channel_output[sample_idx] = dot_product(
+                phase_coefficients_.data() + (phase * num_phase_taps_),
+                history + latest + 1 - num_phase_taps_, num_phase_taps_);
+            phase = (phase + 1) & (factor_ - 1);
+        }
+
+        std::copy(history + num_input, history + num_input + num_phase_taps_,
+                  history);
+    }
+
+    phase_ = (phase_ + num_samples) & (factor_ - 1);
+}
+
+void Interpolator::write_state(juce::OutputStream& stream) const {
+    write_histories(stream, histories_, num_phase_taps_);
+    stream.writeInt64(static_cast<juce::int64>(factor_));
+    stream.writeInt64(static_cast<juce::int64>(phase_));
+}
+
+bool Interpolator::read_state(juce::InputStream& stream) {
+    if (!read_histories(stream, histories_, num_phase_taps_) ||
+        stream.readInt64() != static_cast<juce::int64>(factor_)) {
+        return false;
+    }
+    phase_ = static_cast<size_t>(stream.readInt64()) & (factor_ - 1);
+
+    return true;
+}
+
+size_t Interpolator::memory_usage() const {
+    size_t usage = phase_coefficients_.capacity() * sizeof(float);
+    for (const auto& history : histories_) {
+        usage += history.capacity() * sizeof(float);
+    }
+
+    return usage;
+}
+
+BandSplitDecimator::BandSplitDecimator(size_t num_channels,
+                                       size_t factor,
+                                       size_t inner_latency,
+                                       size_t upper_latency)
+    : inner_latency_(inner_latency),
+      decimator_(num_channels, factor, max_block_size),
+      interpolator_(num_channels, factor, max_block_size),
+      inner_delays_(num_channels, RingBuffer<float>(inner_latency)),
+      input_delays_(num_channels,
+                    RingBuffer<float>(latency_samples(factor, inner_latency) -
+                                      upper_latency)),
+      delayed_decimated_(static_cast<int>(num_channels),
+                         static_cast<int>((max_block_size / factor) + 1)),
+      delayed_input_(static_cast<int>(num_channels),
+                     static_cast<int>(max_block_size)) {
+    jassert(upper_latency < latency_samples(factor, inner_latency));
+
+    delayed_decimated_.clear();
+    delayed_input_.clear();
+}
+
+juce::AudioBuffer<float> BandSplitDecimator::split(
+    const juce::AudioBuffer<float>& input,
+    size_t num_samples) {
+    return split(input, input, num_samples);
+}
+
+juce::AudioBuffer<float> BandSplitDecimator::split(
+    const juce::AudioBuffer<float>& input,
+    const juce::AudioBuffer<float>& upper,
+    size_t num_samples) {
+    jassert(num_samples <= max_block_size);
+
+    juce::AudioBuffer<float> decimated = decimator_.process(input, num_samples);
+    const size_t num_decimated = static_cast<size_t>(decimated.getNumSamples());
+    for (size_t channel = 0; channel < inner_delays_.size(); channel++) {
+        const int channel_idx = static_cast<int>(channel);
+
+        float* delayed_decimated =
+            delayed_decimated_.getWritePointer(channel_idx);
+        std::copy_n(decimated.getReadPointer(channel_idx), num_decimated,
+                    delayed_decimated);
+        delay(inner_delays_[channel], delayed_decimated, num_decimated);
+
+        float* delayed_input = delayed_input_.getWritePointer(channel_idx);
+        std::copy_n(upper.getReadPointer(channel_idx), num_samples,
+                    delayed_input);
+        delay(input_delays_[channel], delayed_input, num_samples);
+    }
+
+    return decimated;
+}
+
+void BandSplitDecimator::join(const juce::AudioBuffer<float>& processed,
+                              juce::AudioBuffer<float>& output,
+                              size_t num_samples) {
+    const int num_decimated = processed.getNumSamples();
+    jassert(static_cast<size_t>(num_decimated) ==
+            interpolator_.num_input_samples(num_samples));
+
+    // Only the change made to the lower band needs to be interpolated, the
+    // rest of the signal is already in the delayed input
+    for (int channel = 0; channel < delayed_decimated_.getNumChannels();
+         channel++) {
+        juce::FloatVectorOperations::subtract(
+            delayed_decimated_.getWritePointer(channel),
+            processed.getReadPointer(channel),
+            delayed_decimated_.getReadPointer(channel), num_decimated);
+    }
+
+    interpolator_.process(delayed_decimated_, output, num_samples);
+    for (int channel = 0; channel < delayed_input_.getNumChannels();
+         channel++) {
+        juce::FloatVectorOperations::add(output.getWritePointer(channel),
+                                         delayed_input_.getReadPointer(channel),
+                                         static_cast<int>(num_samples));
+    }
+}
+
+void BandSplitDecimator::write_state(juce::OutputStream& stream) const {
+    decimator_.write_state(stream);
+    interpolator_.write_state(stream);
+    for (const auto& delays : {&inner_delays_, &input_delays_}) {
+        for (const auto& delay : *delays) {
+            delay.write_state(stream);
+        }
+    }
+}
+
+bool BandSplitDecimator::read_state(juce::InputStream& stream) {
+    if (!decimator_.read_state(stream) || !interpolator_.read_state(stream)) {
+        return false;
+    }
+    for (auto* delays : {&inner_delays_, &input_delays_}) {
+        for (auto& delay : *delays) {
+            if (!delay.read_state(stream)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+size_t BandSplitDecimator::ring_buffer_memory_usage() const {
+    size_t usage = 0;
+    for (const auto& delay : inner_delays_) {
+        usage += delay.memory_usage();
+    }
+    for (const auto& delay : input_delays_) {
+        usage += delay.memory_usage();
+    }
+
+    return usage;
+}
+
+size_t BandSplitDecimator::scratch_buffer_memory_usage() const {
+    return decimator_.memory_usage() + interpolator_.memory_usage() +
+           ((static_cast<size_t>(delayed_decimated_.getNumChannels()) *
+             static_cast<size_t>(delayed_decimated_.getNumSamples())) +
+            (static_cast<size_t>(delayed_input_.getNumChannels()) *
+             static_cast<size_t>(delayed_input_.getNumSamples()))) *
+               sizeof(float);
+}
+
+size_t BandSplitDecimator::estimate_memory_usage(size_t num_channels,
+                                                 size_t factor,
+                                                 size_t inner_latency,
+                                                 size_t upper_latency) {
+    const size_t num_phase_taps = DecimationFilter::taps_per_phase + 1;
+    const size_t max_decimated = (max_block_size / factor) + 1;
+
+    const size_t interpolator =
+        (factor * num_phase_taps) +
+        (num_channels * (num_phase_taps + max_decimated));
+    const size_t delays =
+        num_channels *
+        (inner_latency + latency_samples(factor, inner_latency) -
+         upper_latency);
+    const size_t scratch = num_channels * (max_decimated + max_block_size);
+
+    return Decimator::estimate_memory_usage(num_channels, factor,
+                                            max_block_size) +
+           ((interpolator + delays + scratch) * sizeof(float));
+}
@@ -0,0 +1,355 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <bit>
+#include <vector>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include "../ring.h"
+
+/**
+ * The linear phase lowpass filter shared by `Decimator` and `Interpolator`.
+ * The filter has `(taps_per_phase * factor) + 1` taps, so every polyphase
+ * component has about `taps_per_phase` taps regardless of the factor and the
+ * group delay is `(taps_per_phase / 2) * factor` samples.
+ */
+struct DecimationFilter {
+    static constexpr size_t taps_per_phase = 64;
+
+    /**
+     * The filter's cutoff as a fraction of the decimated Nyquist frequency.
+     * With a Blackman window and `taps_per_phase` taps per phase the
+     * transition band ends just below the decimated Nyquist frequency.
+     */
+    static constexpr double cutoff = 0.9;
+
+    /**
+     * Design the filter for decimating by `factor`. The coefficients are
+     * normalized for unity gain at DC.
+     */
+    static std::vector<float> design(size_t factor);
+
+    /**
+     * The filter's group delay in samples at the original sample rate.
+     */
+    static constexpr size_t group_delay(size_t factor) {
+        return (taps_per_phase / 2) * factor;
+    }
+};
+
+/**
+ * Lowpass filters a multichannel signal and keeps every `factor()`th sample.
+ * Only the samples that are kept get computed, so this costs about
+ * `DecimationFilter::taps_per_phase` multiply-adds per input sample. Decimated
+ * samples are taken at input samples whose index (counted from the last reset)
+ * is a multiple of `factor()`, so blocks can have any size.
+ */
+class Decimator {
+   public:
+    /**
+     * @param num_channels The number of channels to process.
+     * @param factor The decimation factor. Needs to be a power of two.
+     * @param max_block_size The largest number of input samples passed to
+     *   `process()` at once.
+     */
+    Decimator(size_t num_channels, size_t factor, size_t max_block_size);
+
+    inline size_t factor() const { return factor_; }
+    inline size_t max_block_size() const { return max_block_size_; }
+
+    /**
+     * The number of decimated samples the next call to `process()` will
+     * produce for `num_samples` input samples.
+     */
+    size_t num_output_samples(size_t num_samples) const;
+
+    /**
+     * Decimate the first `num_samples` samples of every channel in `input`.
+     *
+     * @return A buffer referring to the decimated samples. This stays valid
+     *   until the next call to `process()`, and it can be modified in place.
+     */
+    juce::AudioBuffer<float> process(const juce::AudioBuffer<float>& input,
+                                     size_t num_samples);
+
+    /**
+     * Write the filter histories and the phase to `stream`, so decimation can
+     * later be resumed from this point with `read_state()`.
+     */
+    void write_state(juce::OutputStream& stream) const;
+    /**
+     * Restore the state written by `write_state()` for a decimator with the
+     * same number of channels and factor.
+     *
+     * @return Whether the state could be restored.
+     */
+    bool read_state(juce::InputStream& stream);
+
+    /**
+     * The memory held by the filter, histories, and output buffer in bytes.
+     */
+    size_t memory_usage() const;
+    /**
+     * The memory a newly constructed object would hold in bytes.
+     */
+    static size_t estimate_memory_usage(size_t num_channels,
+                                        size_t factor,
+                                        size_t max_block_size);
+
+   private:
+    size_t factor_;
+    size_t max_block_size_;
+
+    /**
+     * `DecimationFilter::design()`'s coefficients in reverse order, so they
+     * can be used as a dot product over the input in forward order.
+     */
+    std::vector<float> coefficients_;
+    /**
+     * For every channel, the last `coefficients_.size() - 1` input samples
+     * followed by room for a block of new samples.
+     */
+    std::vector<std::vector<float>> histories_;
+    juce::AudioBuffer<float> output_;
+
+    /**
+     * The index of the next input sample modulo `factor_`.
+     */
+    size_t phase_ = 0;
+};
+
+/**
+ * The inverse of `Decimator`. Upsamples a decimated multichannel signal by
+ * inserting zeros and lowpass filtering it, using the polyphase components of
+ * the same filter. The input samples line up with the output samples whose
+ * index is a multiple of `factor()`, so feeding the output of a `Decimator` to
+ * an `Interpolator` with the same block sizes keeps them in sync.
+ */
+class Interpolator {
+   public:
+    /**
+     * @param num_channels The number of channels to process.
+     * @param factor The interpolation factor. Needs to be a power of two.
+     * @param max_block_size The largest number of output samples produced by
+     *   `process()` at once.
+     */
+    Interpolator(size_t num_channels, size_t factor, size_t max_block_size);
+
+    inline size_t factor() const { return factor_; }
+
+    /**
+     * The number of input samples the next call to `process()` will consume
+     * when producing `num_samples` output samples.
+     */
+    size_t num_input_samples(size_t num_samples) const;
+
+    /**
+     * Produce `num_samples` samples for every channel in `output` from the
+     * first `num_input_samples(num_samples)` samples in `input`.
+     */
+    void process(const juce::AudioBuffer<float>& input,
+                 juce::AudioBuffer<float>& output,
+                 size_t num_samples);
+
+    /**
+     * @see Decimator::write_state()
+     */
+    void write_state(juce::OutputStream& stream) const;
+    /**
+     * @see Decimator::read_state()
+     */
+    bool read_state(juce::InputStream& stream);
+
+    /**
+     * The memory held by the filters and histories in bytes.
+     */
+    size_t memory_usage() const;
+
+   private:
+    size_t factor_;
+    size_t max_block_size_;
+
+    /**
+     * The number of taps in every polyphase component.
+     */
+    size_t num_phase_taps_;
+    /**
+     * `factor_` polyphase components with `num_phase_taps_` taps each, scaled
+     * by `factor_` to make up for the inserted zeros. The taps are stored in
+     * reverse order so they can be used as a dot product over the input in
+     * forward order.
+     */
+    std::vector<float> phase_coefficients_;
+    /**
+     * For every channel, the last `num_phase_taps_` input samples followed by
+     * room for a block of new samples.
+     */
+    std::vector<std::vector<float>> histories_;
+
+    /**
+     * The index of the next output sample modulo `factor_`.
+     */
+    size_t phase_ = 0;
+};
+
+/**
+ * Splits a signal into a lower band that gets decimated so it can be processed
+ * at a lower sample rate, and an upper band that is passed through as is. This
+ * is used to run the spectral processing at high sample rates on only the
+ * audible part of the spectrum, which gives the same frequency resolution as at
+ * regular sample rates at a fraction of the cost.
+ *
+ * `split()` returns the decimated lower band, which should then be processed in
+ * place with a latency of exactly `inner_latency` decimated samples before
+ * passing it back to `join()`. The upper band is not computed explicitly.
+ * Instead, `join()` subtracts a delayed copy of the unprocessed decimated
+ * signal from the processed signal, interpolates only that difference, and
+ * adds the result to the delayed input. This means that when the processing
+ * doesn't change anything, the output is exactly the input delayed by
+ * `latency_samples()`.
+ *
+ * The upper band can also be processed separately by passing the processed
+ * full rate signal to `split()`. That is used for the multi-resolution mode,
+ * where the full rate signal goes through an STFT with a smaller window. That
+ * processing should only change the part of the spectrum the lower band's
+ * processing leaves alone, so the two changes can simply be added up.
+ */
+class BandSplitDecimator {
+   public:
+    /**
+     * The largest number of samples that can be passed to `split()` at once.
+     * Longer blocks should be processed in chunks.
+     */
+    static constexpr size_t max_block_size = 1024;
+
+    /**
+     * @param num_channels The number of channels to process.
+     * @param factor The decimation factor. Needs to be a power of two.
+     * @param inner_latency The latency of the processing applied to the
+     *   decimated signal, in decimated samples.
+     * @param upper_latency The latency of the processing applied to the full
+     *   rate signal passed to `split()` as the upper band, if any. Should be
+     *   lower than `latency_samples()`.
+     */
+    BandSplitDecimator(size_t num_channels,
+                       size_t factor,
+                       size_t inner_latency,
+                       size_t upper_latency = 0);
+
+    inline size_t factor() const { return decimator_.factor(); }
+
+    /**
+     * The total latency at the original sample rate, including the
+     * processing's latency.
+     */
+    inline size_t latency_samples() const {
+        return latency_samples(factor(), inner_latency_);
+    }
+    static constexpr size_t latency_samples(size_t factor,
+                                            size_t inner_latency) {
+        return (inner_latency * factor) +
+               (2 * DecimationFilter::group_delay(factor));
+    }
+
+    /**
+     * Decimate the first `num_samples` samples of every channel in `input`,
+     * which should not exceed `max_block_size`.
+     *
+     * @return A buffer referring to the decimated lower band. This should be
+     *   processed in place before calling `join()`.
+     */
+    juce::AudioBuffer<float> split(const juce::AudioBuffer<float>& input,
+                                   size_t num_samples);
+    /**
+     * The same as the above, but the upper band that gets delayed and added
+     * back in `join()` is taken from `upper` instead of from `input`. `upper`
+     * should be `input` after processing it with a latency of exactly
+     * `upper_latency` samples.
+     */
+    juce::AudioBuffer<float> split(const juce::AudioBuffer<float>& input,
+                                   const juce::AudioBuffer<float>& upper,
+                                   size_t num_samples);
+
+    /**
+     * Combine the processed lower band with the delayed upper band and write
+     * the result to `output`.
+     *
+     * @param processed The buffer returned from the last call to `split()`,
+     *   after processing.
+     * @param output Where to write the `num_samples` output samples to.
+     * @param num_samples The same number of samples passed to `split()`.
+     */
+    void join(const juce::AudioBuffer<float>& processed,
+              juce::AudioBuffer<float>& output,
+              size_t num_samples);
+
+    /**
+     * Write the filters' histories and the delay lines to `stream`. This
+     * should be called in between `join()` and the next `split()`.
+     *
+     * @see Decimator::write_state()
+     */
+    void write_state(juce::OutputStream& stream) const;
+    /**
+     * Restore the state written by `write_state()` for a band split with the
+     * same number of channels, factor, and latencies.
+     *
+     * @return Whether the state could be restored.
+     */
+    bool read_state(juce::InputStream& stream);
+
+    /**
+     * The memory held by the delay lines in bytes.
+     */
+    size_t ring_buffer_memory_usage() const;
+    /**
+     * The memory held by the filters and scratch buffers in bytes.
+     */
+    size_t scratch_buffer_memory_usage() const;
+
+    /**
+     * The memory a newly constructed object would hold in bytes. Used to
+     * enforce the memory budget.
+     */
+    static size_t estimate_memory_usage(size_t num_channels,
+                                        size_t factor,
+                                        size_t inner_latency,
+                                        size_t upper_latency = 0);
+
+   private:
+    size_t inner_latency_;
+
+    Decimator decimator_;
+    Interpolator interpolator_;
+
+    /**
+     * Delays the unprocessed decimated signal by `inner_latency_` decimated
+     * samples, and the upper band by the remainder of `latency_samples()`.
+     */
+    std::vector<RingBuffer<float>> inner_delays_;
+    std::vector<RingBuffer<float>> input_delays_;
+
+    /**
+     * The delayed unprocessed decimated signal and the delayed input from the
+     * last call to `split()`.
+     */
+    juce::AudioBuffer<float> delayed_decimated_;
+    juce::AudioBuffer<float> delayed_input_;
+};
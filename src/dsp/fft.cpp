@@ -0,0 +1,432 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "fft.h"
+
+#include <array>
+#include <mutex>
+
+#include <juce_data_structures/juce_data_structures.h>
+#include <juce_dsp/juce_dsp.h>
+
+namespace fft {
+
+namespace {
+
+/**
+ * When set to a backend name, that backend will be used for all FFT orders
+ * instead of the calibrated ones.
+ */
+constexpr char backend_env_var[] = "SPECTRAL_COMPRESSOR_FFT_BACKEND";
+
+constexpr Backend all_backends[] = {Backend::juce, Backend::fftw,
+                                    Backend::pffft};
+
+/**
+ * How long to benchmark every backend for, in seconds. A couple of round trips
+ * are always done regardless of this.
+ */
+constexpr double benchmark_duration = 0.01;
+constexpr int min_benchmark_round_trips = 8;
+
+/**
+ * `juce::dsp::FFT` already uses the same buffer layout we do, so this is a
+ * trivial wrapper.
+ */
+class JuceEngine : public Engine {
+   public:
+    JuceEngine(int order)
+        : Engine(static_cast<size_t>(1) << order), fft_(order) {}
+
+    void forward(float* data) override {
+        fft_.performRealOnlyForwardTransform(data, true);
+    }
+
+    void inverse(float* data) override {
+        fft_.performRealOnlyInverseTransform(data);
+    }
+
+    Backend backend() const override { return Backend::juce; }
+
+   private:
+    juce::dsp::FFT fft_;
+};
+
+/**
+ * The fastest backend for every FFT order, persisted in the user's application
+ * data directory. The cache is tied to the CPU model and to the set of
+ * backends compiled into this binary, and it gets discarded when either of
+ * those changes. This is shared between all instances in the process.
+ */
+class CalibrationCache {
+   public:
+    static CalibrationCache& instance() {
+        static CalibrationCache cache;
+        return cache;
+    }
+
+    std::optional<Backend> get(int order) {
+        std::lock_guard lock(mutex_);
+        jassert(order >= 0 && order <= max_calibrated_order);
+
+        return backends_[static_cast<size_t>(order)];
+    }
+
+    void set(int order, Backend backend) {
+        std::lock_guard lock(mutex_);
+        jassert(order >= 0 && order <= max_calibrated_order);
+
+        backends_[static_cast<size_t>(order)] = backend;
+        properties_.setValue("fingerprint", fingerprint_);
+        properties_.setValue(key_for_order(order), backend_name(backend));
+        properties_.saveIfNeeded();
+    }
+
+    /**
+     * Start `CalibrationThread` for these orders if it hasn't been started
+     * yet.
+     */
+    void start_calibration_thread(int min_order, int max_order);
+
+    /**
+     * The mutex that's held while calibrating, so the background calibration
+     * and an explicit `recalibrate()` don't benchmark at the same time.
+     */
+    std::mutex calibration_mutex;
+
+   private:
+    class CalibrationThread;
+
+    CalibrationCache()
+        : fingerprint_(compute_fingerprint()), properties_(options()) {
+        if (properties_.getValue("fingerprint") != fingerprint_) {
+            properties_.clear();
+            return;
+        }
+
+        for (int order = 0; order <= max_calibrated_order; order++) {
+            const std::optional<Backend> backend =
+                parse_backend(properties_.getValue(key_for_order(order)));
+            if (backend && is_available(*backend)) {
+                backends_[static_cast<size_t>(order)] = *backend;
+            }
+        }
+    }
+
+    static juce::PropertiesFile::Options options() {
+        juce::PropertiesFile::Options options;
+        options.applicationName = "fft_calibration";
+        options.filenameSuffix = ".settings";
+        options.folderName = "Spectral Compressor";
+        options.osxLibrarySubFolder = "Application Support";
+
+        return options;
+    }
+
+    static juce::String compute_fingerprint() {
+        juce::String fingerprint = juce::SystemStats::getCpuModel();
+        for (const Backend backend : all_backends) {
+            if (is_available(backend)) {
+                fingerprint << ";" << backend_name(backend);
+            }
+        }
+
+        return fingerprint;
+    }
+
+    static juce::String key_for_order(int order) {
+        return "order_" + juce::String(order);
+    }
+
+    std::mutex mutex_;
+    const juce::String fingerprint_;
+    juce::PropertiesFile properties_;
+    std::array<std::optional<Backend>, max_calibrated_order + 1> backends_;
+
+    std::unique_ptr<CalibrationThread> calibration_thread_;
+};
+
+/**
+ * Benchmarks the orders that haven't been calibrated yet, so this never has to
+ * happen while the plugin is being prepared or on the message thread.
+ */
+class CalibrationCache::CalibrationThread : public juce::Thread {
+   public:
+    CalibrationThread(CalibrationCache& cache, int min_order, int max_order)
+        : juce::Thread("FFT calibration"),
+          cache_(cache),
+          min_order_(min_order),
+          max_order_(max_order) {}
+
+    ~CalibrationThread() override { stopThread(10000); }
+
+    void run() override {
+        for (int order = min_order_; order <= max_order_; order++) {
+            if (threadShouldExit()) {
+                return;
+            }
+
+            std::lock_guard lock(cache_.calibration_mutex);
+            if (!cache_.get(order)) {
+                recalibrate(order);
+            }
+        }
+    }
+
+   private:
+    CalibrationCache& cache_;
+    const int min_order_;
+    const int max_order_;
+};
+
+void CalibrationCache::start_calibration_thread(int min_order,
+                                                int max_order) {
+    jassert(min_order >= 0 && max_order <= max_calibrated_order);
+
+    std::lock_guard lock(mutex_);
+    if (!calibration_thread_) {
+        calibration_thread_ =
+            std::make_unique<CalibrationThread>(*this, min_order, max_order);
+        calibration_thread_->startThread();
+    }
+}
+
+/**
+ * The backend set through the environment variable, if any.
+ */
+std::optional<Backend> read_forced_backend() {
+    const juce::String name =
+        juce::SystemStats::getEnvironmentVariable(backend_env_var, "");
+    if (name.isEmpty()) {
+        return std::nullopt;
+    }
+
+    const std::optional<Backend> backend = parse_backend(name);
+    if (!(backend && is_available(*backend))) {
+        juce::Logger::writeToLog("'" + name + "' from " + backend_env_var +
+                                 " is not available in this build, ignoring");
+        return std::nullopt;
+    }
+
+    return backend;
+}
+
+/**
+ * The backend set through `force_backend()`, or through the environment
+ * variable if that function has never been called.
+ */
+std::optional<Backend>& forced_backend() {
+    static std::optional<Backend> backend = read_forced_backend();
+    return backend;
+}
+
+/**
+ * The backends set through `force_backend(int, std::optional<Backend>)`.
+ */
+std::array<std::optional<Backend>, max_calibrated_order + 1>&
+forced_order_backends() {
+    static std::array<std::optional<Backend>, max_calibrated_order + 1>
+        backends;
+    return backends;
+}
+
+}  // namespace
+
+bool is_available(Backend backend) {
+    switch (backend) {
+        case Backend::juce:
+            return true;
+        case Backend::fftw:
+#if defined(SPECTRAL_COMPRESSOR_WITH_FFTW)
+            return true;
+#else
+            return false;
+#endif
+        case Backend::pffft:
+#if defined(SPECTRAL_COMPRESSOR_WITH_PFFFT)
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+std::unique_ptr<Engine> create_engine(Backend backend, int order) {
+    switch (backend) {
+        case Backend::juce:
+            return detail::create_juce_engine(order);
+        case Backend::fftw:
+            return detail::create_fftw_engine(order);
+        case Backend::pffft:
+            return detail::create_pffft_engine(order);
+    }
+
+    return nullptr;
+}
+
+std::unique_ptr<Engine> create_engine(int order) {
+    std::unique_ptr<Engine> engine =
+        create_engine(selected_backend(order), order);
+    jassert(engine);
+
+    return engine;
+}
+
+Backend selected_backend(int order) {
+    if (order >= 0 && order <= max_calibrated_order) {
+        if (const std::optional<Backend> backend =
+                forced_order_backends()[static_cast<size_t>(order)]) {
+            return *backend;
+        }
+    }
+
+    if (const std::optional<Backend> backend = forced_backend()) {
+        return *backend;
+    }
+
+    if (const std::optional<Backend> backend =
+            CalibrationCache::instance().get(order)) {
+        return *backend;
+    }
+
+    return default_backend();
+}
+
+Backend default_backend() {
+    return is_available(Backend::fftw) ? Backend::fftw : Backend::juce;
+}
+
+void calibrate_in_background(int min_order, int max_order) {
+    CalibrationCache::instance().start_calibration_thread(min_order,
+                                                          max_order);
+}
+
+bool force_backend(std::optional<Backend> backend) {
+    if (backend && !is_available(*backend)) {
+        return false;
+    }
+
+    forced_backend() = backend;
+    return true;
+}
+
+bool force_backend(int order, std::optional<Backend> backend) {
+    if ((backend && !is_available(*backend)) || order < 0 ||
+        order > max_calibrated_order) {
+        return false;
+    }
+
+    forced_order_backends()[static_cast<size_t>(order)] = backend;
+    return true;
+}
+
+std::vector<BenchmarkResult> benchmark(int order) {
+    const size_t size = static_cast<size_t>(1) << order;
+    std::vector<float> input(size);
+    juce::Random random(order);
+    for (float& sample : input) {
+        sample = (random.nextFloat() * 2.0f) - 1.0f;
+    }
+
+    std::vector<BenchmarkResult> results;
+    std::vector<float> buffer(size * 2);
+    for (const Backend backend : all_backends) {
+        std::unique_ptr<Engine> engine = create_engine(backend, order);
+        if (!engine) {
+            continue;
+        }
+
+        std::copy(input.begin(), input.end(), buffer.begin());
+
+        // The first round trip warms up the caches and any lazily initialized
+        // state
+        engine->forward(buffer.data());
+        engine->inverse(buffer.data());
+
+        int num_round_trips = 0;
+        const juce::int64 start_ticks = juce::Time::getHighResolutionTicks();
+        double elapsed = 0.0;
+        while (num_round_trips < min_benchmark_round_trips ||
+               elapsed < benchmark_duration) {
+            engine->forward(buffer.data());
+            engine->inverse(buffer.data());
+
+            num_round_trips += 1;
+            elapsed = juce::Time::highResolutionTicksToSeconds(
+                juce::Time::getHighResolutionTicks() - start_ticks);
+        }
+
+        results.push_back(BenchmarkResult{
+            .backend = backend,
+            .seconds_per_round_trip = elapsed / num_round_trips});
+    }
+
+    std::sort(results.begin(), results.end(),
+              [](const BenchmarkResult& a, const BenchmarkResult& b) {
+                  return a.seconds_per_round_trip < b.seconds_per_round_trip;
+              });
+
+    return results;
+}
+
+std::vector<BenchmarkResult> recalibrate(int order) {
+    const std::vector<BenchmarkResult> results = benchmark(order);
+    jassert(!results.empty());
+
+    CalibrationCache::instance().set(order, results.front().backend);
+
+    juce::String message = "FFT calibration for order " + juce::String(order) +
+                           ", using " + backend_name(results.front().backend);
+    for (const BenchmarkResult& result : results) {
+        message << ", " << backend_name(result.backend) << " "
+                << juce::String(result.seconds_per_round_trip * 1.0e6, 1)
+                << " us";
+    }
+    juce::Logger::writeToLog(message);
+
+    return results;
+}
+
+const char* backend_name(Backend backend) {
+    switch (backend) {
+        case Backend::juce:
+            return "juce";
+        case Backend::fftw:
+            return "fftw";
+        case Backend::pffft:
+            return "pffft";
+    }
+
+    return "unknown";
+}
+
+std::optional<Backend> parse_backend(const juce::String& name) {
+    for (const Backend backend : all_backends) {
+        if (name.equalsIgnoreCase(backend_name(backend))) {
+            return backend;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::unique_ptr<Engine> detail::create_juce_engine(int order) {
+    return std::make_unique<JuceEngine>(order);
+}
+
+}  // namespace fft
@@ -0,0 +1,201 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+/**
+ * Real-only FFT engines with a common interface, so the STFT doesn't depend on
+ * whichever engine `juce::dsp::FFT` happened to be built with. The available
+ * backends depend on the build:
+ *
+ * - `juce`: `juce::dsp::FFT`. The CMake build doesn't enable JUCE's own FFTW
+ *   support, so there this is JUCE's fallback implementation, or vDSP on
+ *   macOS. Always available.
+ * - `fftw`: FFTW, when built with `SPECTRAL_COMPRESSOR_WITH_FFTW`. The CMake
+ *   build always includes this.
+ * - `pffft`: PFFFT, when built with `SPECTRAL_COMPRESSOR_WITH_PFFFT`. See the
+ *   `WITH_PFFFT` CMake option.
+ *
+ * When no backend is requested explicitly the fastest one for the FFT order is
+ * used. That's determined by benchmarking the available backends, either on a
+ * background thread started through `calibrate_in_background()` or with the
+ * `calibrate-fft` tool, and the results are cached on disk so this only happens
+ * once per machine. Until an order has been calibrated `default_backend()` is
+ * used for it. The `SPECTRAL_COMPRESSOR_FFT_BACKEND` environment variable can
+ * be set to one of the names returned by `backend_name()` to override this.
+ */
+namespace fft {
+
+/**
+ * These values are stored in capture files, see `capture_format::FileHeader`,
+ * so existing values should not be changed.
+ */
+enum class Backend { juce, fftw, pffft };
+
+/**
+ * The highest FFT order calibration results can be stored for, and that can be
+ * forced individually.
+ */
+constexpr int max_calibrated_order = 20;
+
+/**
+ * An FFT engine for a fixed size. All transforms are done in place on a buffer
+ * of `2 * size()` floats, using the same layout as `juce::dsp::FFT`'s real-only
+ * transforms.
+ */
+class Engine {
+   public:
+    virtual ~Engine() = default;
+
+    /**
+     * Transform the `size()` real samples at the start of `data` into `size() /
+     * 2 + 1` interleaved complex bins, from DC up to and including the Nyquist
+     * frequency. The contents of the rest of the buffer are unspecified
+     * afterwards.
+     */
+    virtual void forward(float* data) = 0;
+    /**
+     * The inverse of `forward()`. This only reads the first `size() / 2 + 1`
+     * bins and writes `size()` real samples, normalized so that a round trip
+     * results in the original signal.
+     */
+    virtual void inverse(float* data) = 0;
+
+    virtual Backend backend() const = 0;
+
+    inline size_t size() const { return size_; }
+
+   protected:
+    Engine(size_t size) : size_(size) {}
+
+   private:
+    const size_t size_;
+};
+
+/**
+ * Whether `backend` has been compiled into this binary.
+ */
+bool is_available(Backend backend);
+
+/**
+ * Create an engine for `1 << order` sized transforms using a specific backend.
+ * This allocates and should not be called from the audio thread.
+ *
+ * @return A null pointer if the backend is not available.
+ */
+std::unique_ptr<Engine> create_engine(Backend backend, int order);
+
+/**
+ * Create an engine for `1 << order` sized transforms using the backend from
+ * `selected_backend()`. This allocates and should not be called from the audio
+ * thread.
+ */
+std::unique_ptr<Engine> create_engine(int order);
+
+/**
+ * The backend that will be used for `1 << order` sized transforms. This is the
+ * backend set through `force_backend()` or the environment variable if there
+ * is one, and the fastest backend for this order otherwise. If this order has
+ * not yet been calibrated on this machine, then this is `default_backend()`.
+ * This never runs the benchmark itself.
+ */
+Backend selected_backend(int order);
+
+/**
+ * The backend used for orders that haven't been calibrated yet. This is FFTW
+ * when it's available, and JUCE's FFT otherwise.
+ */
+Backend default_backend();
+
+/**
+ * Calibrate every order from `min_order` up to and including `max_order` that
+ * hasn't been calibrated on this machine yet, on a background thread. Only the
+ * first call in a process does anything. Engines created while this is running
+ * use `default_backend()` for the orders that are still missing. The thread is
+ * stopped when the process exits.
+ */
+void calibrate_in_background(int min_order, int max_order);
+
+/**
+ * Use `backend` for all engines created through `create_engine(int)` from now
+ * on, overriding both the calibration and the environment variable. Passing
+ * `std::nullopt` goes back to the calibrated selection, and the environment
+ * variable will then also be ignored. This is meant for testing
+ * and benchmarking, and it should not be called while other threads are
+ * creating engines.
+ *
+ * @return False if the backend is not available, in which case nothing
+ *   changes.
+ */
+bool force_backend(std::optional<Backend> backend);
+/**
+ * The same as the above, but only for `1 << order` sized transforms. This takes
+ * precedence over the backend forced for all orders. Used to replay captures
+ * with the same backends they were recorded with.
+ *
+ * @return False if the backend is not available or if `order` is higher than
+ *   `max_calibrated_order`, in which case nothing changes.
+ */
+bool force_backend(int order, std::optional<Backend> backend);
+
+struct BenchmarkResult {
+    Backend backend;
+    /**
+     * The average time a forward and inverse transform took, in seconds.
+     */
+    double seconds_per_round_trip;
+};
+
+/**
+ * Time every available backend for `1 << order` sized transforms. This takes a
+ * couple of milliseconds per backend.
+ *
+ * @return The results, fastest first.
+ */
+std::vector<BenchmarkResult> benchmark(int order);
+
+/**
+ * Run `benchmark()` for this order and store the fastest backend in the
+ * calibration cache, replacing any existing result.
+ *
+ * @return The benchmark results, fastest first.
+ */
+std::vector<BenchmarkResult> recalibrate(int order);
+
+const char* backend_name(Backend backend);
+/**
+ * The inverse of `backend_name()`. Case insensitive.
+ */
+std::optional<Backend> parse_backend(const juce::String& name);
+
+namespace detail {
+
+// These are defined in the `fft_*.cpp` files. They return a null pointer when
+// the backend was not enabled for this build.
+
+std::unique_ptr<Engine> create_juce_engine(int order);
+std::unique_ptr<Engine> create_fftw_engine(int order);
+std::unique_ptr<Engine> create_pffft_engine(int order);
+
+}  // namespace detail
+
+}  // namespace fft
@@ -0,0 +1,109 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "fft.h"
+
+#if defined(SPECTRAL_COMPRESSOR_WITH_FFTW)
+
+#include <mutex>
+
+#include <fftw3.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace fft {
+
+namespace {
+
+/**
+ * FFTW's planner is not thread safe, so creating and destroying plans needs to
+ * be serialized. Executing plans is thread safe.
+ */
+std::mutex& planner_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+/**
+ * Uses FFTW's real-to-complex and complex-to-real transforms in place. The
+ * plans are created with `FFTW_ESTIMATE` instead of measuring, since measured
+ * plans can differ between runs and then the results would no longer be
+ * reproducible. `FFTW_UNALIGNED` lets us execute the plans on any buffer using
+ * the new-array execute functions.
+ */
+class FftwEngine : public Engine {
+   public:
+    FftwEngine(int order) : Engine(static_cast<size_t>(1) << order) {
+        std::lock_guard lock(planner_mutex());
+
+        // The planner needs a buffer with the same in-place layout we'll use
+        // later, but `FFTW_ESTIMATE` won't touch its contents
+        float* buffer = fftwf_alloc_real(size() * 2);
+        fftwf_complex* bins = reinterpret_cast<fftwf_complex*>(buffer);
+        const int n = static_cast<int>(size());
+        forward_plan_ = fftwf_plan_dft_r2c_1d(
+            n, buffer, bins, FFTW_ESTIMATE | FFTW_UNALIGNED);
+        inverse_plan_ = fftwf_plan_dft_c2r_1d(
+            n, bins, buffer, FFTW_ESTIMATE | FFTW_UNALIGNED);
+        fftwf_free(buffer);
+
+        jassert(forward_plan_ && inverse_plan_);
+    }
+
+    ~FftwEngine() override {
+        std::lock_guard lock(planner_mutex());
+
+        fftwf_destroy_plan(forward_plan_);
+        fftwf_destroy_plan(inverse_plan_);
+    }
+
+    void forward(float* data) override {
+        fftwf_execute_dft_r2c(forward_plan_, data,
+                              reinterpret_cast<fftwf_complex*>(data));
+    }
+
+    void inverse(float* data) override {
+        fftwf_execute_dft_c2r(inverse_plan_,
+                              reinterpret_cast<fftwf_complex*>(data), data);
+
+        // FFTW's inverse transform is not normalized
+        juce::FloatVectorOperations::multiply(
+            data, 1.0f / static_cast<float>(size()), static_cast<int>(size()));
+    }
+
+    Backend backend() const override { return Backend::fftw; }
+
+   private:
+    fftwf_plan forward_plan_;
+    fftwf_plan inverse_plan_;
+
+    JUCE_DECLARE_NON_COPYABLE(FftwEngine)
+};
+
+}  // namespace
+
+std::unique_ptr<Engine> detail::create_fftw_engine(int order) {
+    return std::make_unique<FftwEngine>(order);
+}
+
+}  // namespace fft
+
+#else
+
+std::unique_ptr<fft::Engine> fft::detail::create_fftw_engine(int /*order*/) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,104 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "fft.h"
+
+#if defined(SPECTRAL_COMPRESSOR_WITH_PFFFT)
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <pffft.h>
+
+namespace fft {
+
+namespace {
+
+/**
+ * Uses PFFFT's ordered real transforms. PFFFT needs 16-byte aligned buffers,
+ * so the data gets copied to and from an aligned buffer and repacked along the
+ * way. PFFFT packs the real-valued DC and Nyquist bins into the first complex
+ * value, while we store them as separate bins.
+ */
+class PffftEngine : public Engine {
+   public:
+    PffftEngine(int order)
+        : Engine(static_cast<size_t>(1) << order),
+          setup_(pffft_new_setup(static_cast<int>(size()), PFFFT_REAL)),
+          buffer_(static_cast<float*>(
+              pffft_aligned_malloc(size() * sizeof(float)))),
+          work_(static_cast<float*>(
+              pffft_aligned_malloc(size() * sizeof(float)))) {
+        // PFFFT's real transforms need the size to be a multiple of 32
+        jassert(setup_);
+    }
+
+    ~PffftEngine() override {
+        pffft_aligned_free(work_);
+        pffft_aligned_free(buffer_);
+        pffft_destroy_setup(setup_);
+    }
+
+    void forward(float* data) override {
+        std::copy_n(data, size(), buffer_);
+        pffft_transform_ordered(setup_, buffer_, buffer_, work_,
+                                PFFFT_FORWARD);
+
+        const size_t nyquist_idx = size() / 2;
+        std::copy_n(buffer_ + 2, size() - 2, data + 2);
+        data[0] = buffer_[0];
+        data[1] = 0.0f;
+        data[nyquist_idx * 2] = buffer_[1];
+        data[(nyquist_idx * 2) + 1] = 0.0f;
+    }
+
+    void inverse(float* data) override {
+        const size_t nyquist_idx = size() / 2;
+        buffer_[0] = data[0];
+        buffer_[1] = data[nyquist_idx * 2];
+        std::copy_n(data + 2, size() - 2, buffer_ + 2);
+        pffft_transform_ordered(setup_, buffer_, buffer_, work_,
+                                PFFFT_BACKWARD);
+
+        // PFFFT's transforms are not normalized
+        juce::FloatVectorOperations::multiply(
+            data, buffer_, 1.0f / static_cast<float>(size()),
+            static_cast<int>(size()));
+    }
+
+    Backend backend() const override { return Backend::pffft; }
+
+   private:
+    PFFFT_Setup* setup_;
+    float* buffer_;
+    float* work_;
+
+    JUCE_DECLARE_NON_COPYABLE(PffftEngine)
+};
+
+}  // namespace
+
+std::unique_ptr<Engine> detail::create_pffft_engine(int order) {
+    return std::make_unique<PffftEngine>(order);
+}
+
+}  // namespace fft
+
+#else
+
+std::unique_ptr<fft::Engine> fft::detail::create_pffft_engine(int /*order*/) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,218 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <bit>
+#include <vector>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include "simd.h"
+
+/**
+ * The output side of `STFT`'s overlap-add process. Every synthesized frame
+ * spans `frame_size()` samples starting at the current read position. After a
+ * frame has been added, the first `hop` samples of it won't receive any more
+ * contributions, so `add_frame()` writes those directly to the output instead
+ * of storing them. Only the unfinished tail of the frame is accumulated here.
+ *
+ * Samples that have already been read are never cleared. Instead we keep track
+ * of how many samples past the read position contain partial sums, and
+ * everything beyond that is overwritten rather than added to when the next
+ * frame comes in. This means that every frame touches every sample exactly
+ * once, without a separate copy or clearing pass.
+ */
+class OverlapAddBuffer {
+   public:
+    /**
+     * @param frame_size The size of the synthesized frames. Needs to be a
+     *   power of two.
+     */
+    OverlapAddBuffer(size_t frame_size)
+        : buffer_(frame_size, 0.0f), mask_(frame_size - 1) {
+        jassert(std::has_single_bit(frame_size));
+    }
+
+    inline size_t frame_size() const noexcept { return buffer_.size(); }
+
+    /**
+     * The memory held by the accumulation buffer in bytes.
+     */
+    inline size_t memory_usage() const noexcept {
+        return buffer_.capacity() * sizeof(float);
+    }
+
+    /**
+     * The number of samples starting at the read position that contain
+     * (partial) sums from previous frames. The samples after that are stale.
+     */
+    inline size_t num_accumulated() const noexcept { return num_accumulated_; }
+
+    /**
+     * Add a frame of `frame_size()` samples multiplied by `gain`, starting at
+     * the current read position. The first `num_finished` samples of the sum
+     * are written to `dst` instead of being stored, and the read position
+     * advances by that amount. If a hop's worth of samples can't be written to
+     * the output yet, then the remaining finished samples can be read later
+     * using `read()`.
+     */
+    void add_frame(const float* frame,
+                   float gain,
+                   float* dst,
+                   size_t num_finished) noexcept {
+        const size_t size = frame_size();
+        jassert(num_finished <= size);
+
+        const simd::Kernels& kernels = simd::kernels();
+        const size_t num_finished_accumulated =
+            std::min(num_finished, num_accumulated_);
+
+        // The finished samples go straight to the output. The frame could
+        // start past the accumulated samples if the hop size grew.
+        for_each_segment(0, num_finished_accumulated,
+                         [&](float* segment, size_t offset, size_t length) {
+                             std::copy_n(segment, length, dst + offset);
+                         });
+        kernels.multiply_add(dst, frame, gain, num_finished_accumulated);
+        copy_with_multiply(dst + num_finished_accumulated,
+                           frame + num_finished_accumulated, gain,
+                           num_finished - num_finished_accumulated);
+
+        // The rest of the frame is added to the partial sums, and the part of
+        // the frame that extends past those overwrites the stale samples
+        const size_t accumulated_end =
+            std::max(num_finished, num_accumulated_);
+        for_each_segment(num_finished, accumulated_end - num_finished,
+                         [&](float* segment, size_t offset, size_t length) {
+                             kernels.multiply_add(segment, frame + offset,
+                                                  gain, length);
+                         });
+        for_each_segment(accumulated_end, size - accumulated_end,
+                         [&](float* segment, size_t offset, size_t length) {
+                             copy_with_multiply(segment, frame + offset, gain,
+                                                length);
+                         });
+
+        current_pos_ = (current_pos_ + num_finished) & mask_;
+        num_accumulated_ = size - num_finished;
+    }
+
+    /**
+     * Copy `num` finished samples to `dst` and advance the read position. Any
+     * samples past `num_accumulated()` are read as silence.
+     */
+    void read(float* dst, size_t num) noexcept {
+        jassert(num <= frame_size());
+
+        const size_t num_to_copy = std::min(num, num_accumulated_);
+        for_each_segment(0, num_to_copy,
+                         [&](float* segment, size_t offset, size_t length) {
+                             std::copy_n(segment, length, dst + offset);
+                         });
+        std::fill_n(dst + num_to_copy, num - num_to_copy, 0.0f);
+
+        current_pos_ = (current_pos_ + num) & mask_;
+        num_accumulated_ -= num_to_copy;
+    }
+
+    /**
+     * Discard all partial sums. The next frame will be overlap-added onto
+     * silence. This does not touch the buffer's contents.
+     */
+    inline void reset() noexcept { num_accumulated_ = 0; }
+
+    /**
+     * Write the read position and the partial sums to `stream`. The stale
+     * samples are always overwritten before they're read, so they're left out.
+     */
+    void write_state(juce::OutputStream& stream) const {
+        stream.writeInt64(static_cast<juce::int64>(frame_size()));
+        stream.writeInt64(static_cast<juce::int64>(current_pos_));
+        stream.writeInt64(static_cast<juce::int64>(num_accumulated_));
+
+        const size_t num_to_end =
+            std::min(num_accumulated_, buffer_.size() - current_pos_);
+        stream.write(&buffer_[current_pos_], num_to_end * sizeof(float));
+        stream.write(buffer_.data(),
+                     (num_accumulated_ - num_to_end) * sizeof(float));
+    }
+
+    /**
+     * Restore the state written by `write_state()`. The buffer needs to have
+     * the same frame size as the one the state was written from.
+     *
+     * @return Whether the state could be restored.
+     */
+    bool read_state(juce::InputStream& stream) {
+        const juce::int64 size = stream.readInt64();
+        const juce::int64 pos = stream.readInt64();
+        const juce::int64 num_accumulated = stream.readInt64();
+        if (size != static_cast<juce::int64>(frame_size()) || pos < 0 ||
+            pos >= size || num_accumulated < 0 || num_accumulated > size) {
+            return false;
+        }
+
+        current_pos_ = static_cast<size_t>(pos);
+        num_accumulated_ = 0;
+        bool success = true;
+        for_each_segment(
+            0, static_cast<size_t>(num_accumulated),
+            [&](float* segment, size_t /*offset*/, size_t length) {
+                const int num_bytes = static_cast<int>(length * sizeof(float));
+                success &= stream.read(segment, num_bytes) == num_bytes;
+            });
+        if (success) {
+            num_accumulated_ = static_cast<size_t>(num_accumulated);
+        }
+
+        return success;
+    }
+
+   private:
+    /**
+     * Call `fn(segment, offset, length)` for the one or two contiguous regions
+     * in `buffer_` that make up the `num` samples starting `offset` samples
+     * after the read position. The callback's `offset` is the segment's
+     * distance from the read position, so it can be used to index into the
+     * frame.
+     */
+    template <typename F>
+    inline void for_each_segment(size_t offset, size_t num, F fn) noexcept {
+        const size_t start = (current_pos_ + offset) & mask_;
+        const size_t num_to_end = std::min(num, buffer_.size() - start);
+        if (num_to_end > 0) {
+            fn(&buffer_[start], offset, num_to_end);
+        }
+        if (num > num_to_end) {
+            fn(&buffer_[0], offset + num_to_end, num - num_to_end);
+        }
+    }
+
+    static inline void copy_with_multiply(float* dst,
+                                          const float* src,
+                                          float gain,
+                                          size_t num) noexcept {
+        juce::FloatVectorOperations::copyWithMultiply(dst, src, gain,
+                                                      static_cast<int>(num));
+    }
+
+    std::vector<float> buffer_;
+    size_t mask_;
+
+    size_t current_pos_ = 0;
+    size_t num_accumulated_ = 0;
+};
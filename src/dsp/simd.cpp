@@ -0,0 +1,227 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "simd.h"
+
+#include <atomic>
+#include <cmath>
+
+#include <juce_core/juce_core.h>
+
+namespace simd {
+
+namespace {
+
+/**
+ * When set, this instruction set will be used instead of the best one
+ * supported by the CPU.
+ */
+constexpr char force_isa_env_var[] = "SPECTRAL_COMPRESSOR_FORCE_ISA";
+
+/**
+ * The instruction sets in order of preference.
+ */
+constexpr Isa preferred_isas[] = {Isa::avx512, Isa::avx2, Isa::neon,
+                                  Isa::sse2, Isa::scalar};
+
+void magnitudes_scalar(const std::complex<float>* bins,
+                       float* out,
+                       size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        const float re = bins[i].real();
+        const float im = bins[i].imag();
+        out[i] = std::sqrt((re * re) + (im * im));
+    }
+}
+
+void multiply_complex_scalar(std::complex<float>* bins,
+                             const float* gains,
+                             size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        bins[i] *= gains[i];
+    }
+}
+
+void multiply_scalar(float* dst, const float* src, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        dst[i] *= src[i];
+    }
+}
+
+void multiply_add_scalar(float* dst,
+                         const float* src,
+                         float gain,
+                         size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        dst[i] += src[i] * gain;
+    }
+}
+
+void box_filter_scalar(const float* src,
+                       float* dst,
+                       double* running_sums,
+                       size_t width,
+                       float scale,
+                       size_t num) {
+    detail::running_sums(src, running_sums, num + width - 1);
+
+    size_t i = 0;
+    for (; i < num; i++) {
+        dst[i] = static_cast<float>(running_sums[i + width] -
+                                    running_sums[i]) *
+                 scale;
+    }
+}
+
+constexpr Kernels scalar{.isa = Isa::scalar,
+                         .magnitudes = magnitudes_scalar,
+                         .multiply_complex = multiply_complex_scalar,
+                         .multiply = multiply_scalar,
+                         .multiply_add = multiply_add_scalar,
+                         .box_filter = box_filter_scalar};
+
+/**
+ * The compiled kernels for `isa`, if any. This does not check whether the CPU
+ * supports them.
+ */
+const Kernels* compiled_kernels(Isa isa) {
+    switch (isa) {
+        case Isa::scalar:
+            return detail::scalar_kernels();
+        case Isa::sse2:
+            return detail::sse2_kernels();
+        case Isa::avx2:
+            return detail::avx2_kernels();
+        case Isa::avx512:
+            return detail::avx512_kernels();
+        case Isa::neon:
+            return detail::neon_kernels();
+    }
+
+    return nullptr;
+}
+
+bool cpu_supports(Isa isa) {
+    switch (isa) {
+        case Isa::scalar:
+            return true;
+        case Isa::sse2:
+            return juce::SystemStats::hasSSE2();
+        case Isa::avx2:
+            return juce::SystemStats::hasAVX2() &&
+                   juce::SystemStats::hasFMA3();
+        case Isa::avx512:
+            return juce::SystemStats::hasAVX512F() &&
+                   juce::SystemStats::hasFMA3();
+        case Isa::neon:
+            // The NEON kernels are only compiled in on AArch64, where NEON is
+            // always available
+            return true;
+    }
+
+    return false;
+}
+
+const Kernels* select_kernels() {
+    const juce::String forced_isa_name =
+        juce::SystemStats::getEnvironmentVariable(force_isa_env_var, "");
+    if (forced_isa_name.isNotEmpty()) {
+        const std::optional<Isa> forced_isa = parse_isa(forced_isa_name);
+        if (forced_isa && is_supported(*forced_isa)) {
+            return compiled_kernels(*forced_isa);
+        }
+
+        juce::Logger::writeToLog(
+            "'" + forced_isa_name + "' from " + force_isa_env_var +
+            " is not supported on this machine, ignoring");
+    }
+
+    for (const Isa isa : preferred_isas) {
+        if (is_supported(isa)) {
+            return compiled_kernels(isa);
+        }
+    }
+
+    // The scalar kernels are always supported
+    jassertfalse;
+    return &scalar;
+}
+
+std::atomic<const Kernels*>& active_kernels() {
+    static std::atomic<const Kernels*> active(select_kernels());
+    return active;
+}
+
+}  // namespace
+
+const Kernels& kernels() {
+    return *active_kernels().load(std::memory_order_relaxed);
+}
+
+bool is_supported(Isa isa) {
+    return compiled_kernels(isa) && cpu_supports(isa);
+}
+
+bool force_isa(Isa isa) {
+    if (!is_supported(isa)) {
+        return false;
+    }
+
+    active_kernels().store(compiled_kernels(isa), std::memory_order_relaxed);
+    return true;
+}
+
+const char* isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::scalar:
+            return "scalar";
+        case Isa::sse2:
+            return "sse2";
+        case Isa::avx2:
+            return "avx2";
+        case Isa::avx512:
+            return "avx512";
+        case Isa::neon:
+            return "neon";
+    }
+
+    return "unknown";
+}
+
+std::optional<Isa> parse_isa(const juce::String& name) {
+    for (const Isa isa : preferred_isas) {
+        if (name.equalsIgnoreCase(isa_name(isa))) {
+            return isa;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void detail::running_sums(const float* src, double* sums, size_t num) {
+    double sum = 0.0;
+    sums[0] = sum;
+    for (size_t i = 0; i < num; i++) {
+        sum += src[i];
+        sums[i + 1] = sum;
+    }
+}
+
+const Kernels* detail::scalar_kernels() {
+    return &scalar;
+}
+
+}  // namespace simd
@@ -0,0 +1,157 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <complex>
+#include <optional>
+
+// This header is included from the translation units compiled with AVX2 and
+// AVX-512 flags, so it should not pull in JUCE
+namespace juce {
+class String;
+}
+
+/**
+ * Runtime dispatched vectorized kernels for our hot loops. Every instruction
+ * set gets its own translation unit that is compiled with the matching
+ * compiler flags (see `CMakeLists.txt`), and the best variant supported by the
+ * CPU gets selected the first time `simd::kernels()` is called. That way a
+ * single binary can use AVX-512 on new machines while still running on
+ * machines that only support SSE2.
+ *
+ * The selection can be overridden by setting the
+ * `SPECTRAL_COMPRESSOR_FORCE_ISA` environment variable to one of the names
+ * returned by `isa_name()`, or by calling `force_isa()`. The variants use
+ * different instructions (the AVX2 and AVX-512 variants use FMA), so their
+ * results are not bit-identical.
+ *
+ * The `simd_*.cpp` files must not call any inline functions defined outside of
+ * the intrinsics headers, like `std::complex`'s operators or `std::sqrt()`.
+ * When the compiler emits an out of line copy of such a function, that copy
+ * would be compiled with the translation unit's instruction set, and the
+ * linker is free to pick it for every other translation unit as well. That
+ * would crash on CPUs without those instructions.
+ */
+namespace simd {
+
+/**
+ * These values are stored in capture files, see `capture_format::FileHeader`,
+ * so existing values should not be changed.
+ */
+enum class Isa { scalar, sse2, avx2, avx512, neon };
+
+/**
+ * The set of kernels for a single instruction set. All pointers may be
+ * unaligned, and the output buffers may not overlap with the inputs unless
+ * noted otherwise.
+ */
+struct Kernels {
+    Isa isa;
+
+    /**
+     * `out[i] = std::abs(bins[i])` for `i` in `[0, num)`. Computed as
+     * `sqrt(re^2 + im^2)` instead of with `std::hypot()`, which is fine for
+     * the values we're dealing with.
+     */
+    void (*magnitudes)(const std::complex<float>* bins, float* out, size_t num);
+    /**
+     * `bins[i] *= gains[i]` for `i` in `[0, num)`.
+     */
+    void (*multiply_complex)(std::complex<float>* bins,
+                             const float* gains,
+                             size_t num);
+    /**
+     * `dst[i] *= src[i]` for `i` in `[0, num)`.
+     */
+    void (*multiply)(float* dst, const float* src, size_t num);
+    /**
+     * `dst[i] += src[i] * gain` for `i` in `[0, num)`.
+     */
+    void (*multiply_add)(float* dst, const float* src, float gain, size_t num);
+    /**
+     * `dst[i] = scale * (src[i] + src[i + 1] + ... + src[i + width - 1])` for
+     * `i` in `[0, num)`, so `src` needs to contain `num + width - 1` values.
+     * With `scale = 1 / width` this is a box filter where `dst[i]` is centered
+     * on `src[i + width / 2]`. Every window sum is computed as the difference
+     * between two of `src`'s running sums, so the cost doesn't depend on
+     * `width`. The running sums are written to `running_sums`, which needs
+     * room for `num + width` values. They're accumulated in double precision
+     * by `detail::running_sums()` for every instruction set, so all variants
+     * produce identical results.
+     */
+    void (*box_filter)(const float* src,
+                       float* dst,
+                       double* running_sums,
+                       size_t width,
+                       float scale,
+                       size_t num);
+};
+
+/**
+ * The kernels for the best instruction set supported by this CPU, or for the
+ * instruction set set through `force_isa()` or the environment variable. This
+ * is cheap to call, but in loops the result should be stored in a local
+ * reference anyways. The first call selects the kernels, so that should not
+ * happen on the audio thread.
+ */
+const Kernels& kernels();
+
+/**
+ * Whether the kernels for `isa` have been compiled into this binary and the CPU
+ * supports them.
+ */
+bool is_supported(Isa isa);
+
+/**
+ * Use the kernels for `isa` from now on. This should only be used for testing
+ * and benchmarking, and it should not be called while audio is being
+ * processed.
+ *
+ * @return False if `isa` is not supported, in which case the selection stays
+ *   unchanged.
+ */
+bool force_isa(Isa isa);
+
+const char* isa_name(Isa isa);
+/**
+ * The inverse of `isa_name()`. Case insensitive.
+ */
+std::optional<Isa> parse_isa(const juce::String& name);
+
+namespace detail {
+
+// These are defined in the `simd_*.cpp` files. They return a null pointer when
+// that file was not compiled with the flags for its instruction set, for
+// instance because we're compiling for a different architecture.
+
+const Kernels* scalar_kernels();
+const Kernels* sse2_kernels();
+const Kernels* avx2_kernels();
+const Kernels* avx512_kernels();
+const Kernels* neon_kernels();
+
+/**
+ * Writes `sums[i] = src[0] + src[1] + ... + src[i - 1]` for `i` in
+ * `[0, num]`, accumulated in double precision. Defined in `simd.cpp` and used
+ * by every variant of `Kernels::box_filter`, so they all use the exact same
+ * running sums.
+ */
+void running_sums(const float* src, double* sums, size_t num);
+
+}  // namespace detail
+
+}  // namespace simd
@@ -0,0 +1,168 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "simd.h"
+
+// MSVC doesn't define `__FMA__`, but `/arch:AVX2` also enables FMA
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+
+#include <immintrin.h>
+
+namespace simd {
+
+// The scalar tails use scalar intrinsics and plain float arithmetic instead of
+// `std::sqrt()`, `std::fma()` and `std::complex`'s operators. See the note in
+// `simd.h`.
+
+namespace {
+
+void magnitudes_avx2(const std::complex<float>* bins,
+                     float* out,
+                     size_t num) {
+    const float* bins_data = reinterpret_cast<const float*>(bins);
+
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        const __m256 a = _mm256_loadu_ps(bins_data + (i * 2));
+        const __m256 b = _mm256_loadu_ps(bins_data + (i * 2) + 8);
+        // The shuffles work within 128-bit lanes, so this results in bins
+        // `[0, 1, 4, 5 | 2, 3, 6, 7]`. That's fixed with a single permute at
+        // the end.
+        const __m256 re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m256 magnitudes =
+            _mm256_sqrt_ps(_mm256_fmadd_ps(re, re, _mm256_mul_ps(im, im)));
+        const __m256 ordered = _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(magnitudes), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(out + i, ordered);
+    }
+
+    for (; i < num; i++) {
+        const __m128 re = _mm_set_ss(bins_data[i * 2]);
+        const __m128 im = _mm_set_ss(bins_data[(i * 2) + 1]);
+        out[i] = _mm_cvtss_f32(
+            _mm_sqrt_ss(_mm_fmadd_ss(re, re, _mm_mul_ss(im, im))));
+    }
+}
+
+void multiply_complex_avx2(std::complex<float>* bins,
+                           const float* gains,
+                           size_t num) {
+    float* bins_data = reinterpret_cast<float*>(bins);
+
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        // Every gain applies to both the real and the imaginary part. The
+        // unpacks work within 128-bit lanes, so the halves need to be
+        // recombined afterwards.
+        const __m256 g = _mm256_loadu_ps(gains + i);
+        const __m256 g_lo = _mm256_unpacklo_ps(g, g);
+        const __m256 g_hi = _mm256_unpackhi_ps(g, g);
+        const __m256 g_first = _mm256_permute2f128_ps(g_lo, g_hi, 0x20);
+        const __m256 g_second = _mm256_permute2f128_ps(g_lo, g_hi, 0x31);
+
+        float* a = bins_data + (i * 2);
+        float* b = bins_data + (i * 2) + 8;
+        _mm256_storeu_ps(a, _mm256_mul_ps(_mm256_loadu_ps(a), g_first));
+        _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_loadu_ps(b), g_second));
+    }
+
+    for (; i < num; i++) {
+        bins_data[i * 2] *= gains[i];
+        bins_data[(i * 2) + 1] *= gains[i];
+    }
+}
+
+void multiply_avx2(float* dst, const float* src, size_t num) {
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(dst + i),
+                                                _mm256_loadu_ps(src + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] *= src[i];
+    }
+}
+
+void multiply_add_avx2(float* dst, const float* src, float gain, size_t num) {
+    const __m256 g = _mm256_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        _mm256_storeu_ps(dst + i,
+                         _mm256_fmadd_ps(_mm256_loadu_ps(src + i), g,
+                                         _mm256_loadu_ps(dst + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = _mm_cvtss_f32(_mm_fmadd_ss(
+            _mm_set_ss(src[i]), _mm_set_ss(gain), _mm_set_ss(dst[i])));
+    }
+}
+
+void box_filter_avx2(const float* src,
+                     float* dst,
+                     double* running_sums,
+                     size_t width,
+                     float scale,
+                     size_t num) {
+    detail::running_sums(src, running_sums, num + width - 1);
+
+    const __m256 s = _mm256_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        const double* lower = running_sums + i;
+        const double* upper = running_sums + i + width;
+        const __m128 first = _mm256_cvtpd_ps(
+            _mm256_sub_pd(_mm256_loadu_pd(upper), _mm256_loadu_pd(lower)));
+        const __m128 second = _mm256_cvtpd_ps(_mm256_sub_pd(
+            _mm256_loadu_pd(upper + 4), _mm256_loadu_pd(lower + 4)));
+        const __m256 sums =
+            _mm256_insertf128_ps(_mm256_castps128_ps256(first), second, 1);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(sums, s));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = static_cast<float>(running_sums[i + width] -
+                                    running_sums[i]) *
+                 scale;
+    }
+}
+
+constexpr Kernels avx2{.isa = Isa::avx2,
+                       .magnitudes = magnitudes_avx2,
+                       .multiply_complex = multiply_complex_avx2,
+                       .multiply = multiply_avx2,
+                       .multiply_add = multiply_add_avx2,
+                       .box_filter = box_filter_avx2};
+
+}  // namespace
+
+const Kernels* detail::avx2_kernels() {
+    return &avx2;
+}
+
+}  // namespace simd
+
+#else
+
+const simd::Kernels* simd::detail::avx2_kernels() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,175 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "simd.h"
+
+// Like with AVX2, MSVC doesn't define `__FMA__`
+#if defined(__AVX512F__) && (defined(__FMA__) || defined(_MSC_VER))
+
+#include <immintrin.h>
+
+namespace simd {
+
+// The scalar tails use scalar intrinsics and plain float arithmetic instead of
+// `std::sqrt()`, `std::fma()` and `std::complex`'s operators. See the note in
+// `simd.h`.
+
+namespace {
+
+void magnitudes_avx512(const std::complex<float>* bins,
+                       float* out,
+                       size_t num) {
+    const float* bins_data = reinterpret_cast<const float*>(bins);
+    // Gather the even (real) and odd (imaginary) elements from two registers
+    const __m512i re_idx =
+        _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26,
+                          28, 30);
+    const __m512i im_idx =
+        _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27,
+                          29, 31);
+
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512 a = _mm512_loadu_ps(bins_data + (i * 2));
+        const __m512 b = _mm512_loadu_ps(bins_data + (i * 2) + 16);
+        const __m512 re = _mm512_permutex2var_ps(a, re_idx, b);
+        const __m512 im = _mm512_permutex2var_ps(a, im_idx, b);
+        _mm512_storeu_ps(
+            out + i,
+            _mm512_sqrt_ps(_mm512_fmadd_ps(re, re, _mm512_mul_ps(im, im))));
+    }
+
+    for (; i < num; i++) {
+        const __m128 re = _mm_set_ss(bins_data[i * 2]);
+        const __m128 im = _mm_set_ss(bins_data[(i * 2) + 1]);
+        out[i] = _mm_cvtss_f32(
+            _mm_sqrt_ss(_mm_fmadd_ss(re, re, _mm_mul_ss(im, im))));
+    }
+}
+
+void multiply_complex_avx512(std::complex<float>* bins,
+                             const float* gains,
+                             size_t num) {
+    float* bins_data = reinterpret_cast<float*>(bins);
+    // Every gain applies to both the real and the imaginary part
+    const __m512i first_idx =
+        _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i second_idx = _mm512_setr_epi32(
+        8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15);
+
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512 g = _mm512_loadu_ps(gains + i);
+        const __m512 g_first = _mm512_permutexvar_ps(first_idx, g);
+        const __m512 g_second = _mm512_permutexvar_ps(second_idx, g);
+
+        float* a = bins_data + (i * 2);
+        float* b = bins_data + (i * 2) + 16;
+        _mm512_storeu_ps(a, _mm512_mul_ps(_mm512_loadu_ps(a), g_first));
+        _mm512_storeu_ps(b, _mm512_mul_ps(_mm512_loadu_ps(b), g_second));
+    }
+
+    for (; i < num; i++) {
+        bins_data[i * 2] *= gains[i];
+        bins_data[(i * 2) + 1] *= gains[i];
+    }
+}
+
+void multiply_avx512(float* dst, const float* src, size_t num) {
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_loadu_ps(dst + i),
+                                                _mm512_loadu_ps(src + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] *= src[i];
+    }
+}
+
+void multiply_add_avx512(float* dst,
+                         const float* src,
+                         float gain,
+                         size_t num) {
+    const __m512 g = _mm512_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        _mm512_storeu_ps(dst + i,
+                         _mm512_fmadd_ps(_mm512_loadu_ps(src + i), g,
+                                         _mm512_loadu_ps(dst + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = _mm_cvtss_f32(_mm_fmadd_ss(
+            _mm_set_ss(src[i]), _mm_set_ss(gain), _mm_set_ss(dst[i])));
+    }
+}
+
+void box_filter_avx512(const float* src,
+                       float* dst,
+                       double* running_sums,
+                       size_t width,
+                       float scale,
+                       size_t num) {
+    detail::running_sums(src, running_sums, num + width - 1);
+
+    const __m512 s = _mm512_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const double* lower = running_sums + i;
+        const double* upper = running_sums + i + width;
+        const __m256 first = _mm512_cvtpd_ps(
+            _mm512_sub_pd(_mm512_loadu_pd(upper), _mm512_loadu_pd(lower)));
+        const __m256 second = _mm512_cvtpd_ps(_mm512_sub_pd(
+            _mm512_loadu_pd(upper + 8), _mm512_loadu_pd(lower + 8)));
+        // Combining two 256-bit float vectors directly would need AVX-512DQ
+        const __m512 sums = _mm512_castpd_ps(
+            _mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(first)),
+                               _mm256_castps_pd(second), 1));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(sums, s));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = static_cast<float>(running_sums[i + width] -
+                                    running_sums[i]) *
+                 scale;
+    }
+}
+
+constexpr Kernels avx512{.isa = Isa::avx512,
+                         .magnitudes = magnitudes_avx512,
+                         .multiply_complex = multiply_complex_avx512,
+                         .multiply = multiply_avx512,
+                         .multiply_add = multiply_add_avx512,
+                         .box_filter = box_filter_avx512};
+
+}  // namespace
+
+const Kernels* detail::avx512_kernels() {
+    return &avx512;
+}
+
+}  // namespace simd
+
+#else
+
+const simd::Kernels* simd::detail::avx512_kernels() {
+    return nullptr;
+}
+
+#endif
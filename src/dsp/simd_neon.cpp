@@ -0,0 +1,142 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "simd.h"
+
+// 32-bit ARM doesn't have vectorized square roots, so we only bother with
+// AArch64 where NEON is always available
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+#include <cmath>
+
+#include <arm_neon.h>
+
+namespace simd {
+
+namespace {
+
+void magnitudes_neon(const std::complex<float>* bins,
+                     float* out,
+                     size_t num) {
+    const float* bins_data = reinterpret_cast<const float*>(bins);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        // This deinterleaves the real and imaginary parts while loading
+        const float32x4x2_t v = vld2q_f32(bins_data + (i * 2));
+        const float32x4_t power =
+            vfmaq_f32(vmulq_f32(v.val[1], v.val[1]), v.val[0], v.val[0]);
+        vst1q_f32(out + i, vsqrtq_f32(power));
+    }
+
+    for (; i < num; i++) {
+        const float re = bins_data[i * 2];
+        const float im = bins_data[(i * 2) + 1];
+        out[i] = std::sqrt(std::fma(re, re, im * im));
+    }
+}
+
+void multiply_complex_neon(std::complex<float>* bins,
+                           const float* gains,
+                           size_t num) {
+    float* bins_data = reinterpret_cast<float*>(bins);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const float32x4_t g = vld1q_f32(gains + i);
+        float32x4x2_t v = vld2q_f32(bins_data + (i * 2));
+        v.val[0] = vmulq_f32(v.val[0], g);
+        v.val[1] = vmulq_f32(v.val[1], g);
+        vst2q_f32(bins_data + (i * 2), v);
+    }
+
+    for (; i < num; i++) {
+        bins_data[i * 2] *= gains[i];
+        bins_data[(i * 2) + 1] *= gains[i];
+    }
+}
+
+void multiply_neon(float* dst, const float* src, size_t num) {
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        vst1q_f32(dst + i, vmulq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] *= src[i];
+    }
+}
+
+void multiply_add_neon(float* dst, const float* src, float gain, size_t num) {
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        vst1q_f32(dst + i,
+                  vfmaq_n_f32(vld1q_f32(dst + i), vld1q_f32(src + i), gain));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = std::fma(src[i], gain, dst[i]);
+    }
+}
+
+void box_filter_neon(const float* src,
+                     float* dst,
+                     double* running_sums,
+                     size_t width,
+                     float scale,
+                     size_t num) {
+    detail::running_sums(src, running_sums, num + width - 1);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const double* lower = running_sums + i;
+        const double* upper = running_sums + i + width;
+        const float32x2_t first =
+            vcvt_f32_f64(vsubq_f64(vld1q_f64(upper), vld1q_f64(lower)));
+        const float32x2_t second = vcvt_f32_f64(
+            vsubq_f64(vld1q_f64(upper + 2), vld1q_f64(lower + 2)));
+        vst1q_f32(dst + i, vmulq_n_f32(vcombine_f32(first, second), scale));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = static_cast<float>(running_sums[i + width] -
+                                    running_sums[i]) *
+                 scale;
+    }
+}
+
+constexpr Kernels neon{.isa = Isa::neon,
+                       .magnitudes = magnitudes_neon,
+                       .multiply_complex = multiply_complex_neon,
+                       .multiply = multiply_neon,
+                       .multiply_add = multiply_add_neon,
+                       .box_filter = box_filter_neon};
+
+}  // namespace
+
+const Kernels* detail::neon_kernels() {
+    return &neon;
+}
+
+}  // namespace simd
+
+#else
+
+const simd::Kernels* simd::detail::neon_kernels() {
+    return nullptr;
+}
+
+#endif
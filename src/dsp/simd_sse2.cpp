@@ -0,0 +1,154 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "simd.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <cmath>
+
+#include <emmintrin.h>
+
+namespace simd {
+
+namespace {
+
+void magnitudes_sse2(const std::complex<float>* bins,
+                     float* out,
+                     size_t num) {
+    const float* bins_data = reinterpret_cast<const float*>(bins);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const __m128 a = _mm_loadu_ps(bins_data + (i * 2));
+        const __m128 b = _mm_loadu_ps(bins_data + (i * 2) + 4);
+        // Deinterleave the real and imaginary parts of four bins
+        const __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 power =
+            _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+        _mm_storeu_ps(out + i, _mm_sqrt_ps(power));
+    }
+
+    for (; i < num; i++) {
+        const float re = bins_data[i * 2];
+        const float im = bins_data[(i * 2) + 1];
+        out[i] = std::sqrt((re * re) + (im * im));
+    }
+}
+
+void multiply_complex_sse2(std::complex<float>* bins,
+                           const float* gains,
+                           size_t num) {
+    float* bins_data = reinterpret_cast<float*>(bins);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        // Every gain applies to both the real and the imaginary part
+        const __m128 g = _mm_loadu_ps(gains + i);
+        const __m128 g_lo = _mm_unpacklo_ps(g, g);
+        const __m128 g_hi = _mm_unpackhi_ps(g, g);
+
+        float* a = bins_data + (i * 2);
+        float* b = bins_data + (i * 2) + 4;
+        _mm_storeu_ps(a, _mm_mul_ps(_mm_loadu_ps(a), g_lo));
+        _mm_storeu_ps(b, _mm_mul_ps(_mm_loadu_ps(b), g_hi));
+    }
+
+    for (; i < num; i++) {
+        bins_data[i * 2] *= gains[i];
+        bins_data[(i * 2) + 1] *= gains[i];
+    }
+}
+
+void multiply_sse2(float* dst, const float* src, size_t num) {
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        _mm_storeu_ps(dst + i,
+                      _mm_mul_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] *= src[i];
+    }
+}
+
+void multiply_add_sse2(float* dst, const float* src, float gain, size_t num) {
+    const __m128 g = _mm_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        _mm_storeu_ps(dst + i,
+                      _mm_add_ps(_mm_loadu_ps(dst + i),
+                                 _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+    }
+
+    for (; i < num; i++) {
+        dst[i] += src[i] * gain;
+    }
+}
+
+void box_filter_sse2(const float* src,
+                     float* dst,
+                     double* running_sums,
+                     size_t width,
+                     float scale,
+                     size_t num) {
+    detail::running_sums(src, running_sums, num + width - 1);
+
+    const __m128 s = _mm_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        const double* lower = running_sums + i;
+        const double* upper = running_sums + i + width;
+        const __m128 first = _mm_cvtpd_ps(
+            _mm_sub_pd(_mm_loadu_pd(upper), _mm_loadu_pd(lower)));
+        const __m128 second = _mm_cvtpd_ps(
+            _mm_sub_pd(_mm_loadu_pd(upper + 2), _mm_loadu_pd(lower + 2)));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_movelh_ps(first, second), s));
+    }
+
+    for (; i < num; i++) {
+        dst[i] = static_cast<float>(running_sums[i + width] -
+                                    running_sums[i]) *
+                 scale;
+    }
+}
+
+constexpr Kernels sse2{.isa = Isa::sse2,
+                       .magnitudes = magnitudes_sse2,
+                       .multiply_complex = multiply_complex_sse2,
+                       .multiply = multiply_sse2,
+                       .multiply_add = multiply_add_sse2,
+                       .box_filter = box_filter_sse2};
+
+}  // namespace
+
+const Kernels* detail::sse2_kernels() {
+    return &sse2;
+}
+
+}  // namespace simd
+
+#else
+
+const simd::Kernels* simd::detail::sse2_kernels() {
+    return nullptr;
+}
+
+#endif
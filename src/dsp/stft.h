@@ -16,15 +16,58 @@
 
 #pragma once
 
+#include <bit>
+#include <complex>
+#include <cstdint>
+#include <cstring>
 #include <span>
 
 #include <juce_dsp/juce_dsp.h>
 
 #include "../ring.h"
+#include "../trace.h"
+#include "fft.h"
+#include "overlap_add.h"
+#include "simd.h"
+
+/**
+ * Storage for the forward transforms computed by `STFT`, so processing the same
+ * input again can skip them. Windows are identified by their position, which is
+ * the number of input samples that came before the window's last hop. The
+ * window at a position doesn't depend on the overlap amount. See
+ * `STFT::set_forward_cache()`.
+ */
+class ForwardTransformCache {
+   public:
+    virtual ~ForwardTransformCache() = default;
+
+    /**
+     * The first `fft_window_size / 2 + 1` bins of the window at `position` for
+     * `channel`, or a null pointer if that window is not cached. Sidechain
+     * channels follow the main channels.
+     */
+    virtual const std::complex<float>* find(uint64_t position,
+                                            size_t channel) = 0;
+    /**
+     * Called for every window that was transformed because `find()` didn't
+     * return anything. The positions are increasing.
+     */
+    virtual void store(uint64_t position,
+                       size_t channel,
+                       const std::complex<float>* bins) = 0;
+};
 
 /**
  * Process an audio source in the frequency domain using the overlap-add method.
  *
+ * Channels that are identical to the first channel, like with dual mono
+ * material, are detected while their input is buffered. Those channels reuse
+ * the first channel's forward transform, and when their processed spectra are
+ * also identical they reuse its inverse transform as well. This is exact, so
+ * processing falls back to transforming every channel as soon as the channels
+ * diverge. The callbacks should treat every channel's data the same way for
+ * this to work.
+ *
  * @tparam with_sidechain Whether to also do a parallel analysis on a sidechain
  *   input source. If this is enabled, then you will be able to analyze an FFT
  *   buffer from a sidechain source before processing the main signal.
@@ -42,22 +85,28 @@ class STFT {
      */
     STFT(size_t num_channels, size_t fft_order)
         : fft_window_size(1 << fft_order),
-          fft_(fft_order),
-          windowing_function_(
-              fft_window_size,
-              juce::dsp::WindowingFunction<float>::WindowingMethod::hann,
-              // TODO: Or should we leave normalization enabled?
-              false),
+          fft_(fft::create_engine(static_cast<int>(fft_order))),
+          window_(fft_window_size),
           // JUCE's FFT class interleaves the real and imaginary numbers, so
-          // this buffer should be twice the window size in size
-          fft_scratch_buffer_(fft_window_size * 2),
-          input_ring_buffers_(num_channels, RingBuffer<float>(fft_window_size)),
-          sidechain_ring_buffers_(with_sidechain ? num_channels : 0,
-                                  with_sidechain
-                                      ? RingBuffer<float>(fft_window_size)
-                                      : RingBuffer<float>()),
-          output_ring_buffers_(num_channels,
-                               RingBuffer<float>(fft_window_size)) {}
+          // every channel's part of this buffer should be twice the window
+          // size in size
+          fft_scratch_buffer_(num_channels * fft_window_size * 2),
+          input_ring_buffers_(num_channels,
+                              PowerOfTwoRingBuffer<float>(fft_window_size)),
+          sidechain_ring_buffers_(
+              with_sidechain ? num_channels : 0,
+              with_sidechain ? PowerOfTwoRingBuffer<float>(fft_window_size)
+                             : PowerOfTwoRingBuffer<float>()),
+          overlap_add_buffers_(num_channels,
+                               OverlapAddBuffer(fft_window_size)),
+          num_identical_samples_(num_channels, 0),
+          shares_output_(num_channels, false) {
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(
+            window_.data(), fft_window_size,
+            juce::dsp::WindowingFunction<float>::WindowingMethod::hann,
+            // TODO: Or should we leave normalization enabled?
+            false);
+    }
 
     /**
      * The latency introduced by this processor, in samples.
@@ -67,9 +116,8 @@ class STFT {
     /**
      * Process audio using a short term Fourier transform. This involves using
      * the input ring buffers to buffer audio, processing that audio in windows,
-     * adding up those windows in the output ring buffers, and then finally
-     * writing those outputs to `buffer`'s outputs. The supplied function can be
-     * used to actually process the data.
+     * and then overlap-adding those windows to `buffer`'s outputs. The supplied
+     * function can be used to actually process the data.
      *
      * @param main_io The current processing cycle's buffers for the main input
      *   and output busses. This should contain an input and an output bus with
@@ -81,39 +129,56 @@ class STFT {
      * @param preprocess_fn A function that receives a window of raw samples
      *   just before the FFT processing. The windowing function will have
      *   already applied at this point.
+     * @param analysis_fn A function that receives every channel's FFT buffer
+     *   before any of them get processed. Can be used for detection that's
+     *   linked across channels.
+     * @param post_analysis_fn A function called after `analysis_fn` has been
+     *   called for every channel and before `process_fn` is called for the
+     *   first channel.
      * @param process_fn A function that receives and modifies an FFT buffer.
      *   The results will be written back to `buffer`'s outputs using the
-     *   overlap-add method at an `fft_window_size` sample delay.
+     *   overlap-add method at an `fft_window_size` sample delay. Only the
+     *   first `fft_window_size / 2 + 1` bins are meaningful, see
+     *   `fft::Engine`.
      * @param postprocess_fn A function that receives raw samples just after the
-     *   FFT processing but before they are added to the output ring buffers.
+     *   FFT processing but before they are overlap-added to the output.
      *   Windowing will have already been applied at this point.
      *
      * @tparam FPreProcess A function of type `void(std::span<float>& fft,
      *   size_t channel)`.
+     * @tparam FAnalysis A function of type `void(const
+     *   std::span<std::complex<float>>& fft, size_t channel)`.
+     * @tparam FPostAnalysis A `void()` function.
      * @tparam FProcess A function of type `void(std::span<std::complex<float>>&
      *   fft, size_t channel)`.
      * @tparam FPostProcess A function of type `void(std::span<float>& fft,
      *   size_t channel)`.
      */
-    template <typename FPreProcess, typename FProcess, typename FPostProcess>
+    template <typename FPreProcess,
+              typename FAnalysis,
+              typename FPostAnalysis,
+              typename FProcess,
+              typename FPostProcess>
     void process(juce::AudioBuffer<float>& main_io,
                  int windowing_overlap_times,
                  float gain,
                  FPreProcess preprocess_fn,
+                 FAnalysis analysis_fn,
+                 FPostAnalysis post_analysis_fn,
                  FProcess process_fn,
                  FPostProcess postprocess_fn) {
-        do_process<false, false>(
+        do_process<false, true>(
             main_io, main_io, windowing_overlap_times, gain, [](auto&, auto) {},
-            []() {}, std::move(preprocess_fn), std::move(process_fn),
+            []() {}, std::move(preprocess_fn), std::move(analysis_fn),
+            std::move(post_analysis_fn), std::move(process_fn),
             std::move(postprocess_fn));
     }
 
     /**
      * Process audio using a short term Fourier transform. This involves using
      * the input ring buffers to buffer audio, processing that audio in windows,
-     * adding up those windows in the output ring buffers, and then finally
-     * writing those outputs to `buffer`'s outputs. The supplied function can be
-     * used to actually process the data.
+     * and then overlap-adding those windows to `buffer`'s outputs. The supplied
+     * function can be used to actually process the data.
      *
      * This version lets you analyze a sidechain signal before processing the
      * main signal.
@@ -129,17 +194,26 @@ class STFT {
      * @param gain Gain to apply to every processed window before adding it to
      *   the output. If set to 1.0, no gain will be added.
      * @param sidechain_fn A function that receives an FFT buffer obtained from
-     *   the sidechain signal that can be used for analysis.
+     *   the sidechain signal that can be used for analysis. Only the first
+     *   `fft_window_size / 2 + 1` bins are meaningful.
      * @param post_sidechain_fn A function called after `sidechain_fn` has been
      *   called for every channel. Can be used to aggregate per-channel data.
      * @param preprocess_fn A function that receives a window of raw samples
      *   just before the FFT processing. The windowing function will have
      *   already applied at this point.
+     * @param analysis_fn A function that receives every channel's FFT buffer
+     *   before any of them get processed. Can be used for detection that's
+     *   linked across channels.
+     * @param post_analysis_fn A function called after `analysis_fn` has been
+     *   called for every channel and before `process_fn` is called for the
+     *   first channel.
      * @param process_fn A function that receives and modifies an FFT buffer.
      *   The results will be written back to `buffer`'s outputs using the
-     *   overlap-add method at an `fft_window_size` sample delay.
+     *   overlap-add method at an `fft_window_size` sample delay. Only the
+     *   first `fft_window_size / 2 + 1` bins are meaningful, see
+     *   `fft::Engine`.
      * @param postprocess_fn A function that receives raw samples just after the
-     *   FFT processing but before they are added to the output ring buffers.
+     *   FFT processing but before they are overlap-added to the output.
      *   Windowing will have already been applied at this point.
      *
      * @tparam FSidechain A function of type `void(const
@@ -147,6 +221,9 @@ class STFT {
      * @tparam FPostSidechain A `void()` function.
      * @tparam FPreProcess A function of type `void(std::span<float>& fft,
      *   size_t channel)`.
+     * @tparam FAnalysis A function of type `void(const
+     *   std::span<std::complex<float>>& fft, size_t channel)`.
+     * @tparam FPostAnalysis A `void()` function.
      * @tparam FProcess A function of type `void(std::span<std::complex<float>>&
      *   fft, size_t channel)`.
      * @tparam FPostProcess A function of type `void(std::span<float>& fft,
@@ -155,6 +232,8 @@ class STFT {
     template <typename FSidechain,
               typename FPostSidechain,
               typename FPreProcess,
+              typename FAnalysis,
+              typename FPostAnalysis,
               typename FProcess,
               typename FPostProcess,
               typename = std::enable_if_t<with_sidechain>>
@@ -165,27 +244,259 @@ class STFT {
                  FSidechain sidechain_fn,
                  FPostSidechain post_sidechain_fn,
                  FPreProcess preprocess_fn,
+                 FAnalysis analysis_fn,
+                 FPostAnalysis post_analysis_fn,
                  FProcess process_fn,
                  FPostProcess postprocess_fn) {
-        do_process<false, true>(main_io, sidechain_io, windowing_overlap_times,
-                                gain, std::move(sidechain_fn),
-                                std::move(post_sidechain_fn),
-                                std::move(preprocess_fn), std::move(process_fn),
-                                std::move(postprocess_fn));
+        do_process<true, true>(
+            main_io, sidechain_io, windowing_overlap_times, gain,
+            std::move(sidechain_fn), std::move(post_sidechain_fn),
+            std::move(preprocess_fn), std::move(analysis_fn),
+            std::move(post_analysis_fn), std::move(process_fn),
+            std::move(postprocess_fn));
+    }
+
+    /**
+     * Run the same analysis as `process()`, but without resynthesizing the
+     * signal. The inverse transforms, the synthesis windowing, and the
+     * overlap-add are skipped entirely, and `main_io` is left untouched. This
+     * is meant for offline analysis where only the spectra and the gains are
+     * needed. The overlap-add buffers are not kept up to date, so the next
+     * call to `process()` fades in over a single window like it would after a
+     * reset.
+     *
+     * @param process_fn A function that receives every channel's FFT buffer
+     *   after `post_analysis_fn`, like with `process()`. Any changes made to
+     *   the buffer are discarded.
+     *
+     * See `process()` for the other arguments.
+     */
+    template <typename FPreProcess,
+              typename FAnalysis,
+              typename FPostAnalysis,
+              typename FProcess>
+    void analyze(juce::AudioBuffer<float>& main_io,
+                 int windowing_overlap_times,
+                 FPreProcess preprocess_fn,
+                 FAnalysis analysis_fn,
+                 FPostAnalysis post_analysis_fn,
+                 FProcess process_fn) {
+        do_process<false, false>(
+            main_io, main_io, windowing_overlap_times, 1.0f,
+            [](auto&, auto) {}, []() {}, std::move(preprocess_fn),
+            std::move(analysis_fn), std::move(post_analysis_fn),
+            std::move(process_fn), [](auto&, auto) {});
+    }
+
+    /**
+     * The same as the other `analyze()` overload, but with a sidechain input.
+     * See the sidechain version of `process()` for the arguments.
+     */
+    template <typename FSidechain,
+              typename FPostSidechain,
+              typename FPreProcess,
+              typename FAnalysis,
+              typename FPostAnalysis,
+              typename FProcess,
+              typename = std::enable_if_t<with_sidechain>>
+    void analyze(juce::AudioBuffer<float>& main_io,
+                 const juce::AudioBuffer<float>& sidechain_io,
+                 int windowing_overlap_times,
+                 FSidechain sidechain_fn,
+                 FPostSidechain post_sidechain_fn,
+                 FPreProcess preprocess_fn,
+                 FAnalysis analysis_fn,
+                 FPostAnalysis post_analysis_fn,
+                 FProcess process_fn) {
+        do_process<true, false>(
+            main_io, sidechain_io, windowing_overlap_times, 1.0f,
+            std::move(sidechain_fn), std::move(post_sidechain_fn),
+            std::move(preprocess_fn), std::move(analysis_fn),
+            std::move(post_analysis_fn), std::move(process_fn),
+            [](auto&, auto) {});
     }
 
     /**
      * Don't do any processing, but still keep the same amount of latency as if
-     * we were calling `process()`.
+     * we were calling `process()`. Since the input ring buffers are exactly one
+     * window long, swapping the input with their contents delays it by the
+     * right amount. The partial sums in the overlap-add buffers are discarded,
+     * so when processing resumes the output fades in over a single window like
+     * it would after a reset.
      *
      * @param main_io The current processing cycle's buffers for the main input
      *   and output busses. This should contain an input and an output bus with
      *   an equal number of channels for each bus.
      */
     void process_bypassed(juce::AudioBuffer<float>& main_io) {
-        do_process<true, false>(
-            main_io, main_io, 1, 1.0f, [](auto&, auto) {}, []() {},
-            [](auto&, auto) {}, [](auto&, auto) {}, [](auto&, auto) {});
+        TRACE_ZONE("STFT::process_bypassed");
+
+        const size_t num_samples = static_cast<size_t>(main_io.getNumSamples());
+        track_identical_input(main_io, 0, num_samples);
+        for (size_t channel = 0;
+             channel < static_cast<size_t>(main_io.getNumChannels());
+             channel++) {
+            float* channel_io = main_io.getWritePointer(channel);
+            // The ring buffers can only swap up to their size at a time
+            for (size_t offset = 0; offset < num_samples;
+                 offset += fft_window_size) {
+                input_ring_buffers_[channel].swap_n_with(
+                    channel_io + offset,
+                    std::min(fft_window_size, num_samples - offset));
+            }
+
+            overlap_add_buffers_[channel].reset();
+        }
+
+        num_input_samples_ += num_samples;
+    }
+
+    /**
+     * The FFT backend used by this processor.
+     */
+    inline fft::Backend fft_backend() const { return fft_->backend(); }
+
+    /**
+     * Look up the forward transforms in `cache` before computing them, and
+     * store the ones that had to be computed. Pass a null pointer to stop
+     * using the cache. The positions passed to the cache start at zero when
+     * this object is created, so the cache should only be used for objects
+     * that have been processing the cached input from its start. The cached
+     * spectra are used as is, so `preprocess_fn` is not called for them.
+     */
+    inline void set_forward_cache(ForwardTransformCache* cache) {
+        forward_cache_ = cache;
+    }
+    inline ForwardTransformCache* forward_cache() const {
+        return forward_cache_;
+    }
+
+    /**
+     * The total number of input samples processed since this object was
+     * created.
+     */
+    inline uint64_t num_input_samples() const { return num_input_samples_; }
+
+    /**
+     * Write everything that carries over between processing cycles to
+     * `stream`: the ring buffers and overlap-add buffers, which also determine
+     * where the next hop starts, and the number of windows and samples
+     * processed so far. Processing can later be resumed from this point with
+     * `read_state()`.
+     */
+    void write_state(juce::OutputStream& stream) const {
+        stream.writeInt64(static_cast<juce::int64>(input_ring_buffers_.size()));
+        stream.writeInt64(static_cast<juce::int64>(fft_window_size));
+        stream.writeInt(num_windows_processed_);
+        stream.writeBool(overlap_add_stale_);
+        stream.writeInt64(static_cast<juce::int64>(num_input_samples_));
+        for (const auto& ring_buffers :
+             {&input_ring_buffers_, &sidechain_ring_buffers_}) {
+            for (const auto& ring_buffer : *ring_buffers) {
+                ring_buffer.write_state(stream);
+            }
+        }
+        for (const auto& overlap_add_buffer : overlap_add_buffers_) {
+            overlap_add_buffer.write_state(stream);
+        }
+        for (const size_t num_identical : num_identical_samples_) {
+            stream.writeInt64(static_cast<juce::int64>(num_identical));
+        }
+    }
+
+    /**
+     * Restore the state written by `write_state()` for an STFT with the same
+     * number of channels and the same window size.
+     *
+     * @return Whether the state could be restored. If this returns false, the
+     *   object's state is unspecified.
+     */
+    bool read_state(juce::InputStream& stream) {
+        if (stream.readInt64() !=
+                static_cast<juce::int64>(input_ring_buffers_.size()) ||
+            stream.readInt64() != static_cast<juce::int64>(fft_window_size)) {
+            return false;
+        }
+
+        num_windows_processed_ = stream.readInt();
+        overlap_add_stale_ = stream.readBool();
+        num_input_samples_ = static_cast<uint64_t>(stream.readInt64());
+        for (auto* ring_buffers :
+             {&input_ring_buffers_, &sidechain_ring_buffers_}) {
+            for (auto& ring_buffer : *ring_buffers) {
+                if (!ring_buffer.read_state(stream)) {
+                    return false;
+                }
+            }
+        }
+        for (auto& overlap_add_buffer : overlap_add_buffers_) {
+            if (!overlap_add_buffer.read_state(stream)) {
+                return false;
+            }
+        }
+        for (size_t& num_identical : num_identical_samples_) {
+            num_identical = std::min(static_cast<size_t>(stream.readInt64()),
+                                     fft_window_size);
+        }
+
+        return true;
+    }
+
+    /**
+     * The memory held by the input and sidechain ring buffers and the
+     * overlap-add buffers in bytes.
+     */
+    size_t ring_buffer_memory_usage() const {
+        size_t total = 0;
+        for (const auto& ring_buffers :
+             {&input_ring_buffers_, &sidechain_ring_buffers_}) {
+            for (const auto& ring_buffer : *ring_buffers) {
+                total += ring_buffer.memory_usage();
+            }
+        }
+        for (const auto& overlap_add_buffer : overlap_add_buffers_) {
+            total += overlap_add_buffer.memory_usage();
+        }
+
+        return total;
+    }
+
+    /**
+     * The memory held by the FFT scratch buffers in bytes.
+     */
+    size_t scratch_buffer_memory_usage() const {
+        return fft_scratch_buffer_.capacity() * sizeof(float);
+    }
+
+    /**
+     * The memory used by an STFT processor's ring buffers for the given
+     * settings, in bytes. This matches `ring_buffer_memory_usage()` for a newly
+     * created object.
+     */
+    static size_t estimate_ring_buffer_memory_usage(size_t num_channels,
+                                                    size_t fft_window_size) {
+        return (with_sidechain ? 3 : 2) * num_channels * fft_window_size *
+               sizeof(float);
+    }
+
+    /**
+     * The memory used by an STFT processor's scratch buffers for the given
+     * settings, in bytes.
+     */
+    static size_t estimate_scratch_buffer_memory_usage(size_t num_channels,
+                                                       size_t fft_window_size) {
+        return num_channels * fft_window_size * 2 * sizeof(float);
+    }
+
+    /**
+     * An estimate of the memory used by the FFT plan and windowing table for
+     * the given window size, in bytes. Both JUCE's fallback FFT and FFTW
+     * precompute twiddle factors for the forward and the inverse transforms,
+     * and the windowing function stores its table.
+     */
+    static size_t estimate_fft_memory_usage(size_t fft_window_size) {
+        return (2 * fft_window_size * sizeof(std::complex<float>)) +
+               (fft_window_size * sizeof(float));
     }
 
     /**
@@ -196,17 +507,20 @@ class STFT {
    private:
     /**
      * Depending on `with_sidechain`, there are a few different ways to process
-     * a buffer. To avoid duplication, this function has two `bypassed` and
-     * `sidechain_active` template constants that control the order through this
-     * function. These booleans control whether we do any FFT operations at all,
-     * and whether we touch the read from the sidechain input and call the
-     * sidechain analysis functions.
-     */
-    template <bool bypassed,
-              bool sidechain_active,
+     * a buffer. To avoid duplication, this function has a `sidechain_active`
+     * template constant that controls whether we read from the sidechain input
+     * and call the sidechain analysis functions, and a `synthesize` template
+     * constant that controls whether the processed spectra are transformed
+     * back and written to `main_io`. `main_io` is only read from when
+     * `synthesize` is false.
+     */
+    template <bool sidechain_active,
+              bool synthesize,
               typename FSidechain,
               typename FPostSidechain,
               typename FPreProcess,
+              typename FAnalysis,
+              typename FPostAnalysis,
               typename FProcess,
               typename FPostProcess>
     void do_process(
@@ -217,9 +531,27 @@ class STFT {
         [[maybe_unused]] FSidechain sidechain_fn,
         [[maybe_unused]] FPostSidechain post_sidechain_fn,
         FPreProcess preprocess_fn,
+        FAnalysis analysis_fn,
+        FPostAnalysis post_analysis_fn,
         FProcess process_fn,
         FPostProcess postprocess_fn) {
+        TRACE_ZONE("STFT::do_process");
         juce::ScopedNoDenormals noDenormals;
+        const simd::Kernels& kernels = simd::kernels();
+
+        // After analyzing without resynthesis the overlap-add buffers are
+        // stale, so the output starts over like after a reset
+        if constexpr (synthesize) {
+            if (overlap_add_stale_) {
+                for (auto& overlap_add_buffer : overlap_add_buffers_) {
+                    overlap_add_buffer.reset();
+                }
+                num_windows_processed_ = 0;
+                overlap_add_stale_ = false;
+            }
+        } else {
+            overlap_add_stale_ = true;
+        }
 
         const size_t num_channels =
             static_cast<size_t>(main_io.getNumChannels());
@@ -234,7 +566,7 @@ class STFT {
         // We'll process audio in lockstep to make it easier to use processors
         // that require lookahead and thus induce latency. Every this many
         // samples we'll process a new window of input samples. The results will
-        // be added to the output ring buffers.
+        // be overlap-added to the output.
         const size_t windowing_interval =
             fft_window_size / static_cast<size_t>(windowing_overlap_times);
 
@@ -256,19 +588,23 @@ class STFT {
         // actual audio input and output
         size_t sample_buffer_offset = 0;
 
-        // Copying from the input buffer to our input ring buffer, copying from
-        // our output ring buffer to the output buffer, and clearing the output
-        // buffer to prevent feedback is always done in sync
+        // Copying from the input buffer to our input ring buffer, writing the
+        // finished output samples to the output buffer, and clearing the
+        // output buffer while we're still filling up the first window is
+        // always done in sync. The input always needs to be read before the
+        // output is written since they share the same buffer.
         if (already_processed_samples > 0) {
+            track_identical_input(main_io, 0, already_processed_samples);
             for (size_t channel = 0; channel < num_channels; channel++) {
                 input_ring_buffers_[channel].read_n_from(
                     main_io.getReadPointer(channel), already_processed_samples);
-                if (num_windows_processed_ >= windowing_overlap_times) {
-                    output_ring_buffers_[channel].copy_n_to(
+                if constexpr (synthesize) {
+                    overlap_add_buffers_[channel].read(
                         main_io.getWritePointer(channel),
-                        already_processed_samples, true);
-                } else {
-                    main_io.clear(channel, 0, already_processed_samples);
+                        already_processed_samples);
+                    if (num_windows_processed_ < windowing_overlap_times) {
+                        main_io.clear(channel, 0, already_processed_samples);
+                    }
                 }
                 if constexpr (sidechain_active) {
                     sidechain_ring_buffers_[channel].read_n_from(
@@ -278,28 +614,41 @@ class STFT {
             }
 
             sample_buffer_offset += already_processed_samples;
+            num_input_samples_ += already_processed_samples;
         }
 
         // Now if `windows_to_process > 0`, the current ring buffer position
         // will align with a window and we can start doing our FFT magic
         for (int window_idx = 0; window_idx < windows_to_process;
              window_idx++) {
-            if constexpr (sidechain_active && !bypassed) {
+            const size_t samples_to_process_this_iteration = std::min(
+                windowing_interval, num_samples - sample_buffer_offset);
+
+            if constexpr (sidechain_active) {
                 // The sidechain input is only used for analysis
                 for (size_t channel = 0; channel < num_channels; channel++) {
-                    sidechain_ring_buffers_[channel].copy_last_n_to(
-                        fft_scratch_buffer_.data(), fft_window_size);
-                    windowing_function_.multiplyWithWindowingTable(
-                        fft_scratch_buffer_.data(), fft_window_size);
-                    // TODO: We can skip negative frequencies here, right?
-                    fft_.performRealOnlyForwardTransform(
-                        fft_scratch_buffer_.data(), true);
-
+                    TRACE_ZONE_ARG("STFT::sidechain_window", "channel",
+                                   channel);
                     const std::span<std::complex<float>> fft_buffer(
                         reinterpret_cast<std::complex<float>*>(
                             fft_scratch_buffer_.data()),
                         fft_window_size);
+                    if (!read_forward_cache(num_channels + channel,
+                                            fft_scratch_buffer_.data())) {
+                        sidechain_ring_buffers_[channel].copy_last_n_to(
+                            fft_scratch_buffer_.data(), fft_window_size);
+                        kernels.multiply(fft_scratch_buffer_.data(),
+                                         window_.data(), fft_window_size);
+                        fft_->forward(fft_scratch_buffer_.data());
+                        write_forward_cache(num_channels + channel,
+                                            fft_buffer.data());
+                    }
                     sidechain_fn(fft_buffer, channel);
+
+                    sidechain_ring_buffers_[channel].read_n_from(
+                        sidechain_io.getReadPointer(channel) +
+                            sample_buffer_offset,
+                        samples_to_process_this_iteration);
                 }
 
                 // The user might want to do some aggregation after processing
@@ -307,132 +656,284 @@ class STFT {
                 post_sidechain_fn();
             }
 
-            // This is where the magic happens!
-            for (size_t channel = 0; channel < num_channels; channel++) {
-                if constexpr (!bypassed) {
-                    // Depending on what stage of the transformation process
-                    // we're in, our scratch buffer will contain either samples
-                    // or complex frequency bins. The caller should get a chance
-                    // to preprocess the (windowed) samples, process the
-                    // transformed data, and the postprocess the results after
-                    // the windowing function has been applied after the inverse
-                    // transformation.
-                    std::span<float> sample_buffer(fft_scratch_buffer_.data(),
-                                                   fft_window_size);
-                    std::span<std::complex<float>> fft_buffer(
-                        reinterpret_cast<std::complex<float>*>(
-                            fft_scratch_buffer_.data()),
-                        fft_window_size);
+            // We don't copy over anything to the outputs until we processed a
+            // full buffer
+            num_windows_processed_ += 1;
 
+            // This is where the magic happens! Every channel is transformed
+            // first so the caller gets to analyze all of them before any
+            // channel gets processed. Every channel has its own part of the
+            // scratch buffer for this.
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                TRACE_ZONE_ARG("STFT::forward", "channel", channel);
+
+                // Depending on what stage of the transformation process we're
+                // in, our scratch buffer will contain either samples or
+                // complex frequency bins. The caller should get a chance to
+                // preprocess the (windowed) samples, analyze and process the
+                // transformed data, and the postprocess the results after the
+                // windowing function has been applied after the inverse
+                // transformation.
+                float* scratch_buffer = channel_scratch_buffer(channel);
+                std::span<float> sample_buffer(scratch_buffer, fft_window_size);
+                const std::span<std::complex<float>> fft_buffer(
+                    reinterpret_cast<std::complex<float>*>(scratch_buffer),
+                    fft_window_size);
+
+                // When this channel's entire window is identical to the first
+                // channel's, then so is its spectrum
+                if (channel > 0 &&
+                    num_identical_samples_[channel] >= fft_window_size) {
+                    std::copy_n(channel_scratch_buffer(0),
+                                num_meaningful_values(), scratch_buffer);
+                    write_forward_cache(channel, fft_buffer.data());
+                } else if (!read_forward_cache(channel, scratch_buffer)) {
                     input_ring_buffers_[channel].copy_last_n_to(
-                        fft_scratch_buffer_.data(), fft_window_size);
-                    windowing_function_.multiplyWithWindowingTable(
-                        fft_scratch_buffer_.data(), fft_window_size);
+                        scratch_buffer, fft_window_size);
+                    kernels.multiply(scratch_buffer, window_.data(),
+                                     fft_window_size);
                     preprocess_fn(sample_buffer, channel);
 
-                    fft_.performRealOnlyForwardTransform(
-                        fft_scratch_buffer_.data());
-                    process_fn(fft_buffer, channel);
-
-                    fft_.performRealOnlyInverseTransform(
-                        fft_scratch_buffer_.data());
-                    windowing_function_.multiplyWithWindowingTable(
-                        fft_scratch_buffer_.data(), fft_window_size);
-                    postprocess_fn(sample_buffer, channel);
-
-                    // After processing the windowed data, we'll add it to our
-                    // output ring buffer with any (automatic) makeup gain
-                    // applied
-                    output_ring_buffers_[channel].add_n_from_in_place(
-                        fft_scratch_buffer_.data(), fft_window_size, gain);
-                } else {
-                    // TODO: Implement the bypass to copy directly between the
-                    //       ring buffers instead of going through the scratch
-                    //       buffer
-                    input_ring_buffers_[channel].copy_last_n_to(
-                        fft_scratch_buffer_.data(), windowing_interval);
-                    output_ring_buffers_[channel].read_n_from_in_place(
-                        fft_scratch_buffer_.data(), windowing_interval);
+                    fft_->forward(scratch_buffer);
+                    write_forward_cache(channel, fft_buffer.data());
                 }
+
+                analysis_fn(fft_buffer, channel);
             }
 
-            // We don't copy over anything to the outputs until we processed a
-            // full buffer
-            num_windows_processed_ += 1;
+            // The input for this hop gets overwritten with the output below,
+            // so it needs to be compared now
+            track_identical_input(main_io, sample_buffer_offset,
+                                  samples_to_process_this_iteration);
+
+            post_analysis_fn();
 
-            // Copy the input audio into our ring buffer and copy the processed
-            // audio into the output buffer
-            const size_t samples_to_process_this_iteration = std::min(
-                windowing_interval, num_samples - sample_buffer_offset);
             for (size_t channel = 0; channel < num_channels; channel++) {
+                TRACE_ZONE_ARG("STFT::process", "channel", channel);
+
+                std::span<std::complex<float>> fft_buffer(
+                    reinterpret_cast<std::complex<float>*>(
+                        channel_scratch_buffer(channel)),
+                    fft_window_size);
+                process_fn(fft_buffer, channel);
+            }
+
+            // Without resynthesis the input only needs to be buffered for the
+            // next window
+            if constexpr (!synthesize) {
+                for (size_t channel = 0; channel < num_channels; channel++) {
+                    input_ring_buffers_[channel].read_n_from(
+                        main_io.getReadPointer(channel) + sample_buffer_offset,
+                        samples_to_process_this_iteration);
+                }
+
+                sample_buffer_offset += samples_to_process_this_iteration;
+                num_input_samples_ += samples_to_process_this_iteration;
+                continue;
+            }
+
+            // Channels that ended up with the same spectrum as the first
+            // channel don't need their own inverse transform. This needs to be
+            // checked before the first channel's buffer gets transformed.
+            for (size_t channel = 1; channel < num_channels; channel++) {
+                shares_output_[channel] =
+                    std::memcmp(channel_scratch_buffer(channel),
+                                channel_scratch_buffer(0),
+                                num_meaningful_values() * sizeof(float)) == 0;
+            }
+
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                TRACE_ZONE_ARG("STFT::window", "channel", channel);
+
+                float* scratch_buffer = channel_scratch_buffer(channel);
+                if (shares_output_[channel]) {
+                    std::copy_n(channel_scratch_buffer(0), fft_window_size,
+                                scratch_buffer);
+                } else {
+                    fft_->inverse(scratch_buffer);
+                    kernels.multiply(scratch_buffer, window_.data(),
+                                     fft_window_size);
+                }
+            }
+
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                float* scratch_buffer = channel_scratch_buffer(channel);
+                std::span<float> sample_buffer(scratch_buffer, fft_window_size);
+                postprocess_fn(sample_buffer, channel);
+
+                // This window has been analyzed, so we can now read the next
+                // hop of input audio. The processed window is then
+                // overlap-added with any (automatic) makeup gain applied, and
+                // the samples that are now finished are written directly to
+                // the output buffer.
+                float* channel_io =
+                    main_io.getWritePointer(channel) + sample_buffer_offset;
                 input_ring_buffers_[channel].read_n_from(
-                    main_io.getReadPointer(channel) + sample_buffer_offset,
+                    channel_io, samples_to_process_this_iteration);
+                overlap_add_buffers_[channel].add_frame(
+                    scratch_buffer, gain, channel_io,
                     samples_to_process_this_iteration);
-                if (num_windows_processed_ >= windowing_overlap_times) {
-                    output_ring_buffers_[channel].copy_n_to(
-                        main_io.getWritePointer(channel) + sample_buffer_offset,
-                        samples_to_process_this_iteration, true);
-                } else {
+                if (num_windows_processed_ < windowing_overlap_times) {
                     main_io.clear(channel, sample_buffer_offset,
                                   samples_to_process_this_iteration);
                 }
-                if constexpr (sidechain_active) {
-                    sidechain_ring_buffers_[channel].read_n_from(
-                        sidechain_io.getReadPointer(channel) +
-                            sample_buffer_offset,
-                        samples_to_process_this_iteration);
-                }
             }
 
             sample_buffer_offset += samples_to_process_this_iteration;
+            num_input_samples_ += samples_to_process_this_iteration;
         }
 
         jassert(sample_buffer_offset == num_samples);
     }
 
+    /**
+     * The part of `fft_scratch_buffer_` for a channel.
+     */
+    inline float* channel_scratch_buffer(size_t channel) {
+        return fft_scratch_buffer_.data() + (channel * fft_window_size * 2);
+    }
+
+    /**
+     * The number of floats in a channel's scratch buffer that make up the
+     * first `fft_window_size / 2 + 1` bins after a forward transform.
+     */
+    inline size_t num_meaningful_values() const { return fft_window_size + 2; }
+
+    /**
+     * Copy the cached forward transform for the current window on `channel`
+     * to `scratch_buffer`, if there is one.
+     *
+     * @return Whether the window was cached.
+     */
+    inline bool read_forward_cache(size_t channel, float* scratch_buffer) {
+        if (!forward_cache_) {
+            return false;
+        }
+
+        const std::complex<float>* bins =
+            forward_cache_->find(num_input_samples_, channel);
+        if (!bins) {
+            return false;
+        }
+
+        std::copy_n(reinterpret_cast<const float*>(bins),
+                    num_meaningful_values(), scratch_buffer);
+        return true;
+    }
+
+    /**
+     * Store the forward transform for the current window on `channel` in the
+     * cache, if there is one.
+     */
+    inline void write_forward_cache(size_t channel,
+                                    const std::complex<float>* bins) {
+        if (forward_cache_) {
+            forward_cache_->store(num_input_samples_, channel, bins);
+        }
+    }
+
+    /**
+     * Update `num_identical_samples_` for the `num` samples starting at
+     * `offset` in `main_io` that are about to be added to the input ring
+     * buffers. The samples are compared bit for bit.
+     */
+    void track_identical_input(const juce::AudioBuffer<float>& main_io,
+                               size_t offset,
+                               size_t num) {
+        const float* reference = main_io.getReadPointer(0) + offset;
+        for (size_t channel = 1; channel < num_identical_samples_.size();
+             channel++) {
+            const float* samples = main_io.getReadPointer(channel) + offset;
+
+            // Only the samples after the last mismatch are identical
+            size_t num_trailing = 0;
+            while (num_trailing < num &&
+                   std::bit_cast<uint32_t>(samples[num - 1 - num_trailing]) ==
+                       std::bit_cast<uint32_t>(
+                           reference[num - 1 - num_trailing])) {
+                num_trailing++;
+            }
+
+            num_identical_samples_[channel] =
+                num_trailing == num
+                    ? std::min(num_identical_samples_[channel] + num,
+                               fft_window_size)
+                    : num_trailing;
+        }
+    }
+
     /**
      * The numbers of windows already processed. We use this to reduce clicks by
      * not copying over audio to the output during the first
      * `windowing_overlap_times` windows.
      */
     int num_windows_processed_ = 0;
+    /**
+     * Set by `analyze()`, since that doesn't update the overlap-add buffers.
+     * The next call to `process()` then resets them.
+     */
+    bool overlap_add_stale_ = false;
+    /**
+     * The number of input samples processed so far. Used as the position for
+     * `forward_cache_`.
+     */
+    uint64_t num_input_samples_ = 0;
+    /**
+     * Set through `set_forward_cache()`.
+     */
+    ForwardTransformCache* forward_cache_ = nullptr;
 
     /**
-     * The FFT processor.
+     * The FFT processor. The backend is chosen by `fft::create_engine()`.
      */
-    juce::dsp::FFT fft_;
+    std::unique_ptr<fft::Engine> fft_;
 
     /**
      * We'll process the signal with overlapping windows that are added to each
      * other to form the output signal. See `input_ring_buffers` for more
-     * information on how we'll do this.
+     * information on how we'll do this. This is a Hann window without
+     * normalization. We apply it ourselves using `simd::kernels()` instead of
+     * through `juce::dsp::WindowingFunction`.
      */
-    juce::dsp::WindowingFunction<float> windowing_function_;
+    std::vector<float> window_;
 
     /**
      * We need a scratch buffer that can contain `fft_window_size * 2` samples
-     * for `fft` to work in.
+     * for every channel for `fft` to work in. See `channel_scratch_buffer()`.
      */
     std::vector<float> fft_scratch_buffer_;
 
     /**
      * A ring buffer of size `fft_window_size` for every channel. Every
      * `windowing_interval` we'll copy the last `fft_window_size` samples to
-     * `fft_scratch_buffers` using a window function, process it, and then add
-     * the results to `output_ring_buffers`.
+     * `fft_scratch_buffers` using a window function, process it, and then
+     * overlap-add the results using `overlap_add_buffers`.
      */
-    std::vector<RingBuffer<float>> input_ring_buffers_;
+    std::vector<PowerOfTwoRingBuffer<float>> input_ring_buffers_;
     /**
      * These ring buffers are identical to `input_ring_buffers`, but with data
      * from the sidechain input. When sidechaining is enabled, we set the
      * compressor thresholds based on the magnitudes from the same FFT analysis
      * applied to the sidechain input.
      */
-    std::vector<RingBuffer<float>> sidechain_ring_buffers_;
+    std::vector<PowerOfTwoRingBuffer<float>> sidechain_ring_buffers_;
+    /**
+     * The unfinished tails of the processed windows as described in the
+     * docstring of `input_ring_buffers`. Finished samples are written directly
+     * to the output buffer.
+     */
+    std::vector<OverlapAddBuffer> overlap_add_buffers_;
+
+    /**
+     * For every channel, how many of the most recent samples in its input
+     * ring buffer are identical to the first channel's, up to
+     * `fft_window_size`. The first channel's entry is unused.
+     */
+    std::vector<size_t> num_identical_samples_;
     /**
-     * The processed results as described in the docstring of
-     * `input_ring_buffers`. Samples from this buffer will be written to the
-     * output.
+     * For every channel, whether its processed spectrum during the current
+     * window is identical to the first channel's. The first channel's entry
+     * is unused.
      */
-    std::vector<RingBuffer<float>> output_ring_buffers_;
+    std::vector<bool> shares_output_;
 };
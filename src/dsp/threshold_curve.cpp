@@ -0,0 +1,167 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "threshold_curve.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace {
+
+constexpr char breakpoint_type[] = "Breakpoint";
+constexpr char frequency_property[] = "frequency";
+constexpr char threshold_property[] = "threshold";
+
+/**
+ * The position of `frequency` on the scale the curve is interpolated on. This
+ * starts at 1 for 0 Hz (DC).
+ */
+float curve_position(float frequency) {
+    return std::log2(frequency + 2.0f);
+}
+
+}  // namespace
+
+ThresholdCurve::ThresholdCurve()
+    : ThresholdCurve(std::vector<Breakpoint>{}) {}
+
+ThresholdCurve::ThresholdCurve(std::vector<Breakpoint> breakpoints)
+    : breakpoints_(std::move(breakpoints)) {
+    if (breakpoints_.empty()) {
+        // A straight line on this scale, so two breakpoints covering every
+        // sample rate we support are enough. The 3 dB is to compensate for
+        // bin 0.
+        constexpr float base_threshold_dbfs = 0.0f;
+        constexpr float max_frequency = 96000.0f;
+        breakpoints_ = {
+            Breakpoint{.frequency = 0.0f,
+                       .threshold_db = (base_threshold_dbfs + 3.0f) -
+                                       (3.0f * curve_position(0.0f))},
+            Breakpoint{.frequency = max_frequency,
+                       .threshold_db = (base_threshold_dbfs + 3.0f) -
+                                       (3.0f * curve_position(max_frequency))}};
+    }
+
+    for (Breakpoint& breakpoint : breakpoints_) {
+        breakpoint.frequency = std::max(breakpoint.frequency, 0.0f);
+    }
+    std::stable_sort(breakpoints_.begin(), breakpoints_.end(),
+                     [](const Breakpoint& a, const Breakpoint& b) {
+                         return a.frequency < b.frequency;
+                     });
+}
+
+ThresholdCurve ThresholdCurve::from_value_tree(const juce::ValueTree& tree) {
+    if (!tree.isValid() || !tree.hasType(value_tree_type)) {
+        return ThresholdCurve();
+    }
+
+    std::vector<Breakpoint> breakpoints;
+    for (const juce::ValueTree& child : tree) {
+        if (child.hasType(breakpoint_type) &&
+            child.hasProperty(frequency_property) &&
+            child.hasProperty(threshold_property)) {
+            breakpoints.push_back(Breakpoint{
+                .frequency =
+                    static_cast<float>(child.getProperty(frequency_property)),
+                .threshold_db =
+                    static_cast<float>(child.getProperty(threshold_property))});
+        }
+    }
+
+    return ThresholdCurve(std::move(breakpoints));
+}
+
+juce::ValueTree ThresholdCurve::to_value_tree() const {
+    juce::ValueTree tree(value_tree_type);
+    for (const Breakpoint& breakpoint : breakpoints_) {
+        juce::ValueTree child(breakpoint_type);
+        child.setProperty(frequency_property, breakpoint.frequency, nullptr);
+        child.setProperty(threshold_property, breakpoint.threshold_db, nullptr);
+        tree.appendChild(child, nullptr);
+    }
+
+    return tree;
+}
+
+float ThresholdCurve::threshold_db(float frequency) const {
+    jassert(!breakpoints_.empty());
+
+    const auto next = std::upper_bound(
+        breakpoints_.begin(), breakpoints_.end(), frequency,
+        [](float frequency, const Breakpoint& breakpoint) {
+            return frequency < breakpoint.frequency;
+        });
+    if (next == breakpoints_.begin()) {
+        return next->threshold_db;
+    }
+    if (next == breakpoints_.end()) {
+        return breakpoints_.back().threshold_db;
+    }
+
+    const Breakpoint& previous = *(next - 1);
+    const float start = curve_position(previous.frequency);
+    const float weight = (curve_position(frequency) - start) /
+                         (curve_position(next->frequency) - start);
+
+    return previous.threshold_db +
+           ((next->threshold_db - previous.threshold_db) * weight);
+}
+
+ThresholdTable::ThresholdTable(const ThresholdCurve& curve,
+                               const BandLayout& layout,
+                               size_t version)
+    : grouping(layout.grouping()),
+      sample_rate(layout.sample_rate()),
+      num_bins(layout.num_bins()),
+      version(version),
+      thresholds(layout.num_bands()) {
+    jassert(version != 0);
+
+    // This matches the conversion in `MultiwayCompressor::set_threshold()`
+    for (size_t band_idx = 0; band_idx < thresholds.size(); band_idx++) {
+        thresholds[band_idx] = juce::Decibels::decibelsToGain(
+            curve.threshold_db(layout.band_frequency(band_idx)), -200.0f);
+    }
+}
+
+bool ThresholdTable::matches(const BandLayout& layout) const {
+    return grouping == layout.grouping() &&
+           sample_rate == layout.sample_rate() &&
+           num_bins == layout.num_bins();
+}
+
+const ThresholdTable* ThresholdTables::find(const BandLayout& layout) const {
+    for (const ThresholdTable& table : tables) {
+        if (table.matches(layout)) {
+            return &table;
+        }
+    }
+
+    return nullptr;
+}
+
+size_t ThresholdTables::memory_usage() const {
+    size_t total = tables.capacity() * sizeof(ThresholdTable);
+    for (const ThresholdTable& table : tables) {
+        total += table.thresholds.capacity() * sizeof(float);
+    }
+
+    return total;
+}
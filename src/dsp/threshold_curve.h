@@ -0,0 +1,139 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "bands.h"
+
+/**
+ * A user defined curve for the compressor thresholds as a function of
+ * frequency, stored as a list of breakpoints in the plugin's state. The
+ * thresholds are interpolated linearly in decibels over `log2(frequency + 2)`,
+ * which behaves like an octave scale but stays finite at DC, and they're held
+ * constant below the first and above the last breakpoint.
+ *
+ * The curve itself is only ever used off the audio thread. It gets resampled
+ * into a `ThresholdTable` for every band layout in use, and the compressors
+ * read their thresholds straight from those tables.
+ */
+class ThresholdCurve {
+   public:
+    struct Breakpoint {
+        float frequency;
+        float threshold_db;
+
+        bool operator==(const Breakpoint&) const = default;
+    };
+
+    /**
+     * The type of the `juce::ValueTree` created by `to_value_tree()`. This is
+     * stored as a child of the plugin's parameter state.
+     */
+    static constexpr char value_tree_type[] = "ThresholdCurve";
+
+    /**
+     * The default curve. This is the fixed slope we've always used: 0 dBFS at
+     * DC, decreasing by 3 dB per octave.
+     */
+    ThresholdCurve();
+
+    /**
+     * A curve through the given breakpoints. These are sorted by frequency
+     * here, and negative frequencies are clamped to zero. When `breakpoints`
+     * is empty this results in the default curve.
+     */
+    explicit ThresholdCurve(std::vector<Breakpoint> breakpoints);
+
+    /**
+     * Read a curve stored with `to_value_tree()`. Returns the default curve if
+     * `tree` is not a valid curve, for instance because it's from a preset
+     * saved before curves existed.
+     */
+    static ThresholdCurve from_value_tree(const juce::ValueTree& tree);
+    juce::ValueTree to_value_tree() const;
+
+    /**
+     * The threshold in decibels at `frequency` Hertz.
+     */
+    float threshold_db(float frequency) const;
+
+    inline const std::vector<Breakpoint>& breakpoints() const {
+        return breakpoints_;
+    }
+
+    bool operator==(const ThresholdCurve&) const = default;
+
+   private:
+    std::vector<Breakpoint> breakpoints_;
+};
+
+/**
+ * A `ThresholdCurve` resampled for a single `BandLayout`, so for a specific
+ * FFT window size, sample rate and bin grouping. This contains a linear
+ * threshold for every band that can be passed directly to
+ * `MultiwayCompressor::set_threshold_gain()`.
+ */
+struct ThresholdTable {
+    ThresholdTable() = default;
+    ThresholdTable(const ThresholdCurve& curve,
+                   const BandLayout& layout,
+                   size_t version);
+
+    /**
+     * Whether this table was computed for `layout`.
+     */
+    bool matches(const BandLayout& layout) const;
+
+    BinGrouping grouping = BinGrouping::none;
+    double sample_rate = 0.0;
+    size_t num_bins = 0;
+
+    /**
+     * Identifies the curve this table was computed from. Tables computed from
+     * the same curve share the same version, and a new curve gets a new
+     * version. Zero is never used.
+     */
+    size_t version = 0;
+    /**
+     * The linear thresholds for every band in the layout.
+     */
+    std::vector<float> thresholds;
+};
+
+/**
+ * The threshold tables for every band layout that may currently be in use.
+ * Multi-resolution mode uses two layouts, and right after the FFT settings
+ * change the new and the old `ProcessData` objects may both be in use.
+ */
+struct ThresholdTables {
+    /**
+     * The table for `layout`, or a null pointer if there isn't one yet. This
+     * is called on the audio thread.
+     */
+    const ThresholdTable* find(const BandLayout& layout) const;
+
+    /**
+     * The memory held by the tables in bytes.
+     */
+    size_t memory_usage() const;
+
+    std::vector<ThresholdTable> tables;
+};
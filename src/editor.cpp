@@ -18,26 +18,55 @@
 
 #include "processor.h"
 
+namespace {
+
+constexpr int editor_width = 640;
+constexpr int analyzer_height = 260;
+constexpr int memory_usage_label_height = 22;
+
+}  // namespace
+
 SpectralCompressorEditor::SpectralCompressorEditor(
     SpectralCompressorProcessor& p)
-    : AudioProcessorEditor(&p), processor_(p) {
-    setSize(400, 300);
+    : AudioProcessorEditor(&p),
+      processor_(p),
+      analyzer_(p.spectrum_fifo()),
+      parameters_editor_(p) {
+    addAndMakeVisible(analyzer_);
+    addAndMakeVisible(parameters_editor_);
+
+    memory_usage_label_.setFont(12.0f);
+    memory_usage_label_.setMinimumHorizontalScale(0.7f);
+    addAndMakeVisible(memory_usage_label_);
+    timerCallback();
+    startTimerHz(1);
+
+    setSize(editor_width, analyzer_height + parameters_editor_.getHeight() +
+                              memory_usage_label_height);
 }
 
 SpectralCompressorEditor::~SpectralCompressorEditor() {}
 
-//==============================================================================
 void SpectralCompressorEditor::paint(juce::Graphics& g) {
-    // TODO: Replace with something else. Or drop the GUI.
     g.fillAll(
         getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId));
-
-    g.setColour(juce::Colours::white);
-    g.setFont(15.0f);
-    g.drawFittedText("Hello World!", getLocalBounds(),
-                     juce::Justification::centred, 1);
 }
 
 void SpectralCompressorEditor::resized() {
-    // TODO
+    juce::Rectangle<int> area = getLocalBounds();
+    analyzer_.setBounds(area.removeFromTop(analyzer_height));
+    memory_usage_label_.setBounds(
+        area.removeFromBottom(memory_usage_label_height));
+    parameters_editor_.setBounds(area);
+}
+
+void SpectralCompressorEditor::timerCallback() {
+    juce::String text = "Memory: " + processor_.memory_usage().to_string();
+    if (processor_.is_fft_order_capped()) {
+        text += ", resolution limited to " +
+                juce::String(1 << processor_.effective_fft_order()) +
+                " by the memory budget";
+    }
+
+    memory_usage_label_.setText(text, juce::dontSendNotification);
 }
@@ -16,9 +16,15 @@
 
 #pragma once
 
+#include "analyzer.h"
 #include "processor.h"
 
-class SpectralCompressorEditor : public juce::AudioProcessorEditor {
+/**
+ * The plugin's editor. This shows a spectrum analyzer above JUCE's generic
+ * parameter editor, followed by the instance's memory usage.
+ */
+class SpectralCompressorEditor : public juce::AudioProcessorEditor,
+                                 private juce::Timer {
    public:
     explicit SpectralCompressorEditor(SpectralCompressorProcessor&);
     ~SpectralCompressorEditor() override;
@@ -27,7 +33,19 @@ class SpectralCompressorEditor : public juce::AudioProcessorEditor {
     void resized() override;
 
    private:
+    /**
+     * Refreshes the memory usage label.
+     */
+    void timerCallback() override;
+
     SpectralCompressorProcessor& processor_;
 
+    SpectrumAnalyzer analyzer_;
+    /**
+     * TODO: Replace this with a proper set of controls at some point
+     */
+    juce::GenericAudioProcessorEditor parameters_editor_;
+    juce::Label memory_usage_label_;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpectralCompressorEditor)
 };
@@ -0,0 +1,117 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+/**
+ * The memory held by a single `ProcessData` object, in bytes.
+ */
+struct ProcessDataMemoryUsage {
+    /**
+     * The STFT's input and sidechain ring buffers and its overlap-add buffers,
+     * and the band split's delay lines when the lower band is decimated.
+     */
+    size_t ring_buffers = 0;
+    /**
+     * The STFT's FFT scratch buffer, the sidechain threshold accumulators, and
+     * the decimation filters.
+     */
+    size_t scratch_buffers = 0;
+    /**
+     * The compressors, including their envelope followers' per-channel state,
+     * and the tables used to group the FFT bins into bands.
+     */
+    size_t compressors = 0;
+    /**
+     * The FFT plan and the windowing table. JUCE doesn't expose the FFT
+     * engine's internals, so the plan's size is estimated from the twiddle
+     * factors the FFT engines allocate.
+     */
+    size_t fft = 0;
+
+    inline size_t total() const {
+        return ring_buffers + scratch_buffers + compressors + fft;
+    }
+
+    inline ProcessDataMemoryUsage& operator+=(
+        const ProcessDataMemoryUsage& other) {
+        ring_buffers += other.ring_buffers;
+        scratch_buffers += other.scratch_buffers;
+        compressors += other.compressors;
+        fft += other.fft;
+
+        return *this;
+    }
+};
+
+/**
+ * A breakdown of all memory held by a `SpectralCompressorProcessor`, in bytes.
+ * See `SpectralCompressorProcessor::memory_usage()`.
+ */
+struct MemoryUsage {
+    /**
+     * The `ProcessData` object currently used for processing.
+     */
+    ProcessDataMemoryUsage active_process_data;
+    /**
+     * The other `ProcessData` slot in `AtomicallySwappable`. This usually holds
+     * the buffers for the previous FFT window size until the next resize.
+     */
+    ProcessDataMemoryUsage inactive_process_data;
+    /**
+     * The dry/wet mixer's delay line and dry buffer. This is sized for the
+     * largest possible latency regardless of the current settings.
+     */
+    size_t mixer = 0;
+    /**
+     * The processor object itself, the spectrum analyzer's FIFO, and the
+     * session capture's FIFO.
+     */
+    size_t other = 0;
+
+    inline size_t total() const {
+        return active_process_data.total() + inactive_process_data.total() +
+               mixer + other;
+    }
+
+    /**
+     * A short human readable summary, for instance
+     * `12.3 MB (ring buffers 4.1 MB, ...)`.
+     */
+    juce::String to_string() const {
+        const ProcessDataMemoryUsage& a = active_process_data;
+        const ProcessDataMemoryUsage& b = inactive_process_data;
+
+        return format_bytes(total()) + " (ring buffers " +
+               format_bytes(a.ring_buffers + b.ring_buffers) + ", scratch " +
+               format_bytes(a.scratch_buffers + b.scratch_buffers) +
+               ", compressors " + format_bytes(a.compressors + b.compressors) +
+               ", FFT " + format_bytes(a.fft + b.fft) + ", mixer " +
+               format_bytes(mixer) + ", other " + format_bytes(other) + ")";
+    }
+
+    static juce::String format_bytes(size_t bytes) {
+        if (bytes >= (1 << 20)) {
+            return juce::String(static_cast<double>(bytes) / (1 << 20), 1) +
+                   " MB";
+        } else {
+            return juce::String(static_cast<double>(bytes) / (1 << 10), 1) +
+                   " kB";
+        }
+    }
+};
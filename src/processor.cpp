@@ -16,6 +16,14 @@
 
 #include "processor.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <functional>
+#include <utility>
+
+#include "dsp/fft.h"
+#include "dsp/simd.h"
 #include "editor.h"
 
 using juce::uint32;
@@ -35,13 +43,154 @@ constexpr char compressor_multiway_deadzone_param_name[] =
 constexpr char compressor_ratio_param_name[] = "compressor_ratio";
 constexpr char compressor_attack_ms_param_name[] = "compressor_attack";
 constexpr char compressor_release_ms_param_name[] = "compressor_release";
+constexpr char stereo_link_param_name[] = "stereo_link";
+constexpr char decimate_envelopes_param_name[] = "decimate_envelopes";
+constexpr char cpu_budget_param_name[] = "cpu_budget";
+constexpr char cpu_budget_target_param_name[] = "cpu_budget_target";
 
 constexpr char spectral_settings_group_name[] = "spectral";
 constexpr char fft_order_param_name[] = "fft_size";
 constexpr char windowing_overlap_order_param_name[] = "windowing_order";
+constexpr char bin_grouping_param_name[] = "bin_grouping";
+constexpr char gain_smoothing_param_name[] = "gain_smoothing";
+constexpr char low_frequency_param_name[] = "low_frequency";
+constexpr char high_frequency_param_name[] = "high_frequency";
+constexpr char internal_bandwidth_param_name[] = "internal_bandwidth";
+constexpr char multi_resolution_param_name[] = "multi_resolution";
+constexpr char upper_fft_order_param_name[] = "upper_fft_size";
+constexpr char crossover_frequency_param_name[] = "crossover_frequency";
 
 constexpr int fft_order_minimum = 12;
 constexpr int fft_order_maximum = 15;
+static_assert((1 << fft_order_maximum) / 2 <= SpectrumFrame::max_bin_idx,
+              "The spectrum analyzer cannot represent every FFT bin");
+
+/**
+ * The bandwidths in Hertz for the internal bandwidth parameter's choices, where
+ * zero means that the bandwidth is not limited. This should match the
+ * parameter's choices.
+ */
+constexpr double internal_bandwidths[] = {0.0, 20000.0, 40000.0};
+/**
+ * The largest factor the lower band can be decimated by when the internal
+ * bandwidth is limited. This covers 192 kHz with a 20 kHz bandwidth.
+ */
+constexpr size_t max_internal_decimation_factor = 4;
+/**
+ * When this environment variable is set to a directory, every instance will
+ * capture its processing session to a new file in that directory. See
+ * `SessionCapture`.
+ */
+constexpr char capture_directory_env_var[] = "SPECTRAL_COMPRESSOR_CAPTURE_DIR";
+/**
+ * When this environment variable is set to a number, every instance will get a
+ * memory budget of that many megabytes. See
+ * `SpectralCompressorProcessor::set_memory_budget()`.
+ */
+constexpr char memory_budget_env_var[] = "SPECTRAL_COMPRESSOR_MEMORY_BUDGET_MB";
+
+/**
+ * When envelope decimation is enabled, the envelope followers should still get
+ * at least this many updates within the shortest of the attack and release
+ * times.
+ */
+constexpr double envelope_updates_per_time_constant = 8.0;
+
+/**
+ * With a CPU budget, at least this many compressors per channel will get a full
+ * update, no matter how far over budget we are.
+ */
+constexpr size_t min_budget_num_updates = 16;
+
+/**
+ * The largest number of bins on either side of a bin that the gain smoothing
+ * parameter can average over.
+ */
+constexpr int max_gain_smoothing_radius = 16;
+
+/**
+ * The factor the lower band should be decimated by at `sample_rate` to keep
+ * `bandwidth` Hertz, or 1 if the bandwidth is not limited. The decimated
+ * Nyquist frequency will be at least `bandwidth`, and the passband of
+ * `DecimationFilter` ends slightly below that.
+ */
+size_t internal_decimation_factor_for(double sample_rate, double bandwidth) {
+    if (bandwidth <= 0.0) {
+        return 1;
+    }
+
+    size_t factor = 1;
+    while (factor < max_internal_decimation_factor &&
+           sample_rate / static_cast<double>(4 * factor) >= bandwidth) {
+        factor *= 2;
+    }
+
+    return factor;
+}
+
+/**
+ * The number of hops between compressor updates when envelope decimation is
+ * enabled. This is the largest power of two up to `windowing_overlap_times`
+ * that still gives the envelope followers `envelope_updates_per_time_constant`
+ * updates per attack or release time.
+ */
+size_t envelope_decimation_factor(double hop_seconds,
+                                  float attack_ms,
+                                  float release_ms,
+                                  int windowing_overlap_times) {
+    const double shortest_time_seconds =
+        std::min(attack_ms, release_ms) / 1000.0;
+
+    size_t factor = 1;
+    while (factor < static_cast<size_t>(windowing_overlap_times) &&
+           static_cast<double>(factor * 2) * hop_seconds *
+                   envelope_updates_per_time_constant <=
+               shortest_time_seconds) {
+        factor *= 2;
+    }
+
+    return factor;
+}
+
+/**
+ * Written after the processing state in `save_checkpoint()`, so a truncated
+ * checkpoint doesn't get restored.
+ */
+constexpr int checkpoint_end_marker = 0x53434b50;
+
+/**
+ * Write `values` to `stream`, preceded by their number.
+ */
+void write_floats(juce::OutputStream& stream,
+                  const std::vector<float>& values) {
+    stream.writeInt64(static_cast<juce::int64>(values.size()));
+    stream.write(values.data(), values.size() * sizeof(float));
+}
+
+/**
+ * Read values written by `write_floats()` into `values`, which should have the
+ * same size.
+ */
+bool read_floats(juce::InputStream& stream, std::vector<float>& values) {
+    const int num_bytes = static_cast<int>(values.size() * sizeof(float));
+    return stream.readInt64() == static_cast<juce::int64>(values.size()) &&
+           stream.read(values.data(), num_bytes) == num_bytes;
+}
+
+/**
+ * Read a range written as two `int64`s, which should not extend past `limit`.
+ */
+bool read_range(juce::InputStream& stream, IndexRange& range, size_t limit) {
+    const juce::int64 begin = stream.readInt64();
+    const juce::int64 end = stream.readInt64();
+    if (begin < 0 || end < begin || end > static_cast<juce::int64>(limit)) {
+        return false;
+    }
+
+    range = IndexRange{.begin = static_cast<size_t>(begin),
+                       .end = static_cast<size_t>(end)};
+    return true;
+}
 
 SpectralCompressorProcessor::SpectralCompressorProcessor()
     : AudioProcessor(
@@ -49,7 +198,6 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
               .withInput("Input", juce::AudioChannelSet::stereo(), true)
               .withOutput("Output", juce::AudioChannelSet::stereo(), true)
               .withInput("Sidechain", juce::AudioChannelSet::stereo(), true)),
-      mixer_(1 << fft_order_maximum),
       parameters_(
           *this,
           nullptr,
@@ -135,7 +283,27 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
                       juce::NormalisableRange<float>(0.0, 10000.0, 1.0, 0.2),
                       202.0,
                       " ms",
-                      juce::AudioProcessorParameter::genericParameter)),
+                      juce::AudioProcessorParameter::genericParameter),
+                  std::make_unique<juce::AudioParameterChoice>(
+                      stereo_link_param_name,
+                      "Stereo Link",
+                      // This should match `StereoLink`
+                      juce::StringArray{"Off", "Max", "Mean", "Mid"},
+                      static_cast<int>(StereoLink::off)),
+                  std::make_unique<juce::AudioParameterBool>(
+                      decimate_envelopes_param_name,
+                      "Decimate Envelopes",
+                      false),
+                  std::make_unique<juce::AudioParameterBool>(
+                      cpu_budget_param_name,
+                      "CPU Budget",
+                      false),
+                  std::make_unique<juce::AudioParameterFloat>(
+                      cpu_budget_target_param_name,
+                      "CPU Budget Target",
+                      juce::NormalisableRange<float>(1.0, 100.0, 0.1, 0.5),
+                      25.0,
+                      "%")),
               std::make_unique<juce::AudioProcessorParameterGroup>(
                   spectral_settings_group_name,
                   "Spectral Settings",
@@ -165,7 +333,67 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
                       },
                       [&](const juce::String& text) -> int {
                           return std::log2(text.getIntValue());
-                      })),
+                      }),
+                  std::make_unique<juce::AudioParameterChoice>(
+                      bin_grouping_param_name,
+                      "Band Grouping",
+                      // This should match `BinGrouping`
+                      juce::StringArray{"Off", "Bark", "ERB", "1/3 Octave",
+                                        "1/6 Octave", "1/12 Octave"},
+                      static_cast<int>(BinGrouping::none)),
+                  std::make_unique<juce::AudioParameterInt>(
+                      gain_smoothing_param_name,
+                      "Gain Smoothing",
+                      0,
+                      max_gain_smoothing_radius,
+                      0,
+                      " bins"),
+                  std::make_unique<juce::AudioParameterFloat>(
+                      low_frequency_param_name,
+                      "Low Frequency",
+                      juce::NormalisableRange<float>(0.0, 20000.0, 1.0, 0.2),
+                      0.0,
+                      " Hz",
+                      juce::AudioProcessorParameter::genericParameter),
+                  // The default is above the Nyquist frequency for every
+                  // sample rate we support, so nothing gets excluded
+                  std::make_unique<juce::AudioParameterFloat>(
+                      high_frequency_param_name,
+                      "High Frequency",
+                      juce::NormalisableRange<float>(20.0, 96000.0, 1.0, 0.2),
+                      96000.0,
+                      " Hz",
+                      juce::AudioProcessorParameter::genericParameter),
+                  std::make_unique<juce::AudioParameterChoice>(
+                      internal_bandwidth_param_name,
+                      "Internal Bandwidth",
+                      // This should match `internal_bandwidths`
+                      juce::StringArray{"Unlimited", "20 kHz", "40 kHz"},
+                      0),
+                  std::make_unique<juce::AudioParameterBool>(
+                      multi_resolution_param_name,
+                      "Multi-Resolution",
+                      false),
+                  std::make_unique<juce::AudioParameterInt>(
+                      upper_fft_order_param_name,
+                      "Upper Resolution",
+                      9,
+                      fft_order_maximum,
+                      11,
+                      "",
+                      [](int value, int /*max_length*/) -> juce::String {
+                          return juce::String(1 << value);
+                      },
+                      [](const juce::String& text) -> int {
+                          return std::log2(text.getIntValue());
+                      }),
+                  std::make_unique<juce::AudioParameterFloat>(
+                      crossover_frequency_param_name,
+                      "Crossover",
+                      juce::NormalisableRange<float>(50.0, 4000.0, 1.0, 0.3),
+                      500.0,
+                      " Hz",
+                      juce::AudioProcessorParameter::genericParameter)),
           }),
       // TODO: Is this how you're supposed to retrieve non-float parameters?
       //       Seems a bit excessive
@@ -193,6 +421,14 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
           *parameters_.getRawParameterValue(compressor_attack_ms_param_name)),
       compressor_release_ms_(
           *parameters_.getRawParameterValue(compressor_release_ms_param_name)),
+      stereo_link_(*dynamic_cast<juce::AudioParameterChoice*>(
+          parameters_.getParameter(stereo_link_param_name))),
+      decimate_envelopes_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(decimate_envelopes_param_name))),
+      cpu_budget_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(cpu_budget_param_name))),
+      cpu_budget_target_(
+          *parameters_.getRawParameterValue(cpu_budget_target_param_name)),
       compressor_settings_listener_(
           [&](const juce::String& /*parameterID*/, float /*newValue*/) {
               compressor_settings_changed_ = true;
@@ -201,19 +437,60 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
           parameters_.getParameter(fft_order_param_name))),
       windowing_overlap_order_(*dynamic_cast<juce::AudioParameterInt*>(
           parameters_.getParameter(windowing_overlap_order_param_name))),
+      bin_grouping_(*dynamic_cast<juce::AudioParameterChoice*>(
+          parameters_.getParameter(bin_grouping_param_name))),
+      gain_smoothing_(*dynamic_cast<juce::AudioParameterInt*>(
+          parameters_.getParameter(gain_smoothing_param_name))),
+      low_frequency_(
+          *parameters_.getRawParameterValue(low_frequency_param_name)),
+      high_frequency_(
+          *parameters_.getRawParameterValue(high_frequency_param_name)),
+      internal_bandwidth_(*dynamic_cast<juce::AudioParameterChoice*>(
+          parameters_.getParameter(internal_bandwidth_param_name))),
+      multi_resolution_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(multi_resolution_param_name))),
+      upper_fft_order_(*dynamic_cast<juce::AudioParameterInt*>(
+          parameters_.getParameter(upper_fft_order_param_name))),
+      crossover_frequency_(
+          *parameters_.getRawParameterValue(crossover_frequency_param_name)),
       process_data_updater_([&]() {
+          // The decimation filters and delays also count towards the memory
+          // budget, so the FFT order may need to be capped differently
+          update_max_fft_order();
           update_and_swap_process_data();
-
-          const size_t new_window_size = 1 << fft_order_;
-          setLatencySamples(new_window_size);
+          setLatencySamples(expected_latency_samples());
       }),
+      threshold_table_updater_("Threshold tables",
+                               [&]() { update_threshold_tables(); }),
       fft_order_listener_(
           [&](const juce::String& /*parameterID*/, float /*newValue*/) {
               process_data_updater_.triggerAsyncUpdate();
           }) {
+    const juce::String memory_budget_mb =
+        juce::SystemStats::getEnvironmentVariable(memory_budget_env_var, "");
+    if (memory_budget_mb.isNotEmpty()) {
+        memory_budget_ = static_cast<size_t>(
+            memory_budget_mb.getDoubleValue() * static_cast<double>(1 << 20));
+    }
+    max_fft_order_ = fft_order_maximum;
+    update_max_fft_order();
+
+    // The SIMD kernels are selected on first use, which reads an environment
+    // variable and may write to the log. That should not happen on the audio
+    // thread.
+    simd::kernels();
+
+    // Benchmarking the FFT backends takes a while, so when running in a host
+    // this happens in the background instead of while preparing to play. The
+    // development tools construct the processor directly, and they should keep
+    // using the same backends for their entire run.
+    if (wrapperType != wrapperType_Undefined) {
+        fft::calibrate_in_background(fft_order_.getRange().getStart(),
+                                     fft_order_maximum);
+    }
+
     // TODO: Move the latency computation elsewhere
-    const size_t new_window_size = 1 << fft_order_;
-    setLatencySamples(new_window_size);
+    setLatencySamples(expected_latency_samples());
 
     // XXX: There doesn't seem to be a fool proof way to just iterate over all
     //      parameters in a group, right?
@@ -227,9 +504,37 @@ SpectralCompressorProcessor::SpectralCompressorProcessor()
 
     parameters_.addParameterListener(fft_order_param_name,
                                      &fft_order_listener_);
+    parameters_.addParameterListener(bin_grouping_param_name,
+                                     &fft_order_listener_);
+    parameters_.addParameterListener(internal_bandwidth_param_name,
+                                     &fft_order_listener_);
+    parameters_.addParameterListener(multi_resolution_param_name,
+                                     &fft_order_listener_);
+    parameters_.addParameterListener(upper_fft_order_param_name,
+                                     &fft_order_listener_);
+
+    const juce::String capture_directory =
+        juce::SystemStats::getEnvironmentVariable(capture_directory_env_var,
+                                                  "");
+    if (capture_directory.isNotEmpty()) {
+        capture_on_next_prepare(
+            juce::File(capture_directory)
+                .getChildFile(
+                    "capture-" +
+                    juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S") +
+                    "-" +
+                    juce::String::toHexString(
+                        reinterpret_cast<juce::pointer_sized_int>(this)) +
+                    ".sccap")
+                .getNonexistentSibling());
+    }
 }
 
-SpectralCompressorProcessor::~SpectralCompressorProcessor() {}
+SpectralCompressorProcessor::~SpectralCompressorProcessor() {
+    // The threshold tables are built from the curve, which is destroyed before
+    // the updater
+    threshold_table_updater_.stop();
+}
 
 const juce::String SpectralCompressorProcessor::getName() const {
     return JucePlugin_Name;
@@ -288,22 +593,53 @@ void SpectralCompressorProcessor::prepareToPlay(
     int maximumExpectedSamplesPerBlock) {
     max_samples_per_block_ =
         static_cast<uint32>(maximumExpectedSamplesPerBlock);
+    mixer_max_latency_samples_ = max_latency_samples(sampleRate);
 
-    // This is used to set the correct 'effective' sample rate on our
-    // compressors during the processing loop
-    last_effective_sample_rate_ = 0.0;
+    // The memory budget depends on the channel count and the block size, so
+    // the FFT order may need to be capped further. With a limited internal
+    // bandwidth the latency also depends on the sample rate.
+    update_max_fft_order();
+    setLatencySamples(expected_latency_samples());
+
+    // A capture has to start from a clean slate to be replayable, so in that
+    // case we'll always reinitialize the process data below
+    bool force_process_data_update = false;
+    if (pending_capture_file_) {
+        juce::MemoryBlock state;
+        getStateInformation(state);
+        capture_.start(*pending_capture_file_, state,
+                       static_cast<size_t>(getParameters().size()));
+
+        pending_capture_file_.reset();
+        force_process_data_update = true;
+    }
+    if (capture_.is_active()) {
+        capture_.record_prepare(sampleRate, maximumExpectedSamplesPerBlock,
+                                getMainBusNumInputChannels());
+    } else {
+        // A stopped capture's buffers can only be freed when the audio thread
+        // is guaranteed not to be using them
+        capture_.free_buffers();
+    }
 
     // When the latency changes because of an FFT window size change the host
     // will restart playback and this function gets called again. In that case
     // we don't want to do an explicit update here, because that would defeat
     // the whole purpose of doing this atomic swap thing from a background
-    // thread.
+    // thread. The compressors' frequencies do depend on the sample rate, so
+    // a sample rate change always needs an update.
     //
     // TODO: In practice this doesn't do anything, since `releaseResources()`
     //       will also have been called at this point
-    if (!(process_data_.get().stft &&
+    const ProcessingLayout layout = processing_layout();
+    if (force_process_data_update ||
+        !(process_data_.get().stft &&
           process_data_.get().stft->fft_window_size ==
-              static_cast<size_t>(1 << fft_order_))) {
+              static_cast<size_t>(1 << layout.fft_order) &&
+          process_data_.get().band_layout.sample_rate() ==
+              sampleRate / static_cast<double>(layout.decimation_factor) &&
+          static_cast<bool>(process_data_.get().upper_band) ==
+              layout.upper_fft_order.has_value())) {
         // After initializing the process data we make an explicit call to
         // `process_data.get()` to swap the two filters in case we get a
         // parameter change before the first processing cycle
@@ -311,20 +647,63 @@ void SpectralCompressorProcessor::prepareToPlay(
         process_data_.get();
     }
 
-    mixer_.prepare(juce::dsp::ProcessSpec{
+    // This is used to set the correct 'effective' sample rate on our
+    // compressors during the processing loop, and the compressors need to be
+    // prepared again for the new block size
+    ProcessData& process_data = process_data_.get();
+    process_data.last_effective_sample_rate = 0.0;
+    if (process_data.upper_band) {
+        process_data.upper_band->last_effective_sample_rate = 0.0;
+    }
+
+    mixer_.emplace(static_cast<int>(mixer_max_latency_samples_));
+    mixer_->prepare(juce::dsp::ProcessSpec{
         .sampleRate = sampleRate,
         .maximumBlockSize = static_cast<uint32>(maximumExpectedSamplesPerBlock),
         .numChannels = static_cast<uint32>(getMainBusNumInputChannels())});
 }
 
 void SpectralCompressorProcessor::releaseResources() {
+    if (capture_.is_active()) {
+        capture_.record_release();
+    } else {
+        capture_.free_buffers();
+    }
+
     process_data_.clear([](ProcessData& process_data) {
         process_data.stft.reset();
+        process_data.decimator.reset();
+        process_data.sidechain_decimator.reset();
+        process_data.upper_band.reset();
+        process_data.upper_band_buffer.setSize(0, 0);
 
         process_data.spectral_compressors.clear();
         process_data.spectral_compressors.shrink_to_fit();
         process_data.spectral_compressor_sidechain_thresholds.clear();
         process_data.spectral_compressor_sidechain_thresholds.shrink_to_fit();
+        process_data.bin_magnitudes.clear();
+        process_data.bin_magnitudes.shrink_to_fit();
+        process_data.bin_gains.clear();
+        process_data.bin_gains.shrink_to_fit();
+        process_data.padded_gains.clear();
+        process_data.padded_gains.shrink_to_fit();
+        process_data.gain_running_sums.clear();
+        process_data.gain_running_sums.shrink_to_fit();
+        process_data.band_magnitudes.clear();
+        process_data.band_magnitudes.shrink_to_fit();
+        process_data.band_gains.clear();
+        process_data.band_gains.shrink_to_fit();
+        process_data.channel_magnitudes.clear();
+        process_data.channel_magnitudes.shrink_to_fit();
+        process_data.linked_bins.clear();
+        process_data.linked_bins.shrink_to_fit();
+        process_data.previous_envelope_gains.clear();
+        process_data.previous_envelope_gains.shrink_to_fit();
+        process_data.target_envelope_gains.clear();
+        process_data.target_envelope_gains.shrink_to_fit();
+        process_data.budget_magnitudes.clear();
+        process_data.budget_magnitudes.shrink_to_fit();
+        process_data.band_layout = BandLayout();
     });
 }
 
@@ -344,241 +723,838 @@ void SpectralCompressorProcessor::processBlockBypassed(
     juce::AudioBuffer<float>& buffer,
     juce::MidiBuffer& /*midiMessages*/) {
     juce::AudioBuffer<float> main_io = getBusBuffer(buffer, true, 0);
+    juce::AudioBuffer<float> sidechain_io = getBusBuffer(buffer, true, 1);
 
     // We need to maintain the same latency when bypassed, so we'll reuse most
-    // of the processing logic
-    ProcessData& process_data = process_data_.get();
-    process_data.stft->process_bypassed(main_io);
+    // of the processing logic. The band split is exact when the lower band is
+    // not modified, so this simply delays the input.
+    ProcessData& process_data = begin_processing_cycle(buffer, true);
+    process_bands(process_data, main_io, sidechain_io, false,
+                  [](ProcessData& band_data, double /*sample_rate*/,
+                     juce::AudioBuffer<float>& main,
+                     juce::AudioBuffer<float>& /*sidechain*/) {
+                      band_data.stft->process_bypassed(main);
+                  });
+
+    // The bypassed hops aren't stored, so this ends any recordings
+    if (analysis_cache_) {
+        analysis_cache_num_samples_ += buffer.getNumSamples();
+    }
+
+    if (capture_.is_active()) {
+        capture_.record_block_output(buffer);
+    }
 }
 
 void SpectralCompressorProcessor::processBlock(
     juce::AudioBuffer<float>& buffer,
     juce::MidiBuffer& /*midiMessages*/) {
-//    juce::ScopedNoDenormals noDenormals;
-//
-//    juce::AudioBuffer<float> main_io = getBusBuffer(buffer, true, 0);
-//    juce::AudioBuffer<float> sidechain_io = getBusBuffer(buffer, true, 1);
-//
-//    juce::dsp::AudioBlock<float> main_block(main_io);
-//    mixer_.setWetMixProportion(dry_wet_ratio_);
-//    mixer_.pushDrySamples(main_block);
-//
-//    ProcessData& process_data = process_data_.get();
-//    const double effective_sample_rate =
-//        getSampleRate() /
-//        (static_cast<double>(process_data.stft->fft_window_size) /
-//         (1 << windowing_overlap_order_));
-//    const float fft_frequency_increment =
-//        getSampleRate() / process_data.stft->fft_window_size;
-//    const MultiwayCompressor<float>::Mode compressor_mode =
-//        static_cast<MultiwayCompressor<float>::Mode>(
-//            compressor_mode_.getIndex());
-//
-//    // We have two different gain stages: just before the FFT transformations,
-//    // after the FFT transformations (the makeup gain). As part of the makeup
-//    // gain we also compensate for the overlap caused by our windowing. We don't
-//    // need any manual ramps or fades here because that's already included in
-//    // our Hanning windows.
-//    // TODO: We should probably also compensate for different FFT window sizes
-//    const float input_gain =
-//        juce::Decibels::decibelsToGain(static_cast<float>(input_gain_db_));
-//    float makeup_gain =
-//        (1.0f / (1 << windowing_overlap_order_)) *
-//        juce::Decibels::decibelsToGain(static_cast<float>(output_gain_db_));
-//    // Obviously don't apply auto makeup gain when doing upwards compression,
-//    // that will just blow up speakers
-//    if (auto_makeup_gain_) {
-//        makeup_gain *= 1.0f / input_gain;
-//
-//        // FIXME: None of this makes any sense! But it works for our current
-//        //        parameters. At some point, come up with a more
-//        //        mathematically justified auto gaining algorithm.
-//        if (compressor_mode != MultiwayCompressor<float>::Mode::upwards) {
-//            if (sidechain_active_) {
-//                // Not really sure what makes sense here
-//                // TODO: Take base threshold into account
-//                makeup_gain *= (compressor_ratio_ + 24.0f) / 25.0f;
-//            } else {
-//                // TODO: Make this smarter, make it take all of the compressor
-//                //       parameters into account. It will probably start making
-//                //       sense once we add parameters for the threshold and
-//                //       ratio.
-//                makeup_gain *=
-//                    compressor_ratio_ > 1.0
-//                        ? ((std::log10(compressor_ratio_ * 100.00f) * 200.0f) -
-//                           399.0f) *
-//                              (input_gain)
-//                        : 1.0f;
-//            }
-//        }
-//    }
-//
-//    auto preprocess_fn = [input_gain](std::span<float>& samples,
-//                                      size_t /*channel*/) {
-//        // We apply the input gain after the windowing, just before the forward
-//        // FFT transformation
-//        // TODO: This could be folded into the windowing function with a FMA
-//        juce::FloatVectorOperations::multiply(samples.data(), input_gain,
-//                                              samples.size());
-//    };
-//
-//    auto process_fn = [this, compressor_mode, effective_sample_rate,
-//                       fft_frequency_increment, &process_data](
-//                          std::span<std::complex<float>>& fft, size_t channel) {
-//        // We'll update the compressor settings just before processing if the
-//        // settings have changed or if the sidechaining has been disabled
-//        bool expected = true;
-//        const bool update_compressors_now =
-//            compressor_settings_changed_.compare_exchange_weak(expected, false);
-//
-//        // If any timing related settings change (so the FFT window size or the
-//        // amount of overlap), we'll need to adjust our compressors accordingly.
-//        // Since this process can cause pops and clicks, we only do it when
-//        // necessary.
-//        const bool update_sample_rate_now =
-//            last_effective_sample_rate_ != effective_sample_rate;
-//        last_effective_sample_rate_ = effective_sample_rate;
-//
-//        // We'll compress every FTT bin individually. Bin 0 is the DC offset and
-//        // should be skipped, and the latter half of the FFT bins should be
-//        // processed in the same way as the first half but in reverse order. The
-//        // real and imaginary parts are interleaved, so ever bin spans two
-//        // values in the scratch buffer. We can 'safely' do this cast so we can
-//        // use the STL's complex value functions.
-//        for (size_t compressor_idx = 0;
-//             compressor_idx < process_data.spectral_compressors.size();
-//             compressor_idx++) {
-//            auto& compressor =
-//                process_data.spectral_compressors[compressor_idx];
-//            // We don't have a compressor for the first bin
-//            const size_t bin_idx = compressor_idx + 1;
-//
-//            if (update_compressors_now) {
-//                compressor.set_mode(compressor_mode);
-//                compressor.set_multiway_deadzone(compressor_multiway_deadzone_);
-//                compressor.set_ratio(compressor_ratio_);
-//                compressor.set_attack(compressor_attack_ms_);
-//                compressor.set_release(compressor_release_ms_);
-//                // TODO: The user should be able to configure their own slope
-//                //       (or free drawn)
-//                // TODO: Change the calculations so that the base threshold
-//                //       parameter is centered around some frequency
-//                // TODO: And we should be doing both upwards and downwards
-//                //       compression, OTT-style
-//                if (!sidechain_active_) {
-//                    constexpr float base_threshold_dbfs = 0.0f;
-//                    const float frequency = fft_frequency_increment * bin_idx;
-//
-//                    // This starts at 1 for 0 Hz (DC)
-//                    const float octave = std::log2(frequency + 2);
-//
-//                    // The 3 dB is to compensate for bin 0
-//                    compressor.set_threshold((base_threshold_dbfs + 3.0f) -
-//                                             (3.0f * octave));
-//                }
-//            }
-//
-//            if (update_sample_rate_now) {
-//                // TODO: This prepare resets the envelope follower, which is not
-//                //       what we want. In our own compressor we should have a
-//                //       way to just change the sample rate.
-//                // TODO: Now that the timings are compensated for changing
-//                //       window intervals, we might not need this to be
-//                //       configurable anymore can just leave this fixed at 4x.
-//                compressor.prepare(juce::dsp::ProcessSpec{
-//                    // We only process everything once every
-//                    // `windowing_interval`, otherwise our attack and release
-//                    // times will be all messed up
-//                    .sampleRate = effective_sample_rate,
-//                    .maximumBlockSize = max_samples_per_block_,
-//                    .numChannels =
-//                        static_cast<uint32>(getMainBusNumInputChannels())});
-//            }
-//
-//            const float magnitude = std::abs(fft[bin_idx]);
-//            const float compressed_magnitude =
-//                compressor.process_sample(channel, magnitude);
-//
-//            // We need to scale both the imaginary and real components of the
-//            // bins at the start and end of the spectrum by the same value
-//            // TODO: Add stereo linking
-//            const float compression_multiplier =
-//                magnitude != 0.0f ? compressed_magnitude / magnitude : 1.0f;
-//
-//            // Since we're usign the real-only FFT operations we don't need to
-//            // touch the second, mirrored half of the FFT bins
-//            fft[bin_idx] *= compression_multiplier;
-//        }
-//
-//        // TODO: We might need some kind of optional limiting stage to
-//        //       be safe
-//        // TODO: We should definitely add a way to recover transients
-//        //       from the original input audio, that sounds really good
-//
-//        if (dc_filter_) {
-//            fft[0] = 0;
-//        }
-//    };
-//
-//    auto postprocess_fn = [](std::span<float>& /*samples*/,
-//                             size_t /*channel*/) {};
-//
-//    // We'll process the input signal in windows, using overlap-add
-//    if (sidechain_active_) {
-//        process_data.stft->process(
-//            main_io, sidechain_io, 1 << windowing_overlap_order_, makeup_gain,
-//            [&process_data](const std::span<std::complex<float>>& fft,
-//                            size_t /*channel*/) {
-//                // If sidechaining is active, we set the compressor thresholds
-//                // based on a sidechain signal. Since compression is already
-//                // ballistics based we don't need any additional smoothing when
-//                // updating those thresholds.
-//                for (size_t compressor_idx = 0;
-//                     compressor_idx < process_data.spectral_compressors.size();
-//                     compressor_idx++) {
-//                    const size_t bin_idx = compressor_idx + 1;
-//                    const float magnitude = std::abs(fft[bin_idx]);
-//
-//                    // We'll set the compressor threshold based on the
-//                    // arithmetic mean of the magnitudes of all channels. As
-//                    // a slight premature optimization (sorry) we'll reset
-//                    // these magnitudes after using them to avoid the
-//                    // conditional here.
-//                    process_data.spectral_compressor_sidechain_thresholds
-//                        [compressor_idx] += magnitude;
-//                }
-//            },
-//            [this, &process_data,
-//             num_channels = sidechain_io.getNumChannels()]() {
-//                // After adding up the magnitudes for each bin in
-//                // `process_data.spectral_compressor_sidechain_thresholds` we
-//                // want to actually configure the compressor thresholds based on
-//                // the mean across the different channels
-//                for (size_t compressor_idx = 0;
-//                     compressor_idx < process_data.spectral_compressors.size();
-//                     compressor_idx++) {
-//                    const float mean_magnitude =
-//                        process_data.spectral_compressor_sidechain_thresholds
-//                            [compressor_idx] /
-//                        num_channels;
-//                    process_data.spectral_compressors[compressor_idx]
-//                        .set_threshold(sidechain_exponential_
-//                                           ? mean_magnitude
-//                                           : juce::Decibels::gainToDecibels(
-//                                                 mean_magnitude));
-//                    process_data.spectral_compressor_sidechain_thresholds
-//                        [compressor_idx] = 0;
-//                }
-//            },
-//            preprocess_fn, process_fn, postprocess_fn);
-//    } else {
-//        process_data.stft->process(main_io, 1 << windowing_overlap_order_,
-//                                   makeup_gain, preprocess_fn, process_fn,
-//                                   postprocess_fn);
-//    }
-//
-//    mixer_.setWetLatency(process_data.stft->latency_samples());
-//    mixer_.mixWetSamples(main_block);
+    TRACE_ZONE("processBlock");
+    juce::ScopedNoDenormals noDenormals;
+
+    juce::AudioBuffer<float> main_io = getBusBuffer(buffer, true, 0);
+    juce::AudioBuffer<float> sidechain_io = getBusBuffer(buffer, true, 1);
+
+    // In analysis-only mode the dry signal is not needed, and the output is
+    // silent
+    const bool analysis_only = analysis_only_.load(std::memory_order_relaxed);
+    juce::dsp::AudioBlock<float> main_block(main_io);
+    if (!analysis_only) {
+        mixer_->setWetMixProportion(dry_wet_ratio_);
+        mixer_->pushDrySamples(main_block);
+    }
+
+    ProcessData& process_data = begin_processing_cycle(buffer, false);
+    const ThresholdTables& threshold_tables = threshold_tables_.get();
+    update_analysis_cache(process_data,
+                          static_cast<size_t>(main_io.getNumChannels()));
+
+    // In multi-resolution mode the lower band's compressors only cover the
+    // bins below the crossover frequency, and the upper band's compressors
+    // cover the bins above it. The crossover has to stay within the decimated
+    // lower band's passband.
+    const float low_frequency = low_frequency_;
+    const float high_frequency = high_frequency_;
+    const float crossover_frequency =
+        process_data.upper_band
+            ? std::min(crossover_frequency_.load(),
+                       static_cast<float>(
+                           DecimationFilter::cutoff *
+                           (process_data.band_layout.sample_rate() / 2.0)))
+            : high_frequency;
+
+    process_bands(process_data, main_io, sidechain_io, sidechain_active_,
+                  [&](ProcessData& band_data, double sample_rate,
+                      juce::AudioBuffer<float>& main,
+                      juce::AudioBuffer<float>& sidechain) {
+                      if (band_data.is_upper_band) {
+                          process_spectrum(
+                              band_data, sample_rate, main, sidechain,
+                              std::max(low_frequency, crossover_frequency),
+                              high_frequency,
+                              threshold_tables.find(band_data.band_layout),
+                              analysis_only);
+                      } else {
+                          process_spectrum(
+                              band_data, sample_rate, main, sidechain,
+                              low_frequency,
+                              std::min(high_frequency, crossover_frequency),
+                              threshold_tables.find(band_data.band_layout),
+                              analysis_only);
+                      }
+                  });
+
+    if (analysis_only) {
+        main_io.clear();
+    } else {
+        mixer_->setWetLatency(process_data.decimator
+                                 ? process_data.decimator->latency_samples()
+                                 : process_data.stft->latency_samples());
+        mixer_->mixWetSamples(main_block);
+    }
+
+    if (analysis_cache_) {
+        analysis_cache_num_samples_ += buffer.getNumSamples();
+    }
+
+    if (capture_.is_active()) {
+        capture_.record_block_output(buffer);
+    }
+}
+
+void SpectralCompressorProcessor::process_spectrum(
+    ProcessData& process_data,
+    double sample_rate,
+    juce::AudioBuffer<float>& main_io,
+    juce::AudioBuffer<float>& sidechain_io,
+    float low_frequency,
+    float high_frequency,
+    const ThresholdTable* threshold_table,
+    bool analysis_only) {
+    const double windowing_interval =
+        static_cast<double>(process_data.stft->fft_window_size) /
+        (1 << windowing_overlap_order_);
+
+    // With envelope decimation the compressors only run every
+    // `envelope_decimation` hops, and their gains are interpolated in between.
+    // Changing the factor restarts the interpolation.
+    const size_t envelope_decimation =
+        decimate_envelopes_
+            ? envelope_decimation_factor(
+                  windowing_interval / sample_rate, compressor_attack_ms_,
+                  compressor_release_ms_, 1 << windowing_overlap_order_)
+            : 1;
+    if (envelope_decimation != process_data.envelope_decimation) {
+        process_data.envelope_decimation = envelope_decimation;
+        process_data.envelope_hop_idx = 0;
+        process_data.reset_envelope_gains = true;
+    }
+
+    // Only the bins within the frequency range are processed. The ranges are
+    // stored in the process data so the compressors that become active again
+    // can be reset, since their envelopes will be stale by then.
+    const IndexRange active_bins =
+        process_data.band_layout.bins_for_frequencies(low_frequency,
+                                                      high_frequency);
+    if (active_bins != process_data.active_bins) {
+        const IndexRange active_bands =
+            process_data.band_layout.bands_for_bins(active_bins);
+        for (size_t compressor_idx = active_bands.begin;
+             compressor_idx < active_bands.end; compressor_idx++) {
+            if (!process_data.active_bands.contains(compressor_idx)) {
+                process_data.spectral_compressors[compressor_idx].reset();
+            }
+        }
+
+        process_data.active_bins = active_bins;
+        process_data.active_bands = active_bands;
+        process_data.detector_bins =
+            process_data.band_layout.bins_for_bands(active_bands);
+        process_data.envelope_hop_idx = 0;
+        process_data.reset_envelope_gains = true;
+    }
+
+    // The thresholds only change when the curve does, or when sidechaining
+    // gets disabled again. There may briefly not be a table for a newly
+    // swapped in layout, but its compressors will already have their
+    // thresholds set at that point.
+    if (sidechain_active_) {
+        process_data.threshold_version = 0;
+    } else if (threshold_table &&
+               threshold_table->version != process_data.threshold_version) {
+        process_data.apply_thresholds(*threshold_table);
+    }
+
+    const double effective_sample_rate =
+        sample_rate /
+        (windowing_interval * static_cast<double>(envelope_decimation));
+    const MultiwayCompressor<float>::Mode compressor_mode =
+        static_cast<MultiwayCompressor<float>::Mode>(
+            compressor_mode_.getIndex());
+
+    // With a CPU budget the compressors may only take up a fraction of every
+    // hop's duration. With envelope decimation a single compressor update gets
+    // the time of `envelope_decimation` hops. Enabling the budget starts out
+    // with full updates, and the number of full updates is adapted from there.
+    if (!cpu_budget_) {
+        process_data.budget_num_updates = 0;
+    } else if (process_data.budget_num_updates == 0) {
+        process_data.budget_num_updates =
+            process_data.spectral_compressors.size();
+        process_data.budget_elapsed_ticks = 0;
+    }
+    const double budget_ticks =
+        (cpu_budget_target_ / 100.0) *
+        (windowing_interval * static_cast<double>(envelope_decimation) /
+         sample_rate) *
+        static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+    // The compressors that don't get a full update have their gains decay
+    // towards unity, reaching 1% of their original deviation after the release
+    // time
+    const float budget_gain_decay =
+        compressor_release_ms_ > 0.0f
+            ? static_cast<float>(
+                  std::exp(std::log(0.01) / (compressor_release_ms_ * 0.001 *
+                                             effective_sample_rate)))
+            : 0.0f;
+
+    // We have two different gain stages: just before the FFT transformations,
+    // after the FFT transformations (the makeup gain). As part of the makeup
+    // gain we also compensate for the overlap caused by our windowing. We don't
+    // need any manual ramps or fades here because that's already included in
+    // our Hanning windows.
+    // TODO: We should probably also compensate for different FFT window sizes
+    const float input_gain =
+        juce::Decibels::decibelsToGain(static_cast<float>(input_gain_db_));
+    float makeup_gain =
+        (1.0f / (1 << windowing_overlap_order_)) *
+        juce::Decibels::decibelsToGain(static_cast<float>(output_gain_db_));
+    // Obviously don't apply auto makeup gain when doing upwards compression,
+    // that will just blow up speakers
+    if (auto_makeup_gain_) {
+        makeup_gain *= 1.0f / input_gain;
+
+        // FIXME: None of this makes any sense! But it works for our current
+        //        parameters. At some point, come up with a more
+        //        mathematically justified auto gaining algorithm.
+        if (compressor_mode != MultiwayCompressor<float>::Mode::upwards) {
+            if (sidechain_active_) {
+                // Not really sure what makes sense here
+                // TODO: Take base threshold into account
+                makeup_gain *= (compressor_ratio_ + 24.0f) / 25.0f;
+            } else {
+                // TODO: Make this smarter, make it take all of the compressor
+                //       parameters into account. It will probably start making
+                //       sense once we add parameters for the threshold and
+                //       ratio.
+                makeup_gain *=
+                    compressor_ratio_ > 1.0
+                        ? ((std::log10(compressor_ratio_ * 100.00f) * 200.0f) -
+                           399.0f) *
+                              (input_gain)
+                        : 1.0f;
+            }
+        }
+    }
+
+    auto preprocess_fn = [input_gain](std::span<float>& samples,
+                                      size_t /*channel*/) {
+        // We apply the input gain after the windowing, just before the forward
+        // FFT transformation
+        // TODO: This could be folded into the windowing function with a FMA
+        juce::FloatVectorOperations::multiply(samples.data(), input_gain,
+                                              samples.size());
+    };
+
+    // When the channels are linked, the compressors only run once per hop on
+    // the combined magnitudes of all channels, and every channel gets the same
+    // gains. This is done in `post_analysis_fn` after every channel has been
+    // transformed. Otherwise every channel gets its own envelopes, and the
+    // gains are computed in `process_fn`.
+    const size_t num_channels = static_cast<size_t>(main_io.getNumChannels());
+    const StereoLink stereo_link =
+        num_channels > 1 ? static_cast<StereoLink>(stereo_link_.getIndex())
+                         : StereoLink::off;
+    const size_t num_compressor_channels =
+        stereo_link == StereoLink::off ? num_channels : 1;
+    const size_t gain_smoothing_radius =
+        static_cast<size_t>(gain_smoothing_.get());
+
+    // Computes `process_data.bin_gains` for the active bins from the
+    // magnitudes in `process_data.bin_magnitudes`, and adds both to the
+    // analyzer. `channel` is the compressors' channel.
+    auto update_gains = [this, compressor_mode, effective_sample_rate,
+                         budget_gain_decay, num_compressor_channels,
+                         gain_smoothing_radius, &process_data](size_t channel) {
+        TRACE_ZONE_ARG("compressors", "channel", channel);
+
+        // When envelopes are decimated, the compressors only run on the first
+        // of every `envelope_decimation` hops
+        const size_t envelope_decimation = process_data.envelope_decimation;
+        const bool update_envelopes = process_data.envelope_hop_idx == 0;
+
+        // We'll update the compressor settings just before processing if the
+        // settings have changed or if the sidechaining has been disabled
+        bool update_compressors_now = false;
+        // Preparing the compressors resets their envelope followers, which can
+        // cause pops and clicks. That's only done when they haven't been
+        // prepared yet or when linking or unlinking the channels changes the
+        // number of envelopes. Changing the amount of overlap or the envelope
+        // decimation factor only changes the effective sample rate, which
+        // keeps the envelopes.
+        bool prepare_compressors_now = false;
+        bool update_sample_rate_now = false;
+        if (update_envelopes) {
+            update_compressors_now =
+                std::exchange(process_data.compressor_settings_changed, false);
+
+            prepare_compressors_now =
+                process_data.last_effective_sample_rate == 0.0 ||
+                process_data.last_num_compressor_channels !=
+                    num_compressor_channels;
+            update_sample_rate_now =
+                !prepare_compressors_now &&
+                process_data.last_effective_sample_rate !=
+                    effective_sample_rate;
+            if (prepare_compressors_now) {
+                process_data.prepared_sample_rate = effective_sample_rate;
+            }
+            process_data.last_effective_sample_rate = effective_sample_rate;
+            process_data.last_num_compressor_channels = num_compressor_channels;
+        }
+
+        const simd::Kernels& kernels = simd::kernels();
+        const BandLayout& band_layout = process_data.band_layout;
+        const size_t num_compressors = process_data.spectral_compressors.size();
+
+        // Bins outside of the frequency range are left untouched, so the
+        // detector and the gains are only computed for the bins and bands
+        // within these ranges. The scratch buffers are indexed by bin or band
+        // index, so only the part covering the active range gets touched.
+        const IndexRange active_bins = process_data.active_bins;
+        const IndexRange active_bands = process_data.active_bands;
+
+        // When the bins are grouped, the compressors only see the bands'
+        // magnitudes and their gains are spread back out over the bins below
+        const float* detector_magnitudes = process_data.bin_magnitudes.data();
+        float* detector_gains = process_data.bin_gains.data();
+        if (!band_layout.is_identity()) {
+            if (update_envelopes) {
+                band_layout.reduce(process_data.bin_magnitudes.data(),
+                                   process_data.band_magnitudes.data(),
+                                   active_bands);
+            }
+            detector_magnitudes = process_data.band_magnitudes.data();
+            detector_gains = process_data.band_gains.data();
+        }
+
+        // With decimation the compressors compute the gains we'll be
+        // interpolating towards over the next `envelope_decimation` hops
+        float* previous_envelope_gains =
+            process_data.previous_envelope_gains.data() +
+            (channel * num_compressors);
+        float* target_envelope_gains =
+            process_data.target_envelope_gains.data() +
+            (channel * num_compressors);
+        // With a CPU budget the gains need to persist between updates, since
+        // most of them will only be decayed
+        const bool has_budget = process_data.budget_num_updates > 0;
+        float* compressor_gains = envelope_decimation > 1 || has_budget
+                                      ? target_envelope_gains
+                                      : detector_gains;
+
+        // The compressors outside of the frequency range are configured as
+        // well, so they're ready to go when the range changes
+        if (update_compressors_now || prepare_compressors_now ||
+            update_sample_rate_now) {
+            for (size_t compressor_idx = 0; compressor_idx < num_compressors;
+                 compressor_idx++) {
+                auto& compressor =
+                    process_data.spectral_compressors[compressor_idx];
+
+                if (update_compressors_now) {
+                    compressor.set_mode(compressor_mode);
+                    compressor.set_multiway_deadzone(
+                        compressor_multiway_deadzone_);
+                    compressor.set_ratio(compressor_ratio_);
+                    compressor.set_attack(compressor_attack_ms_);
+                    compressor.set_release(compressor_release_ms_);
+                }
+
+                if (prepare_compressors_now) {
+                    // TODO: Now that the timings are compensated for changing
+                    //       window intervals, we might not need this to be
+                    //       configurable anymore can just leave this fixed at
+                    //       4x.
+                    compressor.prepare(juce::dsp::ProcessSpec{
+                        // We only process everything once every
+                        // `windowing_interval` (times the envelope
+                        // decimation), otherwise our attack and release times
+                        // will be all messed up
+                        .sampleRate = effective_sample_rate,
+                        .maximumBlockSize = max_samples_per_block_,
+                        .numChannels =
+                            static_cast<uint32>(num_compressor_channels)});
+                } else if (update_sample_rate_now) {
+                    compressor.set_sample_rate(effective_sample_rate);
+                }
+            }
+        }
+
+        if (update_envelopes) {
+            if (envelope_decimation > 1 && !process_data.reset_envelope_gains) {
+                std::copy_n(target_envelope_gains + active_bands.begin,
+                            active_bands.size(),
+                            previous_envelope_gains + active_bands.begin);
+            }
+
+            const juce::int64 start_ticks =
+                has_budget ? juce::Time::getHighResolutionTicks() : 0;
+
+            // With a CPU budget only the compressors for the
+            // `budget_num_updates` loudest bins or bands get a full update.
+            // Right after a reset there are no gains to decay yet, so then
+            // every compressor is updated. Bins that are exactly as loud as the
+            // quietest selected bin only fill up the remaining updates, so
+            // silence or a flat spectrum doesn't select every bin.
+            const bool limit_updates =
+                has_budget && !process_data.reset_envelope_gains &&
+                process_data.budget_num_updates < active_bands.size();
+            float budget_threshold = 0.0f;
+            size_t num_tied_updates = 0;
+            if (limit_updates) {
+                float* budget_magnitudes =
+                    process_data.budget_magnitudes.data();
+                std::copy_n(detector_magnitudes + active_bands.begin,
+                            active_bands.size(), budget_magnitudes);
+
+                float* nth_largest =
+                    budget_magnitudes + (process_data.budget_num_updates - 1);
+                std::nth_element(budget_magnitudes, nth_largest,
+                                 budget_magnitudes + active_bands.size(),
+                                 std::greater<float>());
+                budget_threshold = *nth_largest;
+                num_tied_updates =
+                    process_data.budget_num_updates -
+                    static_cast<size_t>(std::count_if(
+                        budget_magnitudes, nth_largest, [&](float value) {
+                            return value > budget_threshold;
+                        }));
+            }
+
+            // We'll compress every FTT bin or band individually. Bin 0 is the
+            // DC offset and should be skipped, and the latter half of the FFT
+            // bins should be processed in the same way as the first half but
+            // in reverse order. The real and imaginary parts are interleaved,
+            // so ever bin spans two values in the scratch buffer. We can
+            // 'safely' do this cast so we can use the STL's complex value
+            // functions.
+            for (size_t compressor_idx = active_bands.begin;
+                 compressor_idx < active_bands.end; compressor_idx++) {
+                auto& compressor =
+                    process_data.spectral_compressors[compressor_idx];
+
+                const float magnitude = detector_magnitudes[compressor_idx];
+                if (limit_updates && !(magnitude > budget_threshold)) {
+                    if (magnitude == budget_threshold && num_tied_updates > 0) {
+                        num_tied_updates -= 1;
+                    } else {
+                        // The envelope still follows the input, so the gain is
+                        // right again as soon as this bin gets selected
+                        compressor.process_envelope(channel, magnitude);
+                        compressor_gains[compressor_idx] =
+                            1.0f + ((compressor_gains[compressor_idx] - 1.0f) *
+                                    budget_gain_decay);
+                        continue;
+                    }
+                }
+
+                const float compressed_magnitude =
+                    compressor.process_sample(channel, magnitude);
+
+                // We need to scale both the imaginary and real components of
+                // the bins at the start and end of the spectrum by the same
+                // value
+                const float compression_multiplier =
+                    magnitude != 0.0f ? compressed_magnitude / magnitude
+                                      : 1.0f;
+
+                compressor_gains[compressor_idx] = compression_multiplier;
+            }
+
+            if (has_budget) {
+                process_data.budget_elapsed_ticks +=
+                    juce::Time::getHighResolutionTicks() - start_ticks;
+            }
+        }
+
+        if (envelope_decimation > 1) {
+            // Right after the decimation factor changes there's nothing to
+            // interpolate from yet
+            if (update_envelopes && process_data.reset_envelope_gains) {
+                std::copy_n(target_envelope_gains + active_bands.begin,
+                            active_bands.size(),
+                            previous_envelope_gains + active_bands.begin);
+            }
+
+            const float weight =
+                static_cast<float>(process_data.envelope_hop_idx + 1) /
+                static_cast<float>(envelope_decimation);
+            juce::FloatVectorOperations::copyWithMultiply(
+                detector_gains + active_bands.begin,
+                previous_envelope_gains + active_bands.begin, 1.0f - weight,
+                static_cast<int>(active_bands.size()));
+            kernels.multiply_add(detector_gains + active_bands.begin,
+                                 target_envelope_gains + active_bands.begin,
+                                 weight, active_bands.size());
+        } else if (has_budget) {
+            std::copy_n(target_envelope_gains + active_bands.begin,
+                        active_bands.size(),
+                        detector_gains + active_bands.begin);
+        }
+
+        if (!band_layout.is_identity()) {
+            band_layout.expand(process_data.band_gains.data(),
+                               process_data.bin_gains.data(), active_bins);
+        }
+
+        // Averaging the gains of neighbouring bins gets rid of most of the
+        // musical noise caused by every bin having its own gain, which would
+        // otherwise need a lot more overlap. The active range is padded with
+        // its outermost gains so the bins at the edges aren't pulled towards
+        // the gains of bins outside of the range.
+        if (gain_smoothing_radius > 0 && active_bins.size() > 0) {
+            const size_t width = (2 * gain_smoothing_radius) + 1;
+            float* gains = process_data.bin_gains.data() + active_bins.begin;
+            float* padded_gains = process_data.padded_gains.data();
+            std::fill_n(padded_gains, gain_smoothing_radius, gains[0]);
+            std::copy_n(gains, active_bins.size(),
+                        padded_gains + gain_smoothing_radius);
+            std::fill_n(
+                padded_gains + gain_smoothing_radius + active_bins.size(),
+                gain_smoothing_radius, gains[active_bins.size() - 1]);
+
+            kernels.box_filter(padded_gains, gains,
+                               process_data.gain_running_sums.data(), width,
+                               1.0f / static_cast<float>(width),
+                               active_bins.size());
+        }
+
+        // We don't have a compressor for the first bin. Bins outside of the
+        // frequency range don't show up in the analyzer either. With linked
+        // channels the analyzer shows the combined magnitudes.
+        const size_t analyzer_bin_stride = process_data.analyzer_bin_stride;
+        const float analyzer_window_scale =
+            static_cast<float>(process_data.analyzer_window_scale);
+        for (size_t bin_idx = active_bins.begin + 1;
+             bin_idx <= active_bins.end; bin_idx++) {
+            spectrum_fifo_.add_bin(
+                bin_idx * analyzer_bin_stride,
+                process_data.bin_magnitudes[bin_idx - 1] *
+                    analyzer_window_scale,
+                process_data.bin_gains[bin_idx - 1]);
+        }
+    };
+
+    auto analysis_fn = [stereo_link, &process_data](
+                           const std::span<std::complex<float>>& fft,
+                           size_t channel) {
+        if (stereo_link == StereoLink::off) {
+            return;
+        }
+
+        // The channels are combined into `process_data.bin_magnitudes` (or
+        // `process_data.linked_bins` for the mid mode) as they come in
+        const simd::Kernels& kernels = simd::kernels();
+        const IndexRange detector_bins = process_data.detector_bins;
+        const int num_detector_bins = static_cast<int>(detector_bins.size());
+        const std::complex<float>* bins = fft.data() + 1 + detector_bins.begin;
+        if (stereo_link == StereoLink::mid) {
+            std::complex<float>* linked_bins =
+                process_data.linked_bins.data() + detector_bins.begin;
+            if (channel == 0) {
+                std::copy_n(bins, detector_bins.size(), linked_bins);
+            } else {
+                // The real and imaginary parts can simply be added separately
+                juce::FloatVectorOperations::add(
+                    reinterpret_cast<float*>(linked_bins),
+                    reinterpret_cast<const float*>(bins),
+                    num_detector_bins * 2);
+            }
+
+            return;
+        }
+
+        float* magnitudes = process_data.bin_magnitudes.data() +
+                            detector_bins.begin;
+        if (channel == 0) {
+            kernels.magnitudes(bins, magnitudes, detector_bins.size());
+            return;
+        }
+
+        float* channel_magnitudes =
+            process_data.channel_magnitudes.data() + detector_bins.begin;
+        kernels.magnitudes(bins, channel_magnitudes, detector_bins.size());
+        if (stereo_link == StereoLink::max) {
+            juce::FloatVectorOperations::max(magnitudes, magnitudes,
+                                             channel_magnitudes,
+                                             num_detector_bins);
+        } else {
+            juce::FloatVectorOperations::add(magnitudes, channel_magnitudes,
+                                             num_detector_bins);
+        }
+    };
+    auto post_analysis_fn = [stereo_link, &process_data, &update_gains,
+                             num_channels]() {
+        if (stereo_link == StereoLink::off) {
+            return;
+        }
+
+        const IndexRange detector_bins = process_data.detector_bins;
+        float* magnitudes =
+            process_data.bin_magnitudes.data() + detector_bins.begin;
+        if (stereo_link == StereoLink::mid) {
+            simd::kernels().magnitudes(
+                process_data.linked_bins.data() + detector_bins.begin,
+                magnitudes, detector_bins.size());
+        }
+        if (stereo_link != StereoLink::max) {
+            juce::FloatVectorOperations::multiply(
+                magnitudes, 1.0f / static_cast<float>(num_channels),
+                static_cast<int>(detector_bins.size()));
+        }
+
+        update_gains(0);
+    };
+
+    // The frame file has a single layout, so in multi-resolution mode only the
+    // lower band gets written to it
+    SpectralFrameWriter* frame_writer =
+        process_data.is_upper_band ? nullptr : frame_writer_;
+    const SpectralFrameWriter::Layout frame_layout{
+        .sample_rate = sample_rate,
+        .fft_order = std::countr_zero(process_data.stft->fft_window_size),
+        .hop_size = static_cast<size_t>(windowing_interval),
+        .num_channels = num_channels};
+
+    auto process_fn = [this, sample_rate, budget_ticks, stereo_link,
+                       num_channels, analysis_only, frame_writer, frame_layout,
+                       &process_data,
+                       &update_gains](std::span<std::complex<float>>& fft,
+                                      size_t channel) {
+        const simd::Kernels& kernels = simd::kernels();
+        const IndexRange active_bins = process_data.active_bins;
+        if (stereo_link == StereoLink::off) {
+            const IndexRange detector_bins = process_data.detector_bins;
+            kernels.magnitudes(
+                fft.data() + 1 + detector_bins.begin,
+                process_data.bin_magnitudes.data() + detector_bins.begin,
+                detector_bins.size());
+
+            update_gains(channel);
+        }
+
+        // The frames contain the input spectra, so they need to be written
+        // before the gains are applied
+        if (frame_writer) {
+            if (channel == 0) {
+                frame_writer->begin_frame(frame_layout);
+            }
+            frame_writer->add_channel(
+                channel, fft.data(),
+                process_data.bin_gains.data() + active_bins.begin,
+                active_bins.begin + 1, active_bins.size());
+        }
+
+        // In analysis-only mode every channel's spectrum and gains are passed
+        // on at full resolution. When the channels are linked the detector
+        // only has the combined magnitudes, so this channel's own magnitudes
+        // are computed separately.
+        if (analysis_only) {
+            const float* magnitudes = process_data.bin_magnitudes.data();
+            if (stereo_link != StereoLink::off) {
+                kernels.magnitudes(
+                    fft.data() + 1 + active_bins.begin,
+                    process_data.channel_magnitudes.data() + active_bins.begin,
+                    active_bins.size());
+                magnitudes = process_data.channel_magnitudes.data();
+            }
+
+            analysis_consumer_(BinAnalysis{
+                .channel = channel,
+                .is_upper_band = process_data.is_upper_band,
+                .sample_rate = sample_rate,
+                .fft_window_size = process_data.stft->fft_window_size,
+                .first_bin = active_bins.begin + 1,
+                .magnitudes = std::span<const float>(
+                    magnitudes + active_bins.begin, active_bins.size()),
+                .gains = std::span<const float>(
+                    process_data.bin_gains.data() + active_bins.begin,
+                    active_bins.size())});
+        }
+
+        // Since we're usign the real-only FFT operations we don't need to
+        // touch the second, mirrored half of the FFT bins. The gains don't
+        // need to be applied when the spectrum won't be resynthesized.
+        if (!analysis_only) {
+            kernels.multiply_complex(
+                fft.data() + 1 + active_bins.begin,
+                process_data.bin_gains.data() + active_bins.begin,
+                active_bins.size());
+        }
+
+        // The analyzer's frame contains the data from all channels, so it's
+        // only sent after the last one. The same goes for advancing the
+        // decimated envelopes to the next hop. In multi-resolution mode the
+        // upper band's bins are added to the lower band's frames.
+        if (channel == num_channels - 1) {
+            if (frame_writer) {
+                frame_writer->finish_frame();
+            }
+            if (!process_data.is_upper_band) {
+                spectrum_fifo_.finish_frame(
+                    sample_rate *
+                        static_cast<double>(process_data.analyzer_window_scale),
+                    process_data.stft->fft_window_size *
+                        process_data.analyzer_window_scale,
+                    sidechain_active_);
+            }
+
+            // The number of full compressor updates is scaled by how far off
+            // we were from the budget. The steps are limited so that a single
+            // slow update, for instance because of a context switch, doesn't
+            // throw it off too much.
+            const size_t num_compressors =
+                process_data.spectral_compressors.size();
+            if (process_data.budget_num_updates > 0 &&
+                process_data.envelope_hop_idx == 0 &&
+                process_data.budget_elapsed_ticks > 0) {
+                const double scale = std::clamp(
+                    budget_ticks /
+                        static_cast<double>(process_data.budget_elapsed_ticks),
+                    0.5, 2.0);
+                process_data.budget_num_updates = std::clamp(
+                    static_cast<size_t>(std::ceil(
+                        static_cast<double>(process_data.budget_num_updates) *
+                        scale)),
+                    std::min(min_budget_num_updates, num_compressors),
+                    num_compressors);
+                process_data.budget_elapsed_ticks = 0;
+            }
+
+            process_data.envelope_hop_idx =
+                (process_data.envelope_hop_idx + 1) %
+                process_data.envelope_decimation;
+            process_data.reset_envelope_gains = false;
+        }
+
+        // TODO: We might need some kind of optional limiting stage to
+        //       be safe
+        // TODO: We should definitely add a way to recover transients
+        //       from the original input audio, that sounds really good
+
+        if (dc_filter_) {
+            fft[0] = 0;
+        }
+    };
+
+    auto postprocess_fn = [](std::span<float>& /*samples*/,
+                             size_t /*channel*/) {};
+
+    auto sidechain_fn = [this, &process_data](
+                            const std::span<std::complex<float>>& fft,
+                            size_t /*channel*/) {
+        // If sidechaining is active, we set the compressor thresholds based on
+        // a sidechain signal. Since compression is already ballistics based we
+        // don't need any additional smoothing when updating those thresholds.
+        const simd::Kernels& kernels = simd::kernels();
+        const BandLayout& band_layout = process_data.band_layout;
+        const IndexRange active_bands = process_data.active_bands;
+        const IndexRange detector_bins = process_data.detector_bins;
+        kernels.magnitudes(
+            fft.data() + 1 + detector_bins.begin,
+            process_data.bin_magnitudes.data() + detector_bins.begin,
+            detector_bins.size());
+
+        // The thresholds are only needed when the compressors run, which with
+        // envelope decimation is not on every hop
+        if (process_data.envelope_hop_idx == 0) {
+            const float* detector_magnitudes =
+                process_data.bin_magnitudes.data();
+            if (!band_layout.is_identity()) {
+                band_layout.reduce(process_data.bin_magnitudes.data(),
+                                   process_data.band_magnitudes.data(),
+                                   active_bands);
+                detector_magnitudes = process_data.band_magnitudes.data();
+            }
+
+            // We'll set the compressor threshold based on the arithmetic mean
+            // of the magnitudes of all channels. As a slight premature
+            // optimization (sorry) we'll reset these magnitudes after using
+            // them to avoid the conditional here.
+            kernels.multiply_add(
+                process_data.spectral_compressor_sidechain_thresholds.data() +
+                    active_bands.begin,
+                detector_magnitudes + active_bands.begin, 1.0f,
+                active_bands.size());
+        }
+
+        for (size_t bin_idx = detector_bins.begin; bin_idx < detector_bins.end;
+             bin_idx++) {
+            spectrum_fifo_.add_sidechain_bin(
+                (bin_idx + 1) * process_data.analyzer_bin_stride,
+                process_data.bin_magnitudes[bin_idx] *
+                    static_cast<float>(process_data.analyzer_window_scale));
+        }
+    };
+    auto post_sidechain_fn = [this, &process_data,
+                              num_channels = sidechain_io.getNumChannels()]() {
+        // After adding up the magnitudes for each bin in
+        // `process_data.spectral_compressor_sidechain_thresholds` we want to
+        // actually configure the compressor thresholds based on the mean across
+        // the different channels
+        if (process_data.envelope_hop_idx != 0) {
+            return;
+        }
+
+        for (size_t compressor_idx = process_data.active_bands.begin;
+             compressor_idx < process_data.active_bands.end;
+             compressor_idx++) {
+            const float mean_magnitude =
+                process_data.spectral_compressor_sidechain_thresholds
+                    [compressor_idx] /
+                num_channels;
+            process_data.spectral_compressors[compressor_idx].set_threshold(
+                sidechain_exponential_
+                    ? mean_magnitude
+                    : juce::Decibels::gainToDecibels(mean_magnitude));
+            process_data.spectral_compressor_sidechain_thresholds
+                [compressor_idx] = 0;
+        }
+    };
+
+    // We'll process the input signal in windows, using overlap-add. In
+    // analysis-only mode the signal is never resynthesized.
+    if (analysis_only && sidechain_active_) {
+        process_data.stft->analyze(main_io, sidechain_io,
+                                   1 << windowing_overlap_order_, sidechain_fn,
+                                   post_sidechain_fn, preprocess_fn,
+                                   analysis_fn, post_analysis_fn, process_fn);
+    } else if (analysis_only) {
+        process_data.stft->analyze(main_io, 1 << windowing_overlap_order_,
+                                   preprocess_fn, analysis_fn,
+                                   post_analysis_fn, process_fn);
+    } else if (sidechain_active_) {
+        process_data.stft->process(
+            main_io, sidechain_io, 1 << windowing_overlap_order_, makeup_gain,
+            sidechain_fn, post_sidechain_fn, preprocess_fn, analysis_fn,
+            post_analysis_fn, process_fn, postprocess_fn);
+    } else {
+        process_data.stft->process(main_io, 1 << windowing_overlap_order_,
+                                   makeup_gain, preprocess_fn, analysis_fn,
+                                   post_analysis_fn, process_fn,
+                                   postprocess_fn);
+    }
 }
 
 bool SpectralCompressorProcessor::hasEditor() const {
@@ -586,15 +1562,19 @@ bool SpectralCompressorProcessor::hasEditor() const {
 }
 
 juce::AudioProcessorEditor* SpectralCompressorProcessor::createEditor() {
-    // TODO: Add an editor at some point
-    // return new SpectralCompressorEditor(*this);
-    return new juce::GenericAudioProcessorEditor(*this);
+    return new SpectralCompressorEditor(*this);
 }
 
 void SpectralCompressorProcessor::getStateInformation(
     juce::MemoryBlock& destData) {
-    const std::unique_ptr<juce::XmlElement> xml =
-        parameters_.copyState().createXml();
+    // The threshold curve is not a parameter, so it's stored as a child of
+    // the parameter state
+    juce::ValueTree state = parameters_.copyState();
+    state.removeChild(
+        state.getChildWithName(ThresholdCurve::value_tree_type), nullptr);
+    state.appendChild(threshold_curve().to_value_tree(), nullptr);
+
+    const std::unique_ptr<juce::XmlElement> xml = state.createXml();
     copyXmlToBinary(*xml, destData);
 }
 
@@ -602,7 +1582,12 @@ void SpectralCompressorProcessor::setStateInformation(const void* data,
                                                       int sizeInBytes) {
     const auto xml = getXmlFromBinary(data, sizeInBytes);
     if (xml && xml->hasTagName(parameters_.state.getType())) {
-        parameters_.replaceState(juce::ValueTree::fromXml(*xml));
+        const juce::ValueTree state = juce::ValueTree::fromXml(*xml);
+        parameters_.replaceState(state);
+
+        // Presets from before the curve existed get the default curve
+        set_threshold_curve(ThresholdCurve::from_value_tree(
+            state.getChildWithName(ThresholdCurve::value_tree_type)));
     }
 
     // TODO: Should we do this here, is will `prepareToPlay()` always be called
@@ -613,31 +1598,856 @@ void SpectralCompressorProcessor::setStateInformation(const void* data,
     //       called during playback (without `prepareToPlay()` being called
     //       first)?
     // TODO: Move the latency computation elsewhere
-    const size_t new_window_size = 1 << fft_order_;
-    setLatencySamples(new_window_size);
+    setLatencySamples(expected_latency_samples());
+}
+
+void SpectralCompressorProcessor::capture_on_next_prepare(
+    const juce::File& file) {
+    pending_capture_file_ = file;
+}
+
+void SpectralCompressorProcessor::stop_capture() {
+    pending_capture_file_.reset();
+    capture_.stop();
+}
+
+MemoryUsage SpectralCompressorProcessor::memory_usage() const {
+    const size_t num_channels =
+        static_cast<size_t>(getMainBusNumInputChannels());
+
+    MemoryUsage usage{};
+    process_data_.inspect(
+        [&](const ProcessData& active, const ProcessData& inactive) {
+            usage.active_process_data = active.memory_usage(num_channels);
+            usage.inactive_process_data = inactive.memory_usage(num_channels);
+        });
+    usage.mixer = mixer_memory_usage();
+    usage.other = sizeof(*this) + spectrum_fifo_.memory_usage() +
+                  capture_.memory_usage();
+    threshold_tables_.inspect(
+        [&](const ThresholdTables& active, const ThresholdTables& inactive) {
+            usage.other += active.memory_usage() + inactive.memory_usage();
+        });
+
+    return usage;
+}
+
+std::optional<fft::Backend> SpectralCompressorProcessor::fft_backend() const {
+    std::optional<fft::Backend> backend;
+    process_data_.inspect(
+        [&](const ProcessData& active, const ProcessData& /*inactive*/) {
+            if (active.stft) {
+                backend = active.stft->fft_backend();
+            }
+        });
+
+    return backend;
+}
+
+void SpectralCompressorProcessor::set_analysis_only(
+    BinAnalysisConsumer consumer) {
+    analysis_only_ = static_cast<bool>(consumer);
+    analysis_consumer_ = std::move(consumer);
+}
+
+void SpectralCompressorProcessor::set_frame_writer(
+    SpectralFrameWriter* writer) {
+    frame_writer_ = writer;
+}
+
+void SpectralCompressorProcessor::set_analysis_cache(
+    AnalysisCacheProvider* cache) {
+    analysis_cache_ = cache;
+    analysis_cache_num_samples_ = 0;
+}
+
+bool SpectralCompressorProcessor::save_checkpoint(juce::OutputStream& stream) {
+    ProcessData& process_data = process_data_.get();
+    if (!process_data.stft) {
+        return false;
+    }
+
+    process_data.write_state(stream);
+    stream.writeInt(checkpoint_end_marker);
+
+    return true;
+}
+
+bool SpectralCompressorProcessor::restore_checkpoint(
+    juce::InputStream& stream,
+    const juce::AudioBuffer<float>& dry_history) {
+    const int num_channels = getMainBusNumInputChannels();
+    ProcessData& process_data = process_data_.get();
+    if (!process_data.stft || !mixer_ ||
+        dry_history.getNumChannels() < num_channels ||
+        !process_data.read_state(stream, max_samples_per_block_) ||
+        stream.readInt() != checkpoint_end_marker) {
+        return false;
+    }
+
+    // JUCE's dry-wet mixer doesn't expose the delay line that compensates the
+    // dry signal for our latency, but that delay line only holds the last
+    // latency's worth of dry input. Feeding that input through the mixer again
+    // leaves it in the same state as during the original render. The mix
+    // proportion is set before the reset so it doesn't ramp.
+    mixer_->setWetMixProportion(dry_wet_ratio_);
+    mixer_->reset();
+    mixer_->setWetLatency(process_data.decimator
+                             ? process_data.decimator->latency_samples()
+                             : process_data.stft->latency_samples());
+
+    const int max_block_size = static_cast<int>(max_samples_per_block_);
+    juce::AudioBuffer<float> scratch_buffer(num_channels, max_block_size);
+    for (int offset = 0; offset < dry_history.getNumSamples();
+         offset += max_block_size) {
+        const int num_samples =
+            std::min(dry_history.getNumSamples() - offset, max_block_size);
+        for (int channel = 0; channel < num_channels; channel++) {
+            scratch_buffer.copyFrom(channel, 0, dry_history, channel, offset,
+                                    num_samples);
+        }
+
+        juce::dsp::AudioBlock<float> block =
+            juce::dsp::AudioBlock<float>(scratch_buffer)
+                .getSubBlock(0, static_cast<size_t>(num_samples));
+        mixer_->pushDrySamples(block);
+        mixer_->mixWetSamples(block);
+    }
+
+    return true;
+}
+
+ThresholdCurve SpectralCompressorProcessor::threshold_curve() const {
+    std::lock_guard lock(threshold_curve_mutex_);
+    return threshold_curve_;
+}
+
+void SpectralCompressorProcessor::set_threshold_curve(ThresholdCurve curve) {
+    {
+        std::lock_guard lock(threshold_curve_mutex_);
+        threshold_curve_ = std::move(curve);
+        threshold_curve_version_++;
+    }
+
+    threshold_table_updater_.trigger_update();
+}
+
+void SpectralCompressorProcessor::set_memory_budget(
+    std::optional<size_t> budget_bytes) {
+    memory_budget_ = budget_bytes;
+    if (update_max_fft_order()) {
+        // This works the same way as changing the FFT order parameter
+        process_data_updater_.triggerAsyncUpdate();
+    }
+}
+
+int SpectralCompressorProcessor::effective_fft_order() const {
+    return std::min(fft_order_.get(), max_fft_order_);
+}
+
+ProcessingLayout SpectralCompressorProcessor::processing_layout(
+    int fft_order) const {
+    return processing_layout(
+        fft_order, getSampleRate(), multi_resolution_.get(),
+        internal_bandwidths[internal_bandwidth_.getIndex()]);
+}
+
+ProcessingLayout SpectralCompressorProcessor::processing_layout(
+    int fft_order,
+    double sample_rate,
+    bool multi_resolution,
+    double internal_bandwidth) const {
+    // In multi-resolution mode the lower band is decimated as far as possible
+    // without going below the lowest FFT order. Its STFT then has the same
+    // frequency resolution and latency as a full rate STFT at `fft_order`.
+    if (multi_resolution) {
+        const int lowest_fft_order = fft_order_.getRange().getStart();
+        const int decimation_order =
+            std::min(std::countr_zero(max_internal_decimation_factor),
+                     fft_order - lowest_fft_order);
+        if (decimation_order > 0) {
+            return ProcessingLayout{
+                .fft_order = fft_order - decimation_order,
+                .decimation_factor = static_cast<size_t>(1) << decimation_order,
+                .upper_fft_order = std::min(upper_fft_order_.get(), fft_order)};
+        }
+    }
+
+    return ProcessingLayout{
+        .fft_order = fft_order,
+        .decimation_factor =
+            internal_decimation_factor_for(sample_rate, internal_bandwidth),
+        .upper_fft_order = std::nullopt};
+}
+
+size_t SpectralCompressorProcessor::max_latency_samples(
+    double sample_rate) const {
+    // The latency grows with the FFT order, so only the largest one needs to
+    // be considered. The memory budget can be raised again while playing, so
+    // that doesn't limit it.
+    size_t latency = 0;
+    for (const bool multi_resolution : {false, true}) {
+        for (const double internal_bandwidth : internal_bandwidths) {
+            latency = std::max(
+                latency, processing_layout(fft_order_maximum, sample_rate,
+                                           multi_resolution, internal_bandwidth)
+                             .latency_samples());
+        }
+    }
+
+    return latency;
+}
+
+ProcessingLayout SpectralCompressorProcessor::processing_layout() const {
+    return processing_layout(effective_fft_order());
+}
+
+int SpectralCompressorProcessor::expected_latency_samples() const {
+    return static_cast<int>(processing_layout().latency_samples());
+}
+
+void SpectralCompressorProcessor::apply_pending_process_data_update() {
+    process_data_updater_.cancelPendingUpdate();
+    process_data_updater_.handleAsyncUpdate();
+}
+
+ProcessData& SpectralCompressorProcessor::begin_processing_cycle(
+    const juce::AudioBuffer<float>& buffer,
+    bool bypassed) {
+    ProcessData& process_data = process_data_.get();
+
+    // The compressors in a newly swapped in object still need to be configured.
+    // This is done here instead of in `update_and_swap_process_data()` so the
+    // previous object can't consume these updates before the swap.
+    const bool process_data_swapped = process_data.is_fresh;
+    if (process_data_swapped) {
+        process_data.is_fresh = false;
+        if (process_data.upper_band) {
+            process_data.upper_band->is_fresh = false;
+        }
+    }
+
+    // Both bands in multi-resolution mode have their own compressors, so the
+    // settings change gets passed on to both of them
+    bool expected = true;
+    if (compressor_settings_changed_.compare_exchange_strong(expected,
+                                                             false)) {
+        process_data.compressor_settings_changed = true;
+        if (process_data.upper_band) {
+            process_data.upper_band->compressor_settings_changed = true;
+        }
+    }
+
+    if (capture_.is_active()) {
+        capture_.record_parameters(getParameters());
+        if (process_data_swapped) {
+            const ProcessData* upper_band = process_data.upper_band.get();
+            capture_.record_process_data_swap(
+                std::countr_zero(process_data.stft->fft_window_size),
+                process_data.stft->fft_backend(),
+                upper_band
+                    ? std::countr_zero(upper_band->stft->fft_window_size)
+                    : -1,
+                upper_band ? upper_band->stft->fft_backend()
+                           : process_data.stft->fft_backend());
+        }
+        capture_.record_block(buffer, bypassed);
+    }
+
+    return process_data;
+}
+
+void SpectralCompressorProcessor::update_analysis_cache(
+    ProcessData& process_data,
+    size_t num_channels) {
+    if (!analysis_cache_ && !process_data.stft->forward_cache() &&
+        !(process_data.upper_band &&
+          process_data.upper_band->stft->forward_cache())) {
+        return;
+    }
+
+    // The lower band's input depends on the band split, so that's part of its
+    // key as well
+    const size_t decimation_factor =
+        process_data.decimator ? process_data.decimator->factor() : 1;
+    const int upper_fft_order =
+        process_data.upper_band
+            ? std::countr_zero(process_data.upper_band->stft->fft_window_size)
+            : 0;
+    auto update = [&](ProcessData& band_data, double sample_rate,
+                      size_t band) {
+        const AnalysisCacheKey key{
+            .fft_order = std::countr_zero(band_data.stft->fft_window_size),
+            .overlap_order = windowing_overlap_order_,
+            .sample_rate = sample_rate,
+            .num_channels = num_channels,
+            .sidechain_active = sidechain_active_,
+            .band = band,
+            .decimation_factor = decimation_factor,
+            .upper_fft_order = upper_fft_order,
+            .input_gain_db = input_gain_db_};
+
+        // The positions the STFT passes to the cache are only meaningful if
+        // it has been processing the input from the very start
+        if (!analysis_cache_) {
+            band_data.stft->set_forward_cache(nullptr);
+        } else if (band_data.stft->forward_cache()) {
+            if (key != band_data.analysis_cache_key) {
+                band_data.stft->set_forward_cache(nullptr);
+            }
+        } else if (analysis_cache_num_samples_ == 0 &&
+                   band_data.stft->num_input_samples() == 0) {
+            band_data.stft->set_forward_cache(analysis_cache_->open(key));
+            band_data.analysis_cache_key = key;
+        }
+    };
+
+    update(process_data,
+           getSampleRate() / static_cast<double>(decimation_factor), 0);
+    if (process_data.upper_band) {
+        update(*process_data.upper_band, getSampleRate(), 1);
+    }
+}
+
+template <typename F>
+void SpectralCompressorProcessor::process_bands(
+    ProcessData& process_data,
+    juce::AudioBuffer<float>& main_io,
+    juce::AudioBuffer<float>& sidechain_io,
+    bool use_sidechain,
+    F&& process) {
+    const double sample_rate = getSampleRate();
+    if (!process_data.decimator) {
+        process(process_data, sample_rate, main_io, sidechain_io);
+        return;
+    }
+
+    const double decimated_sample_rate =
+        sample_rate / static_cast<double>(process_data.decimator->factor());
+
+    // The decimators have a fixed maximum block size, so longer blocks are
+    // split up. These buffers only refer to other buffers' data, so this
+    // doesn't allocate.
+    const size_t num_samples = static_cast<size_t>(main_io.getNumSamples());
+    for (size_t offset = 0; offset < num_samples;
+         offset += BandSplitDecimator::max_block_size) {
+        const size_t chunk_size = std::min(
+            num_samples - offset, BandSplitDecimator::max_block_size);
+
+        juce::AudioBuffer<float> main_chunk(
+            main_io.getArrayOfWritePointers(), main_io.getNumChannels(),
+            static_cast<int>(offset), static_cast<int>(chunk_size));
+        juce::AudioBuffer<float> sidechain_chunk;
+        if (use_sidechain) {
+            sidechain_chunk = juce::AudioBuffer<float>(
+                sidechain_io.getArrayOfWritePointers(),
+                sidechain_io.getNumChannels(), static_cast<int>(offset),
+                static_cast<int>(chunk_size));
+        }
+
+        // In multi-resolution mode the upper band is processed on a copy of
+        // the input, since the lower band still needs to be split off from the
+        // unprocessed input
+        juce::AudioBuffer<float> lower_band;
+        if (process_data.upper_band) {
+            juce::AudioBuffer<float> upper_chunk(
+                process_data.upper_band_buffer.getArrayOfWritePointers(),
+                main_io.getNumChannels(), static_cast<int>(chunk_size));
+            for (int channel = 0; channel < main_io.getNumChannels();
+                 channel++) {
+                upper_chunk.copyFrom(channel, 0, main_chunk, channel, 0,
+                                     static_cast<int>(chunk_size));
+            }
+
+            process(*process_data.upper_band, sample_rate, upper_chunk,
+                    sidechain_chunk);
+            lower_band = process_data.decimator->split(main_chunk, upper_chunk,
+                                                       chunk_size);
+        } else {
+            lower_band = process_data.decimator->split(main_chunk, chunk_size);
+        }
+
+        juce::AudioBuffer<float> sidechain_lower_band;
+        if (use_sidechain) {
+            sidechain_lower_band = process_data.sidechain_decimator->process(
+                sidechain_chunk, chunk_size);
+        }
+
+        process(process_data, decimated_sample_rate, lower_band,
+                sidechain_lower_band);
+        process_data.decimator->join(lower_band, main_chunk, chunk_size);
+    }
 }
 
 void SpectralCompressorProcessor::update_and_swap_process_data() {
-    process_data_.modify_and_swap([this](ProcessData& process_data) {
-        process_data.stft.emplace(getMainBusNumInputChannels(), fft_order_);
-
-        // Every FFT bin on both channels gets its own compressor, hooray! The
-        // `fft_window_size / 2` is because the first bin is the DC offset and
-        // shouldn't be compressed, and the bins after the Nyquist frequency are
-        // the same as the first half but in reverse order. The compressor
-        // settings will be set in `update_compressors()`, which is triggered on
-        // the next processing cycle by setting `compressor_settings_changed`
-        // below.
-        process_data.spectral_compressors.resize(
-            process_data.stft->fft_window_size / 2);
-        process_data.spectral_compressor_sidechain_thresholds.resize(
-            process_data.spectral_compressors.size());
-
-        // After resizing the compressors are uninitialized and should be
-        // reinitialized
-        compressor_settings_changed_ = true;
-        last_effective_sample_rate_ = 0.0;
+    TRACE_ZONE("update_and_swap_process_data");
+
+    const ThresholdCurve curve = threshold_curve();
+    size_t curve_version;
+    {
+        std::lock_guard lock(threshold_curve_mutex_);
+        curve_version = threshold_curve_version_;
+    }
+
+    process_data_.modify_and_swap([&](ProcessData& process_data) {
+        const ProcessingLayout layout = processing_layout();
+        const size_t num_channels =
+            static_cast<size_t>(getMainBusNumInputChannels());
+        const BinGrouping bin_grouping =
+            static_cast<BinGrouping>(bin_grouping_.getIndex());
+
+        // At high sample rates or in multi-resolution mode the STFT only sees
+        // a decimated lower band, see `internal_bandwidth_` and
+        // `multi_resolution_`
+        process_data.initialize(
+            num_channels, layout.fft_order,
+            getSampleRate() / static_cast<double>(layout.decimation_factor),
+            bin_grouping);
+
+        // In multi-resolution mode the upper band gets its own STFT and
+        // compressors at the full sample rate. Both bands are shown in the
+        // analyzer at the resolution set by the FFT order parameter.
+        if (layout.upper_fft_order) {
+            if (!process_data.upper_band) {
+                process_data.upper_band = std::make_unique<ProcessData>();
+            }
+
+            ProcessData& upper_band = *process_data.upper_band;
+            upper_band.initialize(num_channels, *layout.upper_fft_order,
+                                  getSampleRate(), bin_grouping);
+
+            const size_t analyzer_window_size =
+                process_data.stft->fft_window_size * layout.decimation_factor;
+            upper_band.is_upper_band = true;
+            upper_band.analyzer_window_scale =
+                analyzer_window_size / upper_band.stft->fft_window_size;
+            upper_band.analyzer_bin_stride = upper_band.analyzer_window_scale;
+            process_data.analyzer_window_scale = layout.decimation_factor;
+            process_data.upper_band_buffer.setSize(
+                static_cast<int>(num_channels),
+                static_cast<int>(BandSplitDecimator::max_block_size));
+        } else {
+            process_data.upper_band.reset();
+            process_data.upper_band_buffer.setSize(0, 0);
+            process_data.analyzer_window_scale = 1;
+        }
+
+        if (layout.decimation_factor > 1) {
+            process_data.decimator.emplace(
+                num_channels, layout.decimation_factor,
+                static_cast<size_t>(process_data.stft->latency_samples()),
+                process_data.upper_band
+                    ? static_cast<size_t>(
+                          process_data.upper_band->stft->latency_samples())
+                    : 0);
+            process_data.sidechain_decimator.emplace(
+                num_channels, layout.decimation_factor,
+                BandSplitDecimator::max_block_size);
+        } else {
+            process_data.decimator.reset();
+            process_data.sidechain_decimator.reset();
+        }
+
+        // The new compressors get their thresholds right away, since the
+        // tables for the new layouts are only swapped in after this
+        process_data.apply_thresholds(
+            ThresholdTable(curve, process_data.band_layout, curve_version));
+        if (process_data.upper_band) {
+            process_data.upper_band->apply_thresholds(ThresholdTable(
+                curve, process_data.upper_band->band_layout, curve_version));
+        }
     });
+
+    threshold_table_updater_.trigger_update();
+}
+
+void SpectralCompressorProcessor::update_threshold_tables() {
+    TRACE_ZONE("update_threshold_tables");
+
+    ThresholdCurve curve;
+    size_t curve_version;
+    {
+        std::lock_guard lock(threshold_curve_mutex_);
+        curve = threshold_curve_;
+        curve_version = threshold_curve_version_;
+    }
+
+    // Both objects' layouts are included since the audio thread may still be
+    // using the active object when these tables get swapped in
+    ThresholdTables tables;
+    process_data_.inspect(
+        [&](const ProcessData& active, const ProcessData& inactive) {
+            const std::array<const ProcessData*, 4> process_data_objects{
+                &active, active.upper_band.get(), &inactive,
+                inactive.upper_band.get()};
+            for (const ProcessData* process_data : process_data_objects) {
+                if (process_data && process_data->stft &&
+                    !tables.find(process_data->band_layout)) {
+                    tables.tables.emplace_back(
+                        curve, process_data->band_layout, curve_version);
+                }
+            }
+        });
+
+    threshold_tables_.modify_and_swap(
+        [&](ThresholdTables& threshold_tables) {
+            threshold_tables = std::move(tables);
+        });
+}
+
+void ProcessData::initialize(size_t num_channels,
+                             int fft_order,
+                             double sample_rate,
+                             BinGrouping bin_grouping) {
+    stft.emplace(num_channels, static_cast<size_t>(fft_order));
+    band_layout = BandLayout(bin_grouping, stft->fft_window_size, sample_rate);
+
+    // Every FFT bin (or band of bins) on both channels gets its own compressor,
+    // hooray! There are `fft_window_size / 2` bins because the first bin is the
+    // DC offset and shouldn't be compressed, and the bins after the Nyquist
+    // frequency are the same as the first half but in reverse order. The
+    // compressor settings will be set on the next processing cycle by setting
+    // `compressor_settings_changed` below.
+    const size_t num_bins = band_layout.num_bins();
+    const size_t num_bands = band_layout.num_bands();
+    const bool is_grouped = !band_layout.is_identity();
+    spectral_compressors.resize(num_bands);
+    spectral_compressor_sidechain_thresholds.resize(num_bands);
+    bin_magnitudes.resize(num_bins);
+    padded_gains.resize(num_bins + (2 * max_gain_smoothing_radius));
+    gain_running_sums.resize(padded_gains.size() + 1);
+    bin_gains.resize(num_bins);
+    band_magnitudes.resize(is_grouped ? num_bands : 0);
+    band_gains.resize(is_grouped ? num_bands : 0);
+    channel_magnitudes.resize(num_bins);
+    linked_bins.resize(num_bins);
+    previous_envelope_gains.resize(num_bands * num_channels);
+    target_envelope_gains.resize(previous_envelope_gains.size());
+    budget_magnitudes.resize(num_bands);
+    // Shrinking a vector doesn't free anything, and going back to a smaller
+    // window size would otherwise keep holding on to the memory from the
+    // larger window size
+    spectral_compressors.shrink_to_fit();
+    spectral_compressor_sidechain_thresholds.shrink_to_fit();
+    bin_magnitudes.shrink_to_fit();
+    padded_gains.shrink_to_fit();
+    gain_running_sums.shrink_to_fit();
+    bin_gains.shrink_to_fit();
+    band_magnitudes.shrink_to_fit();
+    band_gains.shrink_to_fit();
+    channel_magnitudes.shrink_to_fit();
+    linked_bins.shrink_to_fit();
+    previous_envelope_gains.shrink_to_fit();
+    target_envelope_gains.shrink_to_fit();
+    budget_magnitudes.shrink_to_fit();
+
+    envelope_decimation = 1;
+    envelope_hop_idx = 0;
+    reset_envelope_gains = true;
+    budget_num_updates = 0;
+    budget_elapsed_ticks = 0;
+    // These are set on the next processing cycle
+    active_bins = IndexRange{};
+    active_bands = IndexRange{};
+    detector_bins = IndexRange{};
+    is_upper_band = false;
+    analyzer_window_scale = 1;
+    analyzer_bin_stride = 1;
+
+    // After resizing the compressors are uninitialized and should be
+    // reinitialized. This happens on the audio thread after the swap, see
+    // `begin_processing_cycle()`.
+    compressor_settings_changed = true;
+    last_effective_sample_rate = 0.0;
+    prepared_sample_rate = 0.0;
+    last_num_compressor_channels = 0;
+    is_fresh = true;
+}
+
+bool SpectralCompressorProcessor::update_max_fft_order() {
+    int new_max_fft_order = fft_order_maximum;
+    if (memory_budget_) {
+        const size_t num_channels =
+            static_cast<size_t>(std::max(getMainBusNumInputChannels(), 1));
+        // Everything outside of the process data doesn't depend on the FFT
+        // order
+        const size_t fixed_usage =
+            sizeof(*this) + spectrum_fifo_.memory_usage() +
+            mixer_memory_usage();
+
+        // Both slots in `process_data_` can end up holding buffers for this
+        // FFT order, so the budget needs to account for two of them
+        const int lowest_fft_order = fft_order_.getRange().getStart();
+        new_max_fft_order = lowest_fft_order;
+        for (int fft_order = fft_order_maximum; fft_order > lowest_fft_order;
+             fft_order--) {
+            const size_t process_data_usage =
+                ProcessData::estimate_memory_usage(
+                    num_channels, processing_layout(fft_order))
+                    .total();
+            if (fixed_usage + (2 * process_data_usage) <= *memory_budget_) {
+                new_max_fft_order = fft_order;
+                break;
+            }
+        }
+    }
+
+    const bool changed = new_max_fft_order != max_fft_order_;
+    max_fft_order_ = new_max_fft_order;
+
+    return changed;
+}
+
+size_t SpectralCompressorProcessor::mixer_memory_usage() const {
+    // The mixer only allocates when it gets prepared
+    if (max_samples_per_block_ == 0) {
+        return 0;
+    }
+
+    // The dry signal delay line is sized for the largest latency at the
+    // current sample rate, and the dry buffer can hold a single block
+    const size_t num_channels =
+        static_cast<size_t>(getMainBusNumInputChannels());
+    return num_channels *
+           ((mixer_max_latency_samples_ + 1) + max_samples_per_block_) *
+           sizeof(float);
+}
+
+void ProcessData::apply_thresholds(const ThresholdTable& table) {
+    jassert(table.matches(band_layout));
+    jassert(table.thresholds.size() == spectral_compressors.size());
+
+    for (size_t compressor_idx = 0;
+         compressor_idx < spectral_compressors.size(); compressor_idx++) {
+        spectral_compressors[compressor_idx].set_threshold_gain(
+            table.thresholds[compressor_idx]);
+    }
+    threshold_version = table.version;
+}
+
+void ProcessData::write_state(juce::OutputStream& stream) {
+    jassert(stft);
+
+    stream.writeDouble(band_layout.sample_rate());
+    stream.writeInt64(static_cast<juce::int64>(spectral_compressors.size()));
+    stft->write_state(stream);
+    stream.writeBool(decimator.has_value());
+    if (decimator) {
+        decimator->write_state(stream);
+    }
+    stream.writeBool(sidechain_decimator.has_value());
+    if (sidechain_decimator) {
+        sidechain_decimator->write_state(stream);
+    }
+
+    stream.writeInt64(static_cast<juce::int64>(envelope_decimation));
+    stream.writeInt64(static_cast<juce::int64>(envelope_hop_idx));
+    stream.writeBool(reset_envelope_gains);
+    write_floats(stream, previous_envelope_gains);
+    write_floats(stream, target_envelope_gains);
+    stream.writeInt64(static_cast<juce::int64>(budget_num_updates));
+    stream.writeInt64(budget_elapsed_ticks);
+    for (const IndexRange& range : {active_bins, active_bands, detector_bins}) {
+        stream.writeInt64(static_cast<juce::int64>(range.begin));
+        stream.writeInt64(static_cast<juce::int64>(range.end));
+    }
+
+    // The compressors are only prepared once they've run for the first time.
+    // Until then there are no envelopes to store, and they'll be prepared
+    // again after restoring the state.
+    stream.writeDouble(last_effective_sample_rate);
+    stream.writeDouble(prepared_sample_rate);
+    stream.writeInt64(static_cast<juce::int64>(last_num_compressor_channels));
+    const size_t num_envelope_channels =
+        last_effective_sample_rate > 0.0 ? last_num_compressor_channels : 0;
+    stream.writeInt64(static_cast<juce::int64>(num_envelope_channels));
+    for (auto& compressor : spectral_compressors) {
+        for (size_t channel = 0; channel < num_envelope_channels; channel++) {
+            stream.writeFloat(compressor.envelope(static_cast<int>(channel)));
+        }
+    }
+
+    stream.writeBool(static_cast<bool>(upper_band));
+    if (upper_band) {
+        upper_band->write_state(stream);
+    }
+}
+
+bool ProcessData::read_state(juce::InputStream& stream,
+                             juce::uint32 max_block_size) {
+    jassert(stft);
+
+    if (stream.readDouble() != band_layout.sample_rate() ||
+        stream.readInt64() !=
+            static_cast<juce::int64>(spectral_compressors.size()) ||
+        !stft->read_state(stream)) {
+        return false;
+    }
+    if (stream.readBool() != decimator.has_value() ||
+        (decimator && !decimator->read_state(stream))) {
+        return false;
+    }
+    if (stream.readBool() != sidechain_decimator.has_value() ||
+        (sidechain_decimator && !sidechain_decimator->read_state(stream))) {
+        return false;
+    }
+
+    const juce::int64 new_envelope_decimation = stream.readInt64();
+    const juce::int64 new_envelope_hop_idx = stream.readInt64();
+    if (new_envelope_decimation < 1 || new_envelope_hop_idx < 0 ||
+        new_envelope_hop_idx >= new_envelope_decimation) {
+        return false;
+    }
+    envelope_decimation = static_cast<size_t>(new_envelope_decimation);
+    envelope_hop_idx = static_cast<size_t>(new_envelope_hop_idx);
+    reset_envelope_gains = stream.readBool();
+    if (!read_floats(stream, previous_envelope_gains) ||
+        !read_floats(stream, target_envelope_gains)) {
+        return false;
+    }
+    budget_num_updates = std::min(static_cast<size_t>(stream.readInt64()),
+                                  spectral_compressors.size());
+    budget_elapsed_ticks = stream.readInt64();
+    if (!read_range(stream, active_bins, band_layout.num_bins()) ||
+        !read_range(stream, active_bands, spectral_compressors.size()) ||
+        !read_range(stream, detector_bins, band_layout.num_bins())) {
+        return false;
+    }
+
+    last_effective_sample_rate = stream.readDouble();
+    prepared_sample_rate = stream.readDouble();
+    last_num_compressor_channels = static_cast<size_t>(stream.readInt64());
+    const juce::int64 num_envelope_channels = stream.readInt64();
+    if (num_envelope_channels > 0) {
+        if (num_envelope_channels !=
+                static_cast<juce::int64>(last_num_compressor_channels) ||
+            !(last_effective_sample_rate > 0.0) ||
+            !(prepared_sample_rate > 0.0)) {
+            return false;
+        }
+
+        // This reproduces the compressor updates that led up to the
+        // checkpoint, so the next update won't prepare the compressors again
+        // and reset their envelopes. The sample rate is applied the same way
+        // so the envelope followers end up with the exact same coefficients.
+        for (auto& compressor : spectral_compressors) {
+            compressor.prepare(juce::dsp::ProcessSpec{
+                .sampleRate = prepared_sample_rate,
+                .maximumBlockSize = max_block_size,
+                .numChannels = static_cast<uint32>(num_envelope_channels)});
+            compressor.set_sample_rate(last_effective_sample_rate);
+            for (int channel = 0; channel < num_envelope_channels; channel++) {
+                compressor.set_envelope(channel, stream.readFloat());
+            }
+        }
+    } else {
+        last_effective_sample_rate = 0.0;
+    }
+
+    if (stream.readBool() != static_cast<bool>(upper_band) ||
+        (upper_band && !upper_band->read_state(stream, max_block_size))) {
+        return false;
+    }
+
+    return true;
+}
+
+ProcessDataMemoryUsage ProcessData::memory_usage(size_t num_channels) const {
+    ProcessDataMemoryUsage usage{};
+    if (stft) {
+        usage.ring_buffers = stft->ring_buffer_memory_usage();
+        usage.scratch_buffers = stft->scratch_buffer_memory_usage();
+        usage.fft =
+            STFT<true>::estimate_fft_memory_usage(stft->fft_window_size);
+    }
+    if (decimator) {
+        usage.ring_buffers += decimator->ring_buffer_memory_usage();
+        usage.scratch_buffers += decimator->scratch_buffer_memory_usage();
+    }
+    if (sidechain_decimator) {
+        usage.scratch_buffers += sidechain_decimator->memory_usage();
+    }
+
+    usage.scratch_buffers +=
+        (spectral_compressor_sidechain_thresholds.capacity() +
+         bin_magnitudes.capacity() + bin_gains.capacity() +
+         padded_gains.capacity() + band_magnitudes.capacity() +
+         band_gains.capacity() + channel_magnitudes.capacity() +
+         previous_envelope_gains.capacity() + target_envelope_gains.capacity() +
+         budget_magnitudes.capacity()) *
+            sizeof(float) +
+        (gain_running_sums.capacity() * sizeof(double)) +
+        (linked_bins.capacity() * sizeof(std::complex<float>));
+    // Every compressor's envelope follower stores a sample per channel
+    usage.compressors =
+        (spectral_compressors.capacity() * sizeof(MultiwayCompressor<float>)) +
+        (spectral_compressors.size() * num_channels * sizeof(float)) +
+        band_layout.memory_usage();
+
+    if (upper_band) {
+        usage += upper_band->memory_usage(num_channels);
+        usage.scratch_buffers +=
+            static_cast<size_t>(upper_band_buffer.getNumChannels()) *
+            static_cast<size_t>(upper_band_buffer.getNumSamples()) *
+            sizeof(float);
+    }
+
+    return usage;
+}
+
+ProcessDataMemoryUsage ProcessData::estimate_memory_usage(
+    size_t num_channels,
+    const ProcessingLayout& layout) {
+    const size_t fft_window_size = static_cast<size_t>(1) << layout.fft_order;
+    const size_t num_compressors = fft_window_size / 2;
+
+    ProcessDataMemoryUsage usage{
+        .ring_buffers = STFT<true>::estimate_ring_buffer_memory_usage(
+            num_channels, fft_window_size),
+        .scratch_buffers =
+            STFT<true>::estimate_scratch_buffer_memory_usage(num_channels,
+                                                             fft_window_size) +
+            (((8 + (2 * num_channels)) * num_compressors) +
+             (2 * max_gain_smoothing_radius)) *
+                sizeof(float) +
+            // The box filter's running sums
+            ((num_compressors + (2 * max_gain_smoothing_radius) + 1) *
+             sizeof(double)),
+        // Without grouping the band layout only stores a frequency per bin
+        .compressors = num_compressors * (sizeof(MultiwayCompressor<float>) +
+                                          (num_channels * sizeof(float)) +
+                                          sizeof(float)),
+        .fft = STFT<true>::estimate_fft_memory_usage(fft_window_size)};
+    // The estimate for the band split doesn't distinguish between the delay
+    // lines and the filters, so it's all counted as scratch buffers
+    const size_t decimation_factor = layout.decimation_factor;
+    if (decimation_factor > 1) {
+        const size_t upper_latency =
+            layout.upper_fft_order
+                ? static_cast<size_t>(1) << *layout.upper_fft_order
+                : 0;
+        usage.scratch_buffers +=
+            BandSplitDecimator::estimate_memory_usage(
+                num_channels, decimation_factor, fft_window_size,
+                upper_latency) +
+            Decimator::estimate_memory_usage(
+                num_channels, decimation_factor,
+                BandSplitDecimator::max_block_size);
+    }
+
+    // The upper band in multi-resolution mode is a regular full rate STFT
+    if (layout.upper_fft_order) {
+        usage += estimate_memory_usage(
+            num_channels,
+            ProcessingLayout{.fft_order = *layout.upper_fft_order,
+                             .decimation_factor = 1,
+                             .upper_fft_order = std::nullopt});
+        usage.scratch_buffers += num_channels *
+                                 BandSplitDecimator::max_block_size *
+                                 sizeof(float);
+    }
+
+    return usage;
 }
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter() {
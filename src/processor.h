@@ -16,16 +16,113 @@
 
 #pragma once
 
+#include <complex>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_dsp/juce_dsp.h>
 
+#include "analysis_cache.h"
+#include "capture.h"
+#include "dsp/bands.h"
 #include "dsp/compressor.h"
+#include "dsp/decimation.h"
 #include "dsp/stft.h"
+#include "dsp/threshold_curve.h"
+#include "memory_usage.h"
 #include "ring.h"
+#include "spectral_frames.h"
+#include "spectrum_fifo.h"
+#include "trace.h"
 #include "utils.h"
 
+/**
+ * How the compressors' detectors combine the channels. When the channels are
+ * linked, a single envelope per bin or band is computed from every channel's
+ * magnitudes and the resulting gain is applied to all channels. With `max` the
+ * loudest channel is used, with `mean` the average magnitude, and with `mid`
+ * the magnitude of the channels' sum, so content that only differs between
+ * the channels has less of an effect.
+ */
+enum class StereoLink { off, max, mean, mid };
+
+/**
+ * How the input gets split up before it goes through the STFTs. This follows
+ * from the FFT order, the sample rate, the internal bandwidth, and the
+ * multi-resolution settings.
+ */
+struct ProcessingLayout {
+    /**
+     * The FFT order of the STFT for the (lower) band.
+     */
+    int fft_order = 0;
+    /**
+     * The factor the lower band gets decimated by, or 1 if the input is not
+     * split up.
+     */
+    size_t decimation_factor = 1;
+    /**
+     * In multi-resolution mode, the FFT order of the STFT for the upper band.
+     * This runs at the full sample rate. The lower band is always decimated in
+     * this mode.
+     */
+    std::optional<int> upper_fft_order;
+
+    /**
+     * The total latency in samples at the full sample rate.
+     */
+    inline size_t latency_samples() const {
+        const size_t fft_window_size = static_cast<size_t>(1) << fft_order;
+        return decimation_factor > 1
+                   ? BandSplitDecimator::latency_samples(decimation_factor,
+                                                         fft_window_size)
+                   : fft_window_size;
+    }
+};
+
+/**
+ * The full resolution analysis of a single channel for a single STFT hop,
+ * passed to the consumer set through
+ * `SpectralCompressorProcessor::set_analysis_only()`. The spans cover the
+ * bins within the frequency range, and are only valid during the call.
+ */
+struct BinAnalysis {
+    size_t channel;
+    /**
+     * Whether this comes from the upper band's STFT in multi-resolution mode.
+     * The two bands have their own window sizes and hop rates.
+     */
+    bool is_upper_band;
+    /**
+     * The sample rate the STFT runs at. This is lower than the plugin's sample
+     * rate when the band is decimated.
+     */
+    double sample_rate;
+    size_t fft_window_size;
+    /**
+     * The FFT bin index of the first element in `magnitudes` and `gains`.
+     */
+    size_t first_bin;
+    /**
+     * This channel's magnitude spectrum, after the input gain has been
+     * applied.
+     */
+    std::span<const float> magnitudes;
+    /**
+     * The gain multiplier the compressors computed for every bin.
+     */
+    std::span<const float> gains;
+};
+
+/**
+ * Receives every `BinAnalysis` directly on the audio thread.
+ */
+using BinAnalysisConsumer = std::function<void(const BinAnalysis&)>;
+
 /**
  * All of the buffers, compressors and other miscellaneous object we'll need to
  * do our FFT audio processing. This will be used together with
@@ -38,15 +135,63 @@ struct ProcessData {
      * process for us. See the `STFT` class for more information.
      */
     std::optional<STFT<true>> stft;
+    /**
+     * When the internal bandwidth is limited, the input gets split into a
+     * decimated lower band that goes through `stft`, and the remaining upper
+     * band that is passed through as is. Empty when the lower band is not
+     * decimated.
+     */
+    std::optional<BandSplitDecimator> decimator;
+    /**
+     * Decimates the sidechain input by the same factor as `decimator`. The
+     * sidechain's upper band is not needed, so this doesn't need to be split.
+     */
+    std::optional<Decimator> sidechain_decimator;
+    /**
+     * In multi-resolution mode, the process data for the upper band. This
+     * processes the full rate signal with a smaller FFT window, and only
+     * touches the bins above the crossover frequency while this object only
+     * touches the bins below it. Its output is used as `decimator`'s upper
+     * band. Empty when not in multi-resolution mode.
+     */
+    std::unique_ptr<ProcessData> upper_band;
+    /**
+     * A copy of the input for `upper_band` to process, with
+     * `BandSplitDecimator::max_block_size` samples per channel. Empty when not
+     * in multi-resolution mode.
+     */
+    juce::AudioBuffer<float> upper_band_buffer;
+    /**
+     * Set for `upper_band`. Only the lower band finishes the analyzer's
+     * frames, and the upper band's bins get added to those.
+     */
+    bool is_upper_band = false;
+    /**
+     * In multi-resolution mode both bands are shown in the analyzer's frames
+     * at the resolution of a full rate STFT with a window of `1 << fft_order_`
+     * samples. The frame's window is this many times larger than `stft`'s
+     * window, so the magnitudes are scaled by the same amount, and every one
+     * of `stft`'s bins lines up with every `analyzer_bin_stride`th bin in the
+     * frame. Both are 1 outside of multi-resolution mode.
+     */
+    size_t analyzer_window_scale = 1;
+    size_t analyzer_bin_stride = 1;
 
     /**
-     * This will contain `fft_window_size / 2` compressors. The compressors are
+     * How the FFT bins are grouped into bands for the compressors, for the
+     * current FFT window size and the (decimated) sample rate `stft` runs at.
+     */
+    BandLayout band_layout;
+
+    /**
+     * This will contain `band_layout.num_bands()` compressors, which is
+     * `fft_window_size / 2` when the bins are not grouped. The compressors are
      * already multichannel so we don't need a nested vector here. We'll
-     * compress the magnitude of every FFT bin (`sqrt(i^2 + r^2)`) individually,
-     * and then scale both the real and imaginary components by the ratio of
-     * their magnitude and the compressed value. Bin 0 is the DC offset and the
-     * bins in the second half should be processed the same was as the bins in
-     * the first half but mirrored.
+     * compress the magnitude of every FFT bin (`sqrt(i^2 + r^2)`) or band
+     * individually, and then scale both the real and imaginary components by
+     * the ratio of their magnitude and the compressed value. Bin 0 is the DC
+     * offset and the bins in the second half should be processed the same was
+     * as the bins in the first half but mirrored.
      */
     std::vector<MultiwayCompressor<float>> spectral_compressors;
 
@@ -58,6 +203,217 @@ struct ProcessData {
      * average them and configure the compressors based on that.
      */
     std::vector<float> spectral_compressor_sidechain_thresholds;
+
+    /**
+     * Scratch buffers with `band_layout.num_bins()` elements used while
+     * processing a single channel. The bin magnitudes are computed in one go
+     * and the gains are applied in one go using the vectorized kernels from
+     * `simd::kernels()`, so only the compressors themselves are processed bin
+     * by bin.
+     */
+    std::vector<float> bin_magnitudes;
+    std::vector<float> bin_gains;
+    /**
+     * Holds the active bins' gains padded on both sides while they're being
+     * smoothed, see `gain_smoothing_`. This has room for the largest possible
+     * smoothing radius.
+     */
+    std::vector<float> padded_gains;
+    /**
+     * Scratch space for the box filter's running sums over `padded_gains`.
+     */
+    std::vector<double> gain_running_sums;
+    /**
+     * The same as `bin_magnitudes` and `bin_gains`, but for the bands when the
+     * bins are grouped. Empty otherwise.
+     */
+    std::vector<float> band_magnitudes;
+    std::vector<float> band_gains;
+    /**
+     * More scratch buffers with `band_layout.num_bins()` elements, used to
+     * combine the channels when they are linked. With the max and mean modes
+     * every channel's magnitudes are computed into `channel_magnitudes` and
+     * then combined into `bin_magnitudes`, and with the mid mode the channels'
+     * bins are summed in `linked_bins`.
+     */
+    std::vector<float> channel_magnitudes;
+    std::vector<std::complex<float>> linked_bins;
+
+    /**
+     * With envelope decimation the compressors only run once every this many
+     * hops. This is chosen at the start of every processing cycle based on the
+     * attack and release times, and it is 1 when decimation is disabled.
+     * Changing it only changes the compressors' effective sample rate, so
+     * their envelopes are kept.
+     */
+    size_t envelope_decimation = 1;
+    /**
+     * The current hop within the last `envelope_decimation` hops. The
+     * compressors run when this is 0, and it advances after the last channel
+     * has been processed.
+     */
+    size_t envelope_hop_idx = 0;
+    /**
+     * Set when `envelope_decimation` changes. The next compressor update will
+     * then be used as is instead of interpolating towards it from stale gains.
+     */
+    bool reset_envelope_gains = true;
+    /**
+     * The compressors' previous and most recent gains for every channel, laid
+     * out channel by channel with `spectral_compressors.size()` elements per
+     * channel. Between two compressor updates the gains are linearly
+     * interpolated from the previous gains to the target gains. Only used when
+     * `envelope_decimation > 1`, or when there's a CPU budget in which case the
+     * target gains of the compressors that were skipped are decayed in place.
+     */
+    std::vector<float> previous_envelope_gains;
+    std::vector<float> target_envelope_gains;
+
+    /**
+     * With a CPU budget only this many loudest compressors per channel get
+     * a full update. The other compressors' envelopes still follow their
+     * input, but their gains only decay towards unity.
+     * This is adapted after every compressor update so the time spent in the
+     * compressors matches the budget. Zero when the budget is disabled.
+     */
+    size_t budget_num_updates = 0;
+    /**
+     * The time spent in the compressors during the current compressor update,
+     * summed over all channels, in high resolution ticks.
+     */
+    juce::int64 budget_elapsed_ticks = 0;
+    /**
+     * A scratch buffer with `spectral_compressors.size()` elements used to find
+     * the `budget_num_updates` loudest bands.
+     */
+    std::vector<float> budget_magnitudes;
+
+    /**
+     * The bins within the low and high frequency bounds, relative to bin 1.
+     * Only these bins are processed, and the other bins are left untouched.
+     * This is updated at the start of every processing cycle.
+     */
+    IndexRange active_bins;
+    /**
+     * The compressors needed to compute the gains for `active_bins`. These are
+     * the only compressors that run.
+     */
+    IndexRange active_bands;
+    /**
+     * The bins whose magnitudes are needed for `active_bands`. This is the
+     * same as `active_bins` when the bins are not grouped, and it can be
+     * slightly wider than that when they are.
+     */
+    IndexRange detector_bins;
+
+    /**
+     * Set when the compressor settings have changed. The compressors will be
+     * reconfigured on their next update, after which this is cleared again.
+     * This is tracked per object since `upper_band` has its own compressors.
+     */
+    bool compressor_settings_changed = true;
+    /**
+     * The 'effective sample rate' (sample rate divided by the windowing
+     * interval) for the last compressor update. If this changes, then we'll
+     * need to adjust our compressors accordingly. When this is 0 the
+     * compressors still need to be prepared.
+     */
+    double last_effective_sample_rate = 0.0;
+    /**
+     * The effective sample rate the compressors were last prepared for.
+     * Preparing them resets their envelopes, so later changes to the effective
+     * sample rate are applied through `MultiwayCompressor::set_sample_rate()`
+     * instead.
+     */
+    double prepared_sample_rate = 0.0;
+    /**
+     * The number of channels the compressors' envelope followers were last
+     * prepared for. Linked channels share a single envelope, so this is 1 in
+     * that case.
+     */
+    size_t last_num_compressor_channels = 0;
+    /**
+     * The version of the `ThresholdTable` the compressors' thresholds were
+     * last set from, or 0 if they still need to be set. Sidechaining sets the
+     * thresholds from the sidechain signal, so this is reset while that's
+     * active.
+     */
+    size_t threshold_version = 0;
+
+    /**
+     * Set when this object gets (re)initialized in
+     * `update_and_swap_process_data()`. The audio thread clears this again in
+     * `begin_processing_cycle()` after the object has been swapped in, at which
+     * point the compressors will be configured for it.
+     */
+    bool is_fresh = false;
+
+    /**
+     * The key `stft`'s forward transform cache was opened with, if it has one.
+     * See `SpectralCompressorProcessor::update_analysis_cache()`.
+     */
+    AnalysisCacheKey analysis_cache_key;
+
+    /**
+     * The memory held by this object in bytes, excluding `sizeof(ProcessData)`
+     * itself.
+     *
+     * @param num_channels The number of channels the compressors have been
+     *   prepared for.
+     */
+    ProcessDataMemoryUsage memory_usage(size_t num_channels) const;
+
+    /**
+     * (Re)allocate the STFT, the compressors and the scratch buffers for a
+     * window of `1 << fft_order` samples at `sample_rate`, and reset the
+     * multi-resolution fields. This does not touch `upper_band`. Called off
+     * the audio thread from `update_and_swap_process_data()`.
+     */
+    void initialize(size_t num_channels,
+                    int fft_order,
+                    double sample_rate,
+                    BinGrouping bin_grouping);
+
+    /**
+     * Set the compressors' thresholds from `table`, which should have been
+     * computed for `band_layout`. This is cheap enough to do on the audio
+     * thread.
+     */
+    void apply_thresholds(const ThresholdTable& table);
+
+    /**
+     * Write the processing state that carries over between processing cycles
+     * to `stream`. This includes the STFTs, the band split filters, the
+     * compressors' envelopes, and the envelope decimation and CPU budget
+     * state, for both bands in multi-resolution mode. This isn't `const`
+     * since reading the compressors' envelopes briefly reconfigures them, see
+     * `MultiwayCompressor::envelope()`. See
+     * `SpectralCompressorProcessor::save_checkpoint()`.
+     */
+    void write_state(juce::OutputStream& stream);
+
+    /**
+     * Restore the state written by `write_state()` into an object that was
+     * initialized for the same layout, channel count, and sample rate. The
+     * compressors are prepared again for the stored sample rate, so their
+     * envelopes can be restored.
+     *
+     * @param max_block_size The maximum block size the compressors should be
+     *   prepared for.
+     *
+     * @return Whether the state could be restored. If this returns false, the
+     *   object's state is unspecified.
+     */
+    bool read_state(juce::InputStream& stream, juce::uint32 max_block_size);
+
+    /**
+     * The memory a freshly initialized object would hold for the given
+     * settings. Used to enforce the memory budget before allocating anything.
+     * This assumes the bins are not grouped, which needs the most memory.
+     */
+    static ProcessDataMemoryUsage estimate_memory_usage(
+        size_t num_channels,
+        const ProcessingLayout& layout);
 };
 
 class SpectralCompressorProcessor : public juce::AudioProcessor {
@@ -96,7 +452,224 @@ class SpectralCompressorProcessor : public juce::AudioProcessor {
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
 
+    /**
+     * Capture this instance's processing session to `file` starting from the
+     * next call to `prepareToPlay()`, so it can later be replayed offline. See
+     * `SessionCapture` for more information. Setting the
+     * `SPECTRAL_COMPRESSOR_CAPTURE_DIR` environment variable does the same
+     * thing for every instance.
+     */
+    void capture_on_next_prepare(const juce::File& file);
+    /**
+     * Stop an active capture, or cancel a pending one. The capture's buffers
+     * are freed on the next call to `prepareToPlay()` or `releaseResources()`.
+     */
+    void stop_capture();
+
+    /**
+     * Immediately perform the `ProcessData` update that normally happens
+     * asynchronously on the message thread after the FFT order changes. This is
+     * only meant for replaying captures, where everything happens on a single
+     * thread and the update needs to happen at the exact same point as during
+     * the original session.
+     */
+    void apply_pending_process_data_update();
+
+    /**
+     * Report how much memory this instance currently holds. Should not be
+     * called from the audio thread.
+     */
+    MemoryUsage memory_usage() const;
+
+    /**
+     * Limit this instance's memory usage to roughly `budget_bytes` by capping
+     * the FFT order. The FFT order parameter keeps its value, but the largest
+     * FFT window size that still fits within the budget will be used instead.
+     * The smallest FFT window size is always allowed, even if it doesn't fit.
+     * Passing `std::nullopt` removes the limit. Setting the
+     * `SPECTRAL_COMPRESSOR_MEMORY_BUDGET_MB` environment variable does the
+     * same thing for every instance. Should be called from the message thread.
+     */
+    void set_memory_budget(std::optional<size_t> budget_bytes);
+    /**
+     * The largest FFT order allowed by the memory budget.
+     */
+    inline int max_fft_order() const { return max_fft_order_; }
+
+    /**
+     * Switch to an analysis-only mode for offline analysis. In this mode the
+     * input is analyzed and run through the compressors like normal, but the
+     * signal is never resynthesized and the output is silent. Every channel's
+     * magnitudes and gains are passed to `consumer` for every hop, at the
+     * STFT's full resolution. The editor's analyzer still gets its decimated
+     * frames. Passing an empty function switches back to normal processing.
+     * This should not be called while audio is being processed.
+     */
+    void set_analysis_only(BinAnalysisConsumer consumer);
+
+    /**
+     * Write every processed STFT frame to `writer`, or stop doing so when
+     * `writer` is a null pointer. The frames are written from the audio
+     * thread, so this is only meant for offline processing. In
+     * multi-resolution mode only the lower band is written. The writer must
+     * outlive the processing, and this should not be called while audio is
+     * being processed.
+     */
+    void set_frame_writer(SpectralFrameWriter* writer);
+
+    /**
+     * Look up and store the STFTs' forward transforms through `cache`, or stop
+     * doing so when `cache` is a null pointer. This can be an `AnalysisCache`
+     * for re-rendering the same input, or a `SharedAnalysis` for rendering
+     * several variants at once. The caches are only used when processing
+     * starts right after this call, and they are dropped when the FFT order,
+     * the overlap amount, the input gain, or the sidechain routing changes.
+     * The caches are opened from the audio thread, so this is only meant for
+     * offline processing. The cache must outlive the processing, and this
+     * should not be called while audio is being processed.
+     */
+    void set_analysis_cache(AnalysisCacheProvider* cache);
+
+    /**
+     * Write a snapshot of the processing state to `stream`, so that a later
+     * render can resume from this point with `restore_checkpoint()` instead of
+     * processing everything that came before it. This covers the STFTs' ring
+     * buffers and hop positions, the band split filters, and the compressors'
+     * envelopes, but not the parameters. This is only meant for offline
+     * processing, and it should be called in between processing cycles from
+     * the thread that calls `processBlock()`.
+     *
+     * @return Whether there was anything to write. This returns false if the
+     *   processor has not been prepared yet.
+     */
+    bool save_checkpoint(juce::OutputStream& stream);
+    /**
+     * Resume from a snapshot written by `save_checkpoint()`. This should be
+     * called right after `prepareToPlay()` with the same parameters, sample
+     * rate, and channel count that were used when the snapshot was taken. The
+     * next call to `processBlock()` then produces the same output as the
+     * original processor did for the block after the snapshot.
+     *
+     * @param dry_history The main input leading up to the snapshot, used to
+     *   restore the dry signal's latency compensation. This should contain at
+     *   least `getLatencySamples()` samples for every main channel, padded
+     *   with silence at the start if the snapshot was taken before that many
+     *   samples had been processed.
+     *
+     * @return Whether the snapshot could be restored. If this returns false,
+     *   the processor needs to be prepared again before it can be used.
+     */
+    bool restore_checkpoint(juce::InputStream& stream,
+                            const juce::AudioBuffer<float>& dry_history);
+
+    /**
+     * The curve that sets the compressor thresholds when sidechaining is
+     * disabled. This is stored in the plugin's state.
+     */
+    ThresholdCurve threshold_curve() const;
+    /**
+     * Replace the threshold curve. This is also how curves stored in a preset
+     * are loaded. The per-band threshold tables are recomputed on
+     * `threshold_table_updater_`'s background thread and swapped in on a later
+     * processing cycle. Should not be called from the audio thread.
+     */
+    void set_threshold_curve(ThresholdCurve curve);
+    /**
+     * The FFT order actually used for processing. This is the FFT order
+     * parameter's value capped by `max_fft_order()`.
+     */
+    int effective_fft_order() const;
+    /**
+     * Whether the memory budget currently prevents the FFT order parameter's
+     * value from being used.
+     */
+    inline bool is_fft_order_capped() const {
+        return effective_fft_order() < fft_order_.get();
+    }
+    /**
+     * How the input gets split up for the current settings and sample rate,
+     * using `fft_order` as the FFT order. The FFT orders in the layout can be
+     * lower than that, see `multi_resolution_`.
+     */
+    ProcessingLayout processing_layout(int fft_order) const;
+    /**
+     * The same as the above, using `effective_fft_order()`.
+     */
+    ProcessingLayout processing_layout() const;
+    /**
+     * The latency we'll report to the host for the current settings. This is
+     * the FFT window size, times the decimation factor plus the decimation
+     * filters' delay when the lower band is decimated.
+     */
+    int expected_latency_samples() const;
+
+    /**
+     * The FFT backend used by the active `ProcessData` object, or
+     * `std::nullopt` if it has not been initialized yet. See `fft::Engine`.
+     * Should not be called from the audio thread.
+     */
+    std::optional<fft::Backend> fft_backend() const;
+
+    /**
+     * The decimated spectra and gains for every processed STFT frame, consumed
+     * by the editor's spectrum analyzer. There should only ever be a single
+     * reader.
+     */
+    inline SpectrumFifo& spectrum_fifo() { return spectrum_fifo_; }
+
    private:
+    /**
+     * Fetch the active process data object at the start of a processing cycle.
+     * If a new object has just been swapped in, then this will make sure the
+     * compressors get configured during this cycle. When capturing, this also
+     * records the cycle's inputs.
+     */
+    ProcessData& begin_processing_cycle(const juce::AudioBuffer<float>& buffer,
+                                        bool bypassed);
+
+    /**
+     * Open forward transform caches for `process_data`'s STFTs at the start of
+     * a render, and drop them again once the settings no longer match the
+     * keys they were opened with. See `set_analysis_cache()`.
+     */
+    void update_analysis_cache(ProcessData& process_data, size_t num_channels);
+
+    /**
+     * Run `process(process_data, sample_rate, main, sidechain)` on the parts of
+     * the signal that should go through an STFT. Normally that's just
+     * `main_io` and `sidechain_io` themselves. When the lower band is decimated
+     * this processes the buffers in chunks, and `process` gets called with the
+     * decimated lower band of every chunk which then gets recombined with the
+     * upper band in place. In multi-resolution mode `process` is first called
+     * for every chunk with `process_data.upper_band` and a copy of the chunk.
+     *
+     * @param use_sidechain Whether the sidechain input is used. If not, then
+     *   `process` receives an empty sidechain buffer when the lower band is
+     *   decimated.
+     */
+    template <typename F>
+    void process_bands(ProcessData& process_data,
+                       juce::AudioBuffer<float>& main_io,
+                       juce::AudioBuffer<float>& sidechain_io,
+                       bool use_sidechain,
+                       F&& process);
+
+    /**
+     * Run `process_data`'s STFT and compressors on `main_io`, using the
+     * frequency range between `low_frequency` and `high_frequency`.
+     * `sample_rate` is the sample rate the STFT runs at. With `analysis_only`
+     * the spectra are analyzed but `main_io` is not modified, see
+     * `set_analysis_only()`.
+     */
+    void process_spectrum(ProcessData& process_data,
+                          double sample_rate,
+                          juce::AudioBuffer<float>& main_io,
+                          juce::AudioBuffer<float>& sidechain_io,
+                          float low_frequency,
+                          float high_frequency,
+                          const ThresholdTable* threshold_table,
+                          bool analysis_only);
+
     /**
      * (Re)initialize a process data object and all compressors within it for
      * the current FFT order on the next audio processing cycle. The inactive
@@ -106,29 +679,73 @@ class SpectralCompressorProcessor : public juce::AudioProcessor {
      */
     void update_and_swap_process_data();
 
+    /**
+     * Resample the threshold curve into a `ThresholdTable` for every band
+     * layout used by either of the process data objects, and swap those in on
+     * the next processing cycle. This runs on `threshold_table_updater_`'s
+     * thread.
+     */
+    void update_threshold_tables();
+
+    /**
+     * Recompute `max_fft_order_` from the memory budget and the current
+     * channel count.
+     *
+     * @return Whether the maximum FFT order has changed.
+     */
+    bool update_max_fft_order();
+
+    /**
+     * `processing_layout(int)`, but with the sample rate and the latency
+     * related parameters passed in explicitly.
+     */
+    ProcessingLayout processing_layout(int fft_order,
+                                       double sample_rate,
+                                       bool multi_resolution,
+                                       double internal_bandwidth) const;
+
+    /**
+     * The largest latency any combination of parameters can result in at
+     * `sample_rate`. Those parameters can change while playing, so `mixer_`'s
+     * delay line is sized for this.
+     */
+    size_t max_latency_samples(double sample_rate) const;
+
+    /**
+     * The memory held by `mixer_` after it has been prepared for the current
+     * channel count, block size, and sample rate. JUCE doesn't expose this, so
+     * we mirror `juce::dsp::DryWetMixer`'s allocations.
+     */
+    size_t mixer_memory_usage() const;
+
     /**
      * This contains all of our scratch buffers, ring buffers, compressors, and
      * everything else that depends on the FFT window size.
      */
     AtomicallySwappable<ProcessData> process_data_;
+    /**
+     * The threshold curve resampled for the band layouts in `process_data_`.
+     * The audio thread only ever reads thresholds from these tables.
+     */
+    AtomicallySwappable<ThresholdTables> threshold_tables_;
 
     /**
      * A dry-wet mixer we'll use to be able to blend the processed and the
-     * unprocessed signals.
+     * unprocessed signals. The maximum latency can only be set when
+     * constructing the mixer, so this is created in `prepareToPlay()` for
+     * `mixer_max_latency_samples_`.
      */
-    juce::dsp::DryWetMixer<float> mixer_;
+    std::optional<juce::dsp::DryWetMixer<float>> mixer_;
+    /**
+     * The latency `mixer_` was created for, see `max_latency_samples()`.
+     */
+    size_t mixer_max_latency_samples_ = 0;
 
     /**
      * Will be set during `prepareToPlay()`, needed to initialize compressors
      * when resizing our buffers.
      */
     juce::uint32 max_samples_per_block_ = 0;
-    /**
-     * The 'effective sample rate' (sample rate divided by the windowing
-     * interval) for the last processing cycle. If this changes, then we'll need
-     * to adjust our compressors accordingly.
-     */
-    double last_effective_sample_rate_ = 0.0;
 
     juce::AudioProcessorValueTreeState parameters_;
 
@@ -196,6 +813,29 @@ class SpectralCompressorProcessor : public juce::AudioProcessor {
      * Compressor attack time in milliseconds.
      */
     std::atomic<float>& compressor_release_ms_;
+    /**
+     * Whether and how the channels should be linked. The choices should match
+     * `StereoLink`. Turning linking on or off with more than one channel
+     * changes the number of envelopes per compressor, which resets them.
+     * Switching between the linked modes keeps the envelopes.
+     */
+    juce::AudioParameterChoice& stereo_link_;
+    /**
+     * When enabled, only run the compressors every few hops and interpolate
+     * their gains in between. The number of hops is chosen automatically based
+     * on the attack and release times, see `ProcessData::envelope_decimation`.
+     */
+    juce::AudioParameterBool& decimate_envelopes_;
+    /**
+     * When enabled, only the loudest bins or bands get a full compressor update
+     * and the rest of the gains decay towards unity, so that the compressors
+     * take up at most `cpu_budget_target_` percent of every hop's duration. See
+     * `ProcessData::budget_num_updates`. Since this is based on wall clock
+     * time, the output is no longer deterministic and captured sessions cannot
+     * be replayed bit-exactly.
+     */
+    juce::AudioParameterBool& cpu_budget_;
+    std::atomic<float>& cpu_budget_target_;
     /**
      * Will cause the compressor settings to be updated on the next processing
      * cycle whenever a compressor parameter changes.
@@ -224,16 +864,127 @@ class SpectralCompressorProcessor : public juce::AudioProcessor {
      * changes.
      */
     juce::AudioParameterInt& windowing_overlap_order_;
+    /**
+     * How the FFT bins should be grouped into bands for the compressors. This
+     * should match `BinGrouping`. Changing this changes the number of
+     * compressors, so it works the same way as changing the FFT order.
+     */
+    juce::AudioParameterChoice& bin_grouping_;
+    /**
+     * When nonzero, every bin's gain is replaced by the mean of the gains of
+     * the bins within this many bins of it. This reduces the musical noise at
+     * high ratios without needing more overlap. When the bins are grouped,
+     * this is applied after the bands' gains have been spread out over their
+     * bins.
+     */
+    juce::AudioParameterInt& gain_smoothing_;
+    /**
+     * The lower and upper bounds in Hertz for the bins that should be
+     * processed. Bins outside of this range are passed through as is, and
+     * their compressors don't run at all.
+     */
+    std::atomic<float>& low_frequency_;
+    std::atomic<float>& high_frequency_;
+    /**
+     * Limits the bandwidth of the signal that goes through the STFT at high
+     * sample rates. The lower band gets decimated so the STFT runs at a lower
+     * sample rate, and everything above that gets passed through. The choices
+     * should match `internal_bandwidths`. This changes the sample rate the
+     * compressors run at, so it works the same way as changing the FFT order.
+     */
+    juce::AudioParameterChoice& internal_bandwidth_;
+    /**
+     * Split the input at `crossover_frequency_` and process the two bands with
+     * different FFT window sizes. The lower band gets decimated so its STFT
+     * runs at the resolution set by `fft_order_` with a smaller window, and
+     * the upper band uses a window of `1 << upper_fft_order_` samples at the
+     * full sample rate, which gives it a better time resolution. Both are
+     * aligned to the lower band's latency. This overrides the internal
+     * bandwidth, and it falls back to a single STFT when the FFT order is too
+     * low to decimate the lower band.
+     */
+    juce::AudioParameterBool& multi_resolution_;
+    juce::AudioParameterInt& upper_fft_order_;
+    /**
+     * The frequency in Hertz where the upper band starts in multi-resolution
+     * mode. This is limited to the decimated lower band's passband.
+     */
+    std::atomic<float>& crossover_frequency_;
     /**
      * Atomically resizes the object `ProcessData` from a background thread.
      */
     LambdaAsyncUpdater process_data_updater_;
     /**
-     * When the FFT order parameter changes, we'll have to create a new
-     * `ProcessData` object for the new FFT window size (or rather, resize an
-     * inactive one to match the new size).
+     * Recomputes `threshold_tables_` on a background thread after the threshold
+     * curve or the process data's layouts have changed.
+     */
+    LambdaBackgroundUpdater threshold_table_updater_;
+    /**
+     * When the FFT order or bin grouping parameters change, we'll have to
+     * create a new `ProcessData` object for the new FFT window size (or rather,
+     * resize an inactive one to match the new size).
      */
     LambdaParameterListener fft_order_listener_;
 
+    /**
+     * The audio thread pushes a decimated version of every processed frame in
+     * here for the editor. See `spectrum_fifo()`.
+     */
+    SpectrumFifo spectrum_fifo_;
+
+    /**
+     * The optional memory budget set through `set_memory_budget()`.
+     */
+    std::optional<size_t> memory_budget_;
+    /**
+     * The largest FFT order that fits within `memory_budget_`. Only accessed
+     * from the message thread.
+     */
+    int max_fft_order_;
+
+    /**
+     * Set through `set_threshold_curve()` or when loading a preset. Since this
+     * can be read from `prepareToPlay()`, it's guarded by
+     * `threshold_curve_mutex_`.
+     */
+    ThresholdCurve threshold_curve_;
+    /**
+     * Incremented whenever `threshold_curve_` changes, see
+     * `ThresholdTable::version`.
+     */
+    size_t threshold_curve_version_ = 1;
+    mutable std::mutex threshold_curve_mutex_;
+
+    /**
+     * Set through `set_analysis_only()`. The mode is enabled when there's a
+     * consumer.
+     */
+    std::atomic<bool> analysis_only_ = false;
+    BinAnalysisConsumer analysis_consumer_;
+    /**
+     * Set through `set_frame_writer()`.
+     */
+    SpectralFrameWriter* frame_writer_ = nullptr;
+    /**
+     * Set through `set_analysis_cache()`.
+     */
+    AnalysisCacheProvider* analysis_cache_ = nullptr;
+    /**
+     * The number of samples processed since `set_analysis_cache()` was called.
+     * New caches are only opened while this is still zero.
+     */
+    juce::uint64 analysis_cache_num_samples_ = 0;
+
+    /**
+     * Records the processing session for offline replay when enabled.
+     */
+    SessionCapture capture_;
+    /**
+     * Set by `capture_on_next_prepare()`. The capture only starts in
+     * `prepareToPlay()` since it needs to start from a freshly initialized
+     * state.
+     */
+    std::optional<juce::File> pending_capture_file_;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpectralCompressorProcessor)
 };
@@ -16,9 +16,16 @@
 
 #pragma once
 
+#include <array>
+#include <bit>
+#include <type_traits>
+#include <vector>
+
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_core/juce_core.h>
 
+#include "dsp/simd.h"
+
 /**
  * A simple resizeable ring buffer that allows copying up to its size number of
  * samples to and from the buffer at a time.
@@ -56,6 +63,14 @@ class RingBuffer {
      */
     inline size_t size() const { return buffer_.size(); }
 
+    /**
+     * The amount of heap memory held by this ring buffer in bytes. This can be
+     * larger than `size()` elements after shrinking the buffer.
+     */
+    inline size_t memory_usage() const {
+        return buffer_.capacity() * sizeof(T);
+    }
+
     /**
      * Returns the current head position in the ring buffer.
      */
@@ -159,7 +174,14 @@ class RingBuffer {
 
         const auto& [num_to_end, num_from_start] =
             split_range_from(current_pos_, num);
-        if (gain == 1.0) {
+        if constexpr (std::is_same_v<T, float>) {
+            // This is called for every processed window, so we'll use the
+            // runtime dispatched kernels when we can
+            const simd::Kernels& kernels = simd::kernels();
+            kernels.multiply_add(&buffer_[current_pos_], src, gain, num_to_end);
+            kernels.multiply_add(&buffer_[0], src + num_to_end, gain,
+                                 num_from_start);
+        } else if (gain == 1.0) {
             juce::FloatVectorOperations::add(&buffer_[current_pos_], src,
                                              num_to_end);
             juce::FloatVectorOperations::add(&buffer_[0], src + num_to_end,
@@ -236,6 +258,74 @@ class RingBuffer {
         return num;
     }
 
+    /**
+     * Exchange `num` samples in `data` with the samples in the ring buffer
+     * starting at `pos()`. When this is the only operation used, `data` gets
+     * delayed by exactly `size()` samples.
+     *
+     * This advances the current position by `num`.
+     *
+     * @param data The buffer to exchange samples with.
+     * @param num How many elements to exchange, should not exceed `size()`.
+     *
+     * @return The number of elements exchanged.
+     *
+     * @throw std::invalid_argument When `num > size()`.
+     */
+    size_t swap_n_with(T* data, size_t num) {
+        if (num > buffer_.size()) {
+            throw std::invalid_argument(
+                "num > size() in RingBuffer::swap_n_with()");
+        }
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        std::swap_ranges(data, data + num_to_end, &buffer_[current_pos_]);
+        std::swap_ranges(data + num_to_end, data + num, &buffer_[0]);
+
+        current_pos_ += num;
+        if (current_pos_ >= buffer_.size()) {
+            current_pos_ -= buffer_.size();
+        }
+
+        return num;
+    }
+
+    /**
+     * Write the ring buffer's size, current position, and contents to
+     * `stream`. This is used for checkpointing the processor's state, see
+     * `SpectralCompressorProcessor::save_checkpoint()`.
+     */
+    void write_state(juce::OutputStream& stream) const {
+        stream.writeInt64(static_cast<juce::int64>(buffer_.size()));
+        stream.writeInt64(static_cast<juce::int64>(current_pos_));
+        stream.write(buffer_.data(), buffer_.size() * sizeof(T));
+    }
+
+    /**
+     * Restore the state written by `write_state()`. The ring buffer needs to
+     * have the same size as the one the state was written from.
+     *
+     * @return Whether the state could be restored. If this returns false, the
+     *   ring buffer's contents are unspecified.
+     */
+    bool read_state(juce::InputStream& stream) {
+        const juce::int64 size = stream.readInt64();
+        const juce::int64 pos = stream.readInt64();
+        if (size != static_cast<juce::int64>(buffer_.size()) || pos < 0 ||
+            (pos > 0 && pos >= size)) {
+            return false;
+        }
+
+        const int num_bytes = static_cast<int>(buffer_.size() * sizeof(T));
+        if (stream.read(buffer_.data(), num_bytes) != num_bytes) {
+            return false;
+        }
+        current_pos_ = static_cast<size_t>(pos);
+
+        return true;
+    }
+
    private:
     /**
      * Returns how to split the range when reading or writing `num` elements
@@ -256,3 +346,270 @@ class RingBuffer {
     std::vector<T> buffer_;
     size_t current_pos_ = 0;
 };
+
+/**
+ * Used as `PowerOfTwoRingBuffer`'s capacity to indicate that the size is set at
+ * runtime.
+ */
+constexpr size_t dynamic_capacity = 0;
+
+/**
+ * A `RingBuffer` whose size is always a power of two. This lets positions wrap
+ * around using a bit mask instead of comparisons and remainders. Since this is
+ * used in the audio processing hot loop, none of the operations throw. Sizes
+ * are only checked with debug assertions, and passing a `num` larger than
+ * `size()` is undefined behavior. This makes it possible for the compiler to
+ * inline and vectorize the copies.
+ *
+ * @tparam T The element type of this ring buffer. Because of the operations
+ *   used, this can only be `float` or `double`.
+ * @tparam capacity The size of the buffer. When this is set to a power of two
+ *   the buffer is stored inline and the mask is a compile time constant. When
+ *   this is set to `dynamic_capacity` the size is set at runtime and the buffer
+ *   is heap allocated.
+ *
+ * @see RingBuffer
+ */
+template <typename T, size_t capacity = dynamic_capacity>
+class PowerOfTwoRingBuffer {
+   public:
+    static constexpr bool is_dynamic = capacity == dynamic_capacity;
+    static_assert(is_dynamic || std::has_single_bit(capacity),
+                  "The capacity needs to be a power of two");
+
+    /**
+     * The default constructor doesn't initialize a dynamically sized ring
+     * buffer. `PowerOfTwoRingBuffer::resize()` should be called before
+     * actually using it. Fixed size ring buffers start out zeroed.
+     */
+    PowerOfTwoRingBuffer() noexcept {
+        if constexpr (!is_dynamic) {
+            buffer_.fill(0.0);
+        }
+    }
+
+    /**
+     * Initialize a dynamically sized ring buffer to contain `size` `T`s.
+     * `size` needs to be a power of two.
+     */
+    PowerOfTwoRingBuffer(size_t size)
+        requires is_dynamic
+        : buffer_(size, 0.0), mask_(size - 1) {
+        jassert(std::has_single_bit(size));
+    }
+
+    /**
+     * Resize the ring buffer to be able to contain `new_size` elements. This
+     * needs to be a power of two. This will reset the current position to 0.
+     * Existing data will not be cleared.
+     */
+    void resize(size_t new_size)
+        requires is_dynamic
+    {
+        jassert(std::has_single_bit(new_size));
+
+        buffer_.resize(new_size);
+        mask_ = new_size - 1;
+        current_pos_ = 0;
+    }
+
+    /**
+     * Returns the ring buffer's current size.
+     */
+    inline size_t size() const noexcept { return buffer_.size(); }
+
+    /**
+     * The amount of memory held by this ring buffer's elements in bytes. For
+     * fixed size ring buffers this memory is part of the object itself.
+     */
+    inline size_t memory_usage() const noexcept {
+        if constexpr (is_dynamic) {
+            return buffer_.capacity() * sizeof(T);
+        } else {
+            return sizeof(buffer_);
+        }
+    }
+
+    /**
+     * Returns the current head position in the ring buffer.
+     */
+    inline size_t pos() const noexcept { return current_pos_; }
+
+    /**
+     * Copy `num` samples from `src` into the ring buffer, starting at `pos()`.
+     * This advances the current position by `num`.
+     *
+     * @see RingBuffer::read_n_from()
+     */
+    void read_n_from(const T* src, size_t num) noexcept {
+        jassert(num <= size());
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        std::copy_n(src, num_to_end, &buffer_[current_pos_]);
+        std::copy_n(src + num_to_end, num_from_start, &buffer_[0]);
+
+        current_pos_ = (current_pos_ + num) & mask();
+    }
+
+    /**
+     * Copy `num` samples (starting at `pos()`) to `dst`, optionally clearing
+     * them afterwards. This advances the current position by `num`.
+     *
+     * @see RingBuffer::copy_n_to()
+     */
+    void copy_n_to(T* dst, size_t num, bool clear) noexcept {
+        jassert(num <= size());
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        std::copy_n(&buffer_[current_pos_], num_to_end, dst);
+        std::copy_n(&buffer_[0], num_from_start, dst + num_to_end);
+        if (clear) {
+            std::fill_n(&buffer_[current_pos_], num_to_end, 0.0);
+            std::fill_n(&buffer_[0], num_from_start, 0.0);
+        }
+
+        current_pos_ = (current_pos_ + num) & mask();
+    }
+
+    /**
+     * Add `num` samples from `src` multiplied by `gain` to the existing values
+     * in the ring buffer, starting at `pos()`. This does not advance the
+     * current position.
+     *
+     * @see RingBuffer::add_n_from_in_place()
+     */
+    void add_n_from_in_place(const T* src,
+                             size_t num,
+                             float gain = 1.0) noexcept {
+        jassert(num <= size());
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        if constexpr (std::is_same_v<T, float>) {
+            const simd::Kernels& kernels = simd::kernels();
+            kernels.multiply_add(&buffer_[current_pos_], src, gain, num_to_end);
+            kernels.multiply_add(&buffer_[0], src + num_to_end, gain,
+                                 num_from_start);
+        } else {
+            juce::FloatVectorOperations::addWithMultiply(&buffer_[current_pos_],
+                                                         src, gain, num_to_end);
+            juce::FloatVectorOperations::addWithMultiply(
+                &buffer_[0], src + num_to_end, gain, num_from_start);
+        }
+    }
+
+    /**
+     * Copy `num` samples from `src` to the ring buffer, starting at `pos()`.
+     * This does not advance the current position.
+     *
+     * @see RingBuffer::read_n_from_in_place()
+     */
+    void read_n_from_in_place(const T* src, size_t num) noexcept {
+        jassert(num <= size());
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        std::copy_n(src, num_to_end, &buffer_[current_pos_]);
+        std::copy_n(src + num_to_end, num_from_start, &buffer_[0]);
+    }
+
+    /**
+     * Copy the _last_ `num` samples (going backwards at `pos()`) written to
+     * this ring buffer to `dst`. This does not advance the current position.
+     *
+     * @see RingBuffer::copy_last_n_to()
+     */
+    void copy_last_n_to(T* dst, size_t num) noexcept {
+        jassert(num <= size());
+
+        // Unsigned overflow is well defined, so the mask takes care of the
+        // wraparound
+        const size_t start_pos = (current_pos_ - num) & mask();
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(start_pos, num);
+        std::copy_n(&buffer_[start_pos], num_to_end, dst);
+        std::copy_n(&buffer_[0], num_from_start, dst + num_to_end);
+    }
+
+    /**
+     * Exchange `num` samples in `data` with the samples in the ring buffer
+     * starting at `pos()`. This advances the current position by `num`. When
+     * this is the only operation used, `data` gets delayed by exactly `size()`
+     * samples.
+     */
+    void swap_n_with(T* data, size_t num) noexcept {
+        jassert(num <= size());
+
+        const auto& [num_to_end, num_from_start] =
+            split_range_from(current_pos_, num);
+        std::swap_ranges(data, data + num_to_end, &buffer_[current_pos_]);
+        std::swap_ranges(data + num_to_end, data + num, &buffer_[0]);
+
+        current_pos_ = (current_pos_ + num) & mask();
+    }
+
+    /**
+     * Write the ring buffer's size, current position, and contents to
+     * `stream`.
+     *
+     * @see RingBuffer::write_state()
+     */
+    void write_state(juce::OutputStream& stream) const {
+        stream.writeInt64(static_cast<juce::int64>(size()));
+        stream.writeInt64(static_cast<juce::int64>(current_pos_));
+        stream.write(buffer_.data(), size() * sizeof(T));
+    }
+
+    /**
+     * Restore the state written by `write_state()`. The ring buffer needs to
+     * have the same size as the one the state was written from.
+     *
+     * @see RingBuffer::read_state()
+     */
+    bool read_state(juce::InputStream& stream) {
+        const juce::int64 size = stream.readInt64();
+        const juce::int64 pos = stream.readInt64();
+        if (size != static_cast<juce::int64>(this->size()) || pos < 0 ||
+            (pos > 0 && pos >= size)) {
+            return false;
+        }
+
+        const int num_bytes = static_cast<int>(this->size() * sizeof(T));
+        if (stream.read(buffer_.data(), num_bytes) != num_bytes) {
+            return false;
+        }
+        current_pos_ = static_cast<size_t>(pos);
+
+        return true;
+    }
+
+   private:
+    inline size_t mask() const noexcept {
+        if constexpr (is_dynamic) {
+            return mask_;
+        } else {
+            return capacity - 1;
+        }
+    }
+
+    /**
+     * @see RingBuffer::split_range_from()
+     */
+    inline std::pair<size_t, size_t> split_range_from(size_t from,
+                                                      size_t num) const
+        noexcept {
+        const size_t num_to_end = std::min(num, size() - from);
+        return std::pair(num_to_end, num - num_to_end);
+    }
+
+    std::conditional_t<is_dynamic, std::vector<T>, std::array<T, capacity>>
+        buffer_;
+    /**
+     * `size() - 1`. Only used for dynamically sized buffers.
+     */
+    size_t mask_ = 0;
+    size_t current_pos_ = 0;
+};
@@ -0,0 +1,203 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "spectral_frames.h"
+
+#include <algorithm>
+
+#include "dsp/simd.h"
+
+using namespace spectral_frame_format;
+
+SpectralFrameWriter::SpectralFrameWriter(const juce::File& file,
+                                         bool with_phases)
+    : with_phases_(with_phases) {
+    file.deleteFile();
+    stream_ = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream_->openedOk()) {
+        stream_.reset();
+    }
+}
+
+SpectralFrameWriter::~SpectralFrameWriter() {
+    finish();
+}
+
+bool SpectralFrameWriter::opened_ok() const {
+    return stream_ != nullptr;
+}
+
+bool SpectralFrameWriter::begin_frame(const Layout& layout) {
+    frame_active_ = false;
+    if (!stream_) {
+        return false;
+    }
+
+    // The first frame determines the layout, and the header is written right
+    // away so the file can be read while it's still being written
+    if (!layout_) {
+        const size_t fft_window_size = static_cast<size_t>(1)
+                                       << layout.fft_order;
+        const size_t num_bins = (fft_window_size / 2) + 1;
+        constexpr size_t floats_per_alignment = alignment / sizeof(float);
+        const size_t bin_stride =
+            ((num_bins + floats_per_alignment - 1) / floats_per_alignment) *
+            floats_per_alignment;
+        const size_t arrays_per_channel = with_phases_ ? 3 : 2;
+
+        layout_ = layout;
+        std::copy(std::begin(magic), std::end(magic), header_.magic);
+        header_.version = version;
+        header_.flags =
+            with_phases_ ? static_cast<juce::uint32>(has_phases) : 0;
+        header_.sample_rate = layout.sample_rate;
+        header_.fft_order = static_cast<juce::uint32>(layout.fft_order);
+        header_.hop_size = static_cast<juce::uint32>(layout.hop_size);
+        header_.num_channels = static_cast<juce::uint32>(layout.num_channels);
+        header_.num_bins = static_cast<juce::uint32>(num_bins);
+        header_.bin_stride = static_cast<juce::uint32>(bin_stride);
+        header_.frame_size = static_cast<juce::uint32>(
+            layout.num_channels * arrays_per_channel * bin_stride *
+            sizeof(float));
+        header_.num_frames = 0;
+
+        frame_.resize(header_.frame_size / sizeof(float));
+        stream_->write(&header_, sizeof(header_));
+    }
+
+    if (layout != *layout_) {
+        num_skipped_frames_ += 1;
+        return false;
+    }
+
+    clear_frame();
+    frame_active_ = true;
+
+    return true;
+}
+
+void SpectralFrameWriter::add_channel(size_t channel,
+                                      const std::complex<float>* bins,
+                                      const float* gains,
+                                      size_t first_gain_bin,
+                                      size_t num_gains) {
+    if (!frame_active_) {
+        return;
+    }
+    jassert(channel < header_.num_channels);
+    jassert(first_gain_bin + num_gains <= header_.num_bins);
+
+    const size_t num_bins = header_.num_bins;
+    const size_t bin_stride = header_.bin_stride;
+    float* channel_arrays =
+        frame_.data() + (channel * (with_phases_ ? 3 : 2) * bin_stride);
+
+    simd::kernels().magnitudes(bins, channel_arrays, num_bins);
+    if (with_phases_) {
+        float* phases = channel_arrays + bin_stride;
+        for (size_t bin_idx = 0; bin_idx < num_bins; bin_idx++) {
+            phases[bin_idx] = std::arg(bins[bin_idx]);
+        }
+    }
+
+    float* frame_gains =
+        channel_arrays + ((with_phases_ ? 2 : 1) * bin_stride);
+    std::copy_n(gains, num_gains, frame_gains + first_gain_bin);
+}
+
+void SpectralFrameWriter::finish_frame() {
+    if (!frame_active_) {
+        return;
+    }
+
+    stream_->write(frame_.data(), header_.frame_size);
+    num_frames_ += 1;
+    frame_active_ = false;
+}
+
+void SpectralFrameWriter::finish() {
+    if (!stream_) {
+        return;
+    }
+
+    if (layout_) {
+        header_.num_frames = num_frames_;
+        stream_->setPosition(0);
+        stream_->write(&header_, sizeof(header_));
+    }
+    stream_->flush();
+    stream_.reset();
+}
+
+void SpectralFrameWriter::clear_frame() {
+    const size_t bin_stride = header_.bin_stride;
+    const size_t arrays_per_channel = with_phases_ ? 3 : 2;
+    std::fill(frame_.begin(), frame_.end(), 0.0f);
+    for (size_t channel = 0; channel < header_.num_channels; channel++) {
+        float* gains = frame_.data() +
+                       (((channel + 1) * arrays_per_channel) - 1) * bin_stride;
+        std::fill_n(gains, header_.num_bins, 1.0f);
+    }
+}
+
+SpectralFrameFile::SpectralFrameFile(const juce::File& file) {
+    mapping_ = std::make_unique<juce::MemoryMappedFile>(
+        file, juce::MemoryMappedFile::readOnly);
+    const auto* data = static_cast<const char*>(mapping_->getData());
+    const size_t size = mapping_->getSize();
+    if (!data) {
+        error_ = "Could not map '" + file.getFullPathName() + "'";
+        return;
+    }
+
+    const auto* header = reinterpret_cast<const FileHeader*>(data);
+    if (size < sizeof(FileHeader) ||
+        !std::equal(std::begin(magic), std::end(magic),
+                    std::begin(header->magic))) {
+        error_ = "'" + file.getFullPathName() +
+                 "' is not a spectral frame file";
+        return;
+    }
+    if (header->version != version) {
+        error_ = "Unsupported spectral frame file version " +
+                 juce::String(header->version) + ", expected version " +
+                 juce::String(version);
+        return;
+    }
+
+    const size_t arrays_per_channel =
+        (header->flags & spectral_frame_format::has_phases) != 0 ? 3 : 2;
+    if (header->num_bins == 0 || header->bin_stride < header->num_bins ||
+        (header->bin_stride * sizeof(float)) % alignment != 0 ||
+        header->frame_size != header->num_channels * arrays_per_channel *
+                                  header->bin_stride * sizeof(float)) {
+        error_ = "'" + file.getFullPathName() + "' has an invalid header";
+        return;
+    }
+
+    // Files that are still being written don't have a frame count yet
+    const size_t num_stored_frames =
+        header->frame_size > 0
+            ? (size - sizeof(FileHeader)) / header->frame_size
+            : 0;
+    num_frames_ = header->num_frames > 0
+                      ? std::min(static_cast<size_t>(header->num_frames),
+                                 num_stored_frames)
+                      : num_stored_frames;
+    header_ = header;
+    frames_ = reinterpret_cast<const float*>(data + sizeof(FileHeader));
+}
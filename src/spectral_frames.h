@@ -0,0 +1,271 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <complex>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+/**
+ * The on-disk format for sequences of STFT frames written by
+ * `SpectralFrameWriter`, designed to be memory mapped and used in place
+ * through `SpectralFrameFile`. A file starts with a `FileHeader`, followed by
+ * `num_frames` frames of `frame_size` bytes each. Every frame contains the
+ * following arrays for every channel, in this order:
+ *
+ * - The magnitudes of the input's bins.
+ * - The phases of the input's bins in radians, if `flags` contains
+ *   `has_phases`.
+ * - The gain multipliers applied to the bins.
+ *
+ * Every array contains `num_bins` floats for the bins from DC up to and
+ * including the Nyquist frequency, followed by padding up to `bin_stride`
+ * floats. The header, the frames, and the arrays all start at a multiple of
+ * `alignment` bytes, so a memory mapped file can be fed directly to aligned
+ * vector loads. Everything is stored in native byte order.
+ */
+namespace spectral_frame_format {
+
+constexpr char magic[8] = {'S', 'C', 'F', 'R', 'A', 'M', 'E', 'S'};
+constexpr juce::uint32 version = 1;
+
+/**
+ * The alignment in bytes of every array in the file. This covers AVX-512
+ * vectors and cache lines.
+ */
+constexpr size_t alignment = 64;
+
+enum Flags : juce::uint32 {
+    has_phases = 1 << 0,
+};
+
+struct FileHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 flags;
+    /**
+     * The sample rate the STFT ran at. This is lower than the input's sample
+     * rate when the signal was decimated before the STFT.
+     */
+    double sample_rate;
+    juce::uint32 fft_order;
+    /**
+     * The number of samples between the starts of two consecutive frames.
+     */
+    juce::uint32 hop_size;
+    juce::uint32 num_channels;
+    /**
+     * `(1 << fft_order) / 2 + 1`.
+     */
+    juce::uint32 num_bins;
+    /**
+     * The number of floats between the starts of two consecutive arrays
+     * within a frame.
+     */
+    juce::uint32 bin_stride;
+    /**
+     * The size of a single frame in bytes.
+     */
+    juce::uint32 frame_size;
+    /**
+     * The number of complete frames in the file. This is only written when
+     * the writer is finished, so it's zero for files that are still being
+     * written.
+     */
+    juce::uint64 num_frames;
+    juce::uint8 reserved[8];
+};
+
+static_assert(sizeof(FileHeader) == alignment);
+
+}  // namespace spectral_frame_format
+
+/**
+ * Writes STFT frames to a file in the `spectral_frame_format` format. The
+ * frame layout is fixed by the first frame, and frames with a different
+ * layout (for instance because the FFT window size was changed) are counted
+ * and skipped. Frames are written straight to the file from
+ * `finish_frame()`, so this should only be used when processing offline.
+ */
+class SpectralFrameWriter {
+   public:
+    /**
+     * Everything that determines the size and the meaning of a frame.
+     */
+    struct Layout {
+        double sample_rate;
+        int fft_order;
+        size_t hop_size;
+        size_t num_channels;
+
+        bool operator==(const Layout&) const = default;
+    };
+
+    /**
+     * Open `file` for writing, overwriting it if it already exists. Check
+     * `opened_ok()` afterwards.
+     *
+     * @param with_phases Whether to also store the input's phases. This makes
+     *   the file half again as large.
+     */
+    SpectralFrameWriter(const juce::File& file, bool with_phases);
+    /**
+     * Calls `finish()`.
+     */
+    ~SpectralFrameWriter();
+
+    bool opened_ok() const;
+
+    /**
+     * Start a new frame with the given layout. Any channels that are not added
+     * through `add_channel()` are left silent, with unity gains.
+     *
+     * @return False if the layout doesn't match the first frame's layout, in
+     *   which case the frame is skipped and `add_channel()` and
+     *   `finish_frame()` don't do anything until the next frame.
+     */
+    bool begin_frame(const Layout& layout);
+
+    /**
+     * Add a channel to the current frame.
+     *
+     * @param bins The channel's input spectrum, containing the bins from DC up
+     *   to and including the Nyquist frequency.
+     * @param gains The gain multipliers for `num_gains` bins starting at bin
+     *   `first_gain_bin`. The other bins get a gain of 1.0.
+     */
+    void add_channel(size_t channel,
+                     const std::complex<float>* bins,
+                     const float* gains,
+                     size_t first_gain_bin,
+                     size_t num_gains);
+
+    /**
+     * Write the current frame to the file.
+     */
+    void finish_frame();
+
+    /**
+     * Write the final frame count to the header and flush the file. No more
+     * frames can be written after this.
+     */
+    void finish();
+
+    inline juce::uint64 num_frames() const { return num_frames_; }
+    /**
+     * The number of frames skipped because their layout didn't match.
+     */
+    inline juce::uint64 num_skipped_frames() const {
+        return num_skipped_frames_;
+    }
+
+   private:
+    /**
+     * Clear `frame_` to silence with unity gains.
+     */
+    void clear_frame();
+
+    std::unique_ptr<juce::FileOutputStream> stream_;
+    const bool with_phases_;
+
+    std::optional<Layout> layout_;
+    spectral_frame_format::FileHeader header_{};
+    /**
+     * The frame currently being assembled, with `header_.frame_size` bytes.
+     */
+    std::vector<float> frame_;
+    bool frame_active_ = false;
+
+    juce::uint64 num_frames_ = 0;
+    juce::uint64 num_skipped_frames_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(SpectralFrameWriter)
+};
+
+/**
+ * A read-only memory mapped view of a file written by `SpectralFrameWriter`.
+ * Opening a file only validates the header, and the accessors return pointers
+ * straight into the mapped file. These pointers are aligned to
+ * `spectral_frame_format::alignment` bytes.
+ */
+class SpectralFrameFile {
+   public:
+    /**
+     * Map `file`. Check `opened_ok()` afterwards.
+     */
+    explicit SpectralFrameFile(const juce::File& file);
+
+    /**
+     * Whether the file could be mapped and contains a valid header. If not,
+     * then `error()` contains the reason.
+     */
+    inline bool opened_ok() const { return header_ != nullptr; }
+    inline const juce::String& error() const { return error_; }
+
+    inline const spectral_frame_format::FileHeader& header() const {
+        return *header_;
+    }
+    inline bool has_phases() const {
+        return (header_->flags & spectral_frame_format::has_phases) != 0;
+    }
+    /**
+     * The number of complete frames. For files that are still being written
+     * this is computed from the file's size.
+     */
+    inline size_t num_frames() const { return num_frames_; }
+
+    /**
+     * The `header().num_bins` magnitudes for a channel in a frame.
+     */
+    inline const float* magnitudes(size_t frame, size_t channel) const {
+        return array(frame, channel, 0);
+    }
+    /**
+     * The phases for a channel in a frame, or a null pointer if the file
+     * doesn't contain phases.
+     */
+    inline const float* phases(size_t frame, size_t channel) const {
+        return has_phases() ? array(frame, channel, 1) : nullptr;
+    }
+    inline const float* gains(size_t frame, size_t channel) const {
+        return array(frame, channel, has_phases() ? 2 : 1);
+    }
+
+   private:
+    inline const float* array(size_t frame,
+                              size_t channel,
+                              size_t array_idx) const {
+        jassert(frame < num_frames_ && channel < header_->num_channels);
+
+        const size_t arrays_per_channel = has_phases() ? 3 : 2;
+        return frames_ + (frame * (header_->frame_size / sizeof(float))) +
+               (((channel * arrays_per_channel) + array_idx) *
+                header_->bin_stride);
+    }
+
+    std::unique_ptr<juce::MemoryMappedFile> mapping_;
+    const spectral_frame_format::FileHeader* header_ = nullptr;
+    const float* frames_ = nullptr;
+    size_t num_frames_ = 0;
+    juce::String error_;
+
+    JUCE_DECLARE_NON_COPYABLE(SpectralFrameFile)
+};
@@ -0,0 +1,211 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+/**
+ * A decimated snapshot of a single STFT frame, sent from the audio thread to
+ * the editor's spectrum analyzer. The FFT bins are grouped into bands of a
+ * twelfth of an octave (measured in bins, so independent of the sample rate),
+ * and every band stores the loudest bin's value. This keeps the frames small
+ * and of a fixed size regardless of the FFT window size.
+ */
+struct SpectrumFrame {
+    static constexpr size_t bands_per_octave = 12;
+    /**
+     * The highest bin index we need to be able to map. This corresponds to
+     * the largest supported FFT window size of `1 << 15`.
+     */
+    static constexpr size_t max_bin_idx = 1 << 14;
+    /**
+     * Bin 1 falls in band 0, and `max_bin_idx` falls in the last band.
+     */
+    static constexpr size_t num_bands = (bands_per_octave * 14) + 1;
+
+    /**
+     * The band bin `bin_idx` belongs to. Bin 0 (DC) is not part of any band
+     * and also maps to band 0. This uses a lookup table that is computed on
+     * the first call.
+     */
+    static inline size_t band_for_bin(size_t bin_idx) {
+        static const std::array<juce::uint8, max_bin_idx + 1> table = []() {
+            std::array<juce::uint8, max_bin_idx + 1> table{};
+            for (size_t bin_idx = 1; bin_idx <= max_bin_idx; bin_idx++) {
+                table[bin_idx] = static_cast<juce::uint8>(
+                    std::floor(std::log2(static_cast<double>(bin_idx)) *
+                               bands_per_octave));
+            }
+
+            return table;
+        }();
+        static_assert(num_bands <= std::numeric_limits<juce::uint8>::max());
+
+        return table[bin_idx];
+    }
+
+    double sample_rate = 0.0;
+    juce::uint32 fft_window_size = 0;
+    bool has_sidechain = false;
+
+    /**
+     * The largest magnitude in each band of the main input, after the input
+     * gain has been applied. These are raw FFT magnitudes, so a full scale
+     * sine wave will have a magnitude of about `fft_window_size / 4` because
+     * of the Hann window.
+     */
+    std::array<float, num_bands> input_magnitudes{};
+    /**
+     * The same as `input_magnitudes`, but for the sidechain input. Only
+     * meaningful when `has_sidechain` is set.
+     */
+    std::array<float, num_bands> sidechain_magnitudes{};
+    /**
+     * For every band the gain multiplier that deviates the most from unity, so
+     * this shows both downwards and upwards compression. This is 1.0 for
+     * bands without any bins.
+     */
+    std::array<float, num_bands> gains{};
+};
+
+/**
+ * A lock-free single producer single consumer FIFO of `SpectrumFrame`s that
+ * also accumulates the frame currently being analyzed. The audio thread adds
+ * every bin it processes through `add_bin()` and `add_sidechain_bin()`, and
+ * then calls `finish_frame()` after the last channel. Everything is
+ * preallocated, and the audio thread does the exact same amount of work
+ * whether or not anyone is reading from the FIFO. When the FIFO is full
+ * (because the editor is closed) the finished frame is simply discarded.
+ */
+class SpectrumFifo {
+   public:
+    /**
+     * @param capacity How many finished frames can be buffered. The editor
+     *   reads the FIFO at a much lower rate than frames are produced, so this
+     *   needs a bit of slack.
+     */
+    SpectrumFifo(int capacity = 64) : frames_(capacity), fifo_(capacity) {
+        // Make sure the lookup table doesn't get initialized on the audio
+        // thread
+        SpectrumFrame::band_for_bin(0);
+        reset_accumulators();
+    }
+
+    /**
+     * The memory held by the preallocated frames in bytes.
+     */
+    inline size_t memory_usage() const {
+        return frames_.capacity() * sizeof(SpectrumFrame);
+    }
+
+    /**
+     * Add a bin from the main input to the current frame. `gain` is the gain
+     * multiplier applied to that bin. Called on the audio thread.
+     */
+    inline void add_bin(size_t bin_idx, float magnitude, float gain) {
+        const size_t band = SpectrumFrame::band_for_bin(bin_idx);
+        current_.input_magnitudes[band] =
+            std::max(current_.input_magnitudes[band], magnitude);
+        min_gains_[band] = std::min(min_gains_[band], gain);
+        max_gains_[band] = std::max(max_gains_[band], gain);
+    }
+
+    /**
+     * Add a bin from the sidechain input to the current frame. Called on the
+     * audio thread.
+     */
+    inline void add_sidechain_bin(size_t bin_idx, float magnitude) {
+        const size_t band = SpectrumFrame::band_for_bin(bin_idx);
+        current_.sidechain_magnitudes[band] =
+            std::max(current_.sidechain_magnitudes[band], magnitude);
+    }
+
+    /**
+     * Push the current frame to the FIFO if there's room for it, and start a
+     * new frame. Called on the audio thread after every channel has been
+     * processed.
+     */
+    void finish_frame(double sample_rate,
+                      size_t fft_window_size,
+                      bool has_sidechain) {
+        current_.sample_rate = sample_rate;
+        current_.fft_window_size = static_cast<juce::uint32>(fft_window_size);
+        current_.has_sidechain = has_sidechain;
+        for (size_t band = 0; band < SpectrumFrame::num_bands; band++) {
+            // Bands without any bins keep their initial values of infinity and
+            // zero, in which case this results in a gain of 1.0
+            const float min_gain = std::min(min_gains_[band], 1.0f);
+            const float max_gain = std::max(max_gains_[band], 1.0f);
+            current_.gains[band] =
+                max_gain * min_gain >= 1.0f ? max_gain : min_gain;
+        }
+
+        int start1, size1, start2, size2;
+        fifo_.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 > 0) {
+            frames_[static_cast<size_t>(start1)] = current_;
+            fifo_.finishedWrite(1);
+        }
+
+        reset_accumulators();
+    }
+
+    /**
+     * Pop the oldest finished frame into `frame`. Called on the message
+     * thread.
+     *
+     * @return Whether there was a frame to pop.
+     */
+    bool pop(SpectrumFrame& frame) {
+        int start1, size1, start2, size2;
+        fifo_.prepareToRead(1, start1, size1, start2, size2);
+        if (size1 == 0) {
+            return false;
+        }
+
+        frame = frames_[static_cast<size_t>(start1)];
+        fifo_.finishedRead(1);
+
+        return true;
+    }
+
+   private:
+    void reset_accumulators() {
+        current_.input_magnitudes.fill(0.0f);
+        current_.sidechain_magnitudes.fill(0.0f);
+        min_gains_.fill(std::numeric_limits<float>::infinity());
+        max_gains_.fill(0.0f);
+    }
+
+    std::vector<SpectrumFrame> frames_;
+    juce::AbstractFifo fifo_;
+
+    /**
+     * The frame currently being accumulated. Only accessed from the audio
+     * thread.
+     */
+    SpectrumFrame current_;
+    std::array<float, SpectrumFrame::num_bands> min_gains_;
+    std::array<float, SpectrumFrame::num_bands> max_gains_;
+
+    JUCE_DECLARE_NON_COPYABLE(SpectrumFifo)
+};
@@ -0,0 +1,208 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <optional>
+
+#include "../processor.h"
+#include "commands.h"
+#include "offline.h"
+
+namespace {
+
+/**
+ * The lowest gain written to the output, in decibels. Bands without any
+ * signal would otherwise end up at minus infinity.
+ */
+constexpr float minimum_gain_db = -100.0f;
+
+/**
+ * The center frequency of an FFT bin in Hertz.
+ */
+double bin_frequency(const BinAnalysis& analysis, size_t bin_idx) {
+    return static_cast<double>(bin_idx) * analysis.sample_rate /
+           static_cast<double>(analysis.fft_window_size);
+}
+
+/**
+ * Whether two analyses have the same bins, and can thus share the CSV file's
+ * columns.
+ */
+bool same_layout(const BinAnalysis& a, const BinAnalysis& b) {
+    return a.is_upper_band == b.is_upper_band &&
+           a.sample_rate == b.sample_rate &&
+           a.fft_window_size == b.fft_window_size &&
+           a.first_bin == b.first_bin && a.gains.size() == b.gains.size();
+}
+
+}  // namespace
+
+void analyze_command(const juce::ArgumentList& args) {
+    args.checkMinNumArguments(2);
+    const juce::File input_file = args[1].resolveAsExistingFile();
+    const juce::File output_file =
+        args.containsOption("--output")
+            ? args.getFileForOption("--output")
+            : input_file.withFileExtension("gains.csv");
+
+    const std::unique_ptr<juce::AudioFormatReader> reader =
+        open_audio_file(input_file);
+    const int num_channels = static_cast<int>(reader->numChannels);
+
+    SpectralCompressorProcessor processor;
+    if (args.containsOption("--preset")) {
+        load_preset(processor, args.getExistingFileForOption("--preset"));
+    }
+    set_up_channels(processor, num_channels);
+
+    output_file.deleteFile();
+    juce::FileOutputStream output(output_file);
+    if (!output.openedOk()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       output_file.getFullPathName() + "'");
+    }
+
+    // Every channel of every hop becomes a row with the gain for every bin in
+    // decibels. The header is written for the first hop, since the bins'
+    // frequencies depend on the FFT window size. A CSV file can only have one
+    // set of columns, so in multi-resolution mode the upper band is skipped.
+    std::optional<BinAnalysis> layout;
+    size_t num_hops = 0;
+    size_t num_skipped_rows = 0;
+    float max_reduction_db = 0.0f;
+    processor.set_analysis_only([&](const BinAnalysis& analysis) {
+        if (!layout) {
+            layout = analysis;
+            output << "hop,channel";
+            for (size_t i = 0; i < analysis.gains.size(); i++) {
+                output << ","
+                       << juce::String(
+                              bin_frequency(analysis, analysis.first_bin + i),
+                              1);
+            }
+            output << "\n";
+        } else if (!same_layout(*layout, analysis)) {
+            num_skipped_rows += 1;
+            return;
+        }
+
+        if (analysis.channel == 0) {
+            num_hops += 1;
+        }
+
+        output << juce::String(num_hops - 1) << ","
+               << juce::String(analysis.channel);
+        for (const float gain : analysis.gains) {
+            const float gain_db =
+                juce::Decibels::gainToDecibels(gain, minimum_gain_db);
+            max_reduction_db = std::max(max_reduction_db, -gain_db);
+            output << "," << juce::String(gain_db, 2);
+        }
+        output << "\n";
+    });
+
+    // The STFT frames themselves can optionally be written to a frame file as
+    // well
+    std::unique_ptr<SpectralFrameWriter> frame_writer;
+    if (args.containsOption("--frames")) {
+        const juce::File frames_file = args.getFileForOption("--frames");
+        frame_writer = std::make_unique<SpectralFrameWriter>(
+            frames_file, args.containsOption("--phases"));
+        if (!frame_writer->opened_ok()) {
+            juce::ConsoleApplication::fail("Could not write to '" +
+                                           frames_file.getFullPathName() +
+                                           "'");
+        }
+
+        processor.set_frame_writer(frame_writer.get());
+    }
+
+    const double sample_rate = reader->sampleRate;
+    processor.setRateAndBufferSizeDetails(sample_rate, offline_block_size);
+    processor.prepareToPlay(sample_rate, offline_block_size);
+
+    // The sidechain input stays silent. The input is followed by the
+    // processor's latency worth of silence so the end of the file gets
+    // analyzed as well.
+    juce::AudioBuffer<float> buffer(num_channels * 2, offline_block_size);
+    juce::MidiBuffer midi_buffer;
+    const juce::int64 num_samples =
+        reader->lengthInSamples + processor.getLatencySamples();
+
+    const juce::int64 start_ticks = juce::Time::getHighResolutionTicks();
+    for (juce::int64 offset = 0; offset < num_samples;
+         offset += offline_block_size) {
+        const int num_block_samples = static_cast<int>(
+            std::min(static_cast<juce::int64>(offline_block_size),
+                     num_samples - offset));
+        buffer.setSize(num_channels * 2, num_block_samples, false, false,
+                       true);
+        buffer.clear();
+        read_block(*reader, buffer, 0, num_channels, offset,
+                   num_block_samples);
+
+        processor.processBlock(buffer, midi_buffer);
+    }
+    const double seconds = juce::Time::highResolutionTicksToSeconds(
+        juce::Time::getHighResolutionTicks() - start_ticks);
+
+    output.flush();
+    if (output.getStatus().failed()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       output_file.getFullPathName() + "'");
+    }
+
+    const double audio_seconds =
+        static_cast<double>(reader->lengthInSamples) / sample_rate;
+    std::cout << "Analyzed " << audio_seconds << " seconds of audio in "
+              << seconds << " seconds (" << (audio_seconds / seconds)
+              << "x real time)" << std::endl;
+    std::cout << "Wrote " << num_hops << " hops to '"
+              << output_file.getFullPathName() << "', with at most "
+              << max_reduction_db << " dB of gain reduction";
+    if (num_skipped_rows > 0) {
+        std::cout << ", skipped " << num_skipped_rows
+                  << " rows for the upper band";
+    }
+    std::cout << std::endl;
+
+    if (frame_writer) {
+        processor.set_frame_writer(nullptr);
+        frame_writer->finish();
+
+        // Reading the file back also makes sure it can be mapped
+        const juce::File frames_file = args.getFileForOption("--frames");
+        const SpectralFrameFile frames(frames_file);
+        if (!frames.opened_ok()) {
+            juce::ConsoleApplication::fail("Could not read back '" +
+                                           frames_file.getFullPathName() +
+                                           "': " + frames.error());
+        }
+
+        std::cout << "Wrote " << frames.num_frames() << " STFT frames with "
+                  << frames.header().num_bins << " bins to '"
+                  << frames_file.getFullPathName() << "'";
+        if (frame_writer->num_skipped_frames() > 0) {
+            std::cout << ", skipped " << frame_writer->num_skipped_frames()
+                      << " frames with a different layout";
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <iostream>
+
+#include "../dsp/fft.h"
+#include "commands.h"
+
+namespace {
+
+/**
+ * The FFT orders the plugin's resolution parameter can be set to.
+ */
+constexpr int min_fft_order = 9;
+constexpr int max_fft_order = 15;
+
+}  // namespace
+
+void calibrate_fft_command(const juce::ArgumentList& args) {
+    int first_order = min_fft_order;
+    int last_order = max_fft_order;
+    if (args.containsOption("--order")) {
+        first_order = last_order =
+            args.getValueForOption("--order").getIntValue();
+        if (first_order < min_fft_order || first_order > max_fft_order) {
+            juce::ConsoleApplication::fail(
+                "The FFT order should be between " +
+                juce::String(min_fft_order) + " and " +
+                juce::String(max_fft_order));
+        }
+    }
+
+    for (int order = first_order; order <= last_order; order++) {
+        const std::vector<fft::BenchmarkResult> results =
+            fft::recalibrate(order);
+
+        std::cout << "Order " << order << " (" << (1 << order)
+                  << " samples): fastest is "
+                  << fft::backend_name(results.front().backend);
+        // The environment variable takes precedence over the calibration
+        const fft::Backend selected = fft::selected_backend(order);
+        if (selected != results.front().backend) {
+            std::cout << ", but " << fft::backend_name(selected)
+                      << " is forced through the environment";
+        }
+        std::cout << std::endl;
+
+        for (const fft::BenchmarkResult& result : results) {
+            std::cout << "  " << fft::backend_name(result.backend) << ": "
+                      << result.seconds_per_round_trip * 1.0e6
+                      << " us per round trip" << std::endl;
+        }
+    }
+}
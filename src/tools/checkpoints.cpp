@@ -0,0 +1,165 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "checkpoints.h"
+
+#include <algorithm>
+
+#include "../processor.h"
+
+using namespace checkpoint_format;
+
+juce::uint64 hash_processor_state(SpectralCompressorProcessor& processor) {
+    juce::MemoryBlock state;
+    processor.getStateInformation(state);
+
+    juce::uint64 hash = 0xcbf29ce484222325;
+    const auto* bytes = static_cast<const juce::uint8*>(state.getData());
+    for (size_t i = 0; i < state.getSize(); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+CheckpointWriter::CheckpointWriter(const juce::File& file, FileHeader header)
+    : file_(file) {
+    file.deleteFile();
+    stream_ = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream_->openedOk()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file.getFullPathName() + "'");
+    }
+
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.version = version;
+    stream_->write(&header, sizeof(header));
+}
+
+void CheckpointWriter::add(SpectralCompressorProcessor& processor,
+                           juce::uint64 position) {
+    juce::MemoryOutputStream compressed;
+    {
+        juce::GZIPCompressorOutputStream compressor(compressed);
+        if (!processor.save_checkpoint(compressor)) {
+            juce::ConsoleApplication::fail(
+                "Could not take a checkpoint, the processor has not been "
+                "prepared");
+        }
+    }
+
+    const RecordHeader record{
+        .position = position,
+        .compressed_size = static_cast<juce::uint32>(compressed.getDataSize()),
+        .reserved = 0};
+    if (!stream_->write(&record, sizeof(record)) ||
+        !stream_->write(compressed.getData(), compressed.getDataSize())) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file_.getFullPathName() + "'");
+    }
+
+    num_checkpoints_ += 1;
+    num_bytes_ += compressed.getDataSize();
+}
+
+void CheckpointWriter::finish() {
+    stream_->flush();
+    if (stream_->getStatus().failed()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file_.getFullPathName() + "'");
+    }
+}
+
+CheckpointFile::CheckpointFile(const juce::File& file) : file_(file) {
+    juce::FileInputStream stream(file);
+    if (!stream.openedOk()) {
+        juce::ConsoleApplication::fail("Could not open '" +
+                                       file.getFullPathName() + "'");
+    }
+
+    if (stream.read(&header_, sizeof(header_)) != sizeof(header_) ||
+        !std::equal(std::begin(magic), std::end(magic),
+                    std::begin(header_.magic))) {
+        juce::ConsoleApplication::fail("'" + file.getFullPathName() +
+                                       "' is not a checkpoint file");
+    }
+    if (header_.version != version) {
+        juce::ConsoleApplication::fail(
+            "Unsupported checkpoint version " + juce::String(header_.version) +
+            ", expected version " + juce::String(version));
+    }
+
+    // Only the record headers are read here. A record that got cut off, for
+    // instance because the render was interrupted, ends the index.
+    const juce::int64 total_length = stream.getTotalLength();
+    RecordHeader record{};
+    while (stream.read(&record, sizeof(record)) == sizeof(record)) {
+        const juce::int64 offset = stream.getPosition();
+        if (offset + record.compressed_size > total_length ||
+            (!records_.empty() &&
+             record.position <= records_.back().position)) {
+            break;
+        }
+
+        records_.push_back(Record{.position = record.position,
+                                  .offset = offset,
+                                  .compressed_size = record.compressed_size});
+        stream.setPosition(offset + record.compressed_size);
+    }
+}
+
+juce::uint64 CheckpointFile::find(juce::uint64 position) const {
+    const auto record = std::upper_bound(
+        records_.begin(), records_.end(), position,
+        [](juce::uint64 value, const Record& candidate) {
+            return value < candidate.position;
+        });
+
+    return record == records_.begin() ? 0 : std::prev(record)->position;
+}
+
+void CheckpointFile::restore(juce::uint64 position,
+                             SpectralCompressorProcessor& processor,
+                             const juce::AudioBuffer<float>& dry_history) {
+    if (position == 0) {
+        return;
+    }
+
+    const auto record =
+        std::find_if(records_.begin(), records_.end(),
+                     [&](const Record& candidate) {
+                         return candidate.position == position;
+                     });
+    jassert(record != records_.end());
+
+    juce::FileInputStream stream(file_);
+    juce::MemoryBlock compressed;
+    if (!stream.openedOk() || !stream.setPosition(record->offset) ||
+        stream.readIntoMemoryBlock(compressed, record->compressed_size) !=
+            record->compressed_size) {
+        juce::ConsoleApplication::fail("Could not read '" +
+                                       file_.getFullPathName() + "'");
+    }
+
+    juce::MemoryInputStream compressed_stream(compressed, false);
+    juce::GZIPDecompressorInputStream state_stream(compressed_stream);
+    if (!processor.restore_checkpoint(state_stream, dry_history)) {
+        juce::ConsoleApplication::fail(
+            "The checkpoint at sample " + juce::String(position) +
+            " does not match the processor's current settings");
+    }
+}
@@ -0,0 +1,162 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+class SpectralCompressorProcessor;
+
+/**
+ * The on-disk format for the processor snapshots taken by `render
+ * --checkpoints`. A checkpoint file starts with a `FileHeader`, followed by a
+ * sequence of records in increasing order of position. Every record starts
+ * with a `RecordHeader` followed by `compressed_size` bytes of gzip compressed
+ * state from `SpectralCompressorProcessor::save_checkpoint()`. Everything is
+ * stored in native byte order, and the states are only meant to be restored by
+ * the same build of the plugin.
+ */
+namespace checkpoint_format {
+
+constexpr char magic[8] = {'S', 'C', 'C', 'H', 'E', 'C', 'K', 'P'};
+constexpr juce::uint32 version = 1;
+
+enum Flags : juce::uint32 {
+    has_sidechain = 1 << 0,
+};
+
+struct FileHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 flags;
+    double sample_rate;
+    juce::uint32 num_channels;
+    /**
+     * The processor's latency in samples. Restoring a checkpoint needs this
+     * many samples of the main input leading up to it.
+     */
+    juce::uint32 latency;
+    /**
+     * A hash of the plugin's state at the start of the render, see
+     * `hash_processor_state()`. The checkpoints can only be restored into a
+     * processor with the same state.
+     */
+    juce::uint64 state_hash;
+};
+
+struct RecordHeader {
+    /**
+     * The number of input samples processed before the checkpoint was taken.
+     */
+    juce::uint64 position;
+    juce::uint32 compressed_size;
+    juce::uint32 reserved;
+};
+
+}  // namespace checkpoint_format
+
+/**
+ * A 64-bit FNV-1a hash of the plugin's binary state.
+ */
+juce::uint64 hash_processor_state(SpectralCompressorProcessor& processor);
+
+/**
+ * Writes processor snapshots to a file in the `checkpoint_format` format. Like
+ * the commands themselves, this reports errors through
+ * `juce::ConsoleApplication::fail()`.
+ */
+class CheckpointWriter {
+   public:
+    /**
+     * Create `file`, overwriting it if it already exists. The magic and the
+     * version in `header` are filled in here.
+     */
+    CheckpointWriter(const juce::File& file,
+                     checkpoint_format::FileHeader header);
+
+    /**
+     * Take a snapshot of `processor` after `position` input samples have been
+     * processed. Should be called in between processing cycles, with
+     * increasing positions.
+     */
+    void add(SpectralCompressorProcessor& processor, juce::uint64 position);
+
+    /**
+     * Flush everything to disk.
+     */
+    void finish();
+
+    inline size_t num_checkpoints() const { return num_checkpoints_; }
+    /**
+     * The total size of the compressed snapshots in bytes.
+     */
+    inline juce::uint64 num_bytes() const { return num_bytes_; }
+
+   private:
+    juce::File file_;
+    std::unique_ptr<juce::FileOutputStream> stream_;
+
+    size_t num_checkpoints_ = 0;
+    juce::uint64 num_bytes_ = 0;
+};
+
+/**
+ * Reads the checkpoints written by `CheckpointWriter`. The file is indexed up
+ * front, and only the snapshot that gets restored is decompressed. Errors are
+ * reported through `juce::ConsoleApplication::fail()`.
+ */
+class CheckpointFile {
+   public:
+    explicit CheckpointFile(const juce::File& file);
+
+    inline const checkpoint_format::FileHeader& header() const {
+        return header_;
+    }
+    inline size_t num_checkpoints() const { return records_.size(); }
+
+    /**
+     * The position of the last checkpoint taken at or before `position`, or
+     * zero if there is none. Starting from zero does not need a checkpoint.
+     */
+    juce::uint64 find(juce::uint64 position) const;
+
+    /**
+     * Restore the checkpoint at `position`, as returned by `find()`, into a
+     * freshly prepared processor. See
+     * `SpectralCompressorProcessor::restore_checkpoint()` for `dry_history`.
+     * Restoring position zero doesn't do anything.
+     */
+    void restore(juce::uint64 position,
+                 SpectralCompressorProcessor& processor,
+                 const juce::AudioBuffer<float>& dry_history);
+
+   private:
+    struct Record {
+        juce::uint64 position;
+        /**
+         * The offset of the compressed state within the file.
+         */
+        juce::int64 offset;
+        juce::uint32 compressed_size;
+    };
+
+    juce::File file_;
+    checkpoint_format::FileHeader header_{};
+    std::vector<Record> records_;
+};
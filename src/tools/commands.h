@@ -0,0 +1,74 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+// The commands for `spectral-compressor-tools`. These are registered in
+// `main.cpp`, and every command lives in its own file. Errors are reported
+// through `juce::ConsoleApplication::fail()`.
+
+/**
+ * Feed a capture created by `SessionCapture` through a new processor instance
+ * and verify that the output is bit-exact, while timing every processing
+ * cycle.
+ */
+void replay_command(const juce::ArgumentList& args);
+
+/**
+ * Benchmark the available FFT backends for every FFT size the plugin supports
+ * and store the fastest ones in the calibration cache. See
+ * `fft::recalibrate()`.
+ */
+void calibrate_fft_command(const juce::ArgumentList& args);
+
+/**
+ * Check that the optimized processing paths (every combination of SIMD kernels
+ * and FFT backend) produce the same results as the scalar reference
+ * implementation within configurable tolerances, using randomized signals,
+ * block sizes, and settings.
+ */
+void equivalence_command(const juce::ArgumentList& args);
+
+/**
+ * Feed random block size sequences through `RingBuffer`,
+ * `PowerOfTwoRingBuffer`, `OverlapAddBuffer`, `STFT`, and the processor, and
+ * check that the results don't depend on how the input was split up and that
+ * nothing throws.
+ */
+void fuzz_blocks_command(const juce::ArgumentList& args);
+
+/**
+ * Run an audio file through the processor in analysis-only mode and write the
+ * gain reduction for every bin of every STFT hop to a CSV file.
+ */
+void analyze_command(const juce::ArgumentList& args);
+
+/**
+ * Render an audio file through the processor to a WAV file, optionally reusing
+ * the forward transforms from earlier renders of the same input through an
+ * `AnalysisCache`. Full renders can write checkpoints of the processor's state,
+ * and region renders resume from those through a `CheckpointFile`.
+ */
+void render_command(const juce::ArgumentList& args);
+
+/**
+ * Render an audio file through several presets in a single pass, computing
+ * the forward transforms only once for all variants through a
+ * `SharedAnalysis`.
+ */
+void sweep_command(const juce::ArgumentList& args);
@@ -0,0 +1,391 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <optional>
+
+#include "../dsp/fft.h"
+#include "../dsp/simd.h"
+#include "commands.h"
+#include "harness.h"
+
+namespace {
+
+/**
+ * A combination of SIMD kernels and FFT backend. The scalar kernels with
+ * JUCE's FFT serve as the reference implementation.
+ */
+struct ProcessingPath {
+    simd::Isa isa;
+    fft::Backend backend;
+
+    bool is_reference() const {
+        return isa == simd::Isa::scalar && backend == fft::Backend::juce;
+    }
+
+    /**
+     * The SSE2 kernels don't use FMA and perform the exact same operations as
+     * the scalar kernels, so they should produce identical results.
+     */
+    bool should_match_reference_exactly() const {
+        return (isa == simd::Isa::scalar || isa == simd::Isa::sse2) &&
+               backend == fft::Backend::juce;
+    }
+
+    juce::String name() const {
+        return juce::String(simd::isa_name(isa)) + "+" +
+               fft::backend_name(backend);
+    }
+};
+
+/**
+ * The tolerances deviations are checked against, relative to the peak
+ * magnitude of the reference in decibels.
+ */
+struct Tolerances {
+    double kernel_max_db;
+    double fft_max_db;
+    double render_max_db;
+    double render_rms_db;
+};
+
+/**
+ * Tracks the worst deviation for a single check and counts failures.
+ */
+class Check {
+   public:
+    Check(juce::String name, double max_tolerance_db, bool must_be_exact)
+        : name_(std::move(name)),
+          max_tolerance_db_(max_tolerance_db),
+          must_be_exact_(must_be_exact) {}
+
+    /**
+     * Record a deviation, printing the context when it exceeds the tolerance.
+     *
+     * @param context Describes the input, so the failure can be reproduced.
+     * @param rms_tolerance_db An optional separate tolerance for the RMS
+     *   deviation.
+     */
+    void add(const Deviation& deviation,
+             const juce::String& context,
+             std::optional<double> rms_tolerance_db = std::nullopt) {
+        worst_max_db_ = std::max(worst_max_db_, deviation.max_db);
+        worst_rms_db_ = std::max(worst_rms_db_, deviation.rms_db);
+        num_cases_ += 1;
+
+        const bool failed =
+            (must_be_exact_ && !deviation.is_exact) ||
+            deviation.max_db > max_tolerance_db_ ||
+            (rms_tolerance_db && deviation.rms_db > *rms_tolerance_db);
+        if (failed) {
+            num_failures_ += 1;
+            std::cout << "FAIL " << name_ << ": max "
+                      << juce::String(deviation.max_db, 1) << " dB, RMS "
+                      << juce::String(deviation.rms_db, 1) << " dB"
+                      << (must_be_exact_ ? " (expected bit-exact)" : "")
+                      << ", " << context << std::endl;
+        }
+    }
+
+    /**
+     * Print a summary line.
+     *
+     * @return The number of failed cases.
+     */
+    size_t report() const {
+        std::cout << (num_failures_ > 0 ? "FAIL " : "ok   ") << name_
+                  << ": worst max " << juce::String(worst_max_db_, 1)
+                  << " dB, worst RMS " << juce::String(worst_rms_db_, 1)
+                  << " dB over " << num_cases_ << " cases"
+                  << (must_be_exact_ ? ", bit-exact" : "") << std::endl;
+
+        return num_failures_;
+    }
+
+   private:
+    juce::String name_;
+    double max_tolerance_db_;
+    bool must_be_exact_;
+
+    double worst_max_db_ = -400.0;
+    double worst_rms_db_ = -400.0;
+    size_t num_cases_ = 0;
+    size_t num_failures_ = 0;
+};
+
+double option_or(const juce::ArgumentList& args,
+                 const juce::String& option,
+                 double default_value) {
+    return args.containsOption(option)
+               ? args.getValueForOption(option).getDoubleValue()
+               : default_value;
+}
+
+std::vector<float> random_floats(juce::Random& random, size_t num) {
+    std::vector<float> values(num);
+    for (float& value : values) {
+        value = (random.nextFloat() * 2.0f) - 1.0f;
+    }
+
+    return values;
+}
+
+/**
+ * Compare every kernel against the scalar kernels on random data of random
+ * lengths, so the tails get covered as well.
+ */
+size_t check_kernels(juce::Random& random,
+                     int iterations,
+                     const Tolerances& tolerances) {
+    const simd::Kernels& reference = *simd::detail::scalar_kernels();
+
+    size_t num_failures = 0;
+    for (const simd::Isa isa : {simd::Isa::sse2, simd::Isa::avx2,
+                                simd::Isa::avx512, simd::Isa::neon}) {
+        if (!simd::is_supported(isa)) {
+            continue;
+        }
+
+        simd::force_isa(isa);
+        const simd::Kernels& kernels = simd::kernels();
+        const juce::String prefix = juce::String(simd::isa_name(isa)) + " ";
+        // Only the kernels that don't use FMA perform the exact same
+        // operations as the scalar versions
+        const bool uses_fma = isa != simd::Isa::sse2;
+
+        Check magnitudes(prefix + "magnitudes", tolerances.kernel_max_db,
+                         !uses_fma);
+        Check multiply_complex(prefix + "multiply_complex",
+                               tolerances.kernel_max_db, true);
+        Check multiply(prefix + "multiply", tolerances.kernel_max_db, true);
+        Check multiply_add(prefix + "multiply_add", tolerances.kernel_max_db,
+                           !uses_fma);
+        Check box_filter(prefix + "box_filter", tolerances.kernel_max_db, true);
+
+        for (int iteration = 0; iteration < iterations * 50; iteration++) {
+            const size_t num = static_cast<size_t>(random.nextInt(4100));
+            const juce::String context = juce::String(num) + " elements";
+
+            const std::vector<float> a = random_floats(random, num * 2);
+            const std::vector<float> b = random_floats(random, num);
+            const float gain = (random.nextFloat() * 4.0f) - 2.0f;
+            const auto* bins =
+                reinterpret_cast<const std::complex<float>*>(a.data());
+
+            std::vector<float> expected(num);
+            std::vector<float> actual(num);
+            reference.magnitudes(bins, expected.data(), num);
+            kernels.magnitudes(bins, actual.data(), num);
+            magnitudes.add(compare(expected.data(), actual.data(), num),
+                           context);
+
+            std::vector<float> expected_bins = a;
+            std::vector<float> actual_bins = a;
+            reference.multiply_complex(
+                reinterpret_cast<std::complex<float>*>(expected_bins.data()),
+                b.data(), num);
+            kernels.multiply_complex(
+                reinterpret_cast<std::complex<float>*>(actual_bins.data()),
+                b.data(), num);
+            multiply_complex.add(compare(expected_bins.data(),
+                                         actual_bins.data(), num * 2),
+                                 context);
+
+            expected.assign(a.begin(), a.begin() + num);
+            actual.assign(a.begin(), a.begin() + num);
+            reference.multiply(expected.data(), b.data(), num);
+            kernels.multiply(actual.data(), b.data(), num);
+            multiply.add(compare(expected.data(), actual.data(), num),
+                         context);
+
+            expected.assign(a.begin(), a.begin() + num);
+            actual.assign(a.begin(), a.begin() + num);
+            reference.multiply_add(expected.data(), b.data(), gain, num);
+            kernels.multiply_add(actual.data(), b.data(), gain, num);
+            multiply_add.add(compare(expected.data(), actual.data(), num),
+                             context);
+
+            const size_t width = 1 + static_cast<size_t>(random.nextInt(33));
+            const std::vector<float> padded =
+                random_floats(random, num + width - 1);
+            const float scale = 1.0f / static_cast<float>(width);
+            std::vector<double> running_sums(num + width);
+            reference.box_filter(padded.data(), expected.data(),
+                                 running_sums.data(), width, scale, num);
+            kernels.box_filter(padded.data(), actual.data(),
+                               running_sums.data(), width, scale, num);
+            box_filter.add(compare(expected.data(), actual.data(), num),
+                           context + ", width " + juce::String(width));
+        }
+
+        for (const Check* check : {&magnitudes, &multiply_complex, &multiply,
+                                   &multiply_add, &box_filter}) {
+            num_failures += check->report();
+        }
+    }
+
+    return num_failures;
+}
+
+/**
+ * Compare the forward and inverse transforms of every FFT backend against
+ * JUCE's FFT.
+ */
+size_t check_fft_backends(juce::Random& random,
+                          int iterations,
+                          const Tolerances& tolerances) {
+    size_t num_failures = 0;
+    for (const fft::Backend backend : {fft::Backend::fftw,
+                                       fft::Backend::pffft}) {
+        if (!fft::is_available(backend)) {
+            continue;
+        }
+
+        const juce::String prefix = juce::String(fft::backend_name(backend));
+        Check forward(prefix + " forward", tolerances.fft_max_db, false);
+        Check inverse(prefix + " inverse", tolerances.fft_max_db, false);
+
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            const int order = 9 + random.nextInt(7);
+            const size_t size = static_cast<size_t>(1) << order;
+            const juce::String context = "order " + juce::String(order);
+
+            const std::unique_ptr<fft::Engine> reference =
+                fft::create_engine(fft::Backend::juce, order);
+            const std::unique_ptr<fft::Engine> engine =
+                fft::create_engine(backend, order);
+
+            std::vector<float> expected = random_floats(random, size * 2);
+            std::vector<float> actual = expected;
+            reference->forward(expected.data());
+            engine->forward(actual.data());
+            // Only the bins up to and including the Nyquist frequency are
+            // specified
+            forward.add(compare(expected.data(), actual.data(), size + 2),
+                        context);
+
+            actual = expected;
+            reference->inverse(expected.data());
+            engine->inverse(actual.data());
+            inverse.add(compare(expected.data(), actual.data(), size),
+                        context);
+        }
+
+        num_failures += forward.report();
+        num_failures += inverse.report();
+    }
+
+    return num_failures;
+}
+
+/**
+ * Render random signals with random settings through every processing path
+ * and compare the results against the reference path.
+ */
+size_t check_renders(juce::Random& random,
+                     int iterations,
+                     const Tolerances& tolerances) {
+    std::vector<ProcessingPath> paths;
+    for (const simd::Isa isa : {simd::Isa::scalar, simd::Isa::sse2,
+                                simd::Isa::avx2, simd::Isa::avx512,
+                                simd::Isa::neon}) {
+        for (const fft::Backend backend :
+             {fft::Backend::juce, fft::Backend::fftw, fft::Backend::pffft}) {
+            if (simd::is_supported(isa) && fft::is_available(backend)) {
+                paths.push_back(ProcessingPath{isa, backend});
+            }
+        }
+    }
+
+    // Rendering the reference twice must give identical results, otherwise
+    // none of the other comparisons mean anything
+    Check determinism("reference determinism", tolerances.render_max_db, true);
+    std::vector<Check> checks;
+    for (const ProcessingPath& path : paths) {
+        checks.emplace_back(path.name() + " render", tolerances.render_max_db,
+                            path.should_match_reference_exactly());
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        const int num_samples = 48000 + random.nextInt(96000);
+        RenderSettings settings = random_render_settings(
+            random, 13, static_cast<size_t>(num_samples));
+        settings.block_sizes =
+            random_block_sizes(random, num_samples, 32 << random.nextInt(7));
+        const juce::AudioBuffer<float> input =
+            random_signal(random, settings.num_channels * 2, num_samples);
+        const juce::String context = settings.describe();
+
+        simd::force_isa(simd::Isa::scalar);
+        fft::force_backend(fft::Backend::juce);
+        const juce::AudioBuffer<float> reference = render(settings, input);
+        determinism.add(compare(reference, render(settings, input)), context);
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (paths[i].is_reference()) {
+                continue;
+            }
+
+            simd::force_isa(paths[i].isa);
+            fft::force_backend(paths[i].backend);
+            checks[i].add(compare(reference, render(settings, input)),
+                          context, tolerances.render_rms_db);
+        }
+    }
+
+    size_t num_failures = determinism.report();
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!paths[i].is_reference()) {
+            num_failures += checks[i].report();
+        }
+    }
+
+    return num_failures;
+}
+
+}  // namespace
+
+void equivalence_command(const juce::ArgumentList& args) {
+    const juce::int64 seed =
+        args.containsOption("--seed")
+            ? args.getValueForOption("--seed").getLargeIntValue()
+            : juce::Time::currentTimeMillis();
+    const int iterations =
+        static_cast<int>(option_or(args, "--iterations", 10.0));
+    const Tolerances tolerances{
+        .kernel_max_db = option_or(args, "--kernel-tolerance", -120.0),
+        .fft_max_db = option_or(args, "--fft-tolerance", -100.0),
+        .render_max_db = option_or(args, "--max-tolerance", -60.0),
+        .render_rms_db = option_or(args, "--rms-tolerance", -90.0)};
+
+    std::cout << "Using seed " << seed << std::endl;
+    juce::Random random(seed);
+
+    const simd::Isa original_isa = simd::kernels().isa;
+
+    size_t num_failures = 0;
+    num_failures += check_kernels(random, iterations, tolerances);
+    num_failures += check_fft_backends(random, iterations, tolerances);
+    num_failures += check_renders(random, iterations, tolerances);
+
+    simd::force_isa(original_isa);
+    fft::force_backend(std::nullopt);
+
+    if (num_failures > 0) {
+        juce::ConsoleApplication::fail(juce::String(num_failures) +
+                                       " cases exceeded their tolerance");
+    }
+}
@@ -0,0 +1,552 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+#include "../dsp/decimation.h"
+#include "../dsp/stft.h"
+#include "../ring.h"
+#include "commands.h"
+#include "harness.h"
+
+namespace {
+
+/**
+ * Checks every `RingBuffer` or `PowerOfTwoRingBuffer` operation against a
+ * trivial model. All values are small multiples of a power of two and the
+ * gains are powers of two, so the additions are exact regardless of which SIMD
+ * kernels are used.
+ *
+ * @param ring_buffer A newly initialized ring buffer.
+ *
+ * @return A description of the first mismatch, if any.
+ */
+template <typename Buffer>
+std::optional<juce::String> fuzz_ring_buffer(juce::Random& random,
+                                             Buffer& ring_buffer) {
+    // Only the regular ring buffer checks its arguments at runtime
+    constexpr bool checks_sizes = std::is_same_v<Buffer, RingBuffer<float>>;
+
+    const size_t size = ring_buffer.size();
+    std::vector<float> model(size, 0.0f);
+    size_t model_pos = 0;
+
+    std::vector<float> src(size + 1);
+    std::vector<float> dst(size + 1);
+    std::vector<float> expected(size + 1);
+
+    constexpr int num_operations = 200;
+    for (int operation_idx = 0; operation_idx < num_operations;
+         operation_idx++) {
+        const int operation = random.nextInt(6);
+        // Occasionally try an invalid size, which should throw and leave the
+        // buffer untouched
+        const bool too_large = checks_sizes && random.nextInt(20) == 0;
+        size_t num;
+        switch (random.nextInt(4)) {
+            case 0:
+                num = 0;
+                break;
+            case 1:
+                num = size;
+                break;
+            default:
+                num = static_cast<size_t>(random.nextInt(
+                    static_cast<int>(size) + 1));
+                break;
+        }
+        if (too_large) {
+            num = size + 1;
+        }
+
+        for (float& sample : src) {
+            sample = static_cast<float>(random.nextInt(512) - 256) / 256.0f;
+        }
+        constexpr float gains[] = {1.0f, 0.5f, 2.0f, 0.25f};
+        const float gain = gains[random.nextInt(4)];
+        const bool clear = random.nextBool();
+
+        const juce::String context =
+            "size " + juce::String(size) + ", operation " +
+            juce::String(operation) + " with " + juce::String(num) +
+            " elements after " + juce::String(operation_idx) + " operations";
+
+        bool threw = false;
+        try {
+            switch (operation) {
+                case 0:
+                    ring_buffer.read_n_from(src.data(), num);
+                    break;
+                case 1:
+                    ring_buffer.copy_n_to(dst.data(), num, clear);
+                    break;
+                case 2:
+                    ring_buffer.add_n_from_in_place(src.data(), num, gain);
+                    break;
+                case 3:
+                    ring_buffer.read_n_from_in_place(src.data(), num);
+                    break;
+                case 4:
+                    ring_buffer.copy_last_n_to(dst.data(), num);
+                    break;
+                default:
+                    std::copy_n(src.begin(), num, dst.begin());
+                    ring_buffer.swap_n_with(dst.data(), num);
+                    break;
+            }
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+
+        if (threw != too_large) {
+            return (threw ? "Unexpected exception, " : "Missing exception, ") +
+                   context;
+        }
+        if (too_large) {
+            continue;
+        }
+
+        switch (operation) {
+            case 0:
+                for (size_t i = 0; i < num; i++) {
+                    model[(model_pos + i) % size] = src[i];
+                }
+                model_pos = (model_pos + num) % size;
+                break;
+            case 1:
+                for (size_t i = 0; i < num; i++) {
+                    expected[i] = model[(model_pos + i) % size];
+                    if (clear) {
+                        model[(model_pos + i) % size] = 0.0f;
+                    }
+                }
+                model_pos = (model_pos + num) % size;
+                break;
+            case 2:
+                for (size_t i = 0; i < num; i++) {
+                    model[(model_pos + i) % size] += src[i] * gain;
+                }
+                break;
+            case 3:
+                for (size_t i = 0; i < num; i++) {
+                    model[(model_pos + i) % size] = src[i];
+                }
+                break;
+            case 4:
+                for (size_t i = 0; i < num; i++) {
+                    expected[i] = model[(model_pos + size - num + i) % size];
+                }
+                break;
+            default:
+                for (size_t i = 0; i < num; i++) {
+                    expected[i] = model[(model_pos + i) % size];
+                    model[(model_pos + i) % size] = src[i];
+                }
+                model_pos = (model_pos + num) % size;
+                break;
+        }
+
+        // Copying and swapping write to `dst`
+        const bool has_output = operation == 1 || operation >= 4;
+        if (has_output &&
+            !std::equal(expected.begin(), expected.begin() + num,
+                        dst.begin())) {
+            return "Wrong output, " + context;
+        }
+        if (ring_buffer.pos() != model_pos) {
+            return "Wrong position, " + context;
+        }
+
+        // The entire contents should also still match
+        ring_buffer.copy_last_n_to(dst.data(), size);
+        for (size_t i = 0; i < size; i++) {
+            if (dst[i] != model[(model_pos + i) % size]) {
+                return "Wrong contents, " + context;
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * Checks `OverlapAddBuffer` against a queue of pending sums, using random hop
+ * sizes and reads. Like in `fuzz_ring_buffer()`, all additions are exact.
+ *
+ * @return A description of the first mismatch, if any.
+ */
+std::optional<juce::String> fuzz_overlap_add_buffer(juce::Random& random,
+                                                    size_t frame_size) {
+    OverlapAddBuffer buffer(frame_size);
+    std::deque<float> model;
+
+    std::vector<float> frame(frame_size);
+    std::vector<float> dst(frame_size);
+    std::vector<float> expected(frame_size);
+
+    constexpr int num_operations = 200;
+    for (int operation_idx = 0; operation_idx < num_operations;
+         operation_idx++) {
+        const bool add = random.nextBool();
+        const size_t num =
+            random.nextInt(4) == 0
+                ? frame_size
+                : static_cast<size_t>(
+                      random.nextInt(static_cast<int>(frame_size) + 1));
+
+        for (float& sample : frame) {
+            sample = static_cast<float>(random.nextInt(512) - 256) / 256.0f;
+        }
+        constexpr float gains[] = {1.0f, 0.5f, 2.0f, 0.25f};
+        const float gain = gains[random.nextInt(4)];
+
+        if (add) {
+            buffer.add_frame(frame.data(), gain, dst.data(), num);
+
+            model.resize(frame_size, 0.0f);
+            for (size_t i = 0; i < frame_size; i++) {
+                model[i] += frame[i] * gain;
+            }
+        } else {
+            buffer.read(dst.data(), num);
+        }
+
+        for (size_t i = 0; i < num; i++) {
+            if (model.empty()) {
+                expected[i] = 0.0f;
+            } else {
+                expected[i] = model.front();
+                model.pop_front();
+            }
+        }
+
+        const juce::String context =
+            "size " + juce::String(frame_size) + ", " +
+            (add ? "adding a frame" : "reading") + " with " +
+            juce::String(num) + " elements after " +
+            juce::String(operation_idx) + " operations";
+        if (!std::equal(expected.begin(), expected.begin() + num,
+                        dst.begin())) {
+            return "Wrong output, " + context;
+        }
+        if (buffer.num_accumulated() != model.size()) {
+            return "Wrong number of accumulated samples, " + context;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * Run `input` through an STFT with a no-op processing function, using the
+ * given block sizes.
+ */
+juce::AudioBuffer<float> run_stft(const juce::AudioBuffer<float>& input,
+                                  int fft_order,
+                                  int overlap_order,
+                                  const std::vector<int>& block_sizes) {
+    STFT<true> stft(static_cast<size_t>(input.getNumChannels()),
+                    static_cast<size_t>(fft_order));
+
+    juce::AudioBuffer<float> output(input);
+    int offset = 0;
+    for (const int block_size : block_sizes) {
+        // This refers to `output`'s memory directly, like a host's buffer
+        juce::AudioBuffer<float> block(output.getArrayOfWritePointers(),
+                                       output.getNumChannels(), offset,
+                                       block_size);
+        stft.process(
+            block, 1 << overlap_order, 1.0f, [](auto&, auto) {},
+            [](auto&, auto) {}, []() {}, [](auto&, auto) {},
+            [](auto&, auto) {});
+        offset += block_size;
+    }
+
+    return output;
+}
+
+/**
+ * Run `input` through a bypassed STFT using the given block sizes. The output
+ * should be the input delayed by exactly one window.
+ */
+juce::AudioBuffer<float> run_bypassed_stft(
+    const juce::AudioBuffer<float>& input,
+    int fft_order,
+    const std::vector<int>& block_sizes) {
+    STFT<true> stft(static_cast<size_t>(input.getNumChannels()),
+                    static_cast<size_t>(fft_order));
+
+    juce::AudioBuffer<float> output(input);
+    int offset = 0;
+    for (const int block_size : block_sizes) {
+        juce::AudioBuffer<float> block(output.getArrayOfWritePointers(),
+                                       output.getNumChannels(), offset,
+                                       block_size);
+        stft.process_bypassed(block);
+        offset += block_size;
+    }
+
+    return output;
+}
+
+/**
+ * Run `input` through a `BandSplitDecimator` with a bypassed STFT for the
+ * decimated lower band, the same way the processor does when it's bypassed.
+ * The output should be the input delayed by exactly `latency_samples()`.
+ *
+ * @param upper_fft_order If set, the upper band is taken from a bypassed full
+ *   rate STFT of this order instead of from the input, like in the
+ *   processor's multi-resolution mode.
+ * @param latency Will be set to the band split's total latency.
+ */
+juce::AudioBuffer<float> run_bypassed_band_split(
+    const juce::AudioBuffer<float>& input,
+    size_t factor,
+    int fft_order,
+    std::optional<int> upper_fft_order,
+    const std::vector<int>& block_sizes,
+    size_t& latency) {
+    const size_t num_channels = static_cast<size_t>(input.getNumChannels());
+    STFT<true> stft(num_channels, static_cast<size_t>(fft_order));
+    std::optional<STFT<true>> upper_stft;
+    if (upper_fft_order) {
+        upper_stft.emplace(num_channels,
+                           static_cast<size_t>(*upper_fft_order));
+    }
+    BandSplitDecimator band_split(
+        num_channels, factor, static_cast<size_t>(stft.latency_samples()),
+        upper_stft ? static_cast<size_t>(upper_stft->latency_samples()) : 0);
+    latency = band_split.latency_samples();
+    juce::AudioBuffer<float> upper_band(
+        input.getNumChannels(),
+        static_cast<int>(BandSplitDecimator::max_block_size));
+
+    juce::AudioBuffer<float> output(input);
+    int offset = 0;
+    for (const int block_size : block_sizes) {
+        for (int chunk_offset = 0; chunk_offset < block_size;
+             chunk_offset += BandSplitDecimator::max_block_size) {
+            const int chunk_size =
+                std::min(block_size - chunk_offset,
+                         static_cast<int>(BandSplitDecimator::max_block_size));
+            juce::AudioBuffer<float> chunk(output.getArrayOfWritePointers(),
+                                           output.getNumChannels(),
+                                           offset + chunk_offset, chunk_size);
+
+            juce::AudioBuffer<float> lower_band;
+            if (upper_stft) {
+                juce::AudioBuffer<float> upper_chunk(
+                    upper_band.getArrayOfWritePointers(),
+                    upper_band.getNumChannels(), chunk_size);
+                for (int channel = 0; channel < chunk.getNumChannels();
+                     channel++) {
+                    upper_chunk.copyFrom(channel, 0, chunk, channel, 0,
+                                         chunk_size);
+                }
+                upper_stft->process_bypassed(upper_chunk);
+                lower_band = band_split.split(chunk, upper_chunk,
+                                              static_cast<size_t>(chunk_size));
+            } else {
+                lower_band =
+                    band_split.split(chunk, static_cast<size_t>(chunk_size));
+            }
+            stft.process_bypassed(lower_band);
+            band_split.join(lower_band, chunk, static_cast<size_t>(chunk_size));
+        }
+        offset += block_size;
+    }
+
+    return output;
+}
+
+}  // namespace
+
+void fuzz_blocks_command(const juce::ArgumentList& args) {
+    const juce::int64 seed =
+        args.containsOption("--seed")
+            ? args.getValueForOption("--seed").getLargeIntValue()
+            : juce::Time::currentTimeMillis();
+    const int iterations =
+        args.containsOption("--iterations")
+            ? args.getValueForOption("--iterations").getIntValue()
+            : 20;
+
+    std::cout << "Using seed " << seed << std::endl;
+    juce::Random random(seed);
+
+    size_t num_failures = 0;
+    const auto fail = [&](const juce::String& message) {
+        std::cout << "FAIL " << message << std::endl;
+        num_failures += 1;
+    };
+
+    for (int iteration = 0; iteration < iterations * 10; iteration++) {
+        const size_t size = 1 + static_cast<size_t>(random.nextInt(4096));
+        RingBuffer<float> ring_buffer(size);
+        if (const std::optional<juce::String> error =
+                fuzz_ring_buffer(random, ring_buffer)) {
+            fail("RingBuffer: " + *error);
+        }
+
+        PowerOfTwoRingBuffer<float> masked_ring_buffer(static_cast<size_t>(1)
+                                                       << random.nextInt(13));
+        if (const std::optional<juce::String> error =
+                fuzz_ring_buffer(random, masked_ring_buffer)) {
+            fail("PowerOfTwoRingBuffer: " + *error);
+        }
+
+        auto fixed_ring_buffer =
+            std::make_unique<PowerOfTwoRingBuffer<float, 1024>>();
+        if (const std::optional<juce::String> error =
+                fuzz_ring_buffer(random, *fixed_ring_buffer)) {
+            fail("PowerOfTwoRingBuffer<float, 1024>: " + *error);
+        }
+
+        if (const std::optional<juce::String> error = fuzz_overlap_add_buffer(
+                random, static_cast<size_t>(1) << random.nextInt(13))) {
+            fail("OverlapAddBuffer: " + *error);
+        }
+    }
+
+    // The STFT on its own is cheap, so it gets a lot more iterations than the
+    // full processor
+    for (int iteration = 0; iteration < iterations * 5; iteration++) {
+        const int fft_order = 9 + random.nextInt(7);
+        const int overlap_order = 2 + random.nextInt(5);
+        const int num_channels = 1 + random.nextInt(2);
+        const int num_samples =
+            (1 << fft_order) * (2 + random.nextInt(6)) + random.nextInt(1000);
+        const juce::AudioBuffer<float> input =
+            random_signal(random, num_channels, num_samples);
+        const juce::String context =
+            "order " + juce::String(fft_order) + ", overlap " +
+            juce::String(1 << overlap_order) + ", " +
+            juce::String(num_channels) + " channels";
+
+        try {
+            // Feeding the entire signal at once is the reference, since then
+            // the arithmetic for partial windows is only used for the tail
+            const juce::AudioBuffer<float> reference =
+                run_stft(input, fft_order, overlap_order, {num_samples});
+            const std::vector<int> block_sizes = random_block_sizes(
+                random, num_samples, 1 + random.nextInt(1 << fft_order) * 2);
+            const juce::AudioBuffer<float> output =
+                run_stft(input, fft_order, overlap_order, block_sizes);
+
+            if (!compare(reference, output).is_exact) {
+                fail("STFT output depends on the block sizes, " + context);
+            }
+
+            juce::AudioBuffer<float> delayed_input(num_channels, num_samples);
+            delayed_input.clear();
+            for (int channel = 0; channel < num_channels; channel++) {
+                delayed_input.copyFrom(channel, 1 << fft_order, input, channel,
+                                       0, num_samples - (1 << fft_order));
+            }
+            const juce::AudioBuffer<float> bypassed_output =
+                run_bypassed_stft(input, fft_order, block_sizes);
+            if (!compare(delayed_input, bypassed_output).is_exact) {
+                fail("Bypassed STFT output is not delayed by one window, " +
+                     context);
+            }
+
+            // When the lower band is decimated but not modified, the band
+            // split should also only delay the signal. The same goes for the
+            // multi-resolution mode's full rate upper band.
+            const int decimation_order = 1 + random.nextInt(2);
+            const size_t factor = static_cast<size_t>(1) << decimation_order;
+            const std::optional<int> upper_fft_order =
+                random.nextBool() ? std::optional<int>(
+                                        9 + random.nextInt(fft_order - 8 +
+                                                           decimation_order))
+                                  : std::nullopt;
+            size_t latency = 0;
+            const juce::AudioBuffer<float> band_split_output =
+                run_bypassed_band_split(input, factor, fft_order,
+                                        upper_fft_order, block_sizes, latency);
+            const int delay =
+                std::min(static_cast<int>(latency), num_samples);
+            juce::AudioBuffer<float> band_split_input(num_channels,
+                                                      num_samples);
+            band_split_input.clear();
+            for (int channel = 0; channel < num_channels; channel++) {
+                band_split_input.copyFrom(channel, delay, input, channel, 0,
+                                          num_samples - delay);
+            }
+            if (!compare(band_split_input, band_split_output).is_exact) {
+                fail("Bypassed band split output with factor " +
+                     juce::String(factor) + " and upper order " +
+                     (upper_fft_order ? juce::String(*upper_fft_order)
+                                      : juce::String("none")) +
+                     " is not delayed by its latency, " + context);
+            }
+        } catch (const std::exception& error) {
+            fail("STFT threw '" + juce::String(error.what()) + "', " +
+                 context);
+        }
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        const int num_samples = 24000 + random.nextInt(48000);
+        // Parameter changes would happen at different points with different
+        // block sizes, so those are left out here
+        RenderSettings settings = random_render_settings(
+            random, 13, static_cast<size_t>(num_samples));
+        settings.parameter_changes.clear();
+        const juce::AudioBuffer<float> input =
+            random_signal(random, settings.num_channels * 2, num_samples);
+
+        try {
+            settings.block_sizes =
+                random_block_sizes(random, num_samples, 512);
+            const juce::AudioBuffer<float> reference = render(settings, input);
+
+            settings.block_sizes = random_block_sizes(
+                random, num_samples, 1 << random.nextInt(14));
+            const juce::AudioBuffer<float> output = render(settings, input);
+
+            if (!compare(reference, output).is_exact) {
+                fail("Processor output depends on the block sizes, " +
+                     settings.describe());
+            }
+
+            // Resuming from a checkpoint should pick up exactly where the
+            // original processor left off
+            settings.checkpoint_block = static_cast<size_t>(
+                random.nextInt(static_cast<int>(settings.block_sizes.size())));
+            const juce::AudioBuffer<float> resumed_output =
+                render(settings, input);
+            if (!compare(reference, resumed_output).is_exact) {
+                fail("Processor output changes after restoring a checkpoint, " +
+                     settings.describe());
+            }
+        } catch (const std::exception& error) {
+            fail("Processor threw '" + juce::String(error.what()) + "', " +
+                 settings.describe());
+        }
+    }
+
+    std::cout << iterations * 10 << " ring buffer, " << iterations * 5
+              << " STFT, and " << iterations << " processor runs"
+              << std::endl;
+    if (num_failures > 0) {
+        juce::ConsoleApplication::fail(juce::String(num_failures) +
+                                       " runs failed");
+    }
+}
@@ -0,0 +1,426 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "../processor.h"
+
+namespace {
+
+/**
+ * Set a parameter by its ID. Fails when the processor doesn't have a parameter
+ * with that ID, which means the helpers in this file have gone out of sync with
+ * `processor.cpp`.
+ */
+void set_parameter(juce::AudioProcessor& processor,
+                   const ParameterValue& parameter) {
+    for (juce::AudioProcessorParameter* candidate : processor.getParameters()) {
+        auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(candidate);
+        if (ranged && ranged->paramID == parameter.id) {
+            ranged->setValueNotifyingHost(
+                ranged->convertTo0to1(parameter.value));
+            return;
+        }
+    }
+
+    juce::ConsoleApplication::fail("Unknown parameter '" + parameter.id + "'");
+}
+
+float random_float(juce::Random& random, float min, float max) {
+    return min + (random.nextFloat() * (max - min));
+}
+
+/**
+ * Random values for the parameters that can also be changed while rendering.
+ * Times and ratios are skewed towards smaller values, since that's where most
+ * of the interesting behaviour is.
+ */
+ParameterValue random_automatable_parameter(juce::Random& random) {
+    switch (random.nextInt(10)) {
+        case 0:
+            return {"input_gain", random_float(random, -20.0f, 20.0f)};
+        case 1:
+            return {"output_gain", random_float(random, -20.0f, 20.0f)};
+        case 2:
+            return {"mix", random.nextBool() ? 1.0f : random.nextFloat()};
+        case 3:
+            return {"compressor_mode", static_cast<float>(random.nextInt(3))};
+        case 4:
+            return {"compressor_ratio",
+                    std::pow(300.0f, random.nextFloat() * random.nextFloat())};
+        case 5:
+            return {"compressor_attack",
+                    std::pow(random.nextFloat(), 3.0f) * 2000.0f};
+        case 6:
+            return {"compressor_release",
+                    std::pow(random.nextFloat(), 3.0f) * 2000.0f};
+        case 7:
+            return {"low_frequency",
+                    random.nextBool()
+                        ? 0.0f
+                        : std::pow(random.nextFloat(), 2.0f) * 5000.0f};
+        case 8:
+            return {"high_frequency",
+                    random.nextBool()
+                        ? 96000.0f
+                        : 500.0f + (std::pow(random.nextFloat(), 2.0f) *
+                                    20000.0f)};
+        default:
+            return {"crossover_frequency",
+                    50.0f + (std::pow(random.nextFloat(), 2.0f) * 3950.0f)};
+    }
+}
+
+}  // namespace
+
+juce::String RenderSettings::describe() const {
+    juce::String description = juce::String(sample_rate, 0) + " Hz, " +
+                               juce::String(num_channels) + " channels, " +
+                               juce::String(block_sizes.size()) + " blocks";
+    for (const ParameterValue& parameter : parameters) {
+        description << ", " << parameter.id << "="
+                    << juce::String(parameter.value, 3);
+    }
+    if (!parameter_changes.empty()) {
+        description << ", " << juce::String(parameter_changes.size())
+                    << " parameter changes";
+    }
+    if (checkpoint_block) {
+        description << ", resumed after block "
+                    << juce::String(
+                           static_cast<juce::int64>(*checkpoint_block));
+    }
+
+    return description;
+}
+
+namespace {
+
+/**
+ * Set up a new processor for `settings`, with the parameter changes before
+ * `parameter_changes_end` already applied.
+ */
+std::unique_ptr<SpectralCompressorProcessor> create_processor(
+    const RenderSettings& settings,
+    std::vector<ParameterChange>::const_iterator parameter_changes_end,
+    int max_block_size) {
+    auto processor = std::make_unique<SpectralCompressorProcessor>();
+
+    const juce::AudioChannelSet channel_set =
+        juce::AudioChannelSet::canonicalChannelSet(settings.num_channels);
+    juce::AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(channel_set);
+    layout.inputBuses.add(channel_set);
+    layout.outputBuses.add(channel_set);
+    if (!processor->setBusesLayout(layout)) {
+        juce::ConsoleApplication::fail("Could not set up a processor with " +
+                                       juce::String(settings.num_channels) +
+                                       " channels");
+    }
+
+    for (const ParameterValue& parameter : settings.parameters) {
+        set_parameter(*processor, parameter);
+    }
+    for (auto parameter_change = settings.parameter_changes.begin();
+         parameter_change != parameter_changes_end; parameter_change++) {
+        set_parameter(*processor, parameter_change->parameter);
+    }
+
+    processor->setRateAndBufferSizeDetails(settings.sample_rate,
+                                           max_block_size);
+    processor->prepareToPlay(settings.sample_rate, max_block_size);
+    // There's no message loop here, so the update triggered by changing the
+    // FFT order needs to be applied by hand
+    processor->apply_pending_process_data_update();
+
+    return processor;
+}
+
+/**
+ * Save `processor`'s state at `offset` and restore it into a new processor,
+ * which is returned.
+ */
+std::unique_ptr<SpectralCompressorProcessor> resume_from_checkpoint(
+    SpectralCompressorProcessor& processor,
+    const RenderSettings& settings,
+    std::vector<ParameterChange>::const_iterator parameter_changes_end,
+    int max_block_size,
+    const juce::AudioBuffer<float>& input,
+    int offset) {
+    juce::MemoryOutputStream checkpoint;
+    if (!processor.save_checkpoint(checkpoint)) {
+        juce::ConsoleApplication::fail("Could not save a checkpoint");
+    }
+    processor.releaseResources();
+
+    // The dry input leading up to the checkpoint, with silence before the
+    // start of the input
+    const int latency = processor.getLatencySamples();
+    juce::AudioBuffer<float> dry_history(settings.num_channels, latency);
+    dry_history.clear();
+    const int history_start = std::max(offset - latency, 0);
+    for (int channel = 0; channel < settings.num_channels; channel++) {
+        dry_history.copyFrom(channel, history_start - (offset - latency),
+                             input, channel, history_start,
+                             offset - history_start);
+    }
+
+    std::unique_ptr<SpectralCompressorProcessor> resumed_processor =
+        create_processor(settings, parameter_changes_end, max_block_size);
+    juce::MemoryInputStream stream(checkpoint.getData(),
+                                   checkpoint.getDataSize(), false);
+    if (!resumed_processor->restore_checkpoint(stream, dry_history)) {
+        juce::ConsoleApplication::fail("Could not restore a checkpoint");
+    }
+
+    return resumed_processor;
+}
+
+}  // namespace
+
+juce::AudioBuffer<float> render(const RenderSettings& settings,
+                                const juce::AudioBuffer<float>& input) {
+    jassert(input.getNumChannels() == settings.num_channels * 2);
+
+    int max_block_size = 1;
+    for (const int block_size : settings.block_sizes) {
+        max_block_size = std::max(max_block_size, block_size);
+    }
+    std::unique_ptr<SpectralCompressorProcessor> processor = create_processor(
+        settings, settings.parameter_changes.begin(), max_block_size);
+
+    juce::AudioBuffer<float> output(settings.num_channels,
+                                    input.getNumSamples());
+    juce::AudioBuffer<float> block(input.getNumChannels(), max_block_size);
+    juce::MidiBuffer midi_buffer;
+
+    auto parameter_change = settings.parameter_changes.begin();
+    int offset = 0;
+    for (size_t block_idx = 0; block_idx < settings.block_sizes.size();
+         block_idx++) {
+        const int block_size = settings.block_sizes[block_idx];
+        if (settings.checkpoint_block &&
+            *settings.checkpoint_block == block_idx) {
+            processor =
+                resume_from_checkpoint(*processor, settings, parameter_change,
+                                       max_block_size, input, offset);
+        }
+
+        for (; parameter_change != settings.parameter_changes.end() &&
+               parameter_change->sample <= static_cast<size_t>(offset);
+             parameter_change++) {
+            set_parameter(*processor, parameter_change->parameter);
+        }
+
+        block.setSize(input.getNumChannels(), block_size, false, false, true);
+        for (int channel = 0; channel < input.getNumChannels(); channel++) {
+            block.copyFrom(channel, 0, input, channel, offset, block_size);
+        }
+
+        processor->processBlock(block, midi_buffer);
+
+        for (int channel = 0; channel < settings.num_channels; channel++) {
+            output.copyFrom(channel, offset, block, channel, 0, block_size);
+        }
+        offset += block_size;
+    }
+    jassert(offset == input.getNumSamples());
+
+    processor->releaseResources();
+
+    return output;
+}
+
+RenderSettings random_render_settings(juce::Random& random,
+                                      int max_fft_order,
+                                      size_t num_samples) {
+    constexpr double sample_rates[] = {44100.0, 48000.0, 96000.0};
+
+    RenderSettings settings;
+    settings.sample_rate = sample_rates[random.nextInt(3)];
+    settings.num_channels = 1 + random.nextInt(2);
+    settings.parameters = {
+        {"fft_size", static_cast<float>(9 + random.nextInt(max_fft_order - 8))},
+        {"windowing_order", static_cast<float>(2 + random.nextInt(5))},
+        {"auto_makeup_gain", random.nextBool() ? 1.0f : 0.0f},
+        {"dc_filter", random.nextBool() ? 1.0f : 0.0f},
+        {"sidechain_active", random.nextBool() ? 1.0f : 0.0f},
+        {"sidechain_exp", random.nextBool() ? 1.0f : 0.0f},
+        {"compressor_multiway_deadzone", random_float(random, 0.0f, 15.0f)},
+        {"bin_grouping", static_cast<float>(random.nextInt(6))},
+        {"gain_smoothing", static_cast<float>(random.nextInt(17))},
+        {"decimate_envelopes", random.nextBool() ? 1.0f : 0.0f},
+        {"stereo_link", static_cast<float>(random.nextInt(4))},
+        {"internal_bandwidth", static_cast<float>(random.nextInt(3))},
+        {"multi_resolution", random.nextBool() ? 1.0f : 0.0f},
+        {"upper_fft_size",
+         static_cast<float>(9 + random.nextInt(max_fft_order - 8))},
+    };
+    for (int i = 0; i < 10; i++) {
+        settings.parameters.push_back(random_automatable_parameter(random));
+    }
+
+    const int num_changes = random.nextInt(4);
+    for (int i = 0; i < num_changes && num_samples > 0; i++) {
+        settings.parameter_changes.push_back(ParameterChange{
+            .sample = static_cast<size_t>(random.nextInt64()) % num_samples,
+            .parameter = random_automatable_parameter(random)});
+    }
+    std::sort(settings.parameter_changes.begin(),
+              settings.parameter_changes.end(),
+              [](const ParameterChange& a, const ParameterChange& b) {
+                  return a.sample < b.sample;
+              });
+
+    return settings;
+}
+
+juce::AudioBuffer<float> random_signal(juce::Random& random,
+                                       int num_channels,
+                                       int num_samples) {
+    juce::AudioBuffer<float> signal(num_channels, num_samples);
+    signal.clear();
+
+    // The signal is made up of segments with different characteristics
+    int segment_start = 0;
+    while (segment_start < num_samples) {
+        const int segment_length =
+            std::min(num_samples - segment_start, 64 + random.nextInt(8192));
+        const float level = random.nextInt(5) == 0
+                                ? 0.0f
+                                : std::pow(10.0f, random_float(random, -3.0f,
+                                                               0.3f));
+        const float frequency = random_float(random, 0.0005f, 0.45f);
+        const float noise_amount = random.nextFloat();
+
+        for (int channel = 0; channel < num_channels; channel++) {
+            float* samples = signal.getWritePointer(channel, segment_start);
+            const float phase = random_float(random, 0.0f, 6.28f);
+            for (int i = 0; i < segment_length; i++) {
+                const float sine = std::sin(
+                    phase + (juce::MathConstants<float>::twoPi * frequency *
+                             static_cast<float>(i)));
+                const float noise = random_float(random, -1.0f, 1.0f);
+                samples[i] = level * ((noise_amount * noise) +
+                                      ((1.0f - noise_amount) * sine));
+            }
+
+            // Add the occasional impulse
+            if (random.nextInt(4) == 0) {
+                samples[random.nextInt(segment_length)] = 1.0f;
+            }
+        }
+
+        segment_start += segment_length;
+    }
+
+    return signal;
+}
+
+std::vector<int> random_block_sizes(juce::Random& random,
+                                    int num_samples,
+                                    int max_block_size) {
+    std::vector<int> block_sizes;
+    int remaining = num_samples;
+    while (remaining > 0) {
+        int block_size;
+        switch (random.nextInt(6)) {
+            case 0:
+                block_size = max_block_size;
+                break;
+            case 1:
+                block_size = random.nextInt(4);
+                break;
+            case 2:
+                // Odd sizes that don't line up with the hop size
+                block_size =
+                    (random.nextInt(std::max(max_block_size / 2, 1)) * 2) + 1;
+                break;
+            default:
+                block_size = random.nextInt(max_block_size + 1);
+                break;
+        }
+
+        block_size = std::min(block_size, remaining);
+        block_sizes.push_back(block_size);
+        remaining -= block_size;
+    }
+
+    return block_sizes;
+}
+
+Deviation compare(const float* reference, const float* values, size_t num) {
+    double peak = 0.0;
+    double max_difference = 0.0;
+    double sum_of_squares = 0.0;
+    bool is_exact = true;
+    for (size_t i = 0; i < num; i++) {
+        const double difference =
+            static_cast<double>(values[i]) - static_cast<double>(reference[i]);
+        peak = std::max(peak, std::abs(static_cast<double>(reference[i])));
+        // `std::max()` would silently skip over NaNs
+        max_difference = std::isfinite(difference)
+                             ? std::max(max_difference, std::abs(difference))
+                             : std::numeric_limits<double>::infinity();
+        sum_of_squares += difference * difference;
+        // NaNs also count as a mismatch here
+        is_exact &= std::memcmp(&values[i], &reference[i], sizeof(float)) == 0;
+    }
+
+    const auto to_relative_db = [peak](double difference) {
+        // Silence in the reference turns every deviation into an infinite one
+        return juce::Decibels::gainToDecibels(
+            difference / std::max(peak, 1.0e-9), -400.0);
+    };
+    double rms =
+        num > 0 ? std::sqrt(sum_of_squares / static_cast<double>(num)) : 0.0;
+    if (!std::isfinite(rms)) {
+        rms = std::numeric_limits<double>::infinity();
+    }
+
+    return Deviation{.max_db = to_relative_db(max_difference),
+                     .rms_db = to_relative_db(rms),
+                     .is_exact = is_exact};
+}
+
+Deviation compare(const juce::AudioBuffer<float>& reference,
+                  const juce::AudioBuffer<float>& buffer) {
+    jassert(reference.getNumChannels() == buffer.getNumChannels() &&
+            reference.getNumSamples() == buffer.getNumSamples());
+
+    // The channels are compared as a single signal so the RMS and the peak
+    // cover everything
+    std::vector<float> reference_samples;
+    std::vector<float> samples;
+    for (int channel = 0; channel < reference.getNumChannels(); channel++) {
+        const int num_samples = reference.getNumSamples();
+        reference_samples.insert(reference_samples.end(),
+                                 reference.getReadPointer(channel),
+                                 reference.getReadPointer(channel) +
+                                     num_samples);
+        samples.insert(samples.end(), buffer.getReadPointer(channel),
+                       buffer.getReadPointer(channel) + num_samples);
+    }
+
+    return compare(reference_samples.data(), samples.data(),
+                   reference_samples.size());
+}
@@ -0,0 +1,132 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+// Shared helpers for the commands that render audio through the processor and
+// compare the results, like `equivalence` and `fuzz-blocks`. Everything that
+// involves randomness takes a `juce::Random` so failures can be reproduced from
+// the seed that's printed.
+
+/**
+ * A parameter value in the parameter's own range, for instance `-12.0` for a
+ * gain in decibels.
+ */
+struct ParameterValue {
+    juce::String id;
+    float value;
+};
+
+/**
+ * A parameter change that takes effect at the start of the first block that
+ * starts at or after `sample`.
+ */
+struct ParameterChange {
+    size_t sample;
+    ParameterValue parameter;
+};
+
+/**
+ * Everything needed to render a signal through a new processor instance.
+ */
+struct RenderSettings {
+    double sample_rate = 48000.0;
+    int num_channels = 2;
+    /**
+     * Set before `prepareToPlay()` is called.
+     */
+    std::vector<ParameterValue> parameters;
+    /**
+     * Applied while rendering. Should be sorted by `sample`.
+     */
+    std::vector<ParameterChange> parameter_changes;
+    /**
+     * The size of every processing cycle. These should add up to the input's
+     * length. Zero sized blocks are allowed.
+     */
+    std::vector<int> block_sizes;
+    /**
+     * If set, the processor's state is saved as a checkpoint after this many
+     * blocks, and the rest of the input is rendered by a new processor that
+     * resumes from that checkpoint.
+     */
+    std::optional<size_t> checkpoint_block;
+
+    /**
+     * A short description for in error messages and reports.
+     */
+    juce::String describe() const;
+};
+
+/**
+ * Render `input` through a new `SpectralCompressorProcessor`. `input` should
+ * have `2 * settings.num_channels` channels, with the sidechain input in the
+ * second half.
+ *
+ * @return The main output, with `settings.num_channels` channels.
+ */
+juce::AudioBuffer<float> render(const RenderSettings& settings,
+                                const juce::AudioBuffer<float>& input);
+
+/**
+ * Randomized processor settings covering every parameter, including a couple
+ * of parameter changes somewhere within the first `num_samples` samples. The
+ * FFT order is limited to `max_fft_order` to keep run times reasonable.
+ * `block_sizes` is left empty.
+ */
+RenderSettings random_render_settings(juce::Random& random,
+                                      int max_fft_order,
+                                      size_t num_samples);
+
+/**
+ * A test signal of `num_samples` samples on `num_channels` channels. This is a
+ * mix of noise, sines, impulses, silence, and level jumps, so both the attack
+ * and release stages of the compressors get exercised.
+ */
+juce::AudioBuffer<float> random_signal(juce::Random& random,
+                                       int num_channels,
+                                       int num_samples);
+
+/**
+ * Split `num_samples` into random block sizes between zero and
+ * `max_block_size` samples. Small, odd, and exactly `max_block_size` sized
+ * blocks are more likely than the rest.
+ */
+std::vector<int> random_block_sizes(juce::Random& random,
+                                    int num_samples,
+                                    int max_block_size);
+
+/**
+ * How much two buffers with the same dimensions differ, relative to the peak
+ * magnitude of the reference buffer.
+ */
+struct Deviation {
+    double max_db;
+    double rms_db;
+    /**
+     * Whether the buffers are bit-identical.
+     */
+    bool is_exact;
+};
+
+Deviation compare(const float* reference, const float* values, size_t num);
+Deviation compare(const juce::AudioBuffer<float>& reference,
+                  const juce::AudioBuffer<float>& buffer);
@@ -0,0 +1,134 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <juce_events/juce_events.h>
+
+#include "commands.h"
+
+int main(int argc, char* argv[]) {
+    // The processor's parameters and async updaters expect a message manager
+    // to exist, even though we never run its dispatch loop
+    [[maybe_unused]] juce::ScopedJuceInitialiser_GUI juce_initialiser;
+
+    juce::ConsoleApplication app;
+    app.addHelpCommand("--help|-h", "Usage:", true);
+    app.addCommand(
+        {"replay",
+         "replay <capture> [--trace=<file>]",
+         "Replay a captured processing session",
+         "Feeds a capture recorded with SPECTRAL_COMPRESSOR_CAPTURE_DIR "
+         "through a new processor instance. The output is verified to be "
+         "bit-exact with the original session, and the time spent on every "
+         "processing cycle is reported. When the tools have been built with "
+         "-DWITH_TRACING=ON, --trace writes the recorded trace zones to a "
+         "Chrome trace JSON file.",
+         replay_command});
+    app.addCommand(
+        {"calibrate-fft",
+         "calibrate-fft [--order=<order>]",
+         "Benchmark the FFT backends and update the calibration cache",
+         "Times every FFT backend compiled into this build for every FFT "
+         "size, or for only 2^<order> when --order is given. The fastest "
+         "backends are stored in the calibration cache, which the plugin "
+         "otherwise fills in the background after it's first loaded.",
+         calibrate_fft_command});
+    app.addCommand(
+        {"equivalence",
+         "equivalence [--seed=<seed>] [--iterations=<n>] "
+         "[--max-tolerance=<dB>] [--rms-tolerance=<dB>] "
+         "[--kernel-tolerance=<dB>] [--fft-tolerance=<dB>]",
+         "Check the optimized code paths against the reference "
+         "implementation",
+         "Compares every SIMD kernel variant against the scalar kernels, "
+         "every FFT backend against JUCE's FFT, and full renders of random "
+         "signals with random settings and block sizes through every "
+         "combination of the two against a render using the scalar kernels "
+         "and JUCE's FFT. Deviations are measured relative to the reference's "
+         "peak and checked against the tolerances, and paths that should be "
+         "bit-exact are checked for that as well. Exits with a nonzero exit "
+         "code when any check fails. The seed is printed so failures can be "
+         "reproduced.",
+         equivalence_command});
+    app.addCommand(
+        {"fuzz-blocks",
+         "fuzz-blocks [--seed=<seed>] [--iterations=<n>]",
+         "Check that the output does not depend on the host's block sizes",
+         "Checks every RingBuffer, PowerOfTwoRingBuffer, and OverlapAddBuffer "
+         "operation against a simple model, and renders random signals through "
+         "the STFT and the processor using random sequences of block sizes, "
+         "including empty blocks, odd sizes, and blocks larger than the FFT "
+         "window. The results must be bit-identical to feeding the same signal "
+         "in fixed size blocks, the bypassed STFT must delay its input by "
+         "exactly one window, the band split for the internal bandwidth and "
+         "the multi-resolution mode must delay its input by exactly its "
+         "latency when both bands are untouched, a processor resuming from a "
+         "checkpoint must produce the same output as the original, and "
+         "nothing may throw. "
+         "Exits with a nonzero exit code when any run fails. The seed is "
+         "printed so failures can be reproduced.",
+         fuzz_blocks_command});
+    app.addCommand(
+        {"analyze",
+         "analyze <audio file> [--preset=<file>] [--output=<file>] "
+         "[--frames=<file> [--phases]]",
+         "Write the gain reduction for an audio file to a CSV file",
+         "Runs the file through the processor in analysis-only mode, which "
+         "skips resynthesizing the signal. Every channel of every STFT hop "
+         "becomes a row with the gain in decibels for every FFT bin, with the "
+         "bins' center frequencies in the header. In multi-resolution mode "
+         "only the lower band is written. --preset loads a file "
+         "containing the plugin's binary state, and the output is written "
+         "next to the input file by default. --frames additionally writes the "
+         "STFT frames' magnitudes and gains, and with --phases also their "
+         "phases, to a memory mappable frame file. See "
+         "`src/spectral_frames.h` for the format.",
+         analyze_command});
+    app.addCommand(
+        {"render",
+         "render <audio file> [--sidechain=<file>] [--preset=<file>] "
+         "[--output=<file>] [--cache=<directory>] [--checkpoints=<file>] "
+         "[--checkpoint-interval=<seconds>] [--region=<start>:<end>]",
+         "Render an audio file through the processor",
+         "Writes the processed audio to a 32-bit floating point WAV file, "
+         "next to the input file by default, with the processor's latency "
+         "removed. --sidechain feeds a second file to the sidechain input and "
+         "--preset loads a file containing the plugin's binary state. With "
+         "--cache the STFTs' forward transforms are stored in that directory, "
+         "and later renders of the same input reuse them as long as the FFT "
+         "size, the overlap amount, the input gain, and the sidechain routing "
+         "stay the same. --checkpoints saves the processor's state to that "
+         "file every --checkpoint-interval seconds (10 by default). Combined "
+         "with --region, the render instead resumes from the last checkpoint "
+         "before the region's start, in seconds, and only the region is "
+         "written to the output file.",
+         render_command});
+    app.addCommand(
+        {"sweep",
+         "sweep <audio file> <preset>... [--sidechain=<file>] "
+         "[--output-dir=<directory>] [--independent]",
+         "Render an audio file through several presets in one pass",
+         "Renders every preset, a file containing the plugin's binary state, "
+         "to `<input>.<preset>.wav` in the output directory, which defaults "
+         "to the input file's directory. The variants are rendered in "
+         "lockstep, and variants with the same FFT size, overlap amount, "
+         "input gain, and sidechain routing share a single forward transform "
+         "per hop. Only the compressors, the inverse transforms, and the "
+         "overlap-add run separately for every variant. --independent "
+         "disables this sharing for comparison.",
+         sweep_command});
+
+    return app.findAndRunCommand(argc, argv);
+}
@@ -0,0 +1,156 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "offline.h"
+
+#include <algorithm>
+#include <array>
+
+#include "../processor.h"
+
+std::unique_ptr<juce::AudioFormatReader> open_audio_file(
+    const juce::File& file) {
+    juce::AudioFormatManager format_manager;
+    format_manager.registerBasicFormats();
+    std::unique_ptr<juce::AudioFormatReader> reader(
+        format_manager.createReaderFor(file));
+    if (!reader) {
+        juce::ConsoleApplication::fail("Could not read '" +
+                                       file.getFullPathName() + "'");
+    }
+    if (reader->numChannels < 1 || reader->numChannels > 2) {
+        juce::ConsoleApplication::fail(
+            "Only mono and stereo files are supported");
+    }
+
+    return reader;
+}
+
+void load_preset(SpectralCompressorProcessor& processor,
+                 const juce::File& file) {
+    juce::MemoryBlock state;
+    if (!file.loadFileAsData(state)) {
+        juce::ConsoleApplication::fail("Could not read the preset");
+    }
+
+    processor.setStateInformation(state.getData(),
+                                  static_cast<int>(state.getSize()));
+}
+
+void set_up_channels(SpectralCompressorProcessor& processor,
+                     int num_channels) {
+    const juce::AudioChannelSet channel_set =
+        juce::AudioChannelSet::canonicalChannelSet(num_channels);
+    juce::AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(channel_set);
+    layout.inputBuses.add(channel_set);
+    layout.outputBuses.add(channel_set);
+    if (!processor.setBusesLayout(layout)) {
+        juce::ConsoleApplication::fail("Could not set up a processor with " +
+                                       juce::String(num_channels) +
+                                       " channels");
+    }
+}
+
+void read_block(juce::AudioFormatReader& reader,
+                juce::AudioBuffer<float>& buffer,
+                int first_channel,
+                int num_channels,
+                juce::int64 position,
+                int num_samples) {
+    // The reader needs a buffer with exactly the channels it should write to.
+    // This only refers to `buffer`'s data, so it doesn't allocate.
+    juce::AudioBuffer<float> channels(
+        buffer.getArrayOfWritePointers() + first_channel, num_channels,
+        num_samples);
+    reader.read(&channels, 0, num_samples, position, true, true);
+}
+
+std::unique_ptr<juce::AudioFormatReader> open_sidechain_file(
+    const juce::File& file,
+    double sample_rate) {
+    std::unique_ptr<juce::AudioFormatReader> reader = open_audio_file(file);
+    if (reader->sampleRate != sample_rate) {
+        juce::ConsoleApplication::fail(
+            "The sidechain input's sample rate does not match the main "
+            "input's sample rate");
+    }
+
+    return reader;
+}
+
+std::unique_ptr<juce::AudioFormatWriter> create_wav_writer(
+    const juce::File& file,
+    double sample_rate,
+    int num_channels) {
+    file.deleteFile();
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    if (!stream->openedOk()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file.getFullPathName() + "'");
+    }
+
+    juce::WavAudioFormat wav_format;
+    std::unique_ptr<juce::AudioFormatWriter> writer(wav_format.createWriterFor(
+        stream.get(), sample_rate, static_cast<unsigned int>(num_channels), 32,
+        {}, 0));
+    if (!writer) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file.getFullPathName() + "'");
+    }
+
+    // The writer now owns the stream
+    stream.release();
+
+    return writer;
+}
+
+void write_output(juce::AudioFormatWriter& writer,
+                  const juce::AudioBuffer<float>& buffer,
+                  int num_channels,
+                  juce::int64 position,
+                  juce::int64 latency,
+                  const juce::File& file,
+                  juce::int64 region_start,
+                  juce::int64 region_end) {
+    jassert(num_channels <= 2);
+
+    // The output sample at `position + i` belongs to the input sample at
+    // `position + i - latency`
+    const juce::int64 output_start = position - latency;
+    const juce::int64 output_end = output_start + buffer.getNumSamples();
+    const juce::int64 write_start = std::max(output_start, region_start);
+    const juce::int64 write_end = std::min(output_end, region_end);
+    if (write_end <= write_start) {
+        return;
+    }
+
+    const int num_skipped_samples =
+        static_cast<int>(write_start - output_start);
+    const int num_written_samples = static_cast<int>(write_end - write_start);
+
+    std::array<const float*, 2> channels{};
+    for (int channel = 0; channel < num_channels; channel++) {
+        channels[channel] =
+            buffer.getReadPointer(channel) + num_skipped_samples;
+    }
+
+    if (!writer.writeFromFloatArrays(channels.data(), num_channels,
+                                     num_written_samples)) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       file.getFullPathName() + "'");
+    }
+}
@@ -0,0 +1,98 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <limits>
+#include <memory>
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+class SpectralCompressorProcessor;
+
+// Shared helpers for the commands that run audio files through the processor,
+// like `analyze` and `render`. Like the commands themselves, these report
+// errors through `juce::ConsoleApplication::fail()`.
+
+/**
+ * The number of samples read from the input files and processed at a time.
+ */
+constexpr int offline_block_size = 8192;
+
+/**
+ * Open a mono or stereo audio file for reading.
+ */
+std::unique_ptr<juce::AudioFormatReader> open_audio_file(
+    const juce::File& file);
+
+/**
+ * Load a file containing the plugin's binary state into `processor`.
+ */
+void load_preset(SpectralCompressorProcessor& processor,
+                 const juce::File& file);
+
+/**
+ * Configure the main input, the sidechain input, and the output to have
+ * `num_channels` channels each.
+ */
+void set_up_channels(SpectralCompressorProcessor& processor, int num_channels);
+
+/**
+ * Read `num_samples` samples starting at `position` from `reader` into the
+ * first `num_channels` channels of `buffer`, starting at channel
+ * `first_channel`. Mono files are copied to every channel, and reading past
+ * the end of the file results in silence.
+ */
+void read_block(juce::AudioFormatReader& reader,
+                juce::AudioBuffer<float>& buffer,
+                int first_channel,
+                int num_channels,
+                juce::int64 position,
+                int num_samples);
+
+/**
+ * Open an audio file for the sidechain input. This needs to have the same
+ * sample rate as the main input.
+ */
+std::unique_ptr<juce::AudioFormatReader> open_sidechain_file(
+    const juce::File& file,
+    double sample_rate);
+
+/**
+ * Create a 32-bit floating point WAV file, overwriting `file` if it already
+ * exists.
+ */
+std::unique_ptr<juce::AudioFormatWriter> create_wav_writer(
+    const juce::File& file,
+    double sample_rate,
+    int num_channels);
+
+/**
+ * Write the main output from the first `num_channels` channels of a processed
+ * block that started `position` samples into the input. The processor's
+ * `latency` is trimmed from the start of the output so it lines up with the
+ * input, and only the output for the input samples between `region_start` and
+ * `region_end` is written. `file` is only used in error messages.
+ */
+void write_output(
+    juce::AudioFormatWriter& writer,
+    const juce::AudioBuffer<float>& buffer,
+    int num_channels,
+    juce::int64 position,
+    juce::int64 latency,
+    const juce::File& file,
+    juce::int64 region_start = 0,
+    juce::int64 region_end = std::numeric_limits<juce::int64>::max());
@@ -0,0 +1,298 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <optional>
+
+#include "../processor.h"
+#include "checkpoints.h"
+#include "commands.h"
+#include "offline.h"
+
+namespace {
+
+/**
+ * The time between checkpoints when `--checkpoint-interval` is not set.
+ */
+constexpr double default_checkpoint_interval_seconds = 10.0;
+
+/**
+ * A region of the input in samples, parsed from `--region=<start>:<end>` with
+ * the times in seconds.
+ */
+struct Region {
+    juce::int64 start;
+    juce::int64 end;
+};
+
+Region parse_region(const juce::String& value,
+                    double sample_rate,
+                    juce::int64 length) {
+    if (!value.contains(":")) {
+        juce::ConsoleApplication::fail(
+            "--region should be formatted as <start>:<end>, in seconds");
+    }
+
+    const double start_seconds =
+        value.upToFirstOccurrenceOf(":", false, false).getDoubleValue();
+    const double end_seconds =
+        value.fromFirstOccurrenceOf(":", false, false).getDoubleValue();
+    const Region region{
+        .start = std::clamp(
+            static_cast<juce::int64>(std::round(start_seconds * sample_rate)),
+            static_cast<juce::int64>(0), length),
+        .end = std::clamp(
+            static_cast<juce::int64>(std::round(end_seconds * sample_rate)),
+            static_cast<juce::int64>(0), length)};
+    if (region.end <= region.start) {
+        juce::ConsoleApplication::fail("The region does not contain any audio");
+    }
+
+    return region;
+}
+
+}  // namespace
+
+void render_command(const juce::ArgumentList& args) {
+    args.checkMinNumArguments(2);
+    const juce::File input_file = args[1].resolveAsExistingFile();
+    const juce::File output_file =
+        args.containsOption("--output")
+            ? args.getFileForOption("--output")
+            : input_file.getSiblingFile(
+                  input_file.getFileNameWithoutExtension() + ".rendered.wav");
+
+    const std::unique_ptr<juce::AudioFormatReader> reader =
+        open_audio_file(input_file);
+    const int num_channels = static_cast<int>(reader->numChannels);
+    const double sample_rate = reader->sampleRate;
+
+    std::optional<juce::File> sidechain_file;
+    std::unique_ptr<juce::AudioFormatReader> sidechain_reader;
+    if (args.containsOption("--sidechain")) {
+        sidechain_file = args.getExistingFileForOption("--sidechain");
+        sidechain_reader = open_sidechain_file(*sidechain_file, sample_rate);
+    }
+
+    SpectralCompressorProcessor processor;
+    if (args.containsOption("--preset")) {
+        load_preset(processor, args.getExistingFileForOption("--preset"));
+    }
+    set_up_channels(processor, num_channels);
+
+    // Without a region the entire input is rendered, and checkpoints get
+    // written along the way. With a region the render resumes from the last
+    // checkpoint before it, and only the region's output is written.
+    std::optional<Region> region;
+    if (args.containsOption("--region")) {
+        region = parse_region(args.getValueForOption("--region"), sample_rate,
+                              reader->lengthInSamples);
+    }
+
+    // Renders that replay cached forward transforms skip the STFTs' input
+    // side, so their state can't be checkpointed or restored
+    if (args.containsOption("--checkpoints") &&
+        args.containsOption("--cache")) {
+        juce::ConsoleApplication::fail(
+            "--checkpoints cannot be combined with --cache");
+    }
+
+    checkpoint_format::FileHeader checkpoint_header{
+        .magic = {},
+        .version = 0,
+        .flags = sidechain_reader ? checkpoint_format::has_sidechain : 0u,
+        .sample_rate = sample_rate,
+        .num_channels = static_cast<juce::uint32>(num_channels),
+        .latency = 0,
+        .state_hash = hash_processor_state(processor)};
+    std::optional<CheckpointFile> checkpoint_file;
+    if (region && args.containsOption("--checkpoints")) {
+        checkpoint_file.emplace(args.getExistingFileForOption("--checkpoints"));
+
+        const checkpoint_format::FileHeader& header = checkpoint_file->header();
+        if (header.sample_rate != checkpoint_header.sample_rate ||
+            header.num_channels != checkpoint_header.num_channels ||
+            header.flags != checkpoint_header.flags ||
+            header.state_hash != checkpoint_header.state_hash) {
+            juce::ConsoleApplication::fail(
+                "The checkpoints were taken with a different preset, sample "
+                "rate, channel count, or sidechain routing");
+        }
+    }
+
+    // The forward transforms only depend on the input and on a handful of
+    // settings, so re-rendering the same input with different compressor
+    // settings can reuse them
+    std::unique_ptr<AnalysisCache> analysis_cache;
+    if (args.containsOption("--cache")) {
+        std::vector<juce::File> input_files{input_file};
+        if (sidechain_file) {
+            input_files.push_back(*sidechain_file);
+        }
+        const std::optional<juce::uint64> input_hash =
+            AnalysisCache::hash_files(input_files);
+        if (!input_hash) {
+            juce::ConsoleApplication::fail("Could not hash the input files");
+        }
+
+        analysis_cache = std::make_unique<AnalysisCache>(
+            args.getFileForOption("--cache"), *input_hash);
+        processor.set_analysis_cache(analysis_cache.get());
+    }
+
+    processor.setRateAndBufferSizeDetails(sample_rate, offline_block_size);
+    processor.prepareToPlay(sample_rate, offline_block_size);
+    // There's no message loop here, so the update triggered by changing the
+    // FFT order needs to be applied by hand
+    processor.apply_pending_process_data_update();
+
+    const std::unique_ptr<juce::AudioFormatWriter> writer =
+        create_wav_writer(output_file, sample_rate, num_channels);
+
+    // The input is followed by the processor's latency worth of silence, so
+    // the output can be trimmed to line up with the input
+    const juce::int64 latency = processor.getLatencySamples();
+    const juce::int64 num_samples =
+        (region ? region->end : reader->lengthInSamples) + latency;
+    juce::AudioBuffer<float> buffer(num_channels * 2, offline_block_size);
+    juce::MidiBuffer midi_buffer;
+
+    // Restoring a checkpoint also needs the dry input leading up to it
+    juce::int64 start_position = 0;
+    if (checkpoint_file) {
+        if (static_cast<juce::int64>(checkpoint_file->header().latency) !=
+            latency) {
+            juce::ConsoleApplication::fail(
+                "The checkpoints were taken with a different latency");
+        }
+
+        start_position = static_cast<juce::int64>(
+            checkpoint_file->find(static_cast<juce::uint64>(region->start)));
+        juce::AudioBuffer<float> dry_history(num_channels,
+                                             static_cast<int>(latency));
+        dry_history.clear();
+        const juce::int64 history_start =
+            std::max(start_position - latency, static_cast<juce::int64>(0));
+        const int history_offset =
+            static_cast<int>(history_start - (start_position - latency));
+        juce::AudioBuffer<float> history_samples(
+            dry_history.getArrayOfWritePointers(), num_channels,
+            history_offset, static_cast<int>(latency) - history_offset);
+        read_block(*reader, history_samples, 0, num_channels, history_start,
+                   history_samples.getNumSamples());
+
+        checkpoint_file->restore(static_cast<juce::uint64>(start_position),
+                                 processor, dry_history);
+    }
+
+    std::unique_ptr<CheckpointWriter> checkpoint_writer;
+    juce::int64 checkpoint_interval = 0;
+    juce::int64 next_checkpoint = 0;
+    if (!region && args.containsOption("--checkpoints")) {
+        const double interval_seconds =
+            args.containsOption("--checkpoint-interval")
+                ? args.getValueForOption("--checkpoint-interval")
+                      .getDoubleValue()
+                : default_checkpoint_interval_seconds;
+        checkpoint_interval =
+            std::max(static_cast<juce::int64>(
+                         std::round(interval_seconds * sample_rate)),
+                     static_cast<juce::int64>(1));
+        next_checkpoint = checkpoint_interval;
+
+        checkpoint_header.latency = static_cast<juce::uint32>(latency);
+        checkpoint_writer = std::make_unique<CheckpointWriter>(
+            args.getFileForOption("--checkpoints"), checkpoint_header);
+    }
+
+    const juce::int64 start_ticks = juce::Time::getHighResolutionTicks();
+    for (juce::int64 offset = start_position; offset < num_samples;
+         offset += offline_block_size) {
+        const int num_block_samples = static_cast<int>(
+            std::min(static_cast<juce::int64>(offline_block_size),
+                     num_samples - offset));
+        buffer.setSize(num_channels * 2, num_block_samples, false, false,
+                       true);
+        buffer.clear();
+        read_block(*reader, buffer, 0, num_channels, offset,
+                   num_block_samples);
+        if (sidechain_reader) {
+            read_block(*sidechain_reader, buffer, num_channels, num_channels,
+                       offset, num_block_samples);
+        }
+
+        processor.processBlock(buffer, midi_buffer);
+        if (region) {
+            write_output(*writer, buffer, num_channels, offset, latency,
+                         output_file, region->start, region->end);
+        } else {
+            write_output(*writer, buffer, num_channels, offset, latency,
+                         output_file);
+        }
+
+        // Checkpoints are taken at block boundaries, so a render resuming
+        // from one processes the same blocks as the original render
+        const juce::int64 position = offset + num_block_samples;
+        if (checkpoint_writer && position >= next_checkpoint &&
+            position < num_samples) {
+            checkpoint_writer->add(processor,
+                                   static_cast<juce::uint64>(position));
+            while (next_checkpoint <= position) {
+                next_checkpoint += checkpoint_interval;
+            }
+        }
+    }
+    const double seconds = juce::Time::highResolutionTicksToSeconds(
+        juce::Time::getHighResolutionTicks() - start_ticks);
+
+    if (!writer->flush()) {
+        juce::ConsoleApplication::fail("Could not write to '" +
+                                       output_file.getFullPathName() + "'");
+    }
+
+    const double audio_seconds =
+        static_cast<double>(num_samples - latency - start_position) /
+        sample_rate;
+    if (start_position > 0) {
+        std::cout << "Resumed from the checkpoint at "
+                  << (static_cast<double>(start_position) / sample_rate)
+                  << " seconds" << std::endl;
+    }
+    std::cout << "Rendered " << audio_seconds << " seconds of audio in "
+              << seconds << " seconds (" << (audio_seconds / seconds)
+              << "x real time) to '" << output_file.getFullPathName() << "'"
+              << std::endl;
+
+    if (checkpoint_writer) {
+        checkpoint_writer->finish();
+
+        std::cout << "Wrote " << checkpoint_writer->num_checkpoints()
+                  << " checkpoints taking up "
+                  << checkpoint_writer->num_bytes() << " bytes" << std::endl;
+    }
+
+    if (analysis_cache) {
+        processor.set_analysis_cache(nullptr);
+        analysis_cache->finish();
+
+        std::cout << "Reused " << analysis_cache->num_replayed()
+                  << " and recorded " << analysis_cache->num_recorded()
+                  << " forward transform caches" << std::endl;
+    }
+}
@@ -0,0 +1,372 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <optional>
+
+#include "../capture.h"
+#include "../dsp/fft.h"
+#include "../dsp/simd.h"
+#include "../processor.h"
+#include "../trace.h"
+#include "commands.h"
+
+using namespace capture_format;
+
+namespace {
+
+/**
+ * Read a record's payload into a `T`. If the payload is larger than `T`, then
+ * the remainder gets skipped so we stay aligned with the next record.
+ */
+template <typename T>
+T read_payload(juce::InputStream& stream, const RecordHeader& record) {
+    T payload{};
+    const size_t num_to_read = std::min(sizeof(T), size_t(record.payload_size));
+    if (stream.read(&payload, static_cast<int>(num_to_read)) !=
+        static_cast<int>(num_to_read)) {
+        juce::ConsoleApplication::fail("Unexpected end of capture file");
+    }
+    if (record.payload_size > sizeof(T)) {
+        stream.skipNextBytes(record.payload_size - sizeof(T));
+    }
+
+    return payload;
+}
+
+/**
+ * The time spent in a single processing cycle.
+ */
+struct BlockTiming {
+    size_t block_idx;
+    juce::uint32 num_samples;
+    double seconds;
+};
+
+}  // namespace
+
+void replay_command(const juce::ArgumentList& args) {
+    args.checkMinNumArguments(2);
+    const juce::File capture_file = args[1].resolveAsExistingFile();
+
+    juce::FileInputStream stream(capture_file);
+    if (!stream.openedOk()) {
+        juce::ConsoleApplication::fail("Could not open '" +
+                                       capture_file.getFullPathName() + "'");
+    }
+
+    FileHeader header{};
+    if (stream.read(&header, sizeof(header)) != sizeof(header) ||
+        !std::equal(std::begin(magic), std::end(magic),
+                    std::begin(header.magic))) {
+        juce::ConsoleApplication::fail("'" + capture_file.getFullPathName() +
+                                       "' is not a capture file");
+    }
+    if (header.version != version) {
+        juce::ConsoleApplication::fail(
+            "Unsupported capture version " + juce::String(header.version) +
+            ", expected version " + juce::String(version));
+    }
+
+    juce::MemoryBlock state;
+    if (stream.readIntoMemoryBlock(state, header.state_size) !=
+        header.state_size) {
+        juce::ConsoleApplication::fail("Unexpected end of capture file");
+    }
+
+    // The SIMD kernels and FFT backends don't produce bit-identical results,
+    // so the replay should use the same ones as the capture. This needs to
+    // happen before the processor creates its first STFT. Every `ProcessData`
+    // swap also records the backends it used, and only those orders count
+    // when checking whether the backends are available.
+    const auto captured_isa = static_cast<simd::Isa>(header.simd_isa);
+    const bool used_captured_isa = simd::force_isa(captured_isa);
+    for (int order = 0; order <= fft::max_calibrated_order; order++) {
+        fft::force_backend(
+            order, static_cast<fft::Backend>(header.fft_backends[order]));
+    }
+    std::vector<int> unavailable_fft_orders;
+    const auto force_captured_backend = [&](int order, juce::uint8 backend) {
+        if (!fft::force_backend(order, static_cast<fft::Backend>(backend))) {
+            unavailable_fft_orders.push_back(order);
+        }
+    };
+
+    SpectralCompressorProcessor processor;
+    const auto& parameters = processor.getParameters();
+    if (static_cast<juce::uint32>(parameters.size()) != header.num_parameters) {
+        juce::ConsoleApplication::fail(
+            "The capture was recorded with a different set of parameters, it "
+            "cannot be replayed with this version");
+    }
+    processor.setStateInformation(state.getData(),
+                                  static_cast<int>(state.getSize()));
+
+    // With a CPU budget the processing depends on how long things take, so
+    // those blocks cannot be replayed exactly
+    const juce::AudioProcessorParameter* cpu_budget_parameter = nullptr;
+    for (auto* candidate : parameters) {
+        auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(candidate);
+        if (ranged && ranged->paramID == "cpu_budget") {
+            cpu_budget_parameter = ranged;
+        }
+    }
+
+    juce::AudioBuffer<float> buffer;
+    juce::MidiBuffer midi_buffer;
+    std::vector<BlockTiming> timings;
+    double sample_rate = 0.0;
+    double total_audio_seconds = 0.0;
+
+    size_t num_blocks = 0;
+    size_t num_verified_blocks = 0;
+    size_t num_swaps = 0;
+    size_t num_dropped = 0;
+    bool used_cpu_budget = false;
+    std::optional<size_t> first_mismatch;
+    size_t num_mismatches = 0;
+    std::optional<juce::uint64> last_output_hash;
+
+    RecordHeader record{};
+    while (stream.read(&record, sizeof(record)) == sizeof(record)) {
+        switch (record.type) {
+            case RecordType::prepare: {
+                const auto payload =
+                    read_payload<PreparePayload>(stream, record);
+
+                // The main input, main output, and sidechain busses always
+                // have the same layout
+                const juce::AudioChannelSet channel_set =
+                    juce::AudioChannelSet::canonicalChannelSet(
+                        payload.num_main_channels);
+                juce::AudioProcessor::BusesLayout layout;
+                layout.inputBuses.add(channel_set);
+                layout.inputBuses.add(channel_set);
+                layout.outputBuses.add(channel_set);
+                if (!processor.setBusesLayout(layout)) {
+                    juce::ConsoleApplication::fail(
+                        "Could not set up a processor with " +
+                        juce::String(payload.num_main_channels) +
+                        " channels");
+                }
+
+                sample_rate = payload.sample_rate;
+                processor.setRateAndBufferSizeDetails(payload.sample_rate,
+                                                      payload.max_block_size);
+                processor.prepareToPlay(payload.sample_rate,
+                                        payload.max_block_size);
+            } break;
+            case RecordType::release:
+                processor.releaseResources();
+                break;
+            case RecordType::parameter: {
+                const auto payload =
+                    read_payload<ParameterPayload>(stream, record);
+                if (payload.index < header.num_parameters) {
+                    parameters[static_cast<int>(payload.index)]
+                        ->setValueNotifyingHost(payload.value);
+                }
+            } break;
+            case RecordType::process_data_swap: {
+                // The FFT calibration may have finished while capturing, so
+                // the new STFTs can use different backends than the ones from
+                // the header
+                const auto payload =
+                    read_payload<ProcessDataSwapPayload>(stream, record);
+                force_captured_backend(payload.fft_order, payload.fft_backend);
+                if (payload.upper_fft_order >= 0) {
+                    force_captured_backend(payload.upper_fft_order,
+                                           payload.upper_fft_backend);
+                }
+
+                processor.apply_pending_process_data_update();
+                num_swaps += 1;
+            } break;
+            case RecordType::block: {
+                const auto payload = read_payload<BlockPayload>(stream, record);
+                buffer.setSize(static_cast<int>(payload.num_channels),
+                               static_cast<int>(payload.num_samples), false,
+                               false, true);
+
+                const int channel_size = static_cast<int>(
+                    payload.num_samples * sizeof(float));
+                for (int channel = 0; channel < buffer.getNumChannels();
+                     channel++) {
+                    if (stream.read(buffer.getWritePointer(channel),
+                                    channel_size) != channel_size) {
+                        juce::ConsoleApplication::fail(
+                            "Unexpected end of capture file");
+                    }
+                }
+
+                if (!payload.bypassed && cpu_budget_parameter &&
+                    cpu_budget_parameter->getValue() >= 0.5f) {
+                    used_cpu_budget = true;
+                }
+
+                const juce::int64 start_ticks =
+                    juce::Time::getHighResolutionTicks();
+                if (payload.bypassed) {
+                    processor.processBlockBypassed(buffer, midi_buffer);
+                } else {
+                    processor.processBlock(buffer, midi_buffer);
+                }
+                const juce::int64 end_ticks =
+                    juce::Time::getHighResolutionTicks();
+
+                timings.push_back(BlockTiming{
+                    .block_idx = num_blocks,
+                    .num_samples = payload.num_samples,
+                    .seconds = juce::Time::highResolutionTicksToSeconds(
+                        end_ticks - start_ticks)});
+                if (sample_rate > 0.0) {
+                    total_audio_seconds += payload.num_samples / sample_rate;
+                }
+
+                last_output_hash = hash_buffer(buffer);
+                num_blocks += 1;
+            } break;
+            case RecordType::block_output: {
+                const auto expected_hash =
+                    read_payload<juce::uint64>(stream, record);
+                if (last_output_hash) {
+                    num_verified_blocks += 1;
+                    if (*last_output_hash != expected_hash) {
+                        num_mismatches += 1;
+                        if (!first_mismatch) {
+                            first_mismatch = num_blocks - 1;
+                        }
+                    }
+                }
+                last_output_hash.reset();
+            } break;
+            case RecordType::dropped:
+                num_dropped += read_payload<juce::uint32>(stream, record);
+                break;
+            default:
+                // Records from newer versions can simply be skipped
+                stream.skipNextBytes(record.payload_size);
+                break;
+        }
+    }
+
+    std::cout << "Replayed " << num_blocks << " blocks ("
+              << total_audio_seconds << " seconds of audio) with "
+              << num_swaps << " process data swaps using the "
+              << simd::isa_name(simd::kernels().isa) << " kernels"
+              << std::endl;
+    if (const std::optional<fft::Backend> backend = processor.fft_backend()) {
+        std::cout << "The last FFT backend used was "
+                  << fft::backend_name(*backend) << std::endl;
+    }
+    if (!used_captured_isa) {
+        std::cout << "Warning: the capture used the "
+                  << simd::isa_name(captured_isa)
+                  << " kernels, which are not supported on this machine, the "
+                     "replay is not guaranteed to be exact"
+                  << std::endl;
+    }
+    if (!unavailable_fft_orders.empty()) {
+        std::cout << "Warning: the FFT backend the capture used for order "
+                  << unavailable_fft_orders.front()
+                  << " is not available in this build, the replay is not "
+                     "guaranteed to be exact"
+                  << std::endl;
+    }
+    if (num_dropped > 0) {
+        std::cout << "Warning: " << num_dropped
+                  << " records were dropped while capturing, the replay is "
+                     "not guaranteed to be exact"
+                  << std::endl;
+    }
+    if (used_cpu_budget) {
+        std::cout << "Warning: the CPU budget was enabled, the replay is not "
+                     "guaranteed to be exact"
+                  << std::endl;
+    }
+
+    if (!timings.empty()) {
+        double total_seconds = 0.0;
+        size_t num_over_budget = 0;
+        for (const auto& timing : timings) {
+            total_seconds += timing.seconds;
+            if (sample_rate > 0.0 &&
+                timing.seconds > timing.num_samples / sample_rate) {
+                num_over_budget += 1;
+            }
+        }
+
+        std::vector<BlockTiming> sorted_timings = timings;
+        std::sort(sorted_timings.begin(), sorted_timings.end(),
+                  [](const BlockTiming& a, const BlockTiming& b) {
+                      return a.seconds < b.seconds;
+                  });
+        const auto percentile_us = [&](double percentile) {
+            const size_t idx = std::min(
+                sorted_timings.size() - 1,
+                static_cast<size_t>(percentile * sorted_timings.size()));
+            return sorted_timings[idx].seconds * 1.0e6;
+        };
+
+        std::cout << "Processing took " << total_seconds << " seconds ("
+                  << (total_seconds > 0.0 ? total_audio_seconds / total_seconds
+                                          : 0.0)
+                  << "x real time)" << std::endl;
+        std::cout << "Per block: mean "
+                  << (total_seconds / timings.size()) * 1.0e6 << " us, median "
+                  << percentile_us(0.5) << " us, p99 " << percentile_us(0.99)
+                  << " us, max " << percentile_us(1.0) << " us" << std::endl;
+        std::cout << num_over_budget
+                  << " blocks took longer than their real time duration"
+                  << std::endl;
+
+        std::cout << "Slowest blocks:" << std::endl;
+        for (auto timing = sorted_timings.rbegin();
+             timing != sorted_timings.rend() &&
+             timing - sorted_timings.rbegin() < 5;
+             timing++) {
+            std::cout << "  block " << timing->block_idx << " ("
+                      << timing->num_samples << " samples): "
+                      << timing->seconds * 1.0e6 << " us" << std::endl;
+        }
+    }
+
+    if (args.containsOption("--trace")) {
+        const juce::File trace_file =
+            args.getFileForOption("--trace");
+        if (!tracing::enabled) {
+            std::cout << "Warning: not writing a trace, the tools were built "
+                         "without -DWITH_TRACING=ON"
+                      << std::endl;
+        } else if (tracing::write_chrome_trace(trace_file)) {
+            std::cout << "Wrote a trace to '"
+                      << trace_file.getFullPathName() << "'" << std::endl;
+        } else {
+            juce::ConsoleApplication::fail("Could not write to '" +
+                                           trace_file.getFullPathName() + "'");
+        }
+    }
+
+    if (num_mismatches > 0) {
+        juce::ConsoleApplication::fail(
+            "The output differed from the original session in " +
+            juce::String(num_mismatches) + " out of " +
+            juce::String(num_verified_blocks) +
+            " blocks, starting at block " + juce::String(*first_mismatch));
+    }
+    std::cout << "The output of all " << num_verified_blocks
+              << " verified blocks was bit-exact" << std::endl;
+}
@@ -0,0 +1,178 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../processor.h"
+#include "commands.h"
+#include "offline.h"
+
+namespace {
+
+/**
+ * A single variant being rendered.
+ */
+struct Variant {
+    juce::File preset_file;
+    juce::File output_file;
+    std::unique_ptr<SpectralCompressorProcessor> processor;
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    juce::int64 latency = 0;
+};
+
+}  // namespace
+
+void sweep_command(const juce::ArgumentList& args) {
+    args.checkMinNumArguments(3);
+    const juce::File input_file = args[1].resolveAsExistingFile();
+    const juce::File output_directory =
+        args.containsOption("--output-dir")
+            ? args.getFileForOption("--output-dir")
+            : input_file.getParentDirectory();
+    // Without sharing every variant does its own analysis, which is useful for
+    // comparing the timings
+    const bool share_analysis = !args.containsOption("--independent");
+
+    const std::unique_ptr<juce::AudioFormatReader> reader =
+        open_audio_file(input_file);
+    const int num_channels = static_cast<int>(reader->numChannels);
+    const double sample_rate = reader->sampleRate;
+
+    std::unique_ptr<juce::AudioFormatReader> sidechain_reader;
+    if (args.containsOption("--sidechain")) {
+        sidechain_reader = open_sidechain_file(
+            args.getExistingFileForOption("--sidechain"), sample_rate);
+    }
+
+    if (output_directory.createDirectory().failed()) {
+        juce::ConsoleApplication::fail(
+            "Could not create '" + output_directory.getFullPathName() + "'");
+    }
+
+    // Every preset becomes a variant with its own processor, rendered in
+    // lockstep with the others so they can share the forward transforms. The
+    // first variant computes them for every block, and the variants with the
+    // same analysis settings reuse them.
+    SharedAnalysis shared_analysis;
+    std::vector<Variant> variants;
+    for (int arg_idx = 2; arg_idx < args.size(); arg_idx++) {
+        if (args[arg_idx].isOption()) {
+            continue;
+        }
+
+        Variant& variant = variants.emplace_back();
+        variant.preset_file = args[arg_idx].resolveAsExistingFile();
+        variant.output_file = output_directory.getChildFile(
+            input_file.getFileNameWithoutExtension() + "." +
+            variant.preset_file.getFileNameWithoutExtension() + ".wav");
+
+        variant.processor = std::make_unique<SpectralCompressorProcessor>();
+        SpectralCompressorProcessor& processor = *variant.processor;
+        load_preset(processor, variant.preset_file);
+        set_up_channels(processor, num_channels);
+        if (share_analysis) {
+            processor.set_analysis_cache(&shared_analysis);
+        }
+
+        processor.setRateAndBufferSizeDetails(sample_rate, offline_block_size);
+        processor.prepareToPlay(sample_rate, offline_block_size);
+        // There's no message loop here, so the update triggered by changing
+        // the FFT order needs to be applied by hand
+        processor.apply_pending_process_data_update();
+
+        variant.latency = processor.getLatencySamples();
+        variant.writer =
+            create_wav_writer(variant.output_file, sample_rate, num_channels);
+    }
+    if (variants.empty()) {
+        juce::ConsoleApplication::fail("No presets were specified");
+    }
+
+    juce::int64 max_latency = 0;
+    for (const Variant& variant : variants) {
+        max_latency = std::max(max_latency, variant.latency);
+    }
+
+    // Every variant gets the same input, followed by enough silence to flush
+    // out the variant with the most latency. The variants modify their buffer
+    // in place, so they each get a copy.
+    const juce::int64 num_samples = reader->lengthInSamples + max_latency;
+    juce::AudioBuffer<float> input(num_channels * 2, offline_block_size);
+    juce::AudioBuffer<float> buffer(num_channels * 2, offline_block_size);
+    juce::MidiBuffer midi_buffer;
+
+    const juce::int64 start_ticks = juce::Time::getHighResolutionTicks();
+    for (juce::int64 offset = 0; offset < num_samples;
+         offset += offline_block_size) {
+        const int num_block_samples = static_cast<int>(
+            std::min(static_cast<juce::int64>(offline_block_size),
+                     num_samples - offset));
+        input.setSize(num_channels * 2, num_block_samples, false, false, true);
+        input.clear();
+        read_block(*reader, input, 0, num_channels, offset, num_block_samples);
+        if (sidechain_reader) {
+            read_block(*sidechain_reader, input, num_channels, num_channels,
+                       offset, num_block_samples);
+        }
+
+        for (Variant& variant : variants) {
+            buffer.makeCopyOf(input, true);
+            variant.processor->processBlock(buffer, midi_buffer);
+
+            // The extra silence for the other variants' latency is not
+            // written
+            const juce::int64 num_output_samples =
+                reader->lengthInSamples + variant.latency - offset;
+            if (num_output_samples < num_block_samples) {
+                buffer.setSize(
+                    buffer.getNumChannels(),
+                    static_cast<int>(std::max(num_output_samples,
+                                              static_cast<juce::int64>(0))),
+                    true, false, true);
+            }
+            write_output(*variant.writer, buffer, num_channels, offset,
+                         variant.latency, variant.output_file);
+        }
+
+        shared_analysis.next_block();
+    }
+    const double seconds = juce::Time::highResolutionTicksToSeconds(
+        juce::Time::getHighResolutionTicks() - start_ticks);
+
+    for (Variant& variant : variants) {
+        variant.processor->set_analysis_cache(nullptr);
+        if (!variant.writer->flush()) {
+            juce::ConsoleApplication::fail(
+                "Could not write to '" +
+                variant.output_file.getFullPathName() + "'");
+        }
+
+        std::cout << "Wrote '" << variant.output_file.getFullPathName() << "'"
+                  << std::endl;
+    }
+
+    const double audio_seconds =
+        static_cast<double>(reader->lengthInSamples) / sample_rate;
+    std::cout << "Rendered " << variants.size() << " variants of "
+              << audio_seconds << " seconds of audio in " << seconds
+              << " seconds (" << (audio_seconds * variants.size() / seconds)
+              << "x real time), " << shared_analysis.num_shared()
+              << " STFTs reused the forward transforms of another variant"
+              << std::endl;
+}
@@ -0,0 +1,154 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "trace.h"
+
+#ifdef SPECTRAL_COMPRESSOR_TRACING
+
+#include <mutex>
+#include <vector>
+
+namespace tracing {
+
+namespace {
+
+/**
+ * Every thread's buffer, in the order they were registered. Buffers are never
+ * freed so events from threads that have since exited can still be exported.
+ */
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry& registry() {
+    static Registry registry;
+    return registry;
+}
+
+}  // namespace
+
+ThreadBuffer& this_thread_buffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        Registry& reg = registry();
+        std::lock_guard lock(reg.mutex);
+
+        auto& new_buffer =
+            reg.buffers.emplace_back(std::make_unique<ThreadBuffer>());
+        new_buffer->thread_id = static_cast<int>(reg.buffers.size());
+        buffer = new_buffer.get();
+    }
+
+    return *buffer;
+}
+
+bool write_chrome_trace(const juce::File& file) {
+    Registry& reg = registry();
+    std::lock_guard lock(reg.mutex);
+
+    juce::FileOutputStream stream(file);
+    if (!stream.openedOk()) {
+        return false;
+    }
+    stream.setPosition(0);
+    stream.truncate();
+
+    // Timestamps are written relative to the earliest recorded event so the
+    // numbers stay readable
+    juce::int64 first_start_ticks = std::numeric_limits<juce::int64>::max();
+    for (const auto& buffer : reg.buffers) {
+        const size_t num_written =
+            buffer->num_written.load(std::memory_order_acquire);
+        const size_t num_events =
+            std::min(num_written, ThreadBuffer::capacity);
+        for (size_t i = num_written - num_events; i < num_written; i++) {
+            first_start_ticks = std::min(
+                first_start_ticks,
+                buffer->events[i % ThreadBuffer::capacity].start_ticks);
+        }
+    }
+
+    const double ticks_to_us =
+        1.0e6 /
+        static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+
+    stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first_event = true;
+    for (const auto& buffer : reg.buffers) {
+        const size_t num_written =
+            buffer->num_written.load(std::memory_order_acquire);
+        const size_t num_events =
+            std::min(num_written, ThreadBuffer::capacity);
+        for (size_t i = num_written - num_events; i < num_written; i++) {
+            const Event& event = buffer->events[i % ThreadBuffer::capacity];
+
+            if (!first_event) {
+                stream << ",";
+            }
+            first_event = false;
+
+            // These are complete ('X') events with a start time and a duration
+            stream << "\n{\"name\":\"" << event.name
+                   << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                   << ",\"ts\":"
+                   << juce::String(
+                          static_cast<double>(event.start_ticks -
+                                              first_start_ticks) *
+                              ticks_to_us,
+                          3)
+                   << ",\"dur\":"
+                   << juce::String(static_cast<double>(event.end_ticks -
+                                                       event.start_ticks) *
+                                       ticks_to_us,
+                                   3);
+            if (event.arg_name) {
+                stream << ",\"args\":{\"" << event.arg_name
+                       << "\":" << juce::String(event.arg) << "}";
+            }
+            stream << "}";
+        }
+    }
+    stream << "\n]}\n";
+    stream.flush();
+
+    return stream.getStatus().wasOk();
+}
+
+void clear() {
+    Registry& reg = registry();
+    std::lock_guard lock(reg.mutex);
+
+    for (auto& buffer : reg.buffers) {
+        buffer->num_written.store(0, std::memory_order_release);
+    }
+}
+
+}  // namespace tracing
+
+#else
+
+namespace tracing {
+
+bool write_chrome_trace(const juce::File& /*file*/) {
+    return false;
+}
+
+void clear() {}
+
+}  // namespace tracing
+
+#endif
@@ -0,0 +1,156 @@
+// Spectral Compressor: an FFT based compressor
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+// Trace zones are only compiled in when configuring with `-DWITH_TRACING=ON`.
+// Otherwise `TRACE_ZONE()` and `TRACE_ZONE_ARG()` expand to nothing and their
+// arguments are never evaluated, so production builds don't pay anything for
+// them.
+#ifdef SPECTRAL_COMPRESSOR_TRACING
+
+#include <array>
+#include <atomic>
+
+namespace tracing {
+
+/**
+ * A single completed zone. `name` and `arg_name` must point to string literals
+ * since we only store the pointers.
+ */
+struct Event {
+    const char* name;
+    const char* arg_name;
+    juce::int64 arg;
+    juce::int64 start_ticks;
+    juce::int64 end_ticks;
+};
+
+/**
+ * A fixed size buffer of events owned by a single thread. Only the owning
+ * thread writes to this buffer, so writing an event is just a store followed
+ * by a release increment of `num_written`. When the buffer is full the oldest
+ * events get overwritten. Other threads can read the events up to
+ * `num_written` through `write_chrome_trace()`, which should be done while the
+ * traced threads are idle since a wrapped buffer may otherwise contain
+ * partially overwritten events.
+ */
+struct ThreadBuffer {
+    static constexpr size_t capacity = 1 << 16;
+
+    /**
+     * A sequential ID assigned when the buffer gets registered, used as the
+     * `tid` in the exported trace.
+     */
+    int thread_id = 0;
+    std::atomic<size_t> num_written = 0;
+    std::array<Event, capacity> events;
+};
+
+/**
+ * Get the calling thread's buffer. The first call on a thread allocates and
+ * registers the buffer, so the very first zone on the audio thread will
+ * allocate. That's fine since this is only used in tracing builds.
+ */
+ThreadBuffer& this_thread_buffer();
+
+/**
+ * Records the time between its construction and its destruction as a zone in
+ * the calling thread's buffer. Use `TRACE_ZONE()` instead of using this
+ * directly.
+ */
+class ScopedZone {
+   public:
+    ScopedZone(const char* name,
+               const char* arg_name = nullptr,
+               juce::int64 arg = 0) noexcept
+        : name_(name),
+          arg_name_(arg_name),
+          arg_(arg),
+          start_ticks_(juce::Time::getHighResolutionTicks()) {}
+
+    ~ScopedZone() noexcept {
+        const juce::int64 end_ticks = juce::Time::getHighResolutionTicks();
+
+        ThreadBuffer& buffer = this_thread_buffer();
+        const size_t idx =
+            buffer.num_written.load(std::memory_order_relaxed);
+        buffer.events[idx % ThreadBuffer::capacity] =
+            Event{.name = name_,
+                  .arg_name = arg_name_,
+                  .arg = arg_,
+                  .start_ticks = start_ticks_,
+                  .end_ticks = end_ticks};
+        buffer.num_written.store(idx + 1, std::memory_order_release);
+    }
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+
+   private:
+    const char* name_;
+    const char* arg_name_;
+    juce::int64 arg_;
+    juce::int64 start_ticks_;
+};
+
+}  // namespace tracing
+
+#define TRACE_ZONE(name) \
+    ::tracing::ScopedZone JUCE_JOIN_MACRO(trace_zone_, __LINE__)(name)
+#define TRACE_ZONE_ARG(name, arg_name, arg)                            \
+    ::tracing::ScopedZone JUCE_JOIN_MACRO(trace_zone_, __LINE__)(      \
+        name, arg_name, static_cast<juce::int64>(arg))
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_ZONE_ARG(name, arg_name, arg)
+
+#endif
+
+namespace tracing {
+
+/**
+ * Whether trace zones have been compiled in.
+ */
+constexpr bool enabled =
+#ifdef SPECTRAL_COMPRESSOR_TRACING
+    true;
+#else
+    false;
+#endif
+
+/**
+ * Write all events recorded so far by every thread to `file` in the Chrome
+ * trace event format. The result can be loaded in `chrome://tracing` or
+ * Perfetto. This does nothing and returns false when tracing has not been
+ * compiled in.
+ *
+ * @return Whether the file was written successfully.
+ */
+bool write_chrome_trace(const juce::File& file);
+
+/**
+ * Discard all events recorded so far, for instance after warming up a
+ * benchmark. Like `write_chrome_trace()`, this should only be called when the
+ * traced threads are idle.
+ */
+void clear();
+
+}  // namespace tracing
@@ -23,6 +23,36 @@ void LambdaAsyncUpdater::handleAsyncUpdate() {
     callback_();
 }
 
+LambdaBackgroundUpdater::LambdaBackgroundUpdater(
+    const juce::String& thread_name,
+    fu2::unique_function<void()> callback)
+    : juce::Thread(thread_name), callback_(std::move(callback)) {
+    startThread();
+}
+
+LambdaBackgroundUpdater::~LambdaBackgroundUpdater() {
+    stop();
+}
+
+void LambdaBackgroundUpdater::trigger_update() {
+    update_pending_ = true;
+    notify();
+}
+
+void LambdaBackgroundUpdater::stop() {
+    stopThread(5000);
+}
+
+void LambdaBackgroundUpdater::run() {
+    while (!threadShouldExit()) {
+        if (update_pending_.exchange(false)) {
+            callback_();
+        } else {
+            wait(-1);
+        }
+    }
+}
+
 LambdaParameterListener::LambdaParameterListener(
     fu2::unique_function<void(const juce::String&, float)> callback)
     : callback_(std::move(callback)) {}
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include <juce_audio_processors/juce_audio_processors.h>
 #include "../lib/function2/include/function2/function2.hpp"
 
@@ -35,6 +37,41 @@ class LambdaAsyncUpdater : public juce::AsyncUpdater {
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LambdaAsyncUpdater)
 };
 
+/**
+ * Run some function on a background thread after `trigger_update()` has been
+ * called. Triggers that come in while the function is already pending are
+ * coalesced into a single call. Calls never overlap, so the function always
+ * sees the state from after the latest trigger.
+ */
+class LambdaBackgroundUpdater : private juce::Thread {
+   public:
+    LambdaBackgroundUpdater(const juce::String& thread_name,
+                            fu2::unique_function<void()> callback);
+    ~LambdaBackgroundUpdater() override;
+
+    /**
+     * Schedule a call to the function. This never blocks, but it should not be
+     * called from the audio thread since it signals an event.
+     */
+    void trigger_update();
+
+    /**
+     * Stop the background thread, waiting for a running call to finish.
+     * Pending calls are discarded. This is done automatically on destruction,
+     * but an owner whose function uses members declared after this object
+     * should call this in its own destructor.
+     */
+    void stop();
+
+   private:
+    void run() override;
+
+    fu2::unique_function<void()> callback_;
+    std::atomic_bool update_pending_ = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LambdaBackgroundUpdater)
+};
+
 /**
  * Run some function whenever a parameter changes. This function will be
  * executed synchronously and should thus run in constant time.
@@ -140,6 +177,24 @@ class AtomicallySwappable {
         }
     }
 
+    /**
+     * Call `fn` with the active and the inactive objects, in that order. This
+     * takes the same lock as `modify_and_swap()`, so it should never be called
+     * from the audio thread. `fn` should only read from the objects since the
+     * audio thread may be using the active object at the same time.
+     *
+     * @tparam F A function with the signature `void(const T& active, const T&
+     *   inactive)`.
+     */
+    template <typename F>
+    void inspect(F fn) const {
+        std::lock_guard lock(resize_mutex_);
+
+        const Pointers pointers = pointers_.load();
+        fn(static_cast<const T&>(*pointers.active),
+           static_cast<const T&>(*pointers.inactive));
+    }
+
     /**
      * Resize both objects down to their smallest size using the supplied
      * function. This should only ever be called from
@@ -167,7 +222,7 @@ class AtomicallySwappable {
      * working on the now active object.
      */
     std::atomic_int num_resizing_threads_ = 0;
-    std::mutex resize_mutex_;
+    mutable std::mutex resize_mutex_;
 
     struct Pointers {
         T* active;